@@ -0,0 +1,184 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of a simple region allocator: we carve allocations
+ * out of large heap blocks with a bump pointer, and free the blocks
+ * all at once.
+ */
+
+#include "arena.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+
+/* Allocations are aligned to this many bytes, enough for any type. */
+#define ARENA_ALIGN		16
+
+/* Most blocks are this big; bigger allocations get their own block. */
+#define ARENA_BLOCK_BYTES	(64 * 1024)
+
+/* A block of memory from which we carve allocations. */
+struct arena_block {
+	struct arena_block *next;	/* next (older) block */
+	size_t bytes;			/* usable bytes in the block */
+	size_t used;			/* bytes allocated so far */
+	/* Followed by the memory for allocations, ARENA_ALIGN aligned. */
+};
+
+/* A callback to run when the arena is freed. */
+struct arena_cleanup {
+	void (*cleanup)(void *data);
+	void *data;
+	struct arena_cleanup *next;	/* next (older) cleanup */
+};
+
+struct arena {
+	struct arena_block *blocks;	/* list of blocks, newest first */
+	struct arena_cleanup *cleanups;	/* list of cleanups, newest first */
+};
+
+static inline size_t arena_round_up(size_t bytes)
+{
+	return (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static inline u8 *arena_block_data(struct arena_block *block)
+{
+	return (u8 *)block + arena_round_up(sizeof(struct arena_block));
+}
+
+static struct arena_block *arena_block_new(size_t bytes)
+{
+	struct arena_block *block =
+		malloc(arena_round_up(sizeof(struct arena_block)) + bytes);
+
+	if (block == NULL)
+		die("unable to allocate %zu byte arena block\n", bytes);
+	block->next = NULL;
+	block->bytes = bytes;
+	block->used = 0;
+	return block;
+}
+
+struct arena *arena_new(void)
+{
+	struct arena *arena = calloc(1, sizeof(struct arena));
+
+	if (arena == NULL)
+		die("unable to allocate arena\n");
+	return arena;
+}
+
+void arena_free(struct arena *arena)
+{
+	if (arena == NULL)
+		return;
+	while (arena->cleanups != NULL) {
+		struct arena_cleanup *dead = arena->cleanups;
+
+		arena->cleanups = dead->next;
+		dead->cleanup(dead->data);
+	}
+	while (arena->blocks != NULL) {
+		struct arena_block *dead = arena->blocks;
+
+		arena->blocks = dead->next;
+		free(dead);
+	}
+	free(arena);
+}
+
+void *arena_alloc(struct arena *arena, size_t bytes)
+{
+	struct arena_block *block = arena->blocks;
+	u8 *memory = NULL;
+
+	bytes = arena_round_up(bytes);
+	if (bytes > ARENA_BLOCK_BYTES / 4) {
+		/* Give big allocations their own block, behind the
+		 * current one, so we keep carving from the current one.
+		 */
+		struct arena_block *big = arena_block_new(bytes);
+
+		if (block != NULL) {
+			big->next = block->next;
+			block->next = big;
+		} else {
+			arena->blocks = big;
+		}
+		block = big;
+	} else if (block == NULL || block->bytes - block->used < bytes) {
+		block = arena_block_new(ARENA_BLOCK_BYTES);
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	memory = arena_block_data(block) + block->used;
+	block->used += bytes;
+	memset(memory, 0, bytes);
+	return memory;
+}
+
+char *arena_strdup(struct arena *arena, const char *s)
+{
+	return arena_strndup(arena, s, strlen(s));
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t bytes)
+{
+	size_t len = strnlen(s, bytes);
+	char *copy = arena_alloc(arena, len + 1);
+
+	memcpy(copy, s, len);	/* arena_alloc() zeroed the '\0' */
+	return copy;
+}
+
+char *arena_asprintf(struct arena *arena, const char *format, ...)
+{
+	va_list ap;
+	char *s = NULL;
+	int len;
+
+	va_start(ap, format);
+	len = vsnprintf(NULL, 0, format, ap);
+	va_end(ap);
+	assert(len >= 0);
+
+	s = arena_alloc(arena, len + 1);
+	va_start(ap, format);
+	vsnprintf(s, len + 1, format, ap);
+	va_end(ap);
+	return s;
+}
+
+void arena_add_cleanup(struct arena *arena,
+		       void (*cleanup)(void *data), void *data)
+{
+	struct arena_cleanup *entry =
+		arena_alloc(arena, sizeof(struct arena_cleanup));
+
+	entry->cleanup = cleanup;
+	entry->data = data;
+	entry->next = arena->cleanups;
+	arena->cleanups = entry;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for a simple region allocator. Everything allocated from
+ * an arena is freed at once by arena_free(), so a parsed script can
+ * own thousands of small objects without tracking each of them.
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "types.h"
+
+#include <stddef.h>
+
+struct arena;
+
+/* Allocate a new, empty arena. */
+extern struct arena *arena_new(void);
+
+/* Run the cleanup callbacks of the arena, most recently added first,
+ * then free the arena and all memory allocated from it. A NULL arena
+ * is ignored.
+ */
+extern void arena_free(struct arena *arena);
+
+/* Return 'bytes' of zeroed memory, aligned for any type, that lives
+ * until the arena is freed. Dies if out of memory.
+ */
+extern void *arena_alloc(struct arena *arena, size_t bytes);
+
+/* Return a copy of the given string that lives in the arena. */
+extern char *arena_strdup(struct arena *arena, const char *s);
+
+/* Return a copy of at most 'bytes' bytes of the given string, plus a
+ * terminating '\0', that lives in the arena.
+ */
+extern char *arena_strndup(struct arena *arena, const char *s, size_t bytes);
+
+/* Return a printf-formatted string that lives in the arena. */
+extern char *arena_asprintf(struct arena *arena, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* Call cleanup(data) when the arena is freed. This lets an arena own
+ * objects, like packets, that are built by heap-allocating code that
+ * is shared with other users.
+ */
+extern void arena_add_cleanup(struct arena *arena,
+			      void (*cleanup)(void *data), void *data);
+
+#endif /* __ARENA_H__ */
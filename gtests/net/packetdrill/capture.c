@@ -0,0 +1,442 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of --capture.
+ *
+ * The packet paths copy each packet into a ring of their own thread,
+ * and a writer thread polls the rings and formats the packets as
+ * pcapng Enhanced Packet Blocks, so no file I/O, locking, or waking of
+ * other threads happens on the threads whose timing the script checks.
+ * Each packet has a comment naming the script line being run and
+ * whether we injected or sniffed it, and the epb_flags inbound/outbound
+ * direction bits.
+ *
+ * The file holds one section with one interface of LINKTYPE_RAW, since
+ * we see packets from the IP header on. We keep packets whole, up to
+ * the MAX_PACKET_BYTES that the packet paths handle, so that GSO and
+ * BIG TCP packets are not cut off.
+ *
+ * Each run of a script gets its own file, so that a later script or
+ * --repeat iteration can't overwrite the capture of one that failed:
+ * the first run writes the given path, and the nth run writes the
+ * path with a ".<n>" suffix.
+ */
+
+#include "capture.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "pcap.h"
+#include "run.h"
+
+#define CAPTURE_RING_BYTES	(4 * 1024 * 1024)	/* per thread */
+#define CAPTURE_SNAPLEN		MAX_PACKET_BYTES	/* keep it all */
+#define CAPTURE_POLL_USECS	1000	/* writer sleep when rings empty */
+
+/* The header of a packet waiting to be written; its bytes follow. */
+struct capture_record {
+	s64 time_usecs;			/* wall time of the packet */
+	int line_number;		/* script line being run */
+	enum direction_t direction;	/* injected or sniffed */
+	u32 bytes;			/* length of the packet */
+	u32 captured;			/* bytes of it that follow */
+};
+
+/* The records of one thread. The owning thread is the only one to
+ * advance head, and the writer thread the only one to advance tail;
+ * each publishes its offset with a release store that the other reads
+ * with an acquire load, so neither takes a lock.
+ */
+struct capture_ring {
+	struct capture_ring *next;	/* next in capture.rings */
+	u8 *buffer;			/* CAPTURE_RING_BYTES of records */
+	u64 head;			/* bytes of records filled */
+	u64 tail;			/* bytes of records written */
+	u64 dropped;			/* packets dropped with ring full */
+	bool owned;			/* in use by a live thread? */
+};
+
+struct capture {
+	FILE *file;
+	char *path;
+	struct capture_ring *rings;	/* all rings; the list only grows */
+	u8 *data;			/* writer's copy of a packet */
+	u64 written;			/* packets written */
+	bool active;			/* started and not yet stopping? */
+	pthread_t thread;		/* the writer thread */
+	pthread_key_t ring_key;		/* the ring of each thread */
+	pthread_mutex_t lock;		/* guards adding and owning rings */
+};
+
+static struct capture capture = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static int capture_line;		/* line of the current event */
+static int capture_runs;		/* runs numbered so far */
+
+static void capture_write(const void *data, size_t bytes)
+{
+	if (fwrite(data, 1, bytes, capture.file) != bytes)
+		die_perror("--capture: fwrite");
+}
+
+static void capture_write_u16(u16 value)
+{
+	capture_write(&value, sizeof(value));
+}
+
+static void capture_write_u32(u32 value)
+{
+	capture_write(&value, sizeof(value));
+}
+
+static void capture_write_padding(u32 bytes)
+{
+	static const u8 zeroes[4];
+
+	capture_write(zeroes, pcapng_pad(bytes) - bytes);
+}
+
+/* Write the Section Header Block and our Interface Description Block. */
+static void capture_write_file_header(void)
+{
+	const u32 shb_bytes = 28, idb_bytes = 20;
+	const s64 section_length = -1;	/* unknown */
+
+	capture_write_u32(PCAPNG_SECTION_HEADER);
+	capture_write_u32(shb_bytes);
+	capture_write_u32(PCAPNG_BYTE_ORDER_MAGIC);
+	capture_write_u16(1);		/* major version */
+	capture_write_u16(0);		/* minor version */
+	capture_write(&section_length, sizeof(section_length));
+	capture_write_u32(shb_bytes);
+
+	/* The default if_tsresol is microseconds, as we want. */
+	capture_write_u32(PCAPNG_INTERFACE);
+	capture_write_u32(idb_bytes);
+	capture_write_u16(LINKTYPE_RAW);
+	capture_write_u16(0);		/* reserved */
+	capture_write_u32(CAPTURE_SNAPLEN);
+	capture_write_u32(idb_bytes);
+}
+
+/* Write the given packet as an Enhanced Packet Block. */
+static void capture_write_packet(const struct capture_record *record,
+				 const u8 *data)
+{
+	char comment[64];
+	const bool injected = (record->direction == DIRECTION_INBOUND);
+	u32 comment_bytes = 0, block_bytes = 0;
+
+	comment_bytes = snprintf(comment, sizeof(comment), "line %d: %s",
+				 record->line_number,
+				 injected ? "inbound injected" :
+				 "outbound sniffed");
+	block_bytes = (28 + pcapng_pad(record->captured) +
+		       4 + pcapng_pad(comment_bytes) +	/* comment */
+		       4 + 4 +				/* epb_flags */
+		       4 +				/* end of options */
+		       4);
+
+	capture_write_u32(PCAPNG_ENHANCED_PACKET);
+	capture_write_u32(block_bytes);
+	capture_write_u32(0);		/* interface ID */
+	capture_write_u32((u64)record->time_usecs >> 32);
+	capture_write_u32((u64)record->time_usecs & 0xffffffff);
+	capture_write_u32(record->captured);
+	capture_write_u32(record->bytes);
+	capture_write(data, record->captured);
+	capture_write_padding(record->captured);
+
+	capture_write_u16(PCAPNG_OPT_COMMENT);
+	capture_write_u16(comment_bytes);
+	capture_write(comment, comment_bytes);
+	capture_write_padding(comment_bytes);
+	capture_write_u16(PCAPNG_OPT_EPB_FLAGS);
+	capture_write_u16(4);
+	capture_write_u32(injected ? PCAPNG_EPB_INBOUND :
+			  PCAPNG_EPB_OUTBOUND);
+	capture_write_u16(PCAPNG_OPT_END);
+	capture_write_u16(0);
+
+	capture_write_u32(block_bytes);
+}
+
+/* Copy bytes into the ring at the given offset, wrapping around. */
+static void ring_copy_in(struct capture_ring *ring, u64 offset,
+			 const void *data, u32 bytes)
+{
+	const u32 start = offset % CAPTURE_RING_BYTES;
+	const u32 first = (bytes < CAPTURE_RING_BYTES - start ?
+			   bytes : CAPTURE_RING_BYTES - start);
+
+	memcpy(ring->buffer + start, data, first);
+	memcpy(ring->buffer, (const u8 *)data + first, bytes - first);
+}
+
+/* Copy bytes out of the ring at the given offset, wrapping around. */
+static void ring_copy_out(const struct capture_ring *ring, u64 offset,
+			  void *data, u32 bytes)
+{
+	const u32 start = offset % CAPTURE_RING_BYTES;
+	const u32 first = (bytes < CAPTURE_RING_BYTES - start ?
+			   bytes : CAPTURE_RING_BYTES - start);
+
+	memcpy(data, ring->buffer + start, first);
+	memcpy((u8 *)data + first, ring->buffer, bytes - first);
+}
+
+/* Return the ring holding the earliest packet at the tail of a ring,
+ * filling in its record, or NULL if the rings are all empty. Packets
+ * from different threads can still be written slightly out of order,
+ * if one thread publishes its packet after we pass its ring.
+ */
+static struct capture_ring *capture_next_ring(struct capture_record *record)
+{
+	struct capture_ring *ring = NULL, *next = NULL;
+
+	for (ring = __atomic_load_n(&capture.rings, __ATOMIC_ACQUIRE);
+	     ring != NULL; ring = ring->next) {
+		struct capture_record head_record;
+
+		if (ring->tail == __atomic_load_n(&ring->head,
+						  __ATOMIC_ACQUIRE))
+			continue;
+		ring_copy_out(ring, ring->tail, &head_record,
+			      sizeof(head_record));
+		if (next == NULL ||
+		    head_record.time_usecs < record->time_usecs) {
+			next = ring;
+			*record = head_record;
+		}
+	}
+	return next;
+}
+
+/* Write packets to the file until the capture stops and the rings are
+ * empty. We read active before the rings, so that once we see the
+ * capture stopping, we still write every packet published before that.
+ */
+static void *capture_writer_thread(void *arg)
+{
+	while (1) {
+		const bool active = __atomic_load_n(&capture.active,
+						    __ATOMIC_ACQUIRE);
+		struct capture_record record;
+		struct capture_ring *ring = capture_next_ring(&record);
+
+		if (ring == NULL) {
+			if (!active)
+				break;
+			usleep(CAPTURE_POLL_USECS);
+			continue;
+		}
+
+		ring_copy_out(ring, ring->tail + sizeof(record), capture.data,
+			      record.captured);
+		capture_write_packet(&record, capture.data);
+		++capture.written;
+		__atomic_store_n(&ring->tail,
+				 ring->tail + sizeof(record) + record.captured,
+				 __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/* Give up the ring of a thread that is exiting, for a later thread. */
+static void capture_release_ring(void *arg)
+{
+	struct capture_ring *ring = arg;
+
+	if (pthread_mutex_lock(&capture.lock) != 0)
+		die_perror("pthread_mutex_lock");
+	ring->owned = false;
+	if (pthread_mutex_unlock(&capture.lock) != 0)
+		die_perror("pthread_mutex_unlock");
+}
+
+/* Return the ring of the calling thread. The first packet of each
+ * thread takes a ring that an exited thread gave up, or allocates one.
+ */
+static struct capture_ring *capture_thread_ring(void)
+{
+	struct capture_ring *ring = pthread_getspecific(capture.ring_key);
+
+	if (ring != NULL)
+		return ring;
+
+	if (pthread_mutex_lock(&capture.lock) != 0)
+		die_perror("pthread_mutex_lock");
+	for (ring = capture.rings; ring != NULL; ring = ring->next) {
+		if (!ring->owned)
+			break;
+	}
+	if (ring == NULL) {
+		ring = calloc(1, sizeof(*ring));
+		if (ring != NULL)
+			ring->buffer = malloc(CAPTURE_RING_BYTES);
+		if (ring == NULL || ring->buffer == NULL)
+			die("--capture: unable to allocate packet ring\n");
+		ring->next = capture.rings;
+		__atomic_store_n(&capture.rings, ring, __ATOMIC_RELEASE);
+	}
+	ring->owned = true;
+	if (pthread_mutex_unlock(&capture.lock) != 0)
+		die_perror("pthread_mutex_unlock");
+
+	if (pthread_setspecific(capture.ring_key, ring) != 0)
+		die_perror("pthread_setspecific");
+	return ring;
+}
+
+static void capture_at_exit(void)
+{
+	if (capture.file != NULL) {
+		fprintf(stderr, "--capture: packets up to the failure are "
+			"in %s\n", capture.path);
+	}
+	capture_stop();
+}
+
+void capture_count_run(void)
+{
+	++capture_runs;
+}
+
+void capture_start(const char *path)
+{
+	static bool initialized;
+	struct capture_ring *ring = NULL;
+
+	assert(capture.file == NULL);
+	if (!initialized) {
+		if (pthread_key_create(&capture.ring_key,
+				       capture_release_ring) != 0)
+			die_perror("pthread_key_create");
+		capture.data = malloc(CAPTURE_SNAPLEN);
+		if (capture.data == NULL)
+			die("--capture: unable to allocate packet buffer\n");
+		/* Keep the packets that led up to a failure, which exits. */
+		atexit(capture_at_exit);
+		initialized = true;
+	}
+
+	capture_count_run();
+	if (capture_runs == 1)
+		capture.path = strdup(path);
+	else if (asprintf(&capture.path, "%s.%d", path, capture_runs) < 0)
+		capture.path = NULL;
+	if (capture.path == NULL)
+		die("--capture: unable to allocate path\n");
+	capture.file = fopen(capture.path, "w");
+	if (capture.file == NULL)
+		die_perror("--capture: fopen");
+	capture_write_file_header();
+
+	/* Set up the ring of the thread running the script, and drop any
+	 * packets left over from an earlier capture.
+	 */
+	capture_thread_ring();
+	for (ring = capture.rings; ring != NULL; ring = ring->next) {
+		ring->tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		__atomic_store_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+	}
+	capture.written = 0;
+	__atomic_store_n(&capture_line, 0, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&capture.active, true, __ATOMIC_RELEASE);
+	if (pthread_create(&capture.thread, NULL, capture_writer_thread,
+			   NULL) != 0)
+		die_perror("pthread_create");
+}
+
+void capture_stop(void)
+{
+	struct capture_ring *ring = NULL;
+	u64 dropped = 0;
+
+	if (capture.file == NULL)
+		return;
+
+	__atomic_store_n(&capture.active, false, __ATOMIC_RELEASE);
+
+	/* If the writer itself died, it can't finish the rings. */
+	if (!pthread_equal(pthread_self(), capture.thread) &&
+	    pthread_join(capture.thread, NULL) != 0)
+		die_perror("pthread_join");
+
+	if (fclose(capture.file) != 0)
+		perror("--capture: fclose");
+	capture.file = NULL;
+	for (ring = capture.rings; ring != NULL; ring = ring->next)
+		dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	if (dropped > 0) {
+		fprintf(stderr, "--capture: %s: dropped %llu packets\n",
+			capture.path, (unsigned long long)dropped);
+	}
+	DEBUGP("--capture: wrote %llu packets to %s\n",
+	       (unsigned long long)capture.written, capture.path);
+	free(capture.path);
+	capture.path = NULL;
+	/* Keep the rings for the next script, and in case a packet path
+	 * is still running while we exit.
+	 */
+}
+
+void capture_note_event(int line_number)
+{
+	__atomic_store_n(&capture_line, line_number, __ATOMIC_RELAXED);
+}
+
+void capture_packet(enum direction_t direction,
+		    const u8 *data, u32 bytes, s64 time_usecs)
+{
+	struct capture_ring *ring = NULL;
+	struct capture_record record;
+	u64 head = 0, tail = 0;
+
+	if (!__atomic_load_n(&capture.active, __ATOMIC_ACQUIRE))
+		return;
+	if (time_usecs == 0)
+		time_usecs = now_usecs();
+
+	record.time_usecs = time_usecs;
+	record.line_number = __atomic_load_n(&capture_line, __ATOMIC_RELAXED);
+	record.direction = direction;
+	record.bytes = bytes;
+	record.captured = (bytes < CAPTURE_SNAPLEN ? bytes : CAPTURE_SNAPLEN);
+
+	ring = capture_thread_ring();
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail + sizeof(record) + record.captured >
+	    CAPTURE_RING_BYTES) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	ring_copy_in(ring, head, &record, sizeof(record));
+	ring_copy_in(ring, head + sizeof(record), data, record.captured);
+	__atomic_store_n(&ring->head, head + sizeof(record) + record.captured,
+			 __ATOMIC_RELEASE);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for --capture, which records the packets of a live run
+ * to a pcapng file.
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include "types.h"
+
+#include "packet.h"
+
+/* Start recording packets to a new pcapng file at the given path,
+ * replacing any existing file. The first run of a script in this
+ * process writes the path as given, and the nth run writes it with a
+ * ".<n>" suffix. The file is written by a background thread, and is
+ * completed by capture_stop() or when the process exits, e.g. via
+ * die().
+ */
+extern void capture_start(const char *path);
+
+/* Count a run of a script that captures in a child process, e.g. a
+ * --repeat iteration, so that later runs in this process get the next
+ * file names.
+ */
+extern void capture_count_run(void);
+
+/* Write out all recorded packets and close the capture file. No-op if
+ * there is no capture in progress.
+ */
+extern void capture_stop(void);
+
+/* Note that the script is now running the event at the given line, so
+ * that we can annotate the packets we record with it.
+ */
+extern void capture_note_event(int line_number);
+
+/* Record a packet of the given IP datagram bytes that we injected
+ * (DIRECTION_INBOUND) or sniffed (DIRECTION_OUTBOUND) at the given
+ * wall time, or now if time_usecs is 0. This only copies the packet
+ * into a ring of the calling thread, without locks or system calls
+ * after the first packet of each thread, so it is cheap enough for the
+ * packet paths; if the ring is full the packet is dropped and counted.
+ * Packets are kept whole, up to MAX_PACKET_BYTES. No-op if there is no
+ * capture in progress.
+ */
+extern void capture_packet(enum direction_t direction,
+			   const u8 *data, u32 bytes, s64 time_usecs);
+
+#endif /* __CAPTURE_H__ */
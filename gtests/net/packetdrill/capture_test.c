@@ -0,0 +1,150 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for --capture, reading back what it writes.
+ */
+
+#include "capture.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checksum.h"
+#include "pcap_reader.h"
+
+/* Bigger than the 16KB we used to keep of each packet. */
+#define TEST_BIG_PAYLOAD_BYTES	30000
+
+/* Fill in an IPv4/TCP packet with the given payload length, whose
+ * payload bytes count up from the given value.
+ */
+static void make_tcp_packet(u8 *data, u32 payload_bytes, u8 first)
+{
+	const u32 len = 20 + 20 + payload_bytes;
+	u32 i;
+
+	memset(data, 0, 20 + 20);
+	data[0] = 0x45;				/* IPv4, 20-byte header */
+	data[2] = len >> 8;			/* tot_len */
+	data[3] = len & 0xff;
+	data[8] = 64;				/* ttl */
+	data[9] = 6;				/* TCP */
+	memcpy(data + 12, "\xc0\xa8\x00\x01\xc0\x00\x02\x01", 8);
+	data[20] = 0x1f;			/* sport 8080 */
+	data[21] = 0x90;
+	data[22] = 0xbc;			/* dport 48328 */
+	data[23] = 0xc8;
+	data[32] = 0x50;			/* 20-byte header */
+	data[33] = 0x18;			/* PSH|ACK */
+	memcpy(data + 10, &(u16){ ipv4_checksum(data, 20) }, 2);
+	for (i = 0; i < payload_bytes; ++i)
+		data[40 + i] = first + i;
+}
+
+/* Record a packet from a thread of its own, as peer threads do. */
+static void *capture_from_thread(void *arg)
+{
+	u8 *data = arg;
+
+	capture_packet(DIRECTION_OUTBOUND, data, 20 + 20 + 100, 1000002);
+	return NULL;
+}
+
+/* Read the next packet and check it against what we recorded. */
+static void check_next_packet(struct pcap_reader *reader, s64 time_usecs,
+			      enum direction_t direction, u32 payload_bytes,
+			      u8 first)
+{
+	struct packet *packet = NULL;
+	enum direction_t packet_direction = DIRECTION_INVALID;
+	char *error = NULL;
+	u32 i;
+
+	assert(pcap_reader_next(reader, &packet, &packet_direction,
+				&error) == STATUS_OK);
+	assert(packet->time_usecs == time_usecs);
+	assert(packet_direction == direction);
+	assert(packet->ip_bytes == 20 + 20 + payload_bytes);
+	assert(packet->captured_bytes == 0);	/* nothing cut off */
+	assert(packet_payload_len(packet) == payload_bytes);
+	for (i = 0; i < payload_bytes; ++i)
+		assert(packet_payload(packet)[i] == (u8)(first + i));
+	packet_free(packet);
+}
+
+static void test_capture_read_back(void)
+{
+	char path[] = "/tmp/capture_test.XXXXXX";
+	u8 *big = malloc(20 + 20 + TEST_BIG_PAYLOAD_BYTES);
+	u8 small[20 + 20 + 100];
+	struct pcap_reader *reader = NULL;
+	struct packet *packet = NULL;
+	enum direction_t direction = DIRECTION_INVALID;
+	char *error = NULL;
+	pthread_t thread;
+	int fd = mkstemp(path);
+
+	assert(fd >= 0);
+	assert(close(fd) == 0);
+	assert(big != NULL);
+
+	capture_start(path);
+	capture_note_event(7);
+
+	make_tcp_packet(big, TEST_BIG_PAYLOAD_BYTES, 1);
+	capture_packet(DIRECTION_INBOUND, big, 20 + 20 + TEST_BIG_PAYLOAD_BYTES,
+		       1000001);
+
+	make_tcp_packet(small, 100, 2);
+	assert(pthread_create(&thread, NULL, capture_from_thread,
+			      small) == 0);
+	assert(pthread_join(thread, NULL) == 0);
+
+	make_tcp_packet(big, TEST_BIG_PAYLOAD_BYTES, 3);
+	capture_packet(DIRECTION_INBOUND, big, 20 + 20 + TEST_BIG_PAYLOAD_BYTES,
+		       1000003);
+
+	capture_stop();
+
+	reader = pcap_reader_open(path, &error);
+	assert(reader != NULL);
+	check_next_packet(reader, 1000001, DIRECTION_INBOUND,
+			  TEST_BIG_PAYLOAD_BYTES, 1);
+	check_next_packet(reader, 1000002, DIRECTION_OUTBOUND, 100, 2);
+	check_next_packet(reader, 1000003, DIRECTION_INBOUND,
+			  TEST_BIG_PAYLOAD_BYTES, 3);
+	assert(pcap_reader_next(reader, &packet, &direction, &error) ==
+	       STATUS_ERR);
+	assert(packet == NULL);
+	assert(error == NULL);
+	assert(pcap_reader_skipped(reader) == 0);
+
+	pcap_reader_free(reader);
+	unlink(path);
+	free(big);
+}
+
+int main(void)
+{
+	test_capture_read_back();
+	return 0;
+}
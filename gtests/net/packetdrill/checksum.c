@@ -63,7 +63,7 @@ static __be16 ip_checksum_fold(u64 sum)
 }
 
 static u64 tcp_udp_v4_header_checksum_partial(
-	struct in_addr src_ip, struct in_addr dst_ip, u8 protocol, u16 len)
+	struct in_addr src_ip, struct in_addr dst_ip, u8 protocol, u32 len)
 {
 	/* The IPv4 pseudo-header is defined in RFC 793, Section 3.1. */
 	struct ipv4_pseudo_header_t {
@@ -87,18 +87,33 @@ static u64 tcp_udp_v4_header_checksum_partial(
 	pseudo_header.fields.dst_ip = dst_ip;
 	pseudo_header.fields.mbz = 0;
 	pseudo_header.fields.protocol = protocol;
-	pseudo_header.fields.length = htons(len);
-	return ip_checksum_partial(&pseudo_header, sizeof(pseudo_header), 0);
+	pseudo_header.fields.length = htons(len & 0xffff);
+	u64 sum = ip_checksum_partial(&pseudo_header, sizeof(pseudo_header), 0);
+
+	/* BIG TCP super-packets are longer than the 16-bit length field;
+	 * like Linux, sum their length as a 32-bit quantity.
+	 */
+	sum += htons(len >> 16);
+	return sum;
 }
 
 __be16 tcp_udp_v4_checksum(struct in_addr src_ip, struct in_addr dst_ip,
-			   u8 protocol, const void *payload, u16 len)
+			   u8 protocol, const void *payload, u32 len)
 {
 	u64 sum = tcp_udp_v4_header_checksum_partial(
 		src_ip, dst_ip, protocol, len);
 	sum = ip_checksum_partial(payload, len, sum);
 	return ip_checksum_fold(sum);
 }
+
+__be16 tcp_udp_v4_pseudo_header_checksum(struct in_addr src_ip,
+					 struct in_addr dst_ip,
+					 u8 protocol, u32 len)
+{
+	return ~ip_checksum_fold(tcp_udp_v4_header_checksum_partial(
+					 src_ip, dst_ip, protocol, len));
+}
+
 __be16 udplite_v4_checksum(struct in_addr src_ip, struct in_addr dst_ip,
 			   u8 protocol, const void *payload, u16 len, u16 cov)
 {
@@ -156,6 +171,14 @@ __be16 tcp_udp_v6_checksum(const struct in6_addr *src_ip,
 	return ip_checksum_fold(sum);
 }
 
+__be16 tcp_udp_v6_pseudo_header_checksum(const struct in6_addr *src_ip,
+					 const struct in6_addr *dst_ip,
+					 u8 protocol, u32 len)
+{
+	return ~ip_checksum_fold(tcp_udp_v6_header_checksum_partial(
+					 src_ip, dst_ip, protocol, len));
+}
+
 __be16 udplite_v6_checksum(const struct in6_addr *src_ip,
 			   const struct in6_addr *dst_ip,
 			   u8 protocol, const void *payload, u32 len, u16 cov)
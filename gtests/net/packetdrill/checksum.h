@@ -37,7 +37,15 @@ extern __be16 ipv4_checksum(void *ip_header, size_t ip_header_bytes);
 
 /* Calculates TCP or UDP checksum for IPv4 (in network byte order). */
 extern __be16 tcp_udp_v4_checksum(struct in_addr src_ip, struct in_addr dst_ip,
-				  u8 protocol, const void *payload, u16 len);
+				  u8 protocol, const void *payload, u32 len);
+
+/* Calculates the uncomplemented TCP or UDP pseudo-header checksum for
+ * IPv4 (in network byte order), which is what a packet whose checksum
+ * the receiver must complete (CHECKSUM_PARTIAL) carries.
+ */
+extern __be16 tcp_udp_v4_pseudo_header_checksum(struct in_addr src_ip,
+						struct in_addr dst_ip,
+						u8 protocol, u32 len);
 
 /* Calculates UDPLite checksum for IPv4 (in network byte order). */
 extern __be16 udplite_v4_checksum(struct in_addr src_ip, struct in_addr dst_ip,
@@ -51,6 +59,13 @@ extern __be16 tcp_udp_v6_checksum(const struct in6_addr *src_ip,
 				  const struct in6_addr *dst_ip,
 				  u8 protocol, const void *payload, u32 len);
 
+/* Calculates the uncomplemented TCP or UDP pseudo-header checksum for
+ * IPv6 (in network byte order).
+ */
+extern __be16 tcp_udp_v6_pseudo_header_checksum(const struct in6_addr *src_ip,
+						const struct in6_addr *dst_ip,
+						u8 protocol, u32 len);
+
 /* Calculates UDPLite checksum for IPv6 (in network byte order). */
 extern __be16 udplite_v6_checksum(const struct in6_addr *src_ip,
 				  const struct in6_addr *dst_ip,
@@ -22,6 +22,8 @@
  * Helper functions for configuration information for a test run.
  */
 
+#include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -47,6 +49,9 @@ enum option_codes {
 	OPT_NETMASK_IP,
 	OPT_SPEED,
 	OPT_MTU,
+	OPT_TUN_VNET_HDR,
+	OPT_TUN_QUEUES,
+	OPT_TUN_QUEUE_CPUS,
 	OPT_INIT_SCRIPTS,
 	OPT_TOLERANCE_USECS,
 	OPT_WIRE_CLIENT,
@@ -58,6 +63,32 @@ enum option_codes {
 	OPT_TCP_TS_TICK_USECS,
 	OPT_NON_FATAL,
 	OPT_DRY_RUN,
+	OPT_SYSCALL_THREADS,
+	OPT_PAYLOAD_HUGEPAGES,
+	OPT_PAYLOAD_PATTERN,
+	OPT_MAIN_CPU,
+	OPT_SYSCALL_CPUS,
+	OPT_AUTO_CPUS,
+	OPT_SCHED_STATS,
+	OPT_SYSCALL_HISTOGRAMS,
+	OPT_PERF_COST,
+	OPT_KERNEL_TIMELINE,
+	OPT_START_ALIGNMENT,
+	OPT_REPEAT,
+	OPT_LINT,
+	OPT_LINT_THREADS,
+	OPT_CAPTURE,
+	OPT_OFFLINE_PCAP,
+	OPT_PCAP_TO_SCRIPT,
+	OPT_PCAP_TO_SCRIPT_PORT,
+	OPT_LINK_RATE,
+	OPT_LINK_DELAY_USECS,
+	OPT_LINK_QUEUE,
+	OPT_LINK_LOSS,
+	OPT_LINK_REORDER,
+	OPT_LINK_REORDER_USECS,
+	OPT_LINK_SEED,
+	OPT_LINK_LOG,
 	OPT_VERBOSE = 'v',	/* our only single-letter option */
 };
 
@@ -75,6 +106,9 @@ struct option options[] = {
 	{ "netmask_ip",		.has_arg = true,  NULL, OPT_NETMASK_IP },
 	{ "speed",		.has_arg = true,  NULL, OPT_SPEED },
 	{ "mtu",		.has_arg = true,  NULL, OPT_MTU },
+	{ "tun_vnet_hdr",	.has_arg = false, NULL, OPT_TUN_VNET_HDR },
+	{ "tun_queues",		.has_arg = true,  NULL, OPT_TUN_QUEUES },
+	{ "tun_queue_cpus",	.has_arg = true,  NULL, OPT_TUN_QUEUE_CPUS },
 	{ "init_scripts",	.has_arg = true,  NULL, OPT_INIT_SCRIPTS },
 	{ "tolerance_usecs",	.has_arg = true,  NULL, OPT_TOLERANCE_USECS },
 	{ "wire_client",	.has_arg = false, NULL, OPT_WIRE_CLIENT },
@@ -86,6 +120,32 @@ struct option options[] = {
 	{ "tcp_ts_tick_usecs",	.has_arg = true,  NULL, OPT_TCP_TS_TICK_USECS },
 	{ "non_fatal",		.has_arg = true,  NULL, OPT_NON_FATAL },
 	{ "dry_run",		.has_arg = false, NULL, OPT_DRY_RUN },
+	{ "syscall_threads",	.has_arg = true,  NULL, OPT_SYSCALL_THREADS },
+	{ "payload_hugepages",	.has_arg = false, NULL, OPT_PAYLOAD_HUGEPAGES },
+	{ "payload_pattern",	.has_arg = false, NULL, OPT_PAYLOAD_PATTERN },
+	{ "main_cpu",		.has_arg = true,  NULL, OPT_MAIN_CPU },
+	{ "syscall_cpus",	.has_arg = true,  NULL, OPT_SYSCALL_CPUS },
+	{ "auto_cpus",		.has_arg = false, NULL, OPT_AUTO_CPUS },
+	{ "sched_stats",	.has_arg = false, NULL, OPT_SCHED_STATS },
+	{ "syscall_histograms",	.has_arg = false, NULL, OPT_SYSCALL_HISTOGRAMS },
+	{ "perf_cost",		.has_arg = false, NULL, OPT_PERF_COST },
+	{ "kernel_timeline",	.has_arg = false, NULL, OPT_KERNEL_TIMELINE },
+	{ "start_alignment",	.has_arg = true,  NULL, OPT_START_ALIGNMENT },
+	{ "repeat",		.has_arg = true,  NULL, OPT_REPEAT },
+	{ "lint",		.has_arg = false, NULL, OPT_LINT },
+	{ "lint_threads",	.has_arg = true,  NULL, OPT_LINT_THREADS },
+	{ "capture",		.has_arg = true,  NULL, OPT_CAPTURE },
+	{ "offline_pcap",	.has_arg = true,  NULL, OPT_OFFLINE_PCAP },
+	{ "pcap_to_script",	.has_arg = true,  NULL, OPT_PCAP_TO_SCRIPT },
+	{ "pcap_to_script_port", .has_arg = true, NULL, OPT_PCAP_TO_SCRIPT_PORT },
+	{ "link_rate",		.has_arg = true,  NULL, OPT_LINK_RATE },
+	{ "link_delay_usecs",	.has_arg = true,  NULL, OPT_LINK_DELAY_USECS },
+	{ "link_queue",		.has_arg = true,  NULL, OPT_LINK_QUEUE },
+	{ "link_loss",		.has_arg = true,  NULL, OPT_LINK_LOSS },
+	{ "link_reorder",	.has_arg = true,  NULL, OPT_LINK_REORDER },
+	{ "link_reorder_usecs",	.has_arg = true,  NULL, OPT_LINK_REORDER_USECS },
+	{ "link_seed",		.has_arg = true,  NULL, OPT_LINK_SEED },
+	{ "link_log",		.has_arg = true,  NULL, OPT_LINK_LOG },
 	{ "verbose",		.has_arg = false, NULL, OPT_VERBOSE },
 	{ NULL },
 };
@@ -106,6 +166,9 @@ void show_usage(void)
 		"\t[--init_scripts=<comma separated filenames>]\n"
 		"\t[--speed=<speed in Mbps>]\n"
 		"\t[--mtu=<MTU in bytes>]\n"
+		"\t[--tun_vnet_hdr]\n"
+		"\t[--tun_queues=<number of tun queues>]\n"
+		"\t[--tun_queue_cpus=<cpu for queue 0>,<cpu for queue 1>,...]\n"
 		"\t[--tolerance_usecs=tolerance_usecs]\n"
 		"\t[--tcp_ts_tick_usecs=<microseconds per TCP TS val tick>]\n"
 		"\t[--non_fatal=<comma separated types: packet,syscall>]\n"
@@ -116,6 +179,32 @@ void show_usage(void)
 		"\t[--wire_client_dev=<eth_dev_name>]\n"
 		"\t[--wire_server_dev=<eth_dev_name>]\n"
 		"\t[--dry_run]\n"
+		"\t[--syscall_threads=<threads for blocking system calls>]\n"
+		"\t[--payload_hugepages]\n"
+		"\t[--payload_pattern]\n"
+		"\t[--main_cpu=<cpu for the main thread>]\n"
+		"\t[--syscall_cpus=<cpu for syscall thread 0>,...]\n"
+		"\t[--auto_cpus]\n"
+		"\t[--sched_stats]\n"
+		"\t[--syscall_histograms]\n"
+		"\t[--perf_cost]\n"
+		"\t[--kernel_timeline]\n"
+		"\t[--start_alignment=[spin,cached]]\n"
+		"\t[--repeat=<times to run each script>]\n"
+		"\t[--lint]\n"
+		"\t[--lint_threads=<threads for --lint>]\n"
+		"\t[--capture=<pcapng file to record packets in>]\n"
+		"\t[--offline_pcap=<pcap or pcapng file to verify script against>]\n"
+		"\t[--pcap_to_script=<pcap or pcapng file to convert to a script>]\n"
+		"\t[--pcap_to_script_port=<local port of connection to convert>]\n"
+		"\t[--link_rate=<emulated link bits/sec>]\n"
+		"\t[--link_delay_usecs=<emulated one-way propagation delay>]\n"
+		"\t[--link_queue=<emulated link queue limit in packets>]\n"
+		"\t[--link_loss=<probability of losing a packet>]\n"
+		"\t[--link_reorder=<probability of reordering a packet>]\n"
+		"\t[--link_reorder_usecs=<extra delay of reordered packets>]\n"
+		"\t[--link_seed=<seed for link loss and reordering>]\n"
+		"\t[--link_log=<file to log each packet on the link to>]\n"
 		"\t[--verbose|-v]\n"
 		"\tscript_path ...\n");
 }
@@ -189,6 +278,8 @@ static void set_ipv6_defaults(struct config *config)
 /* Set default configuration before we begin parsing. */
 void set_default_config(struct config *config)
 {
+	int i;
+
 	memset(config, 0, sizeof(*config));
 	config->code_command_line	= "/usr/bin/python";
 	config->code_format		= "python";
@@ -197,8 +288,17 @@ void set_default_config(struct config *config)
 	config->live_bind_port		= 8080;
 	config->live_connect_port	= 8080;
 	config->tolerance_usecs		= 4000;
+	config->repeat			= 1;
+	config->link_reorder_usecs	= 1000;
 	config->speed			= TUN_DRIVER_SPEED_CUR;
 	config->mtu			= TUN_DRIVER_DEFAULT_MTU;
+	config->syscall_threads		= DEFAULT_SYSCALL_THREADS;
+	config->tun_queues		= 1;
+	for (i = 0; i < MAX_TUN_QUEUES; ++i)
+		config->tun_queue_cpus[i] = -1;	/* queue i on CPU i */
+	config->main_cpu		= -1;	/* not pinned */
+	for (i = 0; i < MAX_SYSCALL_THREADS; ++i)
+		config->syscall_cpus[i] = -1;	/* not pinned */
 
 	/* For now, by default we disable checks of outbound TS val
 	 * values, since there are timestamp val bugs in the tests and
@@ -339,6 +439,29 @@ void parse_non_fatal_arg(char *arg, struct config *config)
 	free(argdup);
 }
 
+/* Parse the comma-delimited list of CPUs for the threads of the given
+ * option (e.g. the CPU on which to inject packets for each tun queue).
+ */
+static void parse_cpus(char *arg, int *cpus, int max_cpus,
+		       const char *option, char *where)
+{
+	char *argdup, *saveptr, *token, *end;
+	int i = 0;
+
+	argdup = strdup(arg);
+	token = strtok_r(argdup, ", ", &saveptr);
+	while (token != NULL) {
+		long cpu = strtol(token, &end, 10);
+
+		if ((*end != '\0') || (cpu < 0) || (cpu > INT_MAX) ||
+		    (i >= max_cpus))
+			die("%s: bad --%s: %s\n", where, option, arg);
+		cpus[i++] = cpu;
+		token = strtok_r(NULL, ", ", &saveptr);
+	}
+
+	free(argdup);
+}
 
 /* Process a command line option */
 static void process_option(int opt, char *optarg, struct config *config,
@@ -397,6 +520,19 @@ static void process_option(int opt, char *optarg, struct config *config,
 		if (config->mtu < 0)
 			die("%s: bad --mtu: %s\n", where, optarg);
 		break;
+	case OPT_TUN_VNET_HDR:
+		config->tun_vnet_hdr = true;
+		break;
+	case OPT_TUN_QUEUES:
+		config->tun_queues = atoi(optarg);
+		if ((config->tun_queues < 1) ||
+		    (config->tun_queues > MAX_TUN_QUEUES))
+			die("%s: bad --tun_queues: %s\n", where, optarg);
+		break;
+	case OPT_TUN_QUEUE_CPUS:
+		parse_cpus(optarg, config->tun_queue_cpus, MAX_TUN_QUEUES,
+			   "tun_queue_cpus", where);
+		break;
 	case OPT_NETMASK_IP:
 		strncpy(config->live_netmask_ip_string, optarg,	ADDR_STR_LEN-1);
 		break;
@@ -449,6 +585,120 @@ static void process_option(int opt, char *optarg, struct config *config,
 	case OPT_DRY_RUN:
 		config->dry_run = true;
 		break;
+	case OPT_SYSCALL_THREADS:
+		config->syscall_threads = atoi(optarg);
+		if (config->syscall_threads <= 0 ||
+		    config->syscall_threads > MAX_SYSCALL_THREADS)
+			die("%s: bad --syscall_threads: %s\n", where, optarg);
+		break;
+	case OPT_PAYLOAD_HUGEPAGES:
+		config->payload_hugepages = true;
+		break;
+	case OPT_PAYLOAD_PATTERN:
+		config->payload_pattern = true;
+		break;
+	case OPT_MAIN_CPU:
+		config->main_cpu = strtol(optarg, &end, 10);
+		if (end == optarg || *end || config->main_cpu < 0)
+			die("%s: bad --main_cpu: %s\n", where, optarg);
+		break;
+	case OPT_SYSCALL_CPUS:
+		parse_cpus(optarg, config->syscall_cpus, MAX_SYSCALL_THREADS,
+			   "syscall_cpus", where);
+		break;
+	case OPT_AUTO_CPUS:
+		config->auto_cpus = true;
+		break;
+	case OPT_SCHED_STATS:
+		config->sched_stats = true;
+		break;
+	case OPT_SYSCALL_HISTOGRAMS:
+		config->syscall_histograms = true;
+		break;
+	case OPT_PERF_COST:
+		config->perf_cost = true;
+		break;
+	case OPT_KERNEL_TIMELINE:
+		config->kernel_timeline = true;
+		break;
+	case OPT_START_ALIGNMENT:
+		if (strcmp(optarg, "spin") == 0)
+			config->start_alignment = START_ALIGN_SPIN;
+		else if (strcmp(optarg, "cached") == 0)
+			config->start_alignment = START_ALIGN_CACHED;
+		else
+			die("%s: bad --start_alignment: %s\n", where, optarg);
+		break;
+	case OPT_REPEAT:
+		config->repeat = atoi(optarg);
+		if (config->repeat <= 0)
+			die("%s: bad --repeat: %s\n", where, optarg);
+		break;
+	case OPT_LINT:
+		config->lint = true;
+		break;
+	case OPT_LINT_THREADS:
+		config->lint_threads = atoi(optarg);
+		if (config->lint_threads <= 0)
+			die("%s: bad --lint_threads: %s\n", where, optarg);
+		break;
+	case OPT_CAPTURE:
+		config->capture_path = strdup(optarg);
+		break;
+	case OPT_OFFLINE_PCAP:
+		config->offline_path = strdup(optarg);
+		break;
+	case OPT_PCAP_TO_SCRIPT:
+		config->pcap_to_script_path = strdup(optarg);
+		break;
+	case OPT_PCAP_TO_SCRIPT_PORT:
+		port = atoi(optarg);
+		if ((port <= 0) || (port > 0xffff))
+			die("%s: bad --pcap_to_script_port: %s\n",
+			    where, optarg);
+		config->pcap_to_script_port = port;
+		break;
+	case OPT_LINK_RATE:
+		config->link_rate_bps = strtoll(optarg, &end, 10);
+		if (end == optarg || *end || config->link_rate_bps <= 0)
+			die("%s: bad --link_rate: %s\n", where, optarg);
+		break;
+	case OPT_LINK_DELAY_USECS:
+		config->link_delay_usecs = atoi(optarg);
+		if (config->link_delay_usecs < 0)
+			die("%s: bad --link_delay_usecs: %s\n", where, optarg);
+		break;
+	case OPT_LINK_QUEUE:
+		config->link_queue = atoi(optarg);
+		if (config->link_queue <= 0)
+			die("%s: bad --link_queue: %s\n", where, optarg);
+		break;
+	case OPT_LINK_LOSS:
+		config->link_loss = strtod(optarg, &end);
+		if (end == optarg || *end ||
+		    config->link_loss < 0 || config->link_loss > 1)
+			die("%s: bad --link_loss: %s\n", where, optarg);
+		break;
+	case OPT_LINK_REORDER:
+		config->link_reorder = strtod(optarg, &end);
+		if (end == optarg || *end ||
+		    config->link_reorder < 0 || config->link_reorder > 1)
+			die("%s: bad --link_reorder: %s\n", where, optarg);
+		break;
+	case OPT_LINK_REORDER_USECS:
+		config->link_reorder_usecs = atoi(optarg);
+		if (config->link_reorder_usecs < 0)
+			die("%s: bad --link_reorder_usecs: %s\n",
+			    where, optarg);
+		break;
+	case OPT_LINK_SEED:
+		config->link_seed = strtoul(optarg, &end, 10);
+		if (end == optarg || *end)
+			die("%s: bad --link_seed: %s\n", where, optarg);
+		break;
+	case OPT_LINK_LOG:
+		config->link_log_path = strdup(optarg);
+		break;
 	case OPT_VERBOSE:
 		config->verbose = true;
 		break;
@@ -488,6 +738,9 @@ char **parse_command_line_options(int argc, char *argv[],
 	return argv + optind;
 }
 
+/* Serializes the use of getopt_long() by threads parsing scripts. */
+static pthread_mutex_t command_line_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static void parse_script_options(struct config *config,
 				 struct option_list *option_list)
 {
@@ -529,9 +782,18 @@ void parse_and_finalize_config(struct invocation *invocation)
 	parse_script_options(invocation->config,
 			     invocation->script->option_list);
 
-	/* Command line options overwrite options in script */
+	/* Command line options overwrite options in script. The parser
+	 * is reentrant, but getopt_long() keeps its state in globals.
+	 * A --lint thread that dies in here must not keep the lock.
+	 */
+	if (pthread_mutex_lock(&command_line_mutex) != 0)
+		die_perror("pthread_mutex_lock");
+	die_trap_hold(&command_line_mutex);
 	parse_command_line_options(invocation->argc, invocation->argv,
 					   invocation->config);
+	die_trap_hold(NULL);
+	if (pthread_mutex_unlock(&command_line_mutex) != 0)
+		die_perror("pthread_mutex_unlock");
 
 	/* Now take care of the last details */
 	finalize_config(invocation->config);
@@ -37,9 +37,19 @@
 
 #define TUN_DRIVER_SPEED_CUR	0	/* don't change current speed */
 #define TUN_DRIVER_DEFAULT_MTU 1500	/* default MTU for tun device */
+#define MAX_TUN_QUEUES		256	/* max queues of a multi-queue tun */
+
+#define DEFAULT_SYSCALL_THREADS	4	/* default syscall thread pool size */
+#define MAX_SYSCALL_THREADS	64	/* max syscall thread pool size */
 
 extern struct option options[];
 
+/* How to pick the start time of a script in the middle of a jiffy. */
+enum start_alignment_t {
+	START_ALIGN_SPIN,	/* spin watching several jiffy edges */
+	START_ALIGN_CACHED,	/* use a jiffy phase measured once */
+};
+
 struct config {
 	const char **argv;			/* a copy of process argv */
 
@@ -68,17 +78,35 @@ struct config {
 	int live_prefix_len;		/* IPv4/IPv6 interface prefix len */
 
 	int tolerance_usecs;		/* tolerance for time divergence */
+	int repeat;			/* times to run each script */
 	int tcp_ts_tick_usecs;		/* microseconds per TS val tick */
+	enum start_alignment_t start_alignment;	/* jiffy alignment method */
 
 	u32 speed;			/* speed reported by tun driver;
 					 * may require special tun driver
 					 */
 	int mtu;			/* MTU of tun device */
+	bool tun_vnet_hdr;		/* virtio_net_hdr on tun packets? */
+	int tun_queues;			/* number of tun queues */
+	int tun_queue_cpus[MAX_TUN_QUEUES];	/* CPU injecting per queue */
 
 	bool non_fatal_packet;		/* treat packet asserts as non-fatal */
 	bool non_fatal_syscall;		/* treat syscall asserts as non-fatal */
 
 	bool dry_run;			/* parse script but don't execute? */
+	bool lint;			/* check scripts in parallel, no run? */
+	int lint_threads;		/* threads for --lint; 0 for all CPUs */
+
+	int syscall_threads;		/* threads for blocking syscalls */
+	int main_cpu;			/* CPU for the main thread, or -1 */
+	int syscall_cpus[MAX_SYSCALL_THREADS];	/* CPU per syscall thread */
+	bool auto_cpus;			/* pin unpinned threads to isolated CPUs? */
+	bool sched_stats;		/* report CPU migrations, preemptions? */
+	bool syscall_histograms;	/* report system call latencies? */
+	bool perf_cost;			/* report kernel CPU cost per line? */
+	bool kernel_timeline;		/* report kernel tracepoints on failure? */
+	bool payload_hugepages;		/* back payload arena w/ hugepages? */
+	bool payload_pattern;		/* offset-derived payloads, verified? */
 
 	bool verbose;			/* print detailed debug info? */
 	char *script_path;		/* pathname of script file */
@@ -95,6 +123,26 @@ struct config {
 	/* File scripts to run at beginning of test (using system) */
 	char *init_scripts;
 
+	/* pcapng file to record injected and sniffed packets in, or NULL */
+	char *capture_path;
+
+	/* pcap or pcapng file to verify scripts against offline, or NULL */
+	char *offline_path;
+
+	/* Capture file to convert to a script, or NULL */
+	char *pcap_to_script_path;
+	u16 pcap_to_script_port;	/* local port of connection, or 0 */
+
+	/* Link emulated by the local netdev; see link_emulator.h. */
+	s64 link_rate_bps;		/* bottleneck rate, or 0 for none */
+	int link_delay_usecs;		/* one-way propagation delay */
+	int link_queue;			/* queue limit in packets, or 0 */
+	double link_loss;		/* probability of losing a packet */
+	double link_reorder;		/* probability of reordering one */
+	int link_reorder_usecs;		/* extra delay of reordered packets */
+	u32 link_seed;			/* seed for loss and reordering */
+	char *link_log_path;		/* file to log each packet to, or NULL */
+
 	/* For remote on-the-wire testing using a real NIC. */
 	bool is_wire_client;		   /* use a real NIC and be client? */
 	bool is_wire_server;		   /* use a real NIC and be server? */
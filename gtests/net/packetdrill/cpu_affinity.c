@@ -0,0 +1,302 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of CPU pinning for our threads, and of reporting
+ * their scheduler statistics.
+ *
+ * Migrations of the main thread (which injects and sniffs packets, so
+ * the kernel's tun processing runs on its CPU), the syscall threads and
+ * the tun queue threads between CPUs are a major source of timing
+ * noise, so we let users pin each of them to a CPU, ideally one that
+ * has been isolated from other tasks with isolcpus= or cpusets.
+ */
+
+#include "cpu_affinity.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+
+#ifdef linux
+
+static cpu_set_t start_cpus;	/* CPUs the process started with */
+static pthread_once_t start_cpus_once = PTHREAD_ONCE_INIT;
+
+/* Remember the CPUs we may run on before we pin any thread. */
+static void start_cpus_init(void)
+{
+	if (sched_getaffinity(0, sizeof(start_cpus), &start_cpus) != 0)
+		die_perror("sched_getaffinity");
+}
+
+void cpu_affinity_pin_self(int cpu, const char *who)
+{
+	cpu_set_t cpus;
+
+	if (cpu >= CPU_SETSIZE)
+		die("bad CPU %d for %s\n", cpu, who);
+	pthread_once(&start_cpus_once, start_cpus_init);
+	if (cpu < 0) {
+		cpus = start_cpus;
+	} else {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+	}
+	errno = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (errno != 0)
+		die("pthread_setaffinity_np for %s on CPU %d: %s\n",
+		    who, cpu, strerror(errno));
+	DEBUGP("%s: pinned to CPU %d\n", who, cpu);
+}
+
+/* Read the first line of the given sysfs file into the buffer. Returns
+ * STATUS_OK on success or STATUS_ERR if there is no such file.
+ */
+static int read_sysfs_line(const char *path, char *buf, int buf_len)
+{
+	FILE *f = fopen(path, "r");
+	int result = STATUS_ERR;
+
+	if (f == NULL)
+		return STATUS_ERR;
+	if (fgets(buf, buf_len, f) != NULL)
+		result = STATUS_OK;
+	fclose(f);
+	return result;
+}
+
+/* Parse a sysfs CPU list like "2-5,8" into a CPU set. */
+static void parse_cpu_list(const char *list, cpu_set_t *cpus)
+{
+	const char *p = list;
+	char *end = NULL;
+
+	CPU_ZERO(cpus);
+	while (*p != '\0' && *p != '\n') {
+		long first = strtol(p, &end, 10), last = first, cpu;
+
+		if (end == p)
+			break;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+			if (cpu >= 0)
+				CPU_SET(cpu, cpus);
+		}
+		if (*p == ',')
+			++p;
+	}
+}
+
+/* Return an ID for the core of the given CPU: the lowest-numbered of
+ * its SMT siblings, or the CPU itself if the topology is unknown.
+ */
+static int cpu_core(int cpu)
+{
+	char path[128], line[256];
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+		 cpu);
+	if (read_sysfs_line(path, line, sizeof(line)))
+		return cpu;
+	return atoi(line);
+}
+
+/* Fill in the candidate CPUs for pinning, in order of preference: one
+ * CPU per core first, then their SMT siblings. Returns the count.
+ */
+static int auto_cpu_candidates(int *order)
+{
+	cpu_set_t cpus;
+	char line[1024];
+	int cores[CPU_SETSIZE];
+	bool used[CPU_SETSIZE];
+	int n = 0, pass, cpu, i;
+
+	/* Prefer the isolated CPUs that we may run on; a cpuset or
+	 * taskset can keep us off some or all of them.
+	 */
+	if (read_sysfs_line("/sys/devices/system/cpu/isolated",
+			    line, sizeof(line)) == STATUS_OK)
+		parse_cpu_list(line, &cpus);
+	else
+		CPU_ZERO(&cpus);
+	CPU_AND(&cpus, &cpus, &start_cpus);
+
+	/* Without such CPUs, use the CPUs we may run on, leaving the
+	 * first one to housekeeping if we can.
+	 */
+	if (CPU_COUNT(&cpus) == 0) {
+		cpus = start_cpus;
+		for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &cpus)) {
+				if (CPU_COUNT(&cpus) > 1)
+					CPU_CLR(cpu, &cpus);
+				break;
+			}
+		}
+	}
+
+	memset(used, 0, sizeof(used));
+	for (pass = 0; pass < 2; ++pass) {
+		for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			bool sibling = false;
+			int core;
+
+			if (!CPU_ISSET(cpu, &cpus) || used[cpu])
+				continue;
+			core = cpu_core(cpu);
+			for (i = 0; i < n; ++i) {
+				if (cores[i] == core)
+					sibling = true;
+			}
+			if (pass == 0 && sibling)
+				continue;
+			used[cpu] = true;
+			cores[n] = core;
+			order[n++] = cpu;
+		}
+	}
+	return n;
+}
+
+void cpu_affinity_auto_assign(struct config *config)
+{
+	int order[CPU_SETSIZE];
+	int n, next = 0, i;
+
+	pthread_once(&start_cpus_once, start_cpus_init);
+	n = auto_cpu_candidates(order);
+	if (n == 0)
+		die("--auto_cpus: no CPUs to pin threads to\n");
+
+	if (config->main_cpu < 0)
+		config->main_cpu = order[next++ % n];
+	DEBUGP("auto CPUs: main thread on CPU %d\n", config->main_cpu);
+	for (i = 0; i < config->syscall_threads; ++i) {
+		if (config->syscall_cpus[i] < 0)
+			config->syscall_cpus[i] = order[next++ % n];
+		DEBUGP("auto CPUs: syscall thread %d on CPU %d\n",
+		       i, config->syscall_cpus[i]);
+	}
+	for (i = 0; i < config->tun_queues; ++i) {
+		if (config->tun_queue_cpus[i] < 0)
+			config->tun_queue_cpus[i] = order[next++ % n];
+		DEBUGP("auto CPUs: tun queue %d on CPU %d\n",
+		       i, config->tun_queue_cpus[i]);
+	}
+}
+
+/* Return the value of the given "<field> : <value>" line of the given
+ * /proc file of the given thread (0 for the calling thread), or -1 if
+ * there is no such file or line.
+ */
+static s64 read_thread_proc_field(pid_t thread_id, const char *file,
+				  const char *field)
+{
+	char path[128], line[256];
+	s64 value = -1;
+	FILE *f = NULL;
+
+	if (thread_id == 0)
+		snprintf(path, sizeof(path), "/proc/thread-self/%s", file);
+	else
+		snprintf(path, sizeof(path), "/proc/self/task/%d/%s",
+			 thread_id, file);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *colon = strchr(line, ':');
+
+		if (strncmp(line, field, strlen(field)) == 0 &&
+		    colon != NULL) {
+			value = strtoll(colon + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(f);
+	return value;
+}
+
+void sched_stats_get(pid_t thread_id, struct sched_stats *stats)
+{
+	/* The sched file needs CONFIG_SCHED_DEBUG. */
+	stats->migrations = read_thread_proc_field(thread_id, "sched",
+						   "se.nr_migrations");
+	stats->involuntary_switches =
+		read_thread_proc_field(thread_id, "status",
+				       "nonvoluntary_ctxt_switches");
+}
+
+#else  /* !linux */
+
+void cpu_affinity_pin_self(int cpu, const char *who)
+{
+	if (cpu >= 0)
+		die("CPU pinning is only supported on Linux\n");
+}
+
+void cpu_affinity_auto_assign(struct config *config)
+{
+	die("--auto_cpus is only supported on Linux\n");
+}
+
+void sched_stats_get(pid_t thread_id, struct sched_stats *stats)
+{
+	stats->migrations = -1;
+	stats->involuntary_switches = -1;
+}
+
+#endif  /* linux */
+
+/* Return the change in a statistic, or -1 if it is unknown. */
+static s64 sched_stat_delta(s64 now, s64 start)
+{
+	if (now < 0 || start < 0)
+		return -1;
+	return now - start;
+}
+
+void sched_stats_report(const char *script_path, const char *who,
+			pid_t thread_id, const struct sched_stats *start)
+{
+	struct sched_stats now;
+	s64 migrations, switches;
+
+	sched_stats_get(thread_id, &now);
+	migrations = now.migrations;
+	switches = now.involuntary_switches;
+	if (start != NULL) {
+		migrations = sched_stat_delta(migrations, start->migrations);
+		switches = sched_stat_delta(switches,
+					    start->involuntary_switches);
+	}
+	fprintf(stderr, "%s: %s: %lld CPU migrations, "
+		"%lld involuntary context switches\n",
+		script_path, who, migrations, switches);
+}
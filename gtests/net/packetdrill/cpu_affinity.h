@@ -0,0 +1,63 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for pinning our threads to CPUs, and for reporting how
+ * often the scheduler moved or preempted them.
+ */
+
+#ifndef __CPU_AFFINITY_H__
+#define __CPU_AFFINITY_H__
+
+#include "types.h"
+
+#include <sys/types.h>
+#include "config.h"
+
+/* Pin the calling thread to the given CPU. A negative CPU unpins the
+ * thread, giving it back the CPUs the process started with, since
+ * threads inherit the affinity of a pinned main thread. The 'who'
+ * string names the thread for error messages.
+ */
+extern void cpu_affinity_pin_self(int cpu, const char *who);
+
+/* Fill in the CPUs for the main thread, syscall threads and tun queue
+ * threads that the config leaves unset, choosing among the isolated
+ * CPUs that we may run on (or, if there are none, the CPUs we may run
+ * on other than the first) and preferring CPUs on distinct cores over
+ * their SMT siblings.
+ */
+extern void cpu_affinity_auto_assign(struct config *config);
+
+/* Scheduler statistics for a thread; -1 for any that are unknown. */
+struct sched_stats {
+	s64 migrations;			/* moves to another CPU */
+	s64 involuntary_switches;	/* context switches by preemption */
+};
+
+/* Read the scheduler statistics of the given thread of our process. */
+extern void sched_stats_get(pid_t thread_id, struct sched_stats *stats);
+
+/* Print the scheduler statistics accumulated by a thread since the
+ * 'start' snapshot (which may be NULL for thread creation).
+ */
+extern void sched_stats_report(const char *script_path, const char *who,
+			       pid_t thread_id,
+			       const struct sched_stats *start);
+
+#endif /* __CPU_AFFINITY_H__ */
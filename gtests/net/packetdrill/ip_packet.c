@@ -43,14 +43,16 @@ static u8 ip_ecn_bits(enum ip_ecn_t ecn)
 
 /* Fill in IPv4 header fields. */
 static void set_ipv4_header(struct ipv4 *ipv4,
-			    u16 ip_bytes,
+			    u32 ip_bytes,
 			    enum ip_ecn_t ecn, u8 protocol)
 {
 	ipv4->version = 4;
 	ipv4->ihl = sizeof(struct ipv4) / sizeof(u32);
 	ipv4->tos = ip_ecn_bits(ecn);
 
-	ipv4->tot_len = htons(ip_bytes);
+	/* BIG TCP super-packets have a tot_len of 0. */
+	ipv4->tot_len =
+		htons(ip_bytes > MAX_IP_LENGTH_FIELD_BYTES ? 0 : ip_bytes);
 	ipv4->id = 0;
 	ipv4->frag_off = 0;
 	ipv4->ttl = 255;
@@ -63,7 +65,7 @@ static void set_ipv4_header(struct ipv4 *ipv4,
 
 /* Fill in IPv6 header fields. */
 static void set_ipv6_header(struct ipv6 *ipv6,
-			    u16 ip_bytes,
+			    u32 ip_bytes,
 			    enum ip_ecn_t ecn, u8 protocol)
 {
 	ipv6->version = 6;
@@ -73,7 +75,10 @@ static void set_ipv6_header(struct ipv6 *ipv6,
 	ipv6->flow_label_lo = 0;
 
 	assert(ip_bytes >= sizeof(*ipv6));
-	ipv6->payload_len = htons(ip_bytes - sizeof(*ipv6));
+	ip_bytes -= sizeof(*ipv6);
+	/* BIG TCP super-packets have a payload_len of 0. */
+	ipv6->payload_len =
+		htons(ip_bytes > MAX_IP_LENGTH_FIELD_BYTES ? 0 : ip_bytes);
 	ipv6->next_header = protocol;
 	ipv6->hop_limit = 255;
 
@@ -83,7 +88,7 @@ static void set_ipv6_header(struct ipv6 *ipv6,
 
 void set_ip_header(void *ip_header,
 		   int address_family,
-		   u16 ip_bytes,
+		   u32 ip_bytes,
 		   enum ip_ecn_t ecn, u8 protocol)
 {
 	if (address_family == AF_INET)
@@ -96,7 +101,7 @@ void set_ip_header(void *ip_header,
 
 void set_packet_ip_header(struct packet *packet,
 			  int address_family,
-			  u16 ip_bytes,
+			  u32 ip_bytes,
 			  enum ip_ecn_t ecn, u8 protocol)
 {
 	struct header *ip_header = NULL;
@@ -190,7 +195,8 @@ int ipv4_header_finish(struct packet *packet,
 	struct ipv4 *ipv4 = header->h.ipv4;
 	int ip_bytes = sizeof(struct ipv4) + next_inner->total_bytes;
 
-	ipv4->tot_len = htons(ip_bytes);
+	ipv4->tot_len =
+		htons(ip_bytes > MAX_IP_LENGTH_FIELD_BYTES ? 0 : ip_bytes);
 	ipv4->protocol = header_type_info(next_inner->type)->ip_proto;
 
 	/* Fill in IPv4 header checksum. */
@@ -208,8 +214,9 @@ int ipv6_header_finish(struct packet *packet,
 	struct ipv6 *ipv6 = header->h.ipv6;
 	int ip_bytes = sizeof(struct ipv6) + next_inner->total_bytes;
 
-	assert(next_inner->total_bytes <= 0xffff);
-	ipv6->payload_len = htons(next_inner->total_bytes);
+	ipv6->payload_len =
+		htons(next_inner->total_bytes > MAX_IP_LENGTH_FIELD_BYTES ?
+		      0 : next_inner->total_bytes);
 	ipv6->next_header = header_type_info(next_inner->type)->ip_proto;
 
 	/* IPv6 has no header checksum. */
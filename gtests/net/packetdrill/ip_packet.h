@@ -32,13 +32,13 @@
 /* Populate header fields in the IP header at the given address. */
 extern void set_ip_header(void *ip_header,
 			  int address_family,
-			  u16 ip_bytes,
+			  u32 ip_bytes,
 			  enum ip_ecn_t ecn, u8 protocol);
 
 /* Set the packet's IP header pointer and then populate the IP header fields. */
 extern void set_packet_ip_header(struct packet *packet,
 				 int address_family,
-				 u16 ip_bytes,
+				 u32 ip_bytes,
 				 enum ip_ecn_t ecn, u8 protocol);
 
 /* Append an IPv4 header to the end of the given packet and fill in
@@ -62,6 +62,45 @@ static inline u8 ipv6_ecn_bits(const struct ipv6 *ipv6)
 	return ipv6->traffic_class_lo & IP_ECN_MASK;
 }
 
+/* RFC 2675 jumbo payload option, alone in a Hop-by-Hop Options
+ * header. Linux has used this for BIG TCP super-packets whose payload
+ * does not fit in the 16-bit payload_len, which is then 0.
+ */
+#define IPV6_TLV_JUMBO		0xC2	/* jumbo payload option type */
+
+struct ipv6_jumbo_hbh {
+	__u8			next_header;	/* protocol after the HBH */
+	__u8			hdr_len;	/* 0, in 8-byte units - 1 */
+	__u8			tlv_type;	/* IPV6_TLV_JUMBO */
+	__u8			tlv_len;	/* 4 */
+	__be32			jumbo_payload_len; /* bytes after IPv6 hdr */
+};
+
+/* Return the jumbo payload Hop-by-Hop header following the given IPv6
+ * header, or NULL if there is none. The caller must have checked that
+ * the bytes after the IPv6 header are in the packet.
+ */
+static inline struct ipv6_jumbo_hbh *ipv6_jumbo_hbh(const struct ipv6 *ipv6)
+{
+	struct ipv6_jumbo_hbh *hbh = (struct ipv6_jumbo_hbh *) (ipv6 + 1);
+
+	if (ipv6->payload_len != 0 || ipv6->next_header != IPPROTO_HOPOPTS ||
+	    hbh->hdr_len != 0 || hbh->tlv_type != IPV6_TLV_JUMBO ||
+	    hbh->tlv_len != sizeof(hbh->jumbo_payload_len))
+		return NULL;
+	return hbh;
+}
+
+/* Return the upper layer protocol of an IPv6 header, skipping any
+ * jumbo payload Hop-by-Hop header.
+ */
+static inline u8 ipv6_upper_layer_protocol(const struct ipv6 *ipv6)
+{
+	const struct ipv6_jumbo_hbh *hbh = ipv6_jumbo_hbh(ipv6);
+
+	return hbh ? hbh->next_header : ipv6->next_header;
+}
+
 /* The following struct declaration is needed for the IPv6 ioctls
  * SIOCSIFADDR and SIOCDIFADDR that add and delete IPv6 addresses from
  * a network interface. We have to declare our own version here
@@ -0,0 +1,761 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of --kernel_timeline.
+ *
+ * We look up the id and record layout of each tracepoint in tracefs,
+ * and open it with perf_event_open(2) on every CPU, filtered to the
+ * ports of the script's connections. perf can't stamp records with
+ * CLOCK_REALTIME, the clock of our live times, so it stamps them with
+ * CLOCK_MONOTONIC and we add the offset between the two clocks that we
+ * measure when we start. The tracepoints of each CPU share one mmapped
+ * ring that belongs to this script, so other tracers and other
+ * packetdrill runs neither see nor disturb our records. A reader
+ * thread drains the rings as the script runs and keeps the latest
+ * records, formatted as text, along with the script's events. If the
+ * process exits before kernel_timeline_stop(), which means the script
+ * failed, an atexit() handler drains the rings one last time and
+ * prints the latest records sorted by time.
+ */
+
+#include "kernel_timeline.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "run.h"
+#include "tracefs.h"
+
+#ifdef linux
+
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#define TIMELINE_RING_PAGES	16	/* data pages in each CPU's ring */
+#define TIMELINE_RECORDS	4096	/* records we keep */
+#define TIMELINE_REPORT_RECORDS	64	/* records we print on failure */
+#define TIMELINE_TEXT_BYTES	224	/* text of each record */
+#define TIMELINE_MAX_FIELDS	32	/* fields we print per tracepoint */
+#define TIMELINE_POLL_MSECS	10	/* longest we leave the rings */
+
+/* A field of the raw record of a tracepoint. */
+struct tracepoint_field {
+	char name[32];
+	int offset;			/* bytes from start of raw record */
+	int size;			/* 1, 2, 4 or 8 bytes */
+	bool is_signed;
+};
+
+/* A tracepoint we record, with the fields of it we print. */
+struct tracepoint {
+	const char *system;
+	const char *name;
+	u64 id;				/* from tracefs */
+	struct tracepoint_field fields[TIMELINE_MAX_FIELDS];
+	int num_fields;
+};
+
+static struct tracepoint tracepoints[] = {
+	{ .system = "tcp",	.name = "tcp_probe" },
+	{ .system = "tcp",	.name = "tcp_retransmit_skb" },
+	{ .system = "sock",	.name = "inet_sock_set_state" },
+};
+
+#define NUM_TRACEPOINTS		ARRAY_SIZE(tracepoints)
+
+/* The mmapped ring of one CPU, shared by all our tracepoints there. */
+struct timeline_ring {
+	int fds[NUM_TRACEPOINTS];	/* the ring belongs to fds[0] */
+	struct perf_event_mmap_page *meta;	/* first page of mapping */
+	u8 *data;			/* the ring itself */
+	u64 data_bytes;			/* size of the ring */
+	size_t mmap_bytes;		/* size of the whole mapping */
+};
+
+/* A kernel record or script event, as we print it. */
+struct timeline_record {
+	s64 time_usecs;			/* live wall time */
+	bool is_event;			/* script event, not kernel record? */
+	char text[TIMELINE_TEXT_BYTES];
+};
+
+struct kernel_timeline {
+	struct state *state;		/* for script times and config */
+	struct timeline_ring *rings;	/* one per CPU we opened */
+	struct pollfd *pollfds;		/* the ring fd of each CPU */
+	int num_rings;
+	u8 *scratch;			/* unwrapped copy of a perf record */
+	struct timeline_record *records; /* ring of TIMELINE_RECORDS */
+	u64 num_records;		/* count of records ever added */
+	u64 lost;			/* records the kernel dropped */
+	s64 realtime_offset_nsecs;	/* CLOCK_REALTIME - CLOCK_MONOTONIC */
+	bool active;			/* reader thread should run? */
+	pthread_t thread;		/* the reader thread */
+	pthread_mutex_t lock;		/* guards rings and records */
+};
+
+static struct kernel_timeline timeline = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Names of the TCP states, as the kernel prints them. */
+static const char *tcp_state_names[] = {
+	[1]	= "TCP_ESTABLISHED",
+	[2]	= "TCP_SYN_SENT",
+	[3]	= "TCP_SYN_RECV",
+	[4]	= "TCP_FIN_WAIT1",
+	[5]	= "TCP_FIN_WAIT2",
+	[6]	= "TCP_TIME_WAIT",
+	[7]	= "TCP_CLOSE",
+	[8]	= "TCP_CLOSE_WAIT",
+	[9]	= "TCP_LAST_ACK",
+	[10]	= "TCP_LISTEN",
+	[11]	= "TCP_CLOSING",
+	[12]	= "TCP_NEW_SYN_RECV",
+};
+
+/* Do we print the field with the given name? We skip the common
+ * fields, and ones that don't help to follow a connection's state.
+ */
+static bool is_interesting_field(const char *name)
+{
+	static const char *boring[] = { "family", "protocol", "mark" };
+	size_t length = strlen(name);
+	int i;
+
+	if (strncmp(name, "common_", strlen("common_")) == 0)
+		return false;
+	if (length >= strlen("cookie") &&
+	    strcmp(name + length - strlen("cookie"), "cookie") == 0)
+		return false;
+	for (i = 0; i < ARRAY_SIZE(boring); ++i) {
+		if (strcmp(name, boring[i]) == 0)
+			return false;
+	}
+	return true;
+}
+
+/* Parse a line of a tracepoint's format file, of the form
+ * "field:<declaration>; offset:<n>; size:<n>; signed:<n>;", and add
+ * it to the fields we print if it's an interesting integer.
+ */
+static void parse_format_field(struct tracepoint *tracepoint,
+			       const char *line)
+{
+	struct tracepoint_field *field = NULL;
+	char declaration[128];
+	const char *name = NULL;
+	int offset = 0, size = 0, is_signed = 0;
+
+	if (sscanf(line, " field:%127[^;]; offset:%d; size:%d; signed:%d;",
+		   declaration, &offset, &size, &is_signed) != 4)
+		return;
+	/* Skip arrays (addresses) and pointers. */
+	if (strchr(declaration, '[') != NULL ||
+	    strchr(declaration, '*') != NULL)
+		return;
+	if (size != 1 && size != 2 && size != 4 && size != 8)
+		return;
+	name = strrchr(declaration, ' ');
+	name = (name == NULL) ? declaration : name + 1;
+	if (!is_interesting_field(name) ||
+	    strlen(name) >= sizeof(field->name) ||
+	    tracepoint->num_fields == TIMELINE_MAX_FIELDS)
+		return;
+
+	field = &tracepoint->fields[tracepoint->num_fields++];
+	strcpy(field->name, name);
+	field->offset = offset;
+	field->size = size;
+	field->is_signed = is_signed;
+}
+
+/* Read the id and fields of the given tracepoint from tracefs. */
+static bool read_tracepoint_format(struct tracepoint *tracepoint)
+{
+	char path[128], line[512];
+	unsigned long long id = 0;
+	bool found = false;
+	FILE *f = NULL;
+
+	snprintf(path, sizeof(path), "events/%s/%s/format",
+		 tracepoint->system, tracepoint->name);
+	f = tracefs_fopen(path);
+	if (f == NULL)
+		return false;
+	tracepoint->num_fields = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "ID: %llu", &id) == 1) {
+			tracepoint->id = id;
+			found = true;
+		} else {
+			parse_format_field(tracepoint, line);
+		}
+	}
+	fclose(f);
+	return found;
+}
+
+/* Return the value of the given field of the given raw record. */
+static s64 field_value(const struct tracepoint_field *field, const u8 *raw)
+{
+	u8 value8;
+	u16 value16;
+	u32 value32;
+	u64 value64;
+
+	switch (field->size) {
+	case 1:
+		memcpy(&value8, raw + field->offset, sizeof(value8));
+		return field->is_signed ? (s8)value8 : value8;
+	case 2:
+		memcpy(&value16, raw + field->offset, sizeof(value16));
+		return field->is_signed ? (s16)value16 : value16;
+	case 4:
+		memcpy(&value32, raw + field->offset, sizeof(value32));
+		return field->is_signed ? (s32)value32 : value32;
+	default:
+		memcpy(&value64, raw + field->offset, sizeof(value64));
+		return value64;
+	}
+}
+
+/* Format the given raw tracepoint record as text. */
+static void format_raw_record(const u8 *raw, u32 raw_bytes,
+			      char *text, int text_bytes)
+{
+	const struct tracepoint *tracepoint = NULL;
+	u16 type = 0;
+	int i, length = 0;
+
+	if (raw_bytes < sizeof(type)) {
+		snprintf(text, text_bytes, "truncated tracepoint record");
+		return;
+	}
+	memcpy(&type, raw, sizeof(type));
+	for (i = 0; i < NUM_TRACEPOINTS; ++i) {
+		if (tracepoints[i].id == type)
+			tracepoint = &tracepoints[i];
+	}
+	if (tracepoint == NULL) {
+		snprintf(text, text_bytes, "unknown tracepoint %u", type);
+		return;
+	}
+
+	length = snprintf(text, text_bytes, "%s:%s",
+			  tracepoint->system, tracepoint->name);
+	for (i = 0; i < tracepoint->num_fields && length < text_bytes; ++i) {
+		const struct tracepoint_field *field = &tracepoint->fields[i];
+		const char *name = field->name;
+		s64 value = 0;
+		size_t name_length = strlen(name);
+
+		if (field->offset + field->size > raw_bytes)
+			continue;
+		value = field_value(field, raw);
+		if (name_length >= strlen("state") &&
+		    strcmp(name + name_length - strlen("state"),
+			   "state") == 0 &&
+		    value > 0 && value < ARRAY_SIZE(tcp_state_names)) {
+			length += snprintf(text + length, text_bytes - length,
+					   " %s=%s", name,
+					   tcp_state_names[value]);
+		} else if (field->is_signed) {
+			length += snprintf(text + length, text_bytes - length,
+					   " %s=%lld", name, value);
+		} else {
+			length += snprintf(text + length, text_bytes - length,
+					   " %s=%llu", name, (u64)value);
+		}
+	}
+}
+
+/* Take the next slot of the record ring, overwriting the oldest record
+ * if the ring is full. Caller must hold the lock.
+ */
+static struct timeline_record *timeline_new_record(s64 time_usecs,
+						   bool is_event)
+{
+	struct timeline_record *record =
+		&timeline.records[timeline.num_records % TIMELINE_RECORDS];
+
+	++timeline.num_records;
+	record->time_usecs = time_usecs;
+	record->is_event = is_event;
+	return record;
+}
+
+/* Copy the given bytes at the given position of the ring, which may
+ * wrap around its end.
+ */
+static void ring_copy(const struct timeline_ring *ring, u64 position,
+		      void *buffer, u32 bytes)
+{
+	u64 offset = position % ring->data_bytes;
+	u64 first_bytes = ring->data_bytes - offset;
+
+	if (first_bytes > bytes)
+		first_bytes = bytes;
+	memcpy(buffer, ring->data + offset, first_bytes);
+	memcpy((u8 *)buffer + first_bytes, ring->data, bytes - first_bytes);
+}
+
+/* Handle the given perf record. Our samples hold the time and then the
+ * raw tracepoint record.
+ */
+static void timeline_handle_perf_record(const u8 *bytes)
+{
+	struct perf_event_header header;
+	struct timeline_record *record = NULL;
+	u64 time_nsecs = 0, lost = 0;
+	u32 raw_bytes = 0, offset = sizeof(header);
+
+	memcpy(&header, bytes, sizeof(header));
+	if (header.type == PERF_RECORD_LOST &&
+	    header.size >= offset + 2 * sizeof(u64)) {
+		memcpy(&lost, bytes + offset + sizeof(u64), sizeof(lost));
+		timeline.lost += lost;
+		return;
+	}
+	if (header.type != PERF_RECORD_SAMPLE ||
+	    header.size < offset + sizeof(time_nsecs) + sizeof(raw_bytes))
+		return;
+	memcpy(&time_nsecs, bytes + offset, sizeof(time_nsecs));
+	offset += sizeof(time_nsecs);
+	memcpy(&raw_bytes, bytes + offset, sizeof(raw_bytes));
+	offset += sizeof(raw_bytes);
+	if (raw_bytes > header.size - offset)
+		raw_bytes = header.size - offset;
+
+	record = timeline_new_record(
+		(time_nsecs + timeline.realtime_offset_nsecs) / 1000, false);
+	format_raw_record(bytes + offset, raw_bytes,
+			  record->text, sizeof(record->text));
+}
+
+/* Read all the records in the given ring. Caller must hold the lock. */
+static void timeline_drain_ring(struct timeline_ring *ring)
+{
+	u64 head = ring->meta->data_head;
+	u64 tail = ring->meta->data_tail;
+
+	__sync_synchronize();	/* read data_head before the records */
+
+	while (tail + sizeof(struct perf_event_header) <= head) {
+		struct perf_event_header header;
+
+		ring_copy(ring, tail, &header, sizeof(header));
+		if (header.size < sizeof(header) || tail + header.size > head)
+			break;
+		ring_copy(ring, tail, timeline.scratch, header.size);
+		timeline_handle_perf_record(timeline.scratch);
+		tail += header.size;
+	}
+
+	__sync_synchronize();	/* finish reading before freeing space */
+	ring->meta->data_tail = tail;
+}
+
+static void timeline_drain_rings(void)
+{
+	int i;
+
+	for (i = 0; i < timeline.num_rings; ++i)
+		timeline_drain_ring(&timeline.rings[i]);
+}
+
+/* Drain the rings whenever one gets half full, and every
+ * TIMELINE_POLL_MSECS anyway, until we stop.
+ */
+static void *timeline_reader_thread(void *arg)
+{
+	bool active = true;
+
+	while (active) {
+		if (poll(timeline.pollfds, timeline.num_rings,
+			 TIMELINE_POLL_MSECS) < 0 && errno != EINTR)
+			die_perror("--kernel_timeline: poll");
+
+		if (pthread_mutex_lock(&timeline.lock) != 0)
+			die_perror("pthread_mutex_lock");
+		active = timeline.active;
+		if (active)
+			timeline_drain_rings();
+		if (pthread_mutex_unlock(&timeline.lock) != 0)
+			die_perror("pthread_mutex_unlock");
+	}
+	return NULL;
+}
+
+/* Open the given tracepoint on the given CPU. */
+static int open_tracepoint(const struct tracepoint *tracepoint, int cpu)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.config = tracepoint->id;
+	attr.sample_period = 1;
+	attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+	attr.use_clockid = 1;
+	attr.clockid = CLOCK_MONOTONIC;
+	attr.disabled = 1;
+	return syscall(__NR_perf_event_open, &attr, -1, cpu, -1,
+		       PERF_FLAG_FD_CLOEXEC);
+}
+
+static void close_ring(struct timeline_ring *ring)
+{
+	int i;
+
+	if (ring->meta != NULL)
+		munmap(ring->meta, ring->mmap_bytes);
+	ring->meta = NULL;
+	for (i = 0; i < NUM_TRACEPOINTS; ++i) {
+		if (ring->fds[i] >= 0)
+			close(ring->fds[i]);
+		ring->fds[i] = -1;
+	}
+}
+
+/* Open our tracepoints on the given CPU, with the given filter, and
+ * map their shared ring. Returns 0 on success or an errno value.
+ */
+static int open_ring(struct timeline_ring *ring, int cpu, const char *filter)
+{
+	static bool warned_filter;
+	long page_bytes = sysconf(_SC_PAGESIZE);
+	void *mapping = NULL;
+	int i, error = 0;
+
+	for (i = 0; i < NUM_TRACEPOINTS; ++i)
+		ring->fds[i] = -1;
+	ring->meta = NULL;
+
+	for (i = 0; i < NUM_TRACEPOINTS; ++i) {
+		ring->fds[i] = open_tracepoint(&tracepoints[i], cpu);
+		if (ring->fds[i] < 0)
+			goto fail;
+		if (ioctl(ring->fds[i], PERF_EVENT_IOC_SET_FILTER,
+			  filter) < 0 && !warned_filter) {
+			fprintf(stderr, "--kernel_timeline: unable to filter "
+				"%s:%s by port (%s); recording all sockets\n",
+				tracepoints[i].system, tracepoints[i].name,
+				strerror(errno));
+			warned_filter = true;
+		}
+
+		/* The ring must be mapped before others can share it. */
+		if (i == 0) {
+			ring->mmap_bytes =
+				(1 + TIMELINE_RING_PAGES) * page_bytes;
+			mapping = mmap(NULL, ring->mmap_bytes,
+				       PROT_READ | PROT_WRITE, MAP_SHARED,
+				       ring->fds[0], 0);
+			if (mapping == MAP_FAILED)
+				goto fail;
+			ring->meta = mapping;
+			ring->data = (u8 *)mapping + page_bytes;
+			ring->data_bytes = TIMELINE_RING_PAGES * page_bytes;
+		} else if (ioctl(ring->fds[i], PERF_EVENT_IOC_SET_OUTPUT,
+				 ring->fds[0]) < 0) {
+			goto fail;
+		}
+	}
+	return 0;
+
+fail:
+	error = errno;
+	close_ring(ring);
+	return error;
+}
+
+/* Measure CLOCK_REALTIME - CLOCK_MONOTONIC, reading the monotonic clock
+ * on both sides of the real time one to split the difference.
+ */
+static s64 realtime_offset_nsecs(void)
+{
+	s64 before = now_monotonic_nsecs();
+	s64 realtime = now_nsecs();
+	s64 after = now_monotonic_nsecs();
+
+	return realtime - (before + (after - before) / 2);
+}
+
+/* Stop the reader thread, if it's running. */
+static void timeline_stop_reader(void)
+{
+	bool was_active = false;
+
+	if (pthread_mutex_lock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_lock");
+	was_active = timeline.active;
+	timeline.active = false;
+	if (pthread_mutex_unlock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_unlock");
+
+	/* If the reader itself died, there's no one to wait for. */
+	if (was_active && !pthread_equal(pthread_self(), timeline.thread) &&
+	    pthread_join(timeline.thread, NULL) != 0)
+		die_perror("pthread_join");
+}
+
+static int compare_records(const void *a, const void *b)
+{
+	const struct timeline_record *record_a = a;
+	const struct timeline_record *record_b = b;
+
+	if (record_a->time_usecs < record_b->time_usecs)
+		return -1;
+	return record_a->time_usecs > record_b->time_usecs;
+}
+
+/* Print the latest records, in script time. Caller must hold the lock.
+ * This sorts the records in place, so we can't add any more after it.
+ */
+static void timeline_report(void)
+{
+	struct state *state = timeline.state;
+	u64 count = timeline.num_records;
+	u64 i, first = 0;
+
+	if (count > TIMELINE_RECORDS)
+		count = TIMELINE_RECORDS;
+	qsort(timeline.records, count, sizeof(timeline.records[0]),
+	      compare_records);
+	if (count > TIMELINE_REPORT_RECORDS)
+		first = count - TIMELINE_REPORT_RECORDS;
+
+	fprintf(stderr, "%s: kernel timeline before the failure, "
+		"in script time:\n", state->config->script_path);
+	for (i = first; i < count; ++i) {
+		const struct timeline_record *record = &timeline.records[i];
+		s64 script_usecs = live_time_to_script_time_usecs(
+			state, record->time_usecs);
+
+		fprintf(stderr, "%12.6f %s%s\n", script_usecs / 1000000.0,
+			record->is_event ? "" : "  ", record->text);
+	}
+	if (timeline.lost > 0) {
+		fprintf(stderr, "--kernel_timeline: the kernel dropped "
+			"%llu records\n", timeline.lost);
+	}
+}
+
+/* If the script failed and is exiting, print the timeline. We leave
+ * the rings and records in place, since other threads may still use
+ * them until the process exits.
+ */
+static void timeline_at_exit(void)
+{
+	if (timeline.rings == NULL)
+		return;
+	timeline_stop_reader();
+
+	if (pthread_mutex_lock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_lock");
+	if (timeline.rings != NULL) {
+		timeline_drain_rings();
+		timeline_report();
+		timeline.num_records = 0;
+	}
+	if (pthread_mutex_unlock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_unlock");
+}
+
+void kernel_timeline_start(struct state *state)
+{
+	static bool registered_at_exit;
+	const struct config *config = state->config;
+	long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	char filter[128];
+	int cpu, i, error = 0;
+
+	assert(timeline.rings == NULL);
+	for (i = 0; i < NUM_TRACEPOINTS; ++i) {
+		if (!read_tracepoint_format(&tracepoints[i])) {
+			die("--kernel_timeline: tracepoint %s:%s "
+			    "not found in tracefs\n",
+			    tracepoints[i].system, tracepoints[i].name);
+		}
+	}
+	/* All our tracepoints have ports in host byte order. */
+	snprintf(filter, sizeof(filter),
+		 "sport == %u || dport == %u || sport == %u || dport == %u",
+		 config->live_bind_port, config->live_bind_port,
+		 config->live_connect_port, config->live_connect_port);
+
+	timeline.rings = calloc(num_cpus, sizeof(struct timeline_ring));
+	timeline.pollfds = calloc(num_cpus, sizeof(struct pollfd));
+	timeline.records = calloc(TIMELINE_RECORDS,
+				  sizeof(struct timeline_record));
+	timeline.scratch = malloc(1 << 16);	/* biggest perf record */
+	if (timeline.rings == NULL || timeline.pollfds == NULL ||
+	    timeline.records == NULL || timeline.scratch == NULL)
+		die("--kernel_timeline: unable to allocate timeline\n");
+	timeline.num_rings = 0;
+	for (cpu = 0; cpu < num_cpus; ++cpu) {
+		struct timeline_ring *ring = &timeline.rings[timeline.num_rings];
+
+		/* Offline CPUs fail with ENODEV; we skip them. */
+		error = open_ring(ring, cpu, filter);
+		if (error != 0)
+			continue;
+		timeline.pollfds[timeline.num_rings].fd = ring->fds[0];
+		timeline.pollfds[timeline.num_rings].events = POLLIN;
+		++timeline.num_rings;
+	}
+	if (timeline.num_rings == 0) {
+		die("--kernel_timeline: unable to open tracepoints: %s\n",
+		    strerror(error));
+	}
+
+	timeline.state = state;
+	timeline.num_records = 0;
+	timeline.lost = 0;
+	timeline.realtime_offset_nsecs = realtime_offset_nsecs();
+	for (i = 0; i < timeline.num_rings; ++i) {
+		int j;
+
+		for (j = 0; j < NUM_TRACEPOINTS; ++j) {
+			if (ioctl(timeline.rings[i].fds[j],
+				  PERF_EVENT_IOC_ENABLE, 0) < 0)
+				die_perror("--kernel_timeline: enable");
+		}
+	}
+
+	if (pthread_mutex_lock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_lock");
+	timeline.active = true;
+	if (pthread_mutex_unlock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_unlock");
+
+	if (pthread_create(&timeline.thread, NULL, timeline_reader_thread,
+			   NULL) != 0)
+		die_perror("pthread_create");
+
+	/* Report the timeline if the script fails, which exits. */
+	if (!registered_at_exit) {
+		atexit(timeline_at_exit);
+		registered_at_exit = true;
+	}
+}
+
+void kernel_timeline_stop(void)
+{
+	int i;
+
+	if (timeline.rings == NULL)
+		return;
+	timeline_stop_reader();
+
+	if (pthread_mutex_lock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_lock");
+	for (i = 0; i < timeline.num_rings; ++i)
+		close_ring(&timeline.rings[i]);
+	free(timeline.rings);
+	timeline.rings = NULL;
+	timeline.num_rings = 0;
+	free(timeline.pollfds);
+	timeline.pollfds = NULL;
+	free(timeline.records);
+	timeline.records = NULL;
+	free(timeline.scratch);
+	timeline.scratch = NULL;
+	timeline.state = NULL;
+	if (pthread_mutex_unlock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_unlock");
+}
+
+void kernel_timeline_note_event(const struct event *event)
+{
+	struct timeline_record *record = NULL;
+	const char *what = NULL;
+
+	if (timeline.rings == NULL)
+		return;
+
+	switch (event->type) {
+	case PACKET_EVENT:
+		what = (packet_direction(event->event.packet) ==
+			DIRECTION_INBOUND) ? "inbound packet" :
+			"outbound packet";
+		break;
+	case SYSCALL_EVENT:
+		what = event->event.syscall->name;
+		break;
+	case COMMAND_EVENT:
+		what = "command";
+		break;
+	case CODE_EVENT:
+		what = "code";
+		break;
+	case PEER_EVENT:
+		what = "autopeer";
+		break;
+	case SPACING_EVENT:
+		what = "spacing";
+		break;
+	case INVALID_EVENT:
+	case NUM_EVENT_TYPES:
+		assert(!"bogus type");
+		break;
+	/* We omit default case so compiler catches missing values. */
+	}
+
+	if (pthread_mutex_lock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_lock");
+	if (timeline.active) {
+		record = timeline_new_record(
+			script_time_to_live_time_usecs(timeline.state,
+						       event->time_usecs),
+			true);
+		snprintf(record->text, sizeof(record->text), "line %d: %s",
+			 event->line_number, what);
+	}
+	if (pthread_mutex_unlock(&timeline.lock) != 0)
+		die_perror("pthread_mutex_unlock");
+}
+
+#else  /* !linux */
+
+void kernel_timeline_start(struct state *state)
+{
+	die("--kernel_timeline is only supported on Linux\n");
+}
+
+void kernel_timeline_stop(void)
+{
+}
+
+void kernel_timeline_note_event(const struct event *event)
+{
+}
+
+#endif  /* linux */
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for --kernel_timeline, which records the kernel's TCP
+ * tracepoints during a live run and, if the script fails, prints them
+ * merged with the script's events in script time.
+ */
+
+#ifndef __KERNEL_TIMELINE_H__
+#define __KERNEL_TIMELINE_H__
+
+#include "types.h"
+
+struct event;
+struct state;
+
+/* Start recording the tcp:tcp_probe, tcp:tcp_retransmit_skb and
+ * sock:inet_sock_set_state tracepoints for the sockets of the script
+ * run by the given state, into ring buffers of our own. If the process
+ * exits (e.g. via die()) before kernel_timeline_stop(), we print the
+ * latest records to stderr after the failure message. Dies if the
+ * tracepoints can't be opened.
+ */
+extern void kernel_timeline_start(struct state *state);
+
+/* Stop recording and discard the timeline. No-op if there is no
+ * timeline being recorded.
+ */
+extern void kernel_timeline_stop(void);
+
+/* Add the given script event to the timeline at its script time, so
+ * that the kernel's records show up among the script's events. Call
+ * this once the event's relative time has been adjusted.
+ */
+extern void kernel_timeline_note_event(const struct event *event);
+
+#endif /* __KERNEL_TIMELINE_H__ */
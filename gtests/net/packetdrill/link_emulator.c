@@ -0,0 +1,397 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the link emulator.
+ *
+ * Each direction of the link is a FIFO bottleneck that sends packets
+ * at --link_rate bits/sec and holds at most --link_queue packets,
+ * dropping packets that arrive to a full queue, followed by a wire
+ * with a --link_delay_usecs propagation delay. A packet that gets
+ * through the queue is lost with probability --link_loss, or else
+ * with probability --link_reorder held back for --link_reorder_usecs
+ * more, so that the packets behind it overtake it. The generator for
+ * these is seeded with --link_seed, so runs that send the same packets
+ * see the same losses.
+ *
+ * We compute the time each packet leaves the link, in nanoseconds,
+ * when it enters the link, and keep the packets in flight sorted by
+ * that time. They leave through a delivery thread (for the packets we
+ * inject) or when the caller dequeues them (for the packets we sniff).
+ */
+
+#include "link_emulator.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "logging.h"
+#include "run.h"
+#include "stats.h"
+
+#define NSECS_PER_USEC	1000LL
+#define NSECS_PER_SEC	1000000000LL
+
+/* A packet in flight in the link. */
+struct link_packet {
+	struct packet *packet;
+	s64 exit_nsecs;			/* when it leaves the link */
+	struct link_packet *next;
+};
+
+struct link {
+	const char *name;		/* "inbound" or "outbound" */
+	const char *script_path;	/* for reporting statistics */
+	s64 rate_bps;			/* bottleneck rate, or 0 for none */
+	s64 delay_nsecs;		/* propagation delay */
+	int queue_limit;		/* packets the queue holds, or 0 */
+	double loss;			/* probability of losing a packet */
+	double reorder;			/* probability of reordering one */
+	s64 reorder_nsecs;		/* extra delay of reordered packets */
+	u64 random_state;		/* xorshift64* generator state */
+	FILE *log;			/* per-packet log, or NULL */
+
+	/* The bottleneck. */
+	s64 busy_until_nsecs;		/* when it finishes sending */
+	s64 *queue_exits;		/* ring of times queued packets leave */
+	int queue_head;			/* index of oldest in queue_exits */
+	int queue_count;		/* packets in queue_exits */
+
+	/* Packets in flight, sorted by exit time. */
+	pthread_mutex_t lock;		/* guards packets, last and exit */
+	pthread_cond_t cond;		/* signals new packets or exit */
+	struct link_packet *packets;
+	struct link_packet *last;
+	void (*deliver)(void *arg, struct packet *packet);
+	void *deliver_arg;
+	pthread_t thread;		/* calls deliver(), if set */
+	bool exit;			/* should the thread flush and exit? */
+
+	/* Statistics. */
+	u64 num_packets;		/* packets that entered the link */
+	u64 num_queue_drops;		/* dropped at a full queue */
+	u64 num_lost;			/* lost on the wire */
+	u64 num_reordered;		/* held back for reordering */
+	s64 *queue_delays;		/* nsecs each packet spent queued */
+	u64 num_queue_delays;
+	u64 max_queue_delays;		/* allocated length of queue_delays */
+};
+
+bool link_emulation_enabled(const struct config *config)
+{
+	return (config->link_rate_bps > 0 || config->link_delay_usecs > 0 ||
+		config->link_loss > 0 || config->link_reorder > 0);
+}
+
+/* Return a pseudo-random number in [0, 1). */
+static double link_random(struct link *link)
+{
+	u64 x = link->random_state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	link->random_state = x;
+	return ((x * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+struct link *link_new(const struct config *config,
+		      enum direction_t direction, FILE *log)
+{
+	struct link *link = calloc(1, sizeof(struct link));
+
+	link->name = (direction == DIRECTION_INBOUND) ? "inbound" : "outbound";
+	link->script_path = config->script_path;
+	link->rate_bps = config->link_rate_bps;
+	link->delay_nsecs = config->link_delay_usecs * NSECS_PER_USEC;
+	link->queue_limit = config->link_queue;
+	link->loss = config->link_loss;
+	link->reorder = config->link_reorder;
+	link->reorder_nsecs = config->link_reorder_usecs * NSECS_PER_USEC;
+	/* Give each direction its own non-zero generator state. */
+	link->random_state = (((u64)config->link_seed << 1) | 1) ^
+			     ((u64)direction << 40);
+	link->log = log;
+	if (link->queue_limit > 0)
+		link->queue_exits = calloc(link->queue_limit, sizeof(s64));
+	if (pthread_mutex_init(&link->lock, NULL) != 0)
+		die_perror("pthread_mutex_init");
+	if (pthread_cond_init(&link->cond, NULL) != 0)
+		die_perror("pthread_cond_init");
+	return link;
+}
+
+static void link_add_queue_delay(struct link *link, s64 delay_nsecs)
+{
+	if (link->num_queue_delays == link->max_queue_delays) {
+		link->max_queue_delays = (link->max_queue_delays > 0 ?
+					  link->max_queue_delays * 2 : 1024);
+		link->queue_delays = realloc(link->queue_delays,
+					     link->max_queue_delays *
+					     sizeof(s64));
+		if (link->queue_delays == NULL)
+			die("link: out of memory for queueing delays\n");
+	}
+	link->queue_delays[link->num_queue_delays++] = delay_nsecs;
+}
+
+/* Put the packet into the bottleneck queue. Returns the time it is
+ * sent, or -1 if the queue is full.
+ */
+static s64 link_queue_packet(struct link *link, const struct packet *packet,
+			     s64 enter_nsecs, s64 *queue_delay_nsecs)
+{
+	if (link->rate_bps == 0)
+		return enter_nsecs;
+
+	if (link->queue_limit > 0) {
+		/* Forget the packets the bottleneck has finished sending. */
+		while (link->queue_count > 0 &&
+		       link->queue_exits[link->queue_head] <= enter_nsecs) {
+			link->queue_head = ((link->queue_head + 1) %
+					    link->queue_limit);
+			--link->queue_count;
+		}
+		if (link->queue_count == link->queue_limit)
+			return -1;
+	}
+
+	if (link->busy_until_nsecs < enter_nsecs)
+		link->busy_until_nsecs = enter_nsecs;
+	*queue_delay_nsecs = link->busy_until_nsecs - enter_nsecs;
+	link->busy_until_nsecs += ((s64)packet->ip_bytes * 8 * NSECS_PER_SEC /
+				   link->rate_bps);
+	link_add_queue_delay(link, *queue_delay_nsecs);
+
+	if (link->queue_limit > 0) {
+		link->queue_exits[(link->queue_head + link->queue_count) %
+				  link->queue_limit] = link->busy_until_nsecs;
+		++link->queue_count;
+	}
+	return link->busy_until_nsecs;
+}
+
+/* Add the packet to the packets in flight, in order of exit time. */
+static void link_insert(struct link *link, struct packet *packet,
+			s64 exit_nsecs)
+{
+	struct link_packet *entry = calloc(1, sizeof(struct link_packet));
+	struct link_packet **prev = NULL;
+
+	entry->packet = packet;
+	entry->exit_nsecs = exit_nsecs;
+
+	if (pthread_mutex_lock(&link->lock) != 0)
+		die_perror("pthread_mutex_lock");
+	if (link->last == NULL || link->last->exit_nsecs <= exit_nsecs) {
+		prev = (link->last != NULL) ? &link->last->next :
+			&link->packets;
+	} else {
+		/* A reordered packet, or one overtaking it. */
+		prev = &link->packets;
+		while ((*prev)->exit_nsecs <= exit_nsecs)
+			prev = &(*prev)->next;
+	}
+	entry->next = *prev;
+	*prev = entry;
+	if (entry->next == NULL)
+		link->last = entry;
+	if (pthread_cond_signal(&link->cond) != 0)
+		die_perror("pthread_cond_signal");
+	if (pthread_mutex_unlock(&link->lock) != 0)
+		die_perror("pthread_mutex_unlock");
+}
+
+void link_enqueue(struct link *link, struct packet *packet, s64 enter_nsecs)
+{
+	const char *fate = "delivered";
+	const u32 ip_bytes = packet->ip_bytes;
+	s64 queue_delay_nsecs = 0;
+	s64 exit_nsecs = 0;
+
+	++link->num_packets;
+	exit_nsecs = link_queue_packet(link, packet, enter_nsecs,
+				       &queue_delay_nsecs);
+	if (exit_nsecs < 0) {
+		fate = "queue_drop";
+		++link->num_queue_drops;
+		packet_free(packet);
+	} else if (link->loss > 0 && link_random(link) < link->loss) {
+		fate = "lost";
+		++link->num_lost;
+		packet_free(packet);
+	} else {
+		exit_nsecs += link->delay_nsecs;
+		if (link->reorder > 0 && link_random(link) < link->reorder) {
+			fate = "reordered";
+			++link->num_reordered;
+			exit_nsecs += link->reorder_nsecs;
+		}
+		link_insert(link, packet, exit_nsecs);
+	}
+
+	if (link->log != NULL) {
+		fprintf(link->log, "%s %lld.%09lld %u %lld %s\n", link->name,
+			enter_nsecs / NSECS_PER_SEC,
+			enter_nsecs % NSECS_PER_SEC, ip_bytes,
+			queue_delay_nsecs, fate);
+	}
+}
+
+s64 link_next_exit_nsecs(struct link *link)
+{
+	s64 exit_nsecs = -1;
+
+	if (pthread_mutex_lock(&link->lock) != 0)
+		die_perror("pthread_mutex_lock");
+	if (link->packets != NULL)
+		exit_nsecs = link->packets->exit_nsecs;
+	if (pthread_mutex_unlock(&link->lock) != 0)
+		die_perror("pthread_mutex_unlock");
+	return exit_nsecs;
+}
+
+/* Remove and return the first packet in flight. Caller holds the lock. */
+static struct packet *link_remove_first(struct link *link)
+{
+	struct link_packet *entry = link->packets;
+	struct packet *packet = entry->packet;
+
+	packet->time_usecs = entry->exit_nsecs / NSECS_PER_USEC;
+	link->packets = entry->next;
+	if (link->packets == NULL)
+		link->last = NULL;
+	free(entry);
+	return packet;
+}
+
+struct packet *link_dequeue(struct link *link, s64 now_nsecs)
+{
+	struct packet *packet = NULL;
+
+	if (pthread_mutex_lock(&link->lock) != 0)
+		die_perror("pthread_mutex_lock");
+	if (link->packets != NULL && link->packets->exit_nsecs <= now_nsecs)
+		packet = link_remove_first(link);
+	if (pthread_mutex_unlock(&link->lock) != 0)
+		die_perror("pthread_mutex_unlock");
+	return packet;
+}
+
+static void *link_delivery_thread(void *arg)
+{
+	struct link *link = arg;
+
+	if (pthread_mutex_lock(&link->lock) != 0)
+		die_perror("pthread_mutex_lock");
+	while (1) {
+		struct packet *packet = NULL;
+		int result = 0;
+
+		if (link->packets == NULL) {
+			if (link->exit)
+				break;
+			if (pthread_cond_wait(&link->cond, &link->lock) != 0)
+				die_perror("pthread_cond_wait");
+			continue;
+		}
+		if (!link->exit && link->packets->exit_nsecs > now_nsecs()) {
+			const s64 exit_nsecs = link->packets->exit_nsecs;
+			struct timespec deadline = {
+				.tv_sec = exit_nsecs / NSECS_PER_SEC,
+				.tv_nsec = exit_nsecs % NSECS_PER_SEC,
+			};
+
+			result = pthread_cond_timedwait(&link->cond,
+							&link->lock,
+							&deadline);
+			if (result != 0 && result != ETIMEDOUT) {
+				errno = result;
+				die_perror("pthread_cond_timedwait");
+			}
+			continue;
+		}
+
+		packet = link_remove_first(link);
+		if (pthread_mutex_unlock(&link->lock) != 0)
+			die_perror("pthread_mutex_unlock");
+		link->deliver(link->deliver_arg, packet);
+		packet_free(packet);
+		if (pthread_mutex_lock(&link->lock) != 0)
+			die_perror("pthread_mutex_lock");
+	}
+	if (pthread_mutex_unlock(&link->lock) != 0)
+		die_perror("pthread_mutex_unlock");
+	return NULL;
+}
+
+void link_start_delivery(struct link *link,
+			 void (*deliver)(void *arg, struct packet *packet),
+			 void *arg)
+{
+	link->deliver = deliver;
+	link->deliver_arg = arg;
+	if (pthread_create(&link->thread, NULL, link_delivery_thread,
+			   link) != 0)
+		die_perror("pthread_create");
+}
+
+static void link_report(struct link *link)
+{
+	fprintf(stderr, "%s: link %s: %llu packets, %llu queue drops, "
+		"%llu lost, %llu reordered",
+		link->script_path, link->name,
+		(unsigned long long)link->num_packets,
+		(unsigned long long)link->num_queue_drops,
+		(unsigned long long)link->num_lost,
+		(unsigned long long)link->num_reordered);
+	if (link->num_queue_delays > 0) {
+		sort_s64(link->queue_delays, link->num_queue_delays);
+		fprintf(stderr, "; queueing delay usecs: ");
+		print_nsecs_summary(stderr, link->queue_delays,
+				    link->num_queue_delays);
+	}
+	fprintf(stderr, "\n");
+}
+
+void link_free(struct link *link)
+{
+	if (link->deliver != NULL) {
+		if (pthread_mutex_lock(&link->lock) != 0)
+			die_perror("pthread_mutex_lock");
+		link->exit = true;
+		if (pthread_cond_signal(&link->cond) != 0)
+			die_perror("pthread_cond_signal");
+		if (pthread_mutex_unlock(&link->lock) != 0)
+			die_perror("pthread_mutex_unlock");
+		if (pthread_join(link->thread, NULL) != 0)
+			die_perror("pthread_join");
+	}
+	while (link->packets != NULL)
+		packet_free(link_remove_first(link));
+
+	link_report(link);
+
+	pthread_mutex_destroy(&link->lock);
+	pthread_cond_destroy(&link->cond);
+	free(link->queue_exits);
+	free(link->queue_delays);
+	free(link);
+}
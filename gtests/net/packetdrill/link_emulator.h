@@ -0,0 +1,78 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for the link emulator, which can stand between the script
+ * and the kernel under test in the local netdev, and give each
+ * direction a bottleneck rate, a queue limit, a propagation delay, and
+ * random loss and reordering.
+ */
+
+#ifndef __LINK_EMULATOR_H__
+#define __LINK_EMULATOR_H__
+
+#include "types.h"
+
+#include <stdio.h>
+#include "config.h"
+#include "packet.h"
+
+struct link;
+
+/* Return true iff the config asks for any link emulation. */
+extern bool link_emulation_enabled(const struct config *config);
+
+/* Allocate one direction of an emulated link, using the --link_*
+ * parameters in the config. If 'log' is non-NULL we write a line to
+ * it for each packet that enters the link.
+ */
+extern struct link *link_new(const struct config *config,
+			     enum direction_t direction, FILE *log);
+
+/* Start a thread that hands each packet to deliver() as it leaves the
+ * link, and then frees it, instead of waiting for link_dequeue().
+ */
+extern void link_start_delivery(struct link *link,
+				void (*deliver)(void *arg,
+						struct packet *packet),
+				void *arg);
+
+/* Deliver any packets still in the link at once, print the link's
+ * statistics to stderr, and free the link.
+ */
+extern void link_free(struct link *link);
+
+/* Pass a packet that entered the link at the given wall time, in
+ * nanoseconds, into the link, which takes ownership of the packet.
+ * The packet may be dropped by the queue or lost.
+ */
+extern void link_enqueue(struct link *link, struct packet *packet,
+			 s64 enter_nsecs);
+
+/* Return the wall time, in nanoseconds, at which the next packet
+ * leaves the link, or -1 if the link is empty.
+ */
+extern s64 link_next_exit_nsecs(struct link *link);
+
+/* If the next packet has left the link by the given wall time, in
+ * nanoseconds, remove it and return it with its time_usecs set to the
+ * time it left. Otherwise return NULL.
+ */
+extern struct packet *link_dequeue(struct link *link, s64 now_nsecs);
+
+#endif /* __LINK_EMULATOR_H__ */
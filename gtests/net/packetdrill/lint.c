@@ -0,0 +1,271 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of --lint.
+ *
+ * The parser is reentrant, so each thread of the pool parses its
+ * scripts into its own config and script. Errors deep in the parser
+ * and config code are reported with die(), so each thread sets a die()
+ * trap while it checks a script, turning an error into a failure of
+ * just that script.
+ */
+
+#include "lint.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "logging.h"
+#include "run.h"
+#include "script.h"
+
+/* The shared state of a lint run. */
+struct lint {
+	int argc;			/* our command line */
+	char **argv;
+	char **paths;			/* scripts to check */
+	int num_paths;
+	int max_paths;
+	int next_path;			/* index of next script to check */
+	int failures;			/* scripts with problems */
+	pthread_mutex_t mutex;		/* guards next_path and failures */
+};
+
+static void lint_add_script(struct lint *lint, const char *path)
+{
+	if (lint->num_paths == lint->max_paths) {
+		lint->max_paths = lint->max_paths ? 2 * lint->max_paths : 256;
+		lint->paths = realloc(lint->paths,
+				      lint->max_paths * sizeof(char *));
+	}
+	lint->paths[lint->num_paths++] = strdup(path);
+}
+
+static bool is_script_name(const char *name)
+{
+	const char *suffix = ".pkt";
+	size_t len = strlen(name), suffix_len = strlen(suffix);
+
+	return len > suffix_len &&
+		strcmp(name + len - suffix_len, suffix) == 0;
+}
+
+/* Add the given script, or the *.pkt scripts under the given
+ * directory, recursively.
+ */
+static void lint_add_path(struct lint *lint, const char *path)
+{
+	struct dirent *entry = NULL;
+	struct stat info;
+	DIR *dir = NULL;
+
+	if (stat(path, &info) != 0)
+		die("--lint: stat() of '%s': %s\n", path, strerror(errno));
+	if (!S_ISDIR(info.st_mode)) {
+		lint_add_script(lint, path);
+		return;
+	}
+
+	dir = opendir(path);
+	if (dir == NULL)
+		die("--lint: opendir() of '%s': %s\n", path, strerror(errno));
+	while ((entry = readdir(dir)) != NULL) {
+		char *child = NULL;
+
+		if (entry->d_name[0] == '.')
+			continue;
+		asprintf(&child, "%s/%s", path, entry->d_name);
+		if (stat(child, &info) == 0 &&
+		    (S_ISDIR(info.st_mode) || is_script_name(entry->d_name)))
+			lint_add_path(lint, child);
+		free(child);
+	}
+	closedir(dir);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Check that the symbols in the arguments and errno of a system call
+ * event resolve, as they must when the script runs.
+ */
+static int lint_syscall(const struct config *config, struct event *event)
+{
+	struct syscall_spec *syscall = event->event.syscall;
+	struct expression_list *args = NULL;
+	char *error = NULL;
+	int result = STATUS_OK;
+	s64 value = 0;
+
+	if (evaluate_expression_list(syscall->arguments, &args, &error)) {
+		fprintf(stderr, "%s:%d: %s\n",
+			config->script_path, event->line_number, error);
+		free(error);
+		error = NULL;
+		result = STATUS_ERR;
+	}
+	free_expression_list(args);
+
+	if (syscall->error != NULL &&
+	    symbol_to_int(syscall->error->errno_macro, &value, &error)) {
+		fprintf(stderr, "%s:%d: %s\n",
+			config->script_path, event->line_number, error);
+		free(error);
+		result = STATUS_ERR;
+	}
+	return result;
+}
+
+/* Check the events of a parsed script. Returns the number of problems. */
+static int lint_events(const struct config *config, struct script *script)
+{
+	struct event *event = NULL, *last_event = NULL;
+	int problems = 0;
+
+	for (event = script->event_list; event != NULL;
+	     last_event = event, event = event->next) {
+		char *error = NULL;
+
+		if (check_event_order(config, last_event, event, &error)) {
+			fprintf(stderr, "%s", error);
+			free(error);
+			++problems;
+		}
+		if (event->type == SYSCALL_EVENT &&
+		    lint_syscall(config, event))
+			++problems;
+	}
+	return problems;
+}
+
+/* Parse and check one script. Returns true if it has no problems. */
+static bool lint_script(struct lint *lint, const char *path)
+{
+	struct config config;
+	struct script script;
+	struct die_trap trap;
+	volatile int problems = 0;
+	int i;
+
+	memset(&config, 0, sizeof(config));
+	init_script(&script);
+
+	if (sigsetjmp(trap.env, 0) == 0) {
+		die_trap_set(&trap);
+		/* The parser prints any syntax error. */
+		if (parse_script_and_set_config(lint->argc, lint->argv,
+						&config, &script, path, NULL))
+			problems = 1;
+		else
+			problems = lint_events(&config, &script);
+	} else {
+		problems = 1;	/* die() printed the error */
+	}
+	die_trap_set(NULL);
+
+	script_free(&script);
+	free(config.script_path);
+	if (config.argv != NULL) {
+		for (i = 0; config.argv[i] != NULL; ++i)
+			free((char *)config.argv[i]);
+		free(config.argv);
+	}
+	return problems == 0;
+}
+
+static void *lint_thread(void *arg)
+{
+	struct lint *lint = arg;
+
+	while (1) {
+		int i;
+
+		if (pthread_mutex_lock(&lint->mutex) != 0)
+			die_perror("pthread_mutex_lock");
+		i = lint->next_path++;
+		if (pthread_mutex_unlock(&lint->mutex) != 0)
+			die_perror("pthread_mutex_unlock");
+		if (i >= lint->num_paths)
+			break;
+
+		if (lint_script(lint, lint->paths[i]))
+			continue;
+
+		if (pthread_mutex_lock(&lint->mutex) != 0)
+			die_perror("pthread_mutex_lock");
+		++lint->failures;
+		if (pthread_mutex_unlock(&lint->mutex) != 0)
+			die_perror("pthread_mutex_unlock");
+	}
+	return NULL;
+}
+
+int lint_scripts(int argc, char *argv[], const struct config *config,
+		 char **paths)
+{
+	struct lint lint;
+	pthread_t *threads = NULL;
+	int num_threads = config->lint_threads;
+	int i;
+
+	memset(&lint, 0, sizeof(lint));
+	lint.argc = argc;
+	lint.argv = argv;
+	if (pthread_mutex_init(&lint.mutex, NULL) != 0)
+		die_perror("pthread_mutex_init");
+
+	for (; *paths != NULL; ++paths)
+		lint_add_path(&lint, *paths);
+	qsort(lint.paths, lint.num_paths, sizeof(char *), compare_paths);
+
+	if (num_threads == 0)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads > lint.num_paths)
+		num_threads = lint.num_paths;
+	if (num_threads < 1)
+		num_threads = 1;
+	DEBUGP("lint: %d scripts, %d threads\n", lint.num_paths, num_threads);
+
+	threads = calloc(num_threads, sizeof(pthread_t));
+	for (i = 0; i < num_threads; ++i) {
+		if (pthread_create(&threads[i], NULL, lint_thread, &lint) != 0)
+			die_perror("pthread_create");
+	}
+	for (i = 0; i < num_threads; ++i) {
+		if (pthread_join(threads[i], NULL) != 0)
+			die_perror("pthread_join");
+	}
+
+	printf("lint: %d of %d scripts have problems\n",
+	       lint.failures, lint.num_paths);
+
+	for (i = 0; i < lint.num_paths; ++i)
+		free(lint.paths[i]);
+	free(lint.paths);
+	free(threads);
+	pthread_mutex_destroy(&lint.mutex);
+	return lint.failures;
+}
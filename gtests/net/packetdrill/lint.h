@@ -0,0 +1,44 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for --lint, which checks a corpus of scripts in parallel
+ * without running them.
+ */
+
+#ifndef __LINT_H__
+#define __LINT_H__
+
+#include "types.h"
+
+#include "config.h"
+
+/* Check each of the given NULL-terminated list of script paths, or of
+ * the *.pkt scripts under each path that is a directory, using a pool
+ * of config->lint_threads threads (or one per CPU), each with its own
+ * config and script. For each script we report syntax and semantic
+ * errors, unknown symbols in system call arguments and errno names,
+ * and event times out of order, on stderr. Nothing touches the
+ * network. The argc and argv are our command line, whose options
+ * apply to every script as usual. Returns the number of scripts with
+ * problems.
+ */
+extern int lint_scripts(int argc, char *argv[], const struct config *config,
+			char **paths);
+
+#endif /* __LINT_H__ */
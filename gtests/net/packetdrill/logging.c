@@ -27,6 +27,36 @@
 #include <stdarg.h>
 #include <stdlib.h>
 
+/* The die() trap of each thread, if any. */
+static __thread struct die_trap *die_trap;
+
+void die_trap_set(struct die_trap *trap)
+{
+	if (trap != NULL)
+		trap->held = NULL;
+	die_trap = trap;
+}
+
+void die_trap_hold(pthread_mutex_t *mutex)
+{
+	if (die_trap != NULL)
+		die_trap->held = mutex;
+}
+
+/* Exit, or jump to the trap of the calling thread, releasing any lock
+ * the thread registered as held.
+ */
+static void die_exit(void)
+{
+	if (die_trap != NULL) {
+		if (die_trap->held != NULL)
+			pthread_mutex_unlock(die_trap->held);
+		die_trap->held = NULL;
+		siglongjmp(die_trap->env, 1);
+	}
+	exit(EXIT_FAILURE);
+}
+
 extern void die(char *format, ...)
 {
 	va_list ap;
@@ -35,12 +65,12 @@ extern void die(char *format, ...)
 	vfprintf(stderr, format, ap);
 	va_end(ap);
 
-	exit(EXIT_FAILURE);
+	die_exit();
 }
 
 void die_perror(char *message)
 {
 	perror(message);
 
-	exit(EXIT_FAILURE);
+	die_exit();
 }
@@ -27,6 +27,9 @@
 
 #include "types.h"
 
+#include <pthread.h>
+#include <setjmp.h>
+
 /* Enable this to get debug logging. */
 #define DEBUG_LOGGING 0
 
@@ -43,4 +46,26 @@ extern void die(char *format, ...);
 /* Call perror() with message and then exit with a failure status code. */
 extern void die_perror(char *message);
 
+/* A trap for die() and die_perror() in one thread. While a thread has
+ * a trap set, they print their message as usual but then siglongjmp()
+ * to the trap instead of exiting, so that, e.g., we can lint many
+ * scripts in one process. Code that dies may leak memory it has
+ * allocated, so this is not meant for long-running use; but it must
+ * not leave a lock held that other threads need, so code that can die
+ * while holding one registers it with die_trap_hold().
+ */
+struct die_trap {
+	sigjmp_buf env;		/* filled in by sigsetjmp() */
+	pthread_mutex_t *held;	/* mutex to unlock before jumping */
+};
+
+/* Set the trap for the calling thread, or clear it if trap is NULL. */
+extern void die_trap_set(struct die_trap *trap);
+
+/* Note that the calling thread now holds the given mutex, or none if
+ * mutex is NULL, so that if it dies into its trap the mutex is
+ * unlocked first. No-op if the thread has no trap.
+ */
+extern void die_trap_hold(pthread_mutex_t *mutex);
+
 #endif /* __LOGGING_H__ */
@@ -31,6 +31,10 @@
 #include <fcntl.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,15 +49,39 @@
 #include <net/if_tun.h>
 #endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 
+#include "capture.h"
+#include "cpu_affinity.h"
 #include "ip.h"
 #include "ipv6.h"
+#include "link_emulator.h"
 #include "logging.h"
 #include "net_utils.h"
 #include "packet.h"
+#include "packet_checksum.h"
 #include "packet_parser.h"
 #include "packet_socket.h"
+#include "run.h"
 #include "tcp.h"
 #include "tun.h"
+#include "udp.h"
+
+struct local_netdev;
+
+/* A queue of a multi-queue tun device. Each queue has its own thread
+ * that injects the packets for that queue, pinned to a CPU, so that
+ * the kernel's receive processing for the queue runs on that CPU.
+ */
+struct tun_queue {
+	struct local_netdev *netdev;	/* the netdev we belong to */
+	int index;		/* index of this queue */
+	int fd;			/* tun fd attached to this queue */
+	int cpu;		/* CPU the injecting thread is pinned to */
+	pthread_t thread;	/* thread injecting packets for this queue */
+	pthread_mutex_t lock;	/* protects packet and exit */
+	pthread_cond_t cond;	/* signals a new packet, or its injection */
+	struct packet *packet;	/* packet to inject next, or NULL */
+	bool exit;		/* should the thread exit? */
+};
 
 /* Internal private state for the netdev for purely local tests. */
 struct local_netdev {
@@ -61,14 +89,28 @@ struct local_netdev {
 
 	char *name;		/* malloc-ed copy of interface name (owned) */
 	int tun_fd;		/* tun for sending/receiving packets */
+	struct tun_queue *queues;	/* queues, if multi-queue (owned) */
+	int num_queues;		/* number of tun queues */
 	int ipv4_control_fd;	/* fd for IPv4 configuration of tun interface */
 	int ipv6_control_fd;	/* fd for IPv6 configuration of tun interface */
 	int index;		/* interface index from if_nametoindex */
+	bool vnet_hdr;		/* virtio_net_hdr ahead of tun packets? */
 	struct packet_socket *psock;	/* for sniffing packets (owned) */
+	struct link *inbound_link;	/* emulated link to kernel, or NULL */
+	struct link *outbound_link;	/* emulated link from kernel, or NULL */
+	FILE *link_log;			/* --link_log file, or NULL */
 };
 
 struct netdev_ops local_netdev_ops;
 
+#ifdef linux
+static void tun_queues_start(struct config *config,
+			     struct local_netdev *netdev);
+static void tun_queues_stop(struct local_netdev *netdev);
+#endif
+static void local_netdev_start_links(struct config *config,
+				     struct local_netdev *netdev);
+
 /* "Downcast" an abstract netdev to our local flavor. */
 static inline struct local_netdev *to_local_netdev(struct netdev *netdev)
 {
@@ -126,11 +168,55 @@ static void create_device(struct config *config, struct local_netdev *netdev)
 	struct ifreq ifr;
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+	if (config->tun_vnet_hdr)
+		ifr.ifr_flags |= IFF_VNET_HDR;
+	if (config->tun_queues > 1)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
 	int status = ioctl(netdev->tun_fd, TUNSETIFF, (void *)&ifr);
 	if (status < 0)
 		die_perror("TUNSETIFF");
 
 	netdev->name = strdup(ifr.ifr_name);
+
+	if (config->tun_vnet_hdr) {
+		int vnet_hdr_bytes = sizeof(struct virtio_net_hdr);
+
+		if (ioctl(netdev->tun_fd, TUNSETVNETHDRSZ,
+			  &vnet_hdr_bytes) < 0)
+			die_perror("TUNSETVNETHDRSZ");
+		netdev->vnet_hdr = true;
+	}
+
+	/* Attach any further queues to the device we just created. */
+	netdev->num_queues = config->tun_queues;
+	if (netdev->num_queues > 1) {
+		int i;
+
+		netdev->queues = calloc(netdev->num_queues,
+					sizeof(struct tun_queue));
+		netdev->queues[0].fd = netdev->tun_fd;
+		for (i = 1; i < netdev->num_queues; ++i) {
+			int fd = open(TUN_PATH, O_RDWR);
+			if (fd < 0)
+				die_perror("open tun device");
+			if (ioctl(fd, TUNSETIFF, (void *)&ifr) < 0)
+				die_perror("TUNSETIFF IFF_MULTI_QUEUE");
+			if (config->tun_vnet_hdr) {
+				int vnet_hdr_bytes =
+					sizeof(struct virtio_net_hdr);
+				if (ioctl(fd, TUNSETVNETHDRSZ,
+					  &vnet_hdr_bytes) < 0)
+					die_perror("TUNSETVNETHDRSZ");
+			}
+			netdev->queues[i].fd = fd;
+		}
+	}
+#else
+	if (config->tun_vnet_hdr)
+		die("--tun_vnet_hdr is only supported on Linux\n");
+	if (config->tun_queues > 1)
+		die("--tun_queues is only supported on Linux\n");
+	netdev->num_queues = 1;
 #endif
 
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
@@ -226,6 +312,12 @@ static void set_device_offload_flags(struct local_netdev *netdev)
 	/* Linux 3.18 doesn't support TUN_F_UFO. So try and ignore... */
 	offload = TUN_F_UFO;
 	ioctl(netdev->tun_fd, TUNSETOFFLOAD, offload);
+	/* Likewise for UDP segmentation offload, new in Linux 6.2. */
+	if (netdev->vnet_hdr) {
+		offload = (TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 |
+			   TUN_F_TSO_ECN | TUN_F_USO4 | TUN_F_USO6);
+		ioctl(netdev->tun_fd, TUNSETOFFLOAD, offload);
+	}
 #endif
 }
 
@@ -306,6 +398,14 @@ struct netdev *local_netdev_new(struct config *config)
 
 	route_traffic_to_device(config, netdev);
 	netdev->psock = packet_socket_new(netdev->name);
+	if (netdev->vnet_hdr)
+		packet_socket_set_vnet_hdr(netdev->psock);
+#ifdef linux
+	if (netdev->num_queues > 1)
+		tun_queues_start(config, netdev);
+#endif
+	if (link_emulation_enabled(config))
+		local_netdev_start_links(config, netdev);
 
 	return (struct netdev *)netdev;
 }
@@ -314,8 +414,19 @@ static void local_netdev_free(struct netdev *a_netdev)
 {
 	struct local_netdev *netdev = to_local_netdev(a_netdev);
 
+	/* Flush the inbound link into the tun device while we have it. */
+	if (netdev->inbound_link != NULL)
+		link_free(netdev->inbound_link);
+	if (netdev->outbound_link != NULL)
+		link_free(netdev->outbound_link);
+	if (netdev->link_log != NULL)
+		fclose(netdev->link_log);
 	if (netdev->psock)
 		packet_socket_free(netdev->psock);
+#ifdef linux
+	if (netdev->queues != NULL)
+		tun_queues_stop(netdev);
+#endif
 	if (netdev->tun_fd >= 0)
 		close(netdev->tun_fd);
 	if (netdev->ipv4_control_fd >= 0)
@@ -352,14 +463,214 @@ static void bsd_tun_write(struct local_netdev *netdev,
 #endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
 
 #ifdef linux
-static void linux_tun_write(struct local_netdev *netdev,
+/* Fill in the virtio_net_hdr describing the segmentation offload
+ * metadata of the given packet, and for a packet whose checksum the
+ * kernel is to complete, leave only the pseudo-header checksum in it.
+ */
+static void linux_tun_vnet_hdr(struct packet *packet,
+			       struct virtio_net_hdr *vnet)
+{
+	u8 *l4 = (packet->tcp != NULL) ? (u8 *)packet->tcp : (u8 *)packet->udp;
+
+	memset(vnet, 0, sizeof(*vnet));
+
+	if (packet->flags & FLAG_CSUM_PARTIAL) {
+		assert(l4 != NULL);
+		checksum_packet_partial(packet);
+		vnet->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		vnet->csum_start = l4 - packet_start(packet);
+		vnet->csum_offset = ((packet->tcp != NULL) ?
+				     offsetof(struct tcp, check) :
+				     offsetof(struct udp, check));
+	}
+
+	if (packet->gso_size != 0) {
+		assert(l4 != NULL);
+		if (packet->udp != NULL)
+			vnet->gso_type = VIRTIO_NET_HDR_GSO_UDP_L4;
+		else if (packet->ipv4 != NULL)
+			vnet->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+		else
+			vnet->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+		if ((packet->tcp != NULL) && packet->tcp->cwr)
+			vnet->gso_type |= VIRTIO_NET_HDR_GSO_ECN;
+		vnet->hdr_len = packet_payload(packet) - packet_start(packet);
+		vnet->gso_size = packet->gso_size;
+	}
+}
+
+static void linux_tun_write(struct local_netdev *netdev, int tun_fd,
 			    struct packet *packet)
 {
-	if (write(netdev->tun_fd, packet_start(packet), packet->ip_bytes) < 0)
+	if (netdev->vnet_hdr) {
+		struct virtio_net_hdr vnet;
+		struct iovec vector[2] = {
+			{ &vnet, sizeof(vnet) },
+			{ packet_start(packet), packet->ip_bytes }
+		};
+
+		linux_tun_vnet_hdr(packet, &vnet);
+		if (writev(tun_fd, vector, ARRAY_SIZE(vector)) < 0)
+			die_perror("Linux tun writev()");
+		return;
+	}
+
+	if (write(tun_fd, packet_start(packet), packet->ip_bytes) < 0)
 		die_perror("Linux tun write()");
 }
+
+/* The thread for a tun queue: pin ourselves to the queue's CPU, then
+ * inject each packet handed to us, so the kernel receives it on that
+ * CPU.
+ */
+static void *tun_queue_thread(void *arg)
+{
+	struct tun_queue *queue = arg;
+
+	cpu_affinity_pin_self(queue->cpu, "tun queue");
+
+	if (pthread_mutex_lock(&queue->lock) != 0)
+		die_perror("pthread_mutex_lock");
+	while (1) {
+		while ((queue->packet == NULL) && !queue->exit) {
+			if (pthread_cond_wait(&queue->cond, &queue->lock) != 0)
+				die_perror("pthread_cond_wait");
+		}
+		if (queue->exit)
+			break;
+		DEBUGP("tun queue %d: inject on CPU %d\n",
+		       queue->index, sched_getcpu());
+		linux_tun_write(queue->netdev, queue->fd, queue->packet);
+		queue->packet = NULL;
+		if (pthread_cond_broadcast(&queue->cond) != 0)
+			die_perror("pthread_cond_broadcast");
+	}
+	if (pthread_mutex_unlock(&queue->lock) != 0)
+		die_perror("pthread_mutex_unlock");
+	return NULL;
+}
+
+/* Start the injecting thread for each queue of a multi-queue tun. By
+ * default queue i injects on CPU i, wrapping around the online CPUs.
+ */
+static void tun_queues_start(struct config *config,
+			     struct local_netdev *netdev)
+{
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	if (num_cpus < 1)
+		num_cpus = 1;
+	for (i = 0; i < netdev->num_queues; ++i) {
+		struct tun_queue *queue = &netdev->queues[i];
+
+		queue->netdev = netdev;
+		queue->index = i;
+		queue->cpu = config->tun_queue_cpus[i];
+		if (queue->cpu < 0)
+			queue->cpu = i % num_cpus;
+		if (pthread_mutex_init(&queue->lock, NULL) != 0)
+			die_perror("pthread_mutex_init");
+		if (pthread_cond_init(&queue->cond, NULL) != 0)
+			die_perror("pthread_cond_init");
+		if (pthread_create(&queue->thread, NULL, tun_queue_thread,
+				   queue) != 0)
+			die_perror("pthread_create");
+		DEBUGP("tun queue %d: fd %d on CPU %d\n",
+		       i, queue->fd, queue->cpu);
+	}
+}
+
+/* Stop the queue threads and close the fds of queues other than the
+ * first, which is netdev->tun_fd.
+ */
+static void tun_queues_stop(struct local_netdev *netdev)
+{
+	int i;
+
+	for (i = 0; i < netdev->num_queues; ++i) {
+		struct tun_queue *queue = &netdev->queues[i];
+
+		if (pthread_mutex_lock(&queue->lock) != 0)
+			die_perror("pthread_mutex_lock");
+		queue->exit = true;
+		if (pthread_cond_broadcast(&queue->cond) != 0)
+			die_perror("pthread_cond_broadcast");
+		if (pthread_mutex_unlock(&queue->lock) != 0)
+			die_perror("pthread_mutex_unlock");
+		if (pthread_join(queue->thread, NULL) != 0)
+			die_perror("pthread_join");
+		pthread_cond_destroy(&queue->cond);
+		pthread_mutex_destroy(&queue->lock);
+		if ((i > 0) && (close(queue->fd) < 0))
+			die_perror("close");
+	}
+	free(netdev->queues);
+	netdev->queues = NULL;
+}
+
+/* Hand the packet to the thread for its queue, and wait until the
+ * thread has injected it, so injection stays in script order.
+ */
+static void tun_queue_inject(struct tun_queue *queue, struct packet *packet)
+{
+	if (pthread_mutex_lock(&queue->lock) != 0)
+		die_perror("pthread_mutex_lock");
+	assert(queue->packet == NULL);
+	queue->packet = packet;
+	if (pthread_cond_broadcast(&queue->cond) != 0)
+		die_perror("pthread_cond_broadcast");
+	while (queue->packet != NULL) {
+		if (pthread_cond_wait(&queue->cond, &queue->lock) != 0)
+			die_perror("pthread_cond_wait");
+	}
+	if (pthread_mutex_unlock(&queue->lock) != 0)
+		die_perror("pthread_mutex_unlock");
+}
 #endif  /* linux */
 
+/* Write the packet into the kernel under test. */
+static void local_netdev_inject(struct local_netdev *netdev,
+				struct packet *packet)
+{
+	capture_packet(DIRECTION_INBOUND, packet_start(packet),
+		       packet->ip_bytes, 0);
+
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+	bsd_tun_write(netdev, packet);
+#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
+
+#ifdef linux
+	assert(packet->queue < netdev->num_queues);
+	if (netdev->num_queues > 1)
+		tun_queue_inject(&netdev->queues[packet->queue], packet);
+	else
+		linux_tun_write(netdev, netdev->tun_fd, packet);
+#endif  /* linux */
+}
+
+/* Called by the inbound link's thread as each packet leaves the link. */
+static void local_netdev_deliver(void *arg, struct packet *packet)
+{
+	local_netdev_inject(arg, packet);
+}
+
+static void local_netdev_start_links(struct config *config,
+				     struct local_netdev *netdev)
+{
+	if (config->link_log_path != NULL) {
+		netdev->link_log = fopen(config->link_log_path, "w");
+		if (netdev->link_log == NULL)
+			die_perror("--link_log: fopen");
+	}
+	netdev->inbound_link = link_new(config, DIRECTION_INBOUND,
+					netdev->link_log);
+	netdev->outbound_link = link_new(config, DIRECTION_OUTBOUND,
+					 netdev->link_log);
+	link_start_delivery(netdev->inbound_link, local_netdev_deliver,
+			    netdev);
+}
+
 static int local_netdev_send(struct netdev *a_netdev,
 			     struct packet *packet)
 {
@@ -374,34 +685,66 @@ static int local_netdev_send(struct netdev *a_netdev,
 
 	DEBUGP("local_netdev_send\n");
 
-#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
-	bsd_tun_write(netdev, packet);
-#endif /* defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) */
-
-#ifdef linux
-	linux_tun_write(netdev, packet);
-#endif  /* linux */
+	if (netdev->inbound_link != NULL)
+		link_enqueue(netdev->inbound_link, packet_copy(packet),
+			     now_nsecs());
+	else
+		local_netdev_inject(netdev, packet);
 
 	return STATUS_OK;
 }
 
+/* Block until a queue of our multi-queue tun has a packet to read,
+ * and return the fd of that queue.
+ */
+static int local_netdev_ready_queue_fd(struct local_netdev *netdev)
+{
+	struct pollfd fds[MAX_TUN_QUEUES];
+	int i;
+
+	for (i = 0; i < netdev->num_queues; ++i) {
+		fds[i].fd = netdev->queues[i].fd;
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	while (poll(fds, netdev->num_queues, -1) < 0) {
+		if (errno != EINTR)
+			die_perror("poll tun queues");
+	}
+	for (i = 0; i < netdev->num_queues; ++i) {
+		if (fds[i].revents & POLLIN)
+			return fds[i].fd;
+	}
+	assert(!"no tun queue readable");
+	return -1;
+}
+
 /* Read the given number of packets out of the tun device. We read
  * these packets so that the kernel can exercise its normal code paths
  * for packet transmit completion, since this code path may feed back
  * to TCP behavior; e.g., see the Linux patch "tcp: avoid retransmits
  * of TCP packets hanging in host queues".  We don't need to actually
  * need the packet contents, but on Linux we need to read at least 1
- * byte of packet data to consume the packet.
+ * byte of packet data to consume the packet, and with IFF_VNET_HDR the
+ * kernel refuses reads too short to hold the virtio_net_hdr.
  */
 static void local_netdev_read_queue(struct local_netdev *netdev,
 				    int num_packets)
 {
-	char buf[1];
+	char buf[sizeof(struct virtio_net_hdr) + 1];
+	int len = netdev->vnet_hdr ? sizeof(buf) : 1;
 	int i = 0, in_bytes = 0;
 
 	for (i = 0; i < num_packets; ++i) {
-		in_bytes = read(netdev->tun_fd, buf, sizeof(buf));
-		assert(in_bytes <= (int)sizeof(buf));
+		int fd = netdev->tun_fd;
+
+		/* The kernel picks the tx queue, so read from any queue
+		 * with a packet waiting.
+		 */
+		if (netdev->num_queues > 1)
+			fd = local_netdev_ready_queue_fd(netdev);
+		in_bytes = read(fd, buf, len);
+		assert(in_bytes <= len);
 
 		if (in_bytes < 0) {
 			if (errno == EINTR)
@@ -412,26 +755,97 @@ static void local_netdev_read_queue(struct local_netdev *netdev,
        }
 }
 
-static int local_netdev_receive(struct netdev *a_netdev,
-				struct packet **packet, char **error)
+/* Return the next packet to leave the outbound link by the deadline,
+ * or OK with a NULL packet if none does. The kernel's packets enter
+ * the link as we sniff them, so we keep sniffing while we wait for the
+ * next one to leave.
+ */
+static int local_netdev_receive_link(struct local_netdev *netdev,
+				     s64 deadline_usecs,
+				     struct packet **packet, char **error)
+{
+	while (1) {
+		struct packet *sniffed = NULL;
+		s64 wait_usecs = deadline_usecs;
+		s64 exit_nsecs = 0;
+		int num_packets = 0;
+		int status = STATUS_ERR;
+
+		*packet = link_dequeue(netdev->outbound_link, now_nsecs());
+		if (*packet != NULL)
+			return STATUS_OK;
+		if (deadline_usecs != NO_DEADLINE &&
+		    now_usecs() >= deadline_usecs)
+			return STATUS_OK;	/* timed out */
+
+		exit_nsecs = link_next_exit_nsecs(netdev->outbound_link);
+		if (exit_nsecs >= 0) {
+			s64 exit_usecs = (exit_nsecs + 999) / 1000;
+
+			if (wait_usecs == NO_DEADLINE || exit_usecs < wait_usecs)
+				wait_usecs = exit_usecs;
+		}
+		status = netdev_receive_loop_by(netdev->psock,
+						DIRECTION_OUTBOUND,
+						wait_usecs, &sniffed,
+						&num_packets, error);
+		local_netdev_read_queue(netdev, num_packets);
+		if (status != STATUS_OK)
+			return status;
+		if (sniffed != NULL) {
+			s64 enter_nsecs = sniffed->time_usecs * 1000;
+
+			if (enter_nsecs == 0)
+				enter_nsecs = now_nsecs();
+			link_enqueue(netdev->outbound_link, sniffed,
+				     enter_nsecs);
+		}
+	}
+}
+
+static int local_netdev_receive_by(struct netdev *a_netdev,
+				   s64 deadline_usecs,
+				   struct packet **packet, char **error)
 {
 	struct local_netdev *netdev = to_local_netdev(a_netdev);
 	int status = STATUS_ERR;
 	int num_packets = 0;
 
-	DEBUGP("local_netdev_receive\n");
+	if (netdev->outbound_link != NULL)
+		return local_netdev_receive_link(netdev, deadline_usecs,
+						 packet, error);
 
-	status = netdev_receive_loop(netdev->psock, DIRECTION_OUTBOUND, packet,
-				     &num_packets, error);
+	status = netdev_receive_loop_by(netdev->psock, DIRECTION_OUTBOUND,
+					deadline_usecs, packet,
+					&num_packets, error);
 	local_netdev_read_queue(netdev, num_packets);
 	return status;
 }
 
+static int local_netdev_receive(struct netdev *a_netdev,
+				struct packet **packet, char **error)
+{
+	DEBUGP("local_netdev_receive\n");
+
+	return local_netdev_receive_by(a_netdev, NO_DEADLINE, packet, error);
+}
+
 int netdev_receive_loop(struct packet_socket *psock,
 			enum direction_t direction,
 			struct packet **packet,
 			int *num_packets,
 			char **error)
+{
+	return netdev_receive_loop_by(psock, direction, NO_DEADLINE, packet,
+				      num_packets, error);
+}
+
+int netdev_receive_loop_by(struct packet_socket *psock,
+			   enum direction_t direction,
+			   s64 deadline_usecs,
+			   struct packet **packet,
+			   int *num_packets,
+			   char **error)
 {
 	u16 ether_type;
 
@@ -442,14 +856,29 @@ int netdev_receive_loop(struct packet_socket *psock,
 		int in_bytes = 0;
 		enum packet_parse_result_t result;
 
+		if (deadline_usecs != NO_DEADLINE) {
+			s64 wait_usecs = deadline_usecs - now_usecs();
+
+			if (wait_usecs <= 0)
+				return STATUS_OK;	/* timed out */
+			if (!packet_socket_wait(psock, direction,
+						wait_usecs))
+				continue;
+		}
+
 		*packet = packet_new(PACKET_READ_BYTES);
 
 		/* Sniff the next outbound packet from the kernel under test. */
 		if (packet_socket_receive(psock, direction, &ether_type,
-					  *packet, &in_bytes))
+					  *packet, &in_bytes)) {
+			packet_free(*packet);
+			*packet = NULL;
 			continue;
+		}
 
 		++*num_packets;
+		capture_packet(direction, (*packet)->buffer, in_bytes,
+			       (*packet)->time_usecs);
 		result = parse_packet(*packet, in_bytes, ether_type, error);
 
 		if (result == PACKET_OK)
@@ -473,4 +902,5 @@ struct netdev_ops local_netdev_ops = {
 	.free = local_netdev_free,
 	.send = local_netdev_send,
 	.receive = local_netdev_receive,
+	.receive_by = local_netdev_receive_by,
 };
@@ -35,6 +35,8 @@
 
 struct netdev_ops;
 
+#define NO_DEADLINE	-1	/* deadline_usecs for waiting forever */
+
 /* A C-style poor-man's "pure virtual" netdev. */
 struct netdev {
 	struct netdev_ops *ops;	/* C-style vtable pointer */
@@ -54,6 +56,12 @@ struct netdev_ops {
 	 */
 	int (*receive)(struct netdev *netdev,
 		       struct packet **packet, char **error);
+
+	/* Like receive, but give up at the given wall time, in which case
+	 * return STATUS_OK with *packet NULL. Optional.
+	 */
+	int (*receive_by)(struct netdev *netdev, s64 deadline_usecs,
+			  struct packet **packet, char **error);
 };
 
 
@@ -81,6 +89,22 @@ static inline int netdev_receive(struct netdev *netdev,
 	return netdev->ops->receive(netdev, packet, error);
 }
 
+/* Sniff the next TCP/IP packet leaving the kernel, waiting no later
+ * than the given wall time. On timeout returns STATUS_OK with *packet
+ * NULL. Caller must free any packet with packet_free().
+ */
+static inline int netdev_receive_by(struct netdev *netdev,
+				    s64 deadline_usecs,
+				    struct packet **packet,
+				    char **error)
+{
+	if (netdev->ops->receive_by == NULL) {
+		asprintf(error, "timed receive not supported by this netdev");
+		return STATUS_ERR;
+	}
+	return netdev->ops->receive_by(netdev, deadline_usecs, packet, error);
+}
+
 
 /* Keep sniffing packets leaving the kernel until we see one we know
  * about and can parse. Return a pointer to the newly-allocated
@@ -92,6 +116,16 @@ extern int netdev_receive_loop(struct packet_socket *psock,
 			       int *num_packets,
 			       char **error);
 
+/* Like netdev_receive_loop(), but give up at the given wall time, in
+ * which case return STATUS_OK with *packet NULL.
+ */
+extern int netdev_receive_loop_by(struct packet_socket *psock,
+				  enum direction_t direction,
+				  s64 deadline_usecs,
+				  struct packet **packet,
+				  int *num_packets,
+				  char **error);
+
 /* Allocate and return a new netdev for purely local tests. */
 extern struct netdev *local_netdev_new(struct config *config);
 
@@ -0,0 +1,387 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of --offline_pcap.
+ *
+ * We run the script's events through the usual interpreter state, but
+ * with a netdev that never sees a packet, and with the recorded packets
+ * standing in for the ones we would sniff. As in a live run, inbound
+ * and outbound packets are matched up with script packets in order,
+ * separately for each direction.
+ *
+ * Live runs measure time from the wall clock; here time is measured by
+ * the recorded timestamps. We anchor the start of the script so that
+ * the first packet event happens when its recorded packet did, and
+ * start relative event times from the script time of the last recorded
+ * packet or event we handled.
+ *
+ * We only know about the one TCP or UDP connection whose endpoints we
+ * find in the first recorded packet that looks like the first script
+ * packet. Without system calls, we learn the ISNs from the SYNs.
+ */
+
+#include "offline.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+#include "netdev.h"
+#include "pcap_reader.h"
+#include "run.h"
+#include "run_packet.h"
+#include "socket.h"
+
+/* The state of an offline verification. */
+struct offline {
+	struct config *config;
+	struct state *state;
+	struct socket *socket;		/* the connection under test */
+	struct packet **packets;	/* recorded packets, in order */
+	int num_packets;
+	int next_inbound;		/* index of next recorded inbound */
+	int next_outbound;		/* index of next recorded outbound */
+	s64 script_now_usecs;		/* script time we've reached */
+	bool anchored;			/* live_start_time_usecs set yet? */
+};
+
+static void offline_netdev_free(struct netdev *netdev)
+{
+	free(netdev);
+}
+
+/* Packets we'd inject (e.g. the RST in close_all_sockets()) go nowhere. */
+static int offline_netdev_send(struct netdev *netdev, struct packet *packet)
+{
+	return STATUS_OK;
+}
+
+static int offline_netdev_receive(struct netdev *netdev,
+				  struct packet **packet, char **error)
+{
+	asprintf(error, "no live packets in offline mode");
+	return STATUS_ERR;
+}
+
+static struct netdev_ops offline_netdev_ops = {
+	.free = offline_netdev_free,
+	.send = offline_netdev_send,
+	.receive = offline_netdev_receive,
+};
+
+static struct netdev *offline_netdev_new(void)
+{
+	struct netdev *netdev = calloc(1, sizeof(struct netdev));
+
+	netdev->ops = &offline_netdev_ops;
+	return netdev;
+}
+
+/* Read all the IP packets in the capture file. */
+static void offline_read_packets(struct offline *offline)
+{
+	const char *path = offline->config->offline_path;
+	struct pcap_reader *reader = NULL;
+	struct packet *packet = NULL;
+	enum direction_t direction = DIRECTION_INVALID;
+	int max_packets = 0;
+	char *error = NULL;
+
+	reader = pcap_reader_open(path, &error);
+	if (reader == NULL)
+		die("--offline_pcap: %s\n", error);
+
+	while (pcap_reader_next(reader, &packet, &direction, &error) ==
+	       STATUS_OK) {
+		if (offline->num_packets == max_packets) {
+			max_packets = max_packets ? 2 * max_packets : 1024;
+			offline->packets =
+				realloc(offline->packets,
+					max_packets * sizeof(struct packet *));
+		}
+		packet->direction = direction;
+		offline->packets[offline->num_packets++] = packet;
+	}
+	if (error != NULL)
+		die("--offline_pcap: %s\n", error);
+	if (pcap_reader_skipped(reader) > 0) {
+		fprintf(stderr, "--offline_pcap: skipped %llu IP packets of "
+			"%s, so script packets may be paired with the wrong "
+			"recorded packets\n", pcap_reader_skipped(reader),
+			path);
+	}
+	pcap_reader_free(reader);
+	DEBUGP("--offline_pcap: read %d packets from %s\n",
+	       offline->num_packets, path);
+}
+
+static struct event *first_packet_event(struct script *script)
+{
+	struct event *event = NULL;
+
+	for (event = script->event_list; event != NULL; event = event->next) {
+		if (event->type == PACKET_EVENT)
+			return event;
+	}
+	return NULL;
+}
+
+/* Could the recorded packet be the given script packet, judging by
+ * the headers that identify the connection and its first packet?
+ */
+static bool is_recorded_match(const struct packet *recorded,
+			      const struct packet *script_packet)
+{
+	const enum direction_t direction = packet_direction(script_packet);
+
+	if (recorded->direction != DIRECTION_INVALID &&
+	    recorded->direction != direction)
+		return false;
+	if (packet_address_family(recorded) !=
+	    packet_address_family(script_packet) ||
+	    packet_ip_protocol(recorded) != packet_ip_protocol(script_packet))
+		return false;
+	if (script_packet->tcp != NULL) {
+		return (recorded->tcp != NULL &&
+			recorded->tcp->syn == script_packet->tcp->syn &&
+			recorded->tcp->ack == script_packet->tcp->ack &&
+			recorded->tcp->rst == script_packet->tcp->rst &&
+			recorded->tcp->fin == script_packet->tcp->fin);
+	}
+	return script_packet->udp != NULL && recorded->udp != NULL;
+}
+
+/* Find the connection under test in the capture, from the first packet
+ * that looks like the first script packet, and set up its socket.
+ */
+static void offline_new_socket(struct offline *offline,
+			       struct packet *script_packet)
+{
+	const enum direction_t direction = packet_direction(script_packet);
+	struct socket *socket = NULL;
+	struct packet *recorded = NULL;
+	struct tuple script_tuple, live_tuple;
+	int i;
+
+	if (script_packet->tcp == NULL && script_packet->udp == NULL)
+		die("%s: --offline_pcap only supports TCP and UDP scripts\n",
+		    offline->config->script_path);
+
+	for (i = 0; i < offline->num_packets; ++i) {
+		if (is_recorded_match(offline->packets[i], script_packet)) {
+			recorded = offline->packets[i];
+			break;
+		}
+	}
+	if (recorded == NULL)
+		die("%s: no packet in %s looks like the first script packet\n",
+		    offline->config->script_path,
+		    offline->config->offline_path);
+
+	socket = socket_new(offline->state);
+	offline->state->socket_under_test = socket;
+	offline->socket = socket;
+	socket->state = (direction == DIRECTION_INBOUND ?
+			 SOCKET_PASSIVE_PACKET_RECEIVED :
+			 SOCKET_ACTIVE_CONNECTING);
+	socket->address_family = packet_address_family(script_packet);
+	socket->protocol = packet_ip_protocol(script_packet);
+
+	get_packet_tuple(script_packet, &script_tuple);
+	get_packet_tuple(recorded, &live_tuple);
+	if (direction == DIRECTION_INBOUND) {
+		socket->script.local	= script_tuple.dst;
+		socket->script.remote	= script_tuple.src;
+		socket->live.local	= live_tuple.dst;
+		socket->live.remote	= live_tuple.src;
+	} else {
+		socket->script.local	= script_tuple.src;
+		socket->script.remote	= script_tuple.dst;
+		socket->live.local	= live_tuple.src;
+		socket->live.remote	= live_tuple.dst;
+	}
+	socket->script.fd	= -1;
+	socket->live.fd		= -1;
+}
+
+/* Return the direction of the recorded packet relative to the
+ * connection under test, or DIRECTION_INVALID if it's not part of it.
+ */
+static enum direction_t recorded_direction(struct offline *offline,
+					   const struct packet *packet)
+{
+	struct tuple tuple, outbound, inbound;
+
+	if (packet_ip_protocol(packet) != offline->socket->protocol)
+		return DIRECTION_INVALID;
+	get_packet_tuple(packet, &tuple);
+	socket_get_outbound(&offline->socket->live, &outbound);
+	socket_get_inbound(&offline->socket->live, &inbound);
+	if (is_equal_tuple(&tuple, &outbound))
+		return DIRECTION_OUTBOUND;
+	if (is_equal_tuple(&tuple, &inbound))
+		return DIRECTION_INBOUND;
+	return DIRECTION_INVALID;
+}
+
+/* Return the next recorded packet of the connection in the given
+ * direction, or NULL if there are no more.
+ */
+static struct packet *next_recorded_packet(struct offline *offline,
+					   enum direction_t direction)
+{
+	int *next = (direction == DIRECTION_INBOUND ?
+		     &offline->next_inbound : &offline->next_outbound);
+
+	while (*next < offline->num_packets) {
+		struct packet *packet = offline->packets[(*next)++];
+
+		if (recorded_direction(offline, packet) == direction)
+			return packet;
+	}
+	return NULL;
+}
+
+static void offline_packet_event(struct offline *offline,
+				 struct event *event,
+				 struct packet *script_packet)
+{
+	struct state *state = offline->state;
+	struct socket *socket = offline->socket;
+	const enum direction_t direction = packet_direction(script_packet);
+	struct packet *recorded = NULL;
+	char *error = NULL;
+	int result = STATUS_OK;
+
+	if (packet_ip_protocol(script_packet) != socket->protocol) {
+		/* E.g. ICMP, which we don't track. */
+		DEBUGP("%d: skipping packet\n", event->line_number);
+		return;
+	}
+
+	recorded = next_recorded_packet(offline, direction);
+	if (recorded == NULL) {
+		die("%s:%d: error handling packet: no more %s packets in %s\n",
+		    state->config->script_path, event->line_number,
+		    direction == DIRECTION_INBOUND ? "inbound" : "outbound",
+		    state->config->offline_path);
+	}
+
+	if (!offline->anchored) {
+		state->live_start_time_usecs =
+			recorded->time_usecs -
+			(event->time_usecs - state->script_start_time_usecs);
+		offline->anchored = true;
+		DEBUGP("live_start_time_usecs is %lld\n",
+		       state->live_start_time_usecs);
+	}
+
+	if (direction == DIRECTION_INBOUND) {
+		if (script_packet->tcp && script_packet->tcp->syn) {
+			socket->script.remote_isn =
+				ntohl(script_packet->tcp->seq);
+			socket->live.remote_isn = ntohl(recorded->tcp->seq);
+		}
+	} else {
+		result = verify_recorded_packet(state, event, socket,
+						script_packet, recorded,
+						&error);
+		if (result == STATUS_WARN) {
+			fprintf(stderr, "%s", error);
+			free(error);
+		} else if (result == STATUS_ERR) {
+			die("%s", error);
+		}
+	}
+
+	offline->script_now_usecs =
+		live_time_to_script_time_usecs(state, recorded->time_usecs);
+}
+
+static void offline_spacing_event(struct offline *offline,
+				  struct event *event,
+				  const struct spacing_spec *spacing)
+{
+	char *error = NULL;
+	int result = STATUS_OK;
+
+	result = run_spacing_event(offline->state, event, spacing, &error);
+	if (result == STATUS_WARN) {
+		fprintf(stderr, "%s", error);
+		free(error);
+	} else if (result == STATUS_ERR) {
+		die("%s", error);
+	}
+}
+
+void offline_verify_script(struct config *config, struct script *script)
+{
+	struct offline offline;
+	struct event *event = NULL;
+	char *error = NULL;
+
+	DEBUGP("offline_verify_script: verifying %s against %s\n",
+	       config->script_path, config->offline_path);
+
+	memset(&offline, 0, sizeof(offline));
+	offline.config = config;
+	offline_read_packets(&offline);
+
+	event = first_packet_event(script);
+	if (event == NULL)
+		die("%s: no packet events to verify\n", config->script_path);
+
+	offline.state = state_new(config, script, offline_netdev_new());
+	offline_new_socket(&offline, event->event.packet);
+
+	while (1) {
+		if (get_next_event(offline.state, &error))
+			die("%s", error);
+		event = offline.state->event;
+		if (event == NULL)
+			break;
+		if (event == script->event_list)
+			offline.script_now_usecs = event->time_usecs;
+
+		offset_relative_event_times(
+			event, (offline.script_now_usecs -
+				offline.state->script_start_time_usecs));
+
+		if (event->type == PEER_EVENT)
+			die("%s:%d: autopeer phases can't be verified "
+			    "offline\n", offline.config->script_path,
+			    event->line_number);
+
+		/* We can't replay system calls, commands, or code. */
+		if (event->type == PACKET_EVENT)
+			offline_packet_event(&offline, event,
+					     event->event.packet);
+		else if (event->type == SPACING_EVENT)
+			offline_spacing_event(&offline, event,
+					      event->event.spacing);
+		else if (event->time_usecs > offline.script_now_usecs)
+			offline.script_now_usecs = event->time_usecs;
+	}
+
+	state_free(offline.state);
+	while (offline.num_packets > 0)
+		packet_free(offline.packets[--offline.num_packets]);
+	free(offline.packets);
+}
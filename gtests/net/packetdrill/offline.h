@@ -0,0 +1,44 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for --offline_pcap, which verifies a script against the
+ * packets in a capture file instead of running it.
+ */
+
+#ifndef __OFFLINE_H__
+#define __OFFLINE_H__
+
+#include "types.h"
+
+#include "config.h"
+#include "script.h"
+
+/* Check the packets of the script's connection in the capture file at
+ * config->offline_path against the script's packet events, as if we
+ * had sniffed them live: we map and verify the outbound packets'
+ * headers, TCP options, payload, and timing, with the capture's
+ * timestamps as the live times, and use the inbound packets to learn
+ * the remote ISN and advance the clock. Nothing is injected, no system
+ * calls are made, and nothing waits, so this runs at CPU speed. As
+ * with run_script(), on failure we print an error and exit.
+ */
+extern void offline_verify_script(struct config *config,
+				  struct script *script);
+
+#endif /* __OFFLINE_H__ */
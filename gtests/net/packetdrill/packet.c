@@ -31,6 +31,7 @@
 #include "ethernet.h"
 #include "gre_packet.h"
 #include "ip_packet.h"
+#include "logging.h"
 #include "mpls_packet.h"
 #include "sctp_packet.h"
 
@@ -59,9 +60,22 @@ struct packet *packet_new(u32 buffer_bytes)
 	return packet;
 }
 
+void packet_grow(struct packet *packet, u32 buffer_bytes)
+{
+	assert(packet->ip_bytes == 0);	/* no pointers into buffer yet */
+	if (buffer_bytes <= packet->buffer_bytes)
+		return;
+	packet->buffer = realloc(packet->buffer, buffer_bytes);
+	if (packet->buffer == NULL)
+		die("unable to grow packet buffer to %u bytes\n",
+		    buffer_bytes);
+	packet->buffer_bytes = buffer_bytes;
+}
+
 void packet_free(struct packet *packet)
 {
 	sctp_chunk_list_free(packet->chunk_list);
+	free(packet->tcp_template);
 	free(packet->buffer);
 	memset(packet, 0, sizeof(*packet));  /* paranoia to help catch bugs */
 	free(packet);
@@ -144,7 +158,7 @@ static struct packet *packet_copy_with_headroom(struct packet *old_packet,
 	/* Allocate a new packet and copy link layer header and IP datagram. */
 	const int bytes_used = packet_end(old_packet) - old_packet->buffer;
 	assert(bytes_used >= 0);
-	assert(bytes_used <= 128*1024);
+	assert(bytes_used <= MAX_PACKET_BYTES);
 	struct packet *packet = packet_new(max(bytes_headroom + bytes_used, old_packet->buffer_bytes));
 	u8 *old_base = old_packet->buffer;
 	u8 *new_base = packet->buffer + bytes_headroom;
@@ -161,6 +175,9 @@ static struct packet *packet_copy_with_headroom(struct packet *old_packet,
 	packet->time_usecs	= old_packet->time_usecs;
 	packet->flags		= old_packet->flags;
 	packet->ecn		= old_packet->ecn;
+	packet->gso_size	= old_packet->gso_size;
+	packet->queue		= old_packet->queue;
+	packet->captured_bytes	= old_packet->captured_bytes;
 
 	packet_copy_headers(packet, old_packet, bytes_headroom);
 
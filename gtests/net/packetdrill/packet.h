@@ -47,16 +47,27 @@
  */
 #define MAX_TCP_HEADER_BYTES (15*4)
 
-#define MAX_TCP_DATAGRAM_BYTES (64*1024)	/* for sanity-checking */
+/* Linux BIG TCP builds TCP GSO super-packets of up to GSO_MAX_SIZE
+ * (512KB). The IP length field of such a packet cannot hold its
+ * length, so an IPv4 super-packet has a tot_len of 0 and an IPv6 one a
+ * payload_len of 0 (with or without an RFC 2675 jumbo payload option),
+ * and the packet instead extends to the end of the buffer holding it.
+ */
+#define MAX_TCP_DATAGRAM_BYTES (512*1024)	/* for sanity-checking */
 #define MAX_SCTP_DATAGRAM_BYTES (64*1024)	/* for sanity-checking */
 #define MAX_UDP_DATAGRAM_BYTES (64*1024)	/* for sanity-checking */
 #define MAX_UDPLITE_DATAGRAM_BYTES (64*1024)	/* for sanity-checking */
 
-/* We allow reading pretty big packets, since some interface MTUs can
- * be pretty big (the Linux loopback MTU, for example, is typically
- * around 16KB).
+/* Largest IP datagram whose length fits in the IP header length field. */
+#define MAX_IP_LENGTH_FIELD_BYTES 0xffff
+
+/* Initial buffer size for sniffed packets, which fits the default tun
+ * MTU. Since interface MTUs can be pretty big (the Linux loopback MTU,
+ * for example, is typically around 16KB) and GSO packets bigger still,
+ * the receive path grows the buffer with packet_grow() as needed, up to
+ * MAX_PACKET_BYTES.
  */
-static const int PACKET_READ_BYTES = 64 * 1024;
+static const int PACKET_READ_BYTES = 2 * 1024;
 
 /* Maximum number of headers. */
 #define PACKET_MAX_HEADERS	6
@@ -64,6 +75,9 @@ static const int PACKET_READ_BYTES = 64 * 1024;
 /* Maximum number of bytes of headers. */
 #define PACKET_MAX_HEADER_BYTES	256
 
+/* Maximum number of bytes of any packet, including encapsulation. */
+#define MAX_PACKET_BYTES	(MAX_TCP_DATAGRAM_BYTES + PACKET_MAX_HEADER_BYTES)
+
 /* TCP/UDP/IPv4 packet, including IPv4 header, TCP/UDP header, and data. There
  * may also be a link layer header between the 'buffer' and 'ip'
  * pointers, but we typically ignore that. The 'buffer_bytes' field
@@ -108,16 +122,32 @@ struct packet {
 	u32 flags;		/* various meta-flags */
 #define FLAG_WIN_NOCHECK	0x1  /* don't check TCP receive window */
 #define FLAG_OPTIONS_NOCHECK	0x2  /* don't check TCP options */
+#define FLAG_CSUM_PARTIAL	0x4  /* L4 csum left to receiver (NEEDS_CSUM) */
+
+	u16 gso_size;		/* GSO segment size of super-packet, or 0 */
+	u16 queue;		/* tun queue to inject inbound packet on */
+	u32 captured_bytes;	/* bytes of IP datagram read from a capture
+				 * truncated by its snap length, or 0 */
 
 	enum ip_ecn_t ecn;	/* IPv4/IPv6 ECN treatment for packet */
 
 	__be32 *tcp_ts_val;	/* location of TCP timestamp val, or NULL */
 	__be32 *tcp_ts_ecr;	/* location of TCP timestamp ecr, or NULL */
+
+	/* For outbound script packets: the TCP header fields we expect,
+	 * compiled for a masked compare (see tcp_packet.h), or NULL.
+	 */
+	struct tcp_template *tcp_template;
 };
 
 /* Allocate and initialize a packet. */
 extern struct packet *packet_new(u32 buffer_length);
 
+/* Grow the buffer of a packet that has not been parsed yet so that it
+ * holds at least the given number of bytes.
+ */
+extern void packet_grow(struct packet *packet, u32 buffer_bytes);
+
 /* Free all the memory used by the packet. */
 extern void packet_free(struct packet *packet);
 
@@ -327,6 +357,54 @@ static inline int packet_payload_len(struct packet *packet)
 	return packet_end(packet) - packet_payload(packet);
 }
 
+/* Return the length of the TCP/UDP payload that we have the contents
+ * of. This is less than packet_payload_len() for a packet read from a
+ * capture truncated by its snap length, whose missing bytes are zero.
+ */
+static inline int packet_captured_payload_len(struct packet *packet)
+{
+	int len = packet_payload_len(packet);
+	int captured = 0;
+
+	if (packet->captured_bytes == 0)
+		return len;
+	captured = packet_start(packet) + packet->captured_bytes -
+		   packet_payload(packet);
+	return captured < len ? captured : len;
+}
+
+/* Return the bytes of layer 4 header, options, and payload carried by
+ * the given IPv4 header of the packet. For BIG TCP super-packets, which
+ * have a tot_len of 0, these extend to the end of the packet.
+ */
+static inline int packet_ipv4_l4_bytes(struct packet *packet,
+				       const struct ipv4 *ipv4)
+{
+	const u8 *l4_start = (const u8 *) ipv4 + ipv4_header_len(ipv4);
+
+	if (ipv4->tot_len == 0)
+		return packet_end(packet) - l4_start;
+	return ntohs(ipv4->tot_len) - ipv4_header_len(ipv4);
+}
+
+/* Return the bytes of layer 4 header, options, and payload carried by
+ * the given IPv6 header of the packet, excluding any jumbo payload
+ * Hop-by-Hop header. For BIG TCP super-packets, which have a
+ * payload_len of 0, these extend to the end of the packet.
+ */
+static inline int packet_ipv6_l4_bytes(struct packet *packet,
+				       const struct ipv6 *ipv6)
+{
+	const struct ipv6_jumbo_hbh *hbh = NULL;
+
+	if (ipv6->payload_len != 0)
+		return ntohs(ipv6->payload_len);
+	hbh = ipv6_jumbo_hbh(ipv6);
+	if (hbh != NULL)
+		return ntohl(hbh->jumbo_payload_len) - sizeof(*hbh);
+	return packet_end(packet) - (const u8 *) (ipv6 + 1);
+}
+
 /* Return the location of the IP header echoed by an ICMP message. */
 static inline u8 *packet_echoed_ip_header(struct packet *packet)
 {
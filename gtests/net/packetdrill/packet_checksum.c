@@ -41,7 +41,7 @@ static void checksum_ipv4_packet(struct packet *packet)
 	assert(packet->ip_bytes >= ntohs(ipv4->tot_len));
 
 	/* Find the length of layer 4 header, options, and payload. */
-	const int l4_bytes = ntohs(ipv4->tot_len) - ipv4_header_len(ipv4);
+	const int l4_bytes = packet_ipv4_l4_bytes(packet, ipv4);
 	assert(l4_bytes > 0);
 
 	/* Fill in IPv4-based layer 4 checksum. */
@@ -88,11 +88,11 @@ static void checksum_ipv6_packet(struct packet *packet)
 	struct ipv6 *ipv6 = packet->ipv6;
 
 	/* IPv6 has no header checksum. */
-	/* For now we do not support IPv6 extension headers. */
+	/* We support no IPv6 extension headers but the jumbo payload one. */
 	assert(packet->ip_bytes >= sizeof(*ipv6) + ntohs(ipv6->payload_len));
 
 	/* Find the length of layer 4 header, options, and payload. */
-	const int l4_bytes = ntohs(ipv6->payload_len);
+	const int l4_bytes = packet_ipv6_l4_bytes(packet, ipv6);
 	assert(l4_bytes > 0);
 
 	/* Fill in IPv6-based layer 4 checksum. */
@@ -138,6 +138,38 @@ static void checksum_ipv6_packet(struct packet *packet)
 	}
 }
 
+void checksum_packet_partial(struct packet *packet)
+{
+	__be16 *check = NULL;
+	u8 protocol = 0;
+
+	if (packet->tcp != NULL) {
+		check = &packet->tcp->check;
+		protocol = IPPROTO_TCP;
+	} else if (packet->udp != NULL) {
+		check = &packet->udp->check;
+		protocol = IPPROTO_UDP;
+	} else {
+		assert(!"partial checksums are only for TCP or UDP");
+	}
+
+	if (packet->ipv4 != NULL) {
+		struct ipv4 *ipv4 = packet->ipv4;
+		const int l4_bytes = packet_ipv4_l4_bytes(packet, ipv4);
+
+		*check = tcp_udp_v4_pseudo_header_checksum(ipv4->src_ip,
+							   ipv4->dst_ip,
+							   protocol, l4_bytes);
+	} else {
+		struct ipv6 *ipv6 = packet->ipv6;
+		const int l4_bytes = packet_ipv6_l4_bytes(packet, ipv6);
+
+		*check = tcp_udp_v6_pseudo_header_checksum(&ipv6->src_ip,
+							   &ipv6->dst_ip,
+							   protocol, l4_bytes);
+	}
+}
+
 void checksum_packet(struct packet *packet)
 {
 	int address_family = packet_address_family(packet);
@@ -30,4 +30,10 @@
 /* Fill in layer 3 and layer 4 checksums for the given input 'packet'. */
 extern void checksum_packet(struct packet *packet);
 
+/* Replace the TCP or UDP checksum of the given 'packet' with the
+ * pseudo-header checksum, for a receiver that completes the checksum
+ * itself (VIRTIO_NET_HDR_F_NEEDS_CSUM).
+ */
+extern void checksum_packet_partial(struct packet *packet);
+
 #endif /* __PACKET_CHECKSUM_H__ */
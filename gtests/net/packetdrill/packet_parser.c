@@ -190,7 +190,12 @@ static int parse_ipv4(struct packet *packet, u8 *header_start, u8 *packet_end,
 		asprintf(error, "Full IP header overflows packet");
 		goto error_out;
 	}
-	const int ip_total_bytes = ntohs(ipv4->tot_len);
+	int ip_total_bytes = ntohs(ipv4->tot_len);
+
+	/* A BIG TCP super-packet has a tot_len of 0 and runs to the end. */
+	if (ip_total_bytes == 0 &&
+	    packet_end - p > MAX_IP_LENGTH_FIELD_BYTES)
+		ip_total_bytes = packet_end - p;
 
 	if (p + ip_total_bytes > packet_end) {
 		asprintf(error, "IP payload overflows packet");
@@ -262,8 +267,9 @@ error_out:
 }
 
 /* Parse the IPv6 header and the TCP header inside. We do not
- * currently support parsing IPv6 extension headers or any layer 4
- * protocol other than TCP. Return a packet_parse_result_t.
+ * currently support parsing IPv6 extension headers other than the
+ * jumbo payload Hop-by-Hop header of BIG TCP super-packets. Return a
+ * packet_parse_result_t.
  * Note that packet_end points to the byte beyond the end of packet.
  */
 static int parse_ipv6(struct packet *packet, u8 *header_start, u8 *packet_end,
@@ -277,15 +283,49 @@ static int parse_ipv6(struct packet *packet, u8 *header_start, u8 *packet_end,
 	enum packet_parse_result_t result = PACKET_BAD;
 
 	/* Check that header fits in sniffed packet. */
-	const int ip_header_bytes = sizeof(*ipv6);
+	int ip_header_bytes = sizeof(*ipv6);
 	if (p + ip_header_bytes > packet_end) {
 		asprintf(error, "IPv6 header overflows packet");
 		goto error_out;
 	}
 
 	/* Check that payload fits in sniffed packet. */
-	const int ip_total_bytes = (ip_header_bytes +
-				    ntohs(ipv6->payload_len));
+	int ip_total_bytes = (ip_header_bytes + ntohs(ipv6->payload_len));
+	int layer4_protocol = ipv6->next_header;
+
+	/* A BIG TCP super-packet has a payload_len of 0, and either an
+	 * RFC 2675 jumbo payload Hop-by-Hop header, which we treat as part
+	 * of the IPv6 header, or nothing and runs to the end.
+	 */
+	if (ipv6->payload_len == 0 && ipv6->next_header == IPPROTO_HOPOPTS) {
+		const struct ipv6_jumbo_hbh *hbh = NULL;
+		u32 jumbo_bytes;
+
+		if (p + ip_header_bytes + sizeof(*hbh) > packet_end) {
+			asprintf(error, "IPv6 Hop-by-Hop header overflows "
+				 "packet");
+			goto error_out;
+		}
+		hbh = ipv6_jumbo_hbh(ipv6);
+		if (hbh == NULL) {
+			asprintf(error, "IPv6 Hop-by-Hop header is not a "
+				 "jumbo payload option");
+			goto error_out;
+		}
+		jumbo_bytes = ntohl(hbh->jumbo_payload_len);
+		if (jumbo_bytes <= MAX_IP_LENGTH_FIELD_BYTES ||
+		    jumbo_bytes > MAX_PACKET_BYTES) {
+			asprintf(error, "Bad IPv6 jumbo payload length %u",
+				 jumbo_bytes);
+			goto error_out;
+		}
+		ip_header_bytes += sizeof(*hbh);
+		ip_total_bytes = sizeof(*ipv6) + jumbo_bytes;
+		layer4_protocol = hbh->next_header;
+	} else if (ipv6->payload_len == 0 &&
+		   packet_end - p > sizeof(*ipv6) + MAX_IP_LENGTH_FIELD_BYTES) {
+		ip_total_bytes = packet_end - p;
+	}
 
 	if (p + ip_total_bytes > packet_end) {
 		asprintf(error, "IPv6 payload overflows packet");
@@ -316,7 +356,6 @@ static int parse_ipv6(struct packet *packet, u8 *header_start, u8 *packet_end,
 
 	/* Examine the L4 header. */
 	const int layer4_bytes = ip_total_bytes - ip_header_bytes;
-	const int layer4_protocol = ipv6->next_header;
 	result = parse_layer4(packet, p, layer4_protocol, layer4_bytes,
 			      packet_end, &is_inner, error);
 
@@ -22,7 +22,9 @@
  * Test for parsing IP packets.
  */
 
+#include "checksum.h"
 #include "ethernet.h"
+#include "packet_checksum.h"
 #include "packet_parser.h"
 
 #include <assert.h>
@@ -664,6 +666,113 @@ static void test_parse_icmpv6_packet(void)
 	packet_free(packet);
 }
 
+/* Number of TCP payload bytes in our BIG TCP super-packets. */
+#define BIG_TCP_PAYLOAD_BYTES (200*1000)
+
+static void test_parse_big_tcp_ipv4_packet(void)
+{
+	/* A BIG TCP/IPv4 super-packet, whose tot_len is 0. */
+	const int ip_bytes = (sizeof(struct ipv4) + sizeof(struct tcp) +
+			      BIG_TCP_PAYLOAD_BYTES);
+	struct packet *packet = packet_new(ip_bytes);
+	struct ipv4 *ipv4 = (struct ipv4 *)(packet->buffer);
+	struct tcp *tcp = (struct tcp *)(ipv4 + 1);
+
+	memset(packet->buffer, 0, ip_bytes);
+	ipv4->version = 4;
+	ipv4->ihl = sizeof(*ipv4) / sizeof(u32);
+	ipv4->tot_len = 0;
+	ipv4->ttl = 255;
+	ipv4->protocol = IPPROTO_TCP;
+	ipv4->check = ipv4_checksum(ipv4, sizeof(*ipv4));
+	tcp->doff = sizeof(*tcp) / sizeof(u32);
+
+	/* Parse the packet */
+	char *error = NULL;
+	enum packet_parse_result_t result =
+		parse_packet(packet, ip_bytes, ETHERTYPE_IP, &error);
+	assert(result == PACKET_OK);
+	assert(error == NULL);
+
+	assert(packet->ip_bytes		== ip_bytes);
+	assert(packet->ipv4		== ipv4);
+	assert(packet->ipv6		== NULL);
+	assert(packet->tcp		== tcp);
+	assert(packet_payload_len(packet) == BIG_TCP_PAYLOAD_BYTES);
+
+	/* The TCP checksum covers the full super-packet. */
+	checksum_packet(packet);
+	assert(tcp_udp_v4_checksum(ipv4->src_ip, ipv4->dst_ip, IPPROTO_TCP,
+				   tcp, ip_bytes - sizeof(*ipv4)) == 0);
+
+	packet_free(packet);
+
+	/* A tot_len of 0 is bad for a packet that is not that big. */
+	packet = packet_new(sizeof(*ipv4) + sizeof(*tcp));
+	memset(packet->buffer, 0, packet->buffer_bytes);
+	ipv4 = (struct ipv4 *)(packet->buffer);
+	ipv4->version = 4;
+	ipv4->ihl = sizeof(*ipv4) / sizeof(u32);
+	ipv4->protocol = IPPROTO_TCP;
+	ipv4->check = ipv4_checksum(ipv4, sizeof(*ipv4));
+	result = parse_packet(packet, packet->buffer_bytes, ETHERTYPE_IP,
+			      &error);
+	assert(result == PACKET_BAD);
+	free(error);
+	packet_free(packet);
+}
+
+static void test_parse_big_tcp_ipv6_packet(bool jumbo_hbh)
+{
+	/* A BIG TCP/IPv6 super-packet, whose payload_len is 0, with or
+	 * without an RFC 2675 jumbo payload Hop-by-Hop header.
+	 */
+	const int hbh_bytes = jumbo_hbh ? sizeof(struct ipv6_jumbo_hbh) : 0;
+	const int ip_bytes = (sizeof(struct ipv6) + hbh_bytes +
+			      sizeof(struct tcp) + BIG_TCP_PAYLOAD_BYTES);
+	struct packet *packet = packet_new(ip_bytes);
+	struct ipv6 *ipv6 = (struct ipv6 *)(packet->buffer);
+	struct ipv6_jumbo_hbh *hbh = (struct ipv6_jumbo_hbh *)(ipv6 + 1);
+	struct tcp *tcp = (struct tcp *)((u8 *)(ipv6 + 1) + hbh_bytes);
+
+	memset(packet->buffer, 0, ip_bytes);
+	ipv6->version = 6;
+	ipv6->payload_len = 0;
+	ipv6->hop_limit = 255;
+	if (jumbo_hbh) {
+		ipv6->next_header = IPPROTO_HOPOPTS;
+		hbh->next_header = IPPROTO_TCP;
+		hbh->tlv_type = IPV6_TLV_JUMBO;
+		hbh->tlv_len = sizeof(hbh->jumbo_payload_len);
+		hbh->jumbo_payload_len = htonl(ip_bytes - sizeof(*ipv6));
+	} else {
+		ipv6->next_header = IPPROTO_TCP;
+	}
+	tcp->doff = sizeof(*tcp) / sizeof(u32);
+
+	/* Parse the packet */
+	char *error = NULL;
+	enum packet_parse_result_t result =
+		parse_packet(packet, ip_bytes, ETHERTYPE_IPV6, &error);
+	assert(result == PACKET_OK);
+	assert(error == NULL);
+
+	assert(packet->ip_bytes		== ip_bytes);
+	assert(packet->ipv4		== NULL);
+	assert(packet->ipv6		== ipv6);
+	assert(packet->tcp		== tcp);
+	assert(packet->headers[0].header_bytes == sizeof(*ipv6) + hbh_bytes);
+	assert(packet_payload_len(packet) == BIG_TCP_PAYLOAD_BYTES);
+
+	/* The TCP checksum covers the full super-packet. */
+	checksum_packet(packet);
+	assert(tcp_udp_v6_checksum(&ipv6->src_ip, &ipv6->dst_ip, IPPROTO_TCP,
+				   tcp, ip_bytes - sizeof(*ipv6) - hbh_bytes)
+	       == 0);
+
+	packet_free(packet);
+}
+
 int main(void)
 {
 	test_parse_sctp_ipv4_packet();
@@ -678,5 +787,8 @@ int main(void)
 	test_parse_ipv4_gre_mpls_ipv4_tcp_packet();
 	test_parse_icmpv4_packet();
 	test_parse_icmpv6_packet();
+	test_parse_big_tcp_ipv4_packet();
+	test_parse_big_tcp_ipv6_packet(false);
+	test_parse_big_tcp_ipv6_packet(true);
 	return 0;
 }
@@ -49,6 +49,12 @@ extern void packet_socket_set_filter(
 	const struct ether_addr *client_ether_addr,
 	const struct ip_address *client_live_ip);
 
+/* Ask for a virtio_net_hdr ahead of each sniffed packet, so that
+ * packet_socket_receive() can record the GSO size and partial checksum
+ * state of the packet. Only supported on Linux.
+ */
+extern void packet_socket_set_vnet_hdr(struct packet_socket *psock);
+
 /* Send the given packet using writev. Return STATUS_OK on success,
  * or STATUS_ERR if writev returns an error.
  */
@@ -66,4 +72,12 @@ extern int packet_socket_receive(struct packet_socket *psock,
 				 enum direction_t direction, u16 *ether_type,
 				 struct packet *packet, int *in_bytes);
 
+/* Wait up to the given number of microseconds for a packet to sniff
+ * going in the given direction. Return true if packet_socket_receive()
+ * may now be called without blocking, or false on timeout or signal.
+ */
+extern bool packet_socket_wait(struct packet_socket *psock,
+			       enum direction_t direction,
+			       s64 timeout_usecs);
+
 #endif /* __PACKET_SOCKET_H__ */
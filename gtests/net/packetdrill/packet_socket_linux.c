@@ -27,6 +27,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <net/if.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -40,6 +41,7 @@
 
 #include "ethernet.h"
 #include "logging.h"
+#include "tun.h"
 
 /* Number of bytes to buffer in the packet socket we use for sniffing. */
 static const int PACKET_SOCKET_RCVBUF_BYTES = 2*1024*1024;
@@ -49,6 +51,7 @@ struct packet_socket {
 	char *name;	/* malloc-allocated copy of interface name */
 	int index;	/* interface index from if_nametoindex */
 	bool trim_ethernet_header;
+	bool vnet_hdr;	/* is a virtio_net_hdr ahead of each packet? */
 };
 
 /* Set the receive buffer for a socket to the given size in bytes. */
@@ -183,6 +186,16 @@ void packet_socket_set_filter(struct packet_socket *psock,
 	psock->trim_ethernet_header = true;
 }
 
+void packet_socket_set_vnet_hdr(struct packet_socket *psock)
+{
+	int on = 1;
+
+	if (setsockopt(psock->packet_fd, SOL_PACKET, PACKET_VNET_HDR,
+		       &on, sizeof(on)) < 0)
+		die_perror("setsockopt SOL_PACKET, PACKET_VNET_HDR");
+	psock->vnet_hdr = true;
+}
+
 struct packet_socket *packet_socket_new(const char *device_name)
 {
 	struct packet_socket *psock = calloc(1, sizeof(struct packet_socket));
@@ -218,40 +231,81 @@ int packet_socket_writev(struct packet_socket *psock,
 	return STATUS_OK;
 }
 
+bool packet_socket_wait(struct packet_socket *psock,
+			enum direction_t direction, s64 timeout_usecs)
+{
+	struct pollfd pfd = { .fd = psock->packet_fd, .events = POLLIN };
+	struct timespec timeout;
+	int ready = 0;
+
+	usecs_to_timespec(timeout_usecs, &timeout);
+	ready = ppoll(&pfd, 1, &timeout, NULL);
+	if (ready < 0) {
+		if (errno == EINTR)
+			return false;
+		die_perror("packet socket ppoll()");
+	}
+	return ready > 0;
+}
+
 int packet_socket_receive(struct packet_socket *psock,
 			  enum direction_t direction, u16 *ether_type,
 			  struct packet *packet, int *in_bytes)
 {
 	struct sockaddr_ll from;
+	struct virtio_net_hdr vnet;
 	struct ether_header ether;
-	struct iovec iov[2];
+	struct iovec iov[3];
 	struct msghdr msg;
+	int iovcnt = 0;
+	int prefix_bytes = 0;	/* bytes of metadata ahead of the packet */
 
 	/* Read the packet out of our kernel packet socket buffer. */
 	memset(&from, 0, sizeof(from));
+	if (psock->vnet_hdr) {
+		iov[iovcnt].iov_base = &vnet;
+		iov[iovcnt].iov_len = sizeof(vnet);
+		prefix_bytes += iov[iovcnt++].iov_len;
+	}
 	if (psock->trim_ethernet_header) {
-		iov[0].iov_base = &ether;
-		iov[0].iov_len = sizeof(struct ether_header);
-		iov[1].iov_base = packet->buffer;
-		iov[1].iov_len = packet->buffer_bytes;
-	} else {
-		iov[0].iov_base = packet->buffer;
-		iov[0].iov_len = packet->buffer_bytes;
+		iov[iovcnt].iov_base = &ether;
+		iov[iovcnt].iov_len = sizeof(struct ether_header);
+		prefix_bytes += iov[iovcnt++].iov_len;
 	}
 	msg.msg_name = &from;
 	msg.msg_namelen = (socklen_t)sizeof(struct sockaddr_ll);
 	msg.msg_iov = iov;
-	msg.msg_iovlen = (psock->trim_ethernet_header == 1) ? 2 : 1;
+	msg.msg_iovlen = iovcnt;
 	msg.msg_control = NULL;
 	msg.msg_controllen = 0;
 	msg.msg_flags = 0;
+
+	/* Peek at the full length of the packet, so we can grow the
+	 * buffer for packets too big for it, e.g. BIG TCP super-packets.
+	 */
+	*in_bytes = recvmsg(psock->packet_fd, &msg, MSG_PEEK | MSG_TRUNC);
+	if (*in_bytes < 0) {
+		if (errno == EINTR) {
+			DEBUGP("EINTR\n");
+			return STATUS_ERR;
+		} else {
+			die_perror("packet socket recvmsg(MSG_PEEK)");
+		}
+	}
+	if (*in_bytes > prefix_bytes) {
+		if (*in_bytes - prefix_bytes > MAX_PACKET_BYTES)
+			die("sniffed packet of %d bytes is too big\n",
+			    *in_bytes - prefix_bytes);
+		packet_grow(packet, *in_bytes - prefix_bytes);
+	}
+
+	iov[iovcnt].iov_base = packet->buffer;
+	iov[iovcnt].iov_len = packet->buffer_bytes;
+	msg.msg_iovlen = ++iovcnt;
+	msg.msg_namelen = (socklen_t)sizeof(struct sockaddr_ll);
 	*in_bytes = recvmsg(psock->packet_fd, &msg, 0);
 
-	if (psock->trim_ethernet_header)
-		assert(*in_bytes <=
-		       packet->buffer_bytes + sizeof(struct ether_header));
-	else
-		assert(*in_bytes <= packet->buffer_bytes);
+	assert(*in_bytes <= (int)(packet->buffer_bytes + prefix_bytes));
 	if (*in_bytes < 0) {
 		if (errno == EINTR) {
 			DEBUGP("EINTR\n");
@@ -292,6 +346,19 @@ int packet_socket_receive(struct packet_socket *psock,
 	       (u32)tv.tv_sec, (u32)tv.tv_usec,
 	       packet->time_usecs);
 
+	if (psock->vnet_hdr) {
+		if (*in_bytes < sizeof(vnet)) {
+			DEBUGP("packet does not contain virtio_net_hdr\n");
+			return STATUS_ERR;
+		}
+		*in_bytes -= sizeof(vnet);
+		packet->gso_size = vnet.gso_size;
+		if (vnet.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+			packet->flags |= FLAG_CSUM_PARTIAL;
+		DEBUGP("virtio_net_hdr gso_size = %u flags = 0x%x\n",
+		       vnet.gso_size, vnet.flags);
+	}
+
 	DEBUGP("reported sll_protocol = 0x%04x\n", ntohs(from.sll_protocol));
 	if (psock->trim_ethernet_header) {
 		if (*in_bytes < sizeof(struct ether_header)) {
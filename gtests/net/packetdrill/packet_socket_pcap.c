@@ -27,6 +27,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <net/if.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -53,6 +54,13 @@ struct packet_socket {
 	char pcap_error[PCAP_ERRBUF_SIZE];	/* for libpcap errors */
 	int pcap_offset;  /* offset of packet data in pcap buffer */
 	int data_link;
+
+	/* A packet that packet_socket_wait() found already read into
+	 * the pcap buffer, for packet_socket_receive() to return next.
+	 */
+	struct pcap_pkthdr *pending_header;
+	const u8 *pending_data;
+	pcap_t *pending_pcap;	/* handle the pending packet came from */
 };
 
 #if defined(__OpenBSD__)
@@ -84,9 +92,9 @@ static void packet_socket_setup(struct packet_socket *psock)
 	if (psock->pcap_out == NULL)
 		die_pcap_perror(psock->pcap_out, "pcap_create");
 
-	if (pcap_set_snaplen(psock->pcap_in, PACKET_READ_BYTES) != 0)
+	if (pcap_set_snaplen(psock->pcap_in, MAX_PACKET_BYTES) != 0)
 		die_pcap_perror(psock->pcap_in, "pcap_set_snaplen");
-	if (pcap_set_snaplen(psock->pcap_out, PACKET_READ_BYTES) != 0)
+	if (pcap_set_snaplen(psock->pcap_out, MAX_PACKET_BYTES) != 0)
 		die_pcap_perror(psock->pcap_out, "pcap_set_snaplen");
 
 	if (pcap_activate(psock->pcap_in) != 0)
@@ -189,6 +197,11 @@ void packet_socket_set_filter(struct packet_socket *psock,
 	free(filter_str);
 }
 
+void packet_socket_set_vnet_hdr(struct packet_socket *psock)
+{
+	die("virtio_net_hdr sniffing is not supported on this platform\n");
+}
+
 struct packet_socket *packet_socket_new(const char *device_name)
 {
 	struct packet_socket *psock = calloc(1, sizeof(struct packet_socket));
@@ -244,6 +257,55 @@ int packet_socket_writev(struct packet_socket *psock,
 	return STATUS_OK;
 }
 
+/* Return the handle that sniffs packets going in the given direction. */
+static pcap_t *direction_pcap(struct packet_socket *psock,
+			      enum direction_t direction)
+{
+	if (direction == DIRECTION_INBOUND)
+		return psock->pcap_in;
+	else
+		return psock->pcap_out;
+}
+
+bool packet_socket_wait(struct packet_socket *psock,
+			enum direction_t direction, s64 timeout_usecs)
+{
+	pcap_t *pcap = direction_pcap(psock, direction);
+	struct pollfd pfd = { .fd = -1, .events = POLLIN };
+	int status = 0, ready = 0;
+
+	if (psock->pending_pcap == pcap)
+		return true;
+
+	/* libpcap reads the bpf device a buffer at a time, so there may
+	 * be packets waiting in its buffer that poll() can't see. Look
+	 * for one of those first, without blocking, and keep it.
+	 */
+	if (pcap_setnonblock(pcap, 1, psock->pcap_error) != 0)
+		die("pcap_setnonblock: %s\n", psock->pcap_error);
+	status = pcap_next_ex(pcap, &psock->pending_header,
+			      &psock->pending_data);
+	if (pcap_setnonblock(pcap, 0, psock->pcap_error) != 0)
+		die("pcap_setnonblock: %s\n", psock->pcap_error);
+	if (status == 1) {
+		psock->pending_pcap = pcap;
+		return true;
+	} else if (status == -1) {
+		die_pcap_perror(pcap, "pcap_next_ex");
+	}
+
+	pfd.fd = pcap_get_selectable_fd(pcap);
+	if (pfd.fd < 0)
+		die_pcap_perror(pcap, "pcap_get_selectable_fd");
+	ready = poll(&pfd, 1, (timeout_usecs + 999) / 1000);
+	if (ready < 0) {
+		if (errno == EINTR)
+			return false;
+		die_perror("bpf fd poll()");
+	}
+	return ready > 0;
+}
+
 int packet_socket_receive(struct packet_socket *psock,
 			  enum direction_t direction, u16 *ether_type,
 			  struct packet *packet, int *in_bytes)
@@ -258,10 +320,7 @@ int packet_socket_receive(struct packet_socket *psock,
 	DEBUGP("calling pcap_next_ex() for direction %s\n",
 	       direction == DIRECTION_INBOUND ? "inbound" : "outbound");
 
-	if (direction == DIRECTION_INBOUND)
-		pcap = psock->pcap_in;
-	else
-		pcap = psock->pcap_out;
+	pcap = direction_pcap(psock, direction);
 
 	/* Something about the way we're doing BIOCIMMEDIATE
 	 * causes libpcap to return 0 if there's no packet
@@ -273,6 +332,13 @@ int packet_socket_receive(struct packet_socket *psock,
 	 * here. TODO(ncardwell): fix this.
 	 */
 	while (1) {
+		if (psock->pending_pcap == pcap) {
+			/* Take the packet packet_socket_wait() found. */
+			pkt_header = psock->pending_header;
+			pkt_data = psock->pending_data;
+			psock->pending_pcap = NULL;
+			break;
+		}
 		status = pcap_next_ex(pcap, &pkt_header, &pkt_data);
 		if (status == 1)
 			break;		/* got a packet */
@@ -316,8 +382,6 @@ int packet_socket_receive(struct packet_socket *psock,
 		    "caplen %u != len %u\n",
 		    pkt_header->caplen, pkt_header->len);
 	}
-	assert(pkt_header->len <= packet->buffer_bytes);
-
 	assert(pkt_header->len > psock->pcap_offset);
 	switch (psock->data_link) {
 	case DLT_EN10MB:
@@ -349,6 +413,7 @@ int packet_socket_receive(struct packet_socket *psock,
 	}
 	DEBUGP("ether_type is 0x%04x\n", *ether_type);
 	*in_bytes = pkt_header->len - psock->pcap_offset;
+	packet_grow(packet, *in_bytes);
 	memcpy(packet->buffer, pkt_data + psock->pcap_offset, *in_bytes);
 	return STATUS_OK;
 }
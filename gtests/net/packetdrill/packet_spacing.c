@@ -0,0 +1,255 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for verifying the spacing of outbound packet trains.
+ */
+
+#include "packet_spacing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "open_memstream.h"
+#include "stats.h"
+
+#define MAX_LISTED_GAPS	64	/* gaps we list in an error */
+
+/* What we measured of a train. */
+struct spacing_stats {
+	s64 *sorted_gaps;	/* gaps in usecs, in increasing order */
+	int num_gaps;
+	int num_windows;	/* windows we measured the rate over */
+	double min_rate_bps;	/* lowest rate of any window */
+	double max_rate_bps;	/* highest rate of any window */
+	int max_burst;		/* packets in the largest burst */
+	int max_burst_start;	/* index of first packet in that burst */
+};
+
+static void note_rate(struct spacing_stats *stats, double rate_bps)
+{
+	if (stats->num_windows == 0 || rate_bps < stats->min_rate_bps)
+		stats->min_rate_bps = rate_bps;
+	if (stats->num_windows == 0 || rate_bps > stats->max_rate_bps)
+		stats->max_rate_bps = rate_bps;
+	++stats->num_windows;
+}
+
+/* Measure the rate over each window that starts at a packet and ends
+ * within the train, or over the whole train if there is no window.
+ */
+static void measure_rates(const struct spacing_spec *spec,
+			  const struct train_packet *train, int num_packets,
+			  struct spacing_stats *stats)
+{
+	const s64 last_usecs = train[num_packets - 1].time_usecs;
+	s64 bytes = 0;
+	int i = 0, j = 0;
+
+	if (spec->window_usecs == 0) {
+		const s64 span_usecs = last_usecs - train[0].time_usecs;
+
+		/* The first packet starts the train; the rest fill it. */
+		for (i = 1; i < num_packets; ++i)
+			bytes += train[i].ip_bytes;
+		if (span_usecs > 0)
+			note_rate(stats, bytes * 8 * 1.0e6 / span_usecs);
+		return;
+	}
+
+	for (i = 0; i < num_packets; ++i) {
+		const s64 end_usecs = train[i].time_usecs + spec->window_usecs;
+
+		if (end_usecs > last_usecs)
+			break;
+		for (; j < num_packets && train[j].time_usecs < end_usecs; ++j)
+			bytes += train[j].ip_bytes;
+		note_rate(stats, bytes * 8 * 1.0e6 / spec->window_usecs);
+		bytes -= train[i].ip_bytes;
+	}
+}
+
+static void measure_bursts(const struct spacing_spec *spec,
+			   const struct train_packet *train, int num_packets,
+			   struct spacing_stats *stats)
+{
+	int burst = 1, i = 0;
+
+	stats->max_burst = 1;
+	for (i = 1; i < num_packets; ++i) {
+		const s64 gap = train[i].time_usecs - train[i - 1].time_usecs;
+
+		burst = (gap < spec->burst_gap_usecs) ? burst + 1 : 1;
+		if (burst > stats->max_burst) {
+			stats->max_burst = burst;
+			stats->max_burst_start = i + 1 - burst;
+		}
+	}
+}
+
+static void measure_spacing(const struct spacing_spec *spec,
+			    const struct train_packet *train, int num_packets,
+			    struct spacing_stats *stats)
+{
+	int i = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->num_gaps = num_packets - 1;
+	stats->sorted_gaps = calloc(stats->num_gaps, sizeof(s64));
+	for (i = 0; i < stats->num_gaps; ++i) {
+		stats->sorted_gaps[i] =
+			train[i + 1].time_usecs - train[i].time_usecs;
+	}
+	sort_s64(stats->sorted_gaps, stats->num_gaps);
+	measure_rates(spec, train, num_packets, stats);
+	measure_bursts(spec, train, num_packets, stats);
+}
+
+static s64 gap_percentile(const struct spacing_stats *stats, int percent)
+{
+	return percentile_s64(stats->sorted_gaps, stats->num_gaps, percent);
+}
+
+/* Print what we measured of the train, so a failure shows the whole
+ * distribution and not just the limit it broke.
+ */
+static void print_spacing(FILE *s, const struct spacing_spec *spec,
+			  const struct train_packet *train, int num_packets,
+			  const struct spacing_stats *stats)
+{
+	int i = 0;
+
+	fprintf(s, "gaps (usecs): min %lld p10 %lld p50 %lld p90 %lld "
+		"max %lld\n",
+		(long long)stats->sorted_gaps[0],
+		(long long)gap_percentile(stats, 10),
+		(long long)gap_percentile(stats, 50),
+		(long long)gap_percentile(stats, 90),
+		(long long)stats->sorted_gaps[stats->num_gaps - 1]);
+	fprintf(s, "gaps in order (usecs):");
+	for (i = 1; i < num_packets && i <= MAX_LISTED_GAPS; ++i) {
+		fprintf(s, " %lld", (long long)(train[i].time_usecs -
+						train[i - 1].time_usecs));
+	}
+	fprintf(s, "%s\n", num_packets - 1 > MAX_LISTED_GAPS ? " ..." : "");
+	if (stats->num_windows == 0)
+		fprintf(s, "rate: no windows fit in the train\n");
+	else if (spec->window_usecs == 0)
+		fprintf(s, "rate over train: %.0f bits/sec\n",
+			stats->min_rate_bps);
+	else
+		fprintf(s, "rate over %d windows of %.6f sec: "
+			"min %.0f max %.0f bits/sec\n",
+			stats->num_windows, usecs_to_secs(spec->window_usecs),
+			stats->min_rate_bps, stats->max_rate_bps);
+	fprintf(s, "largest burst: %d packets, starting at %.6f "
+		"(gaps under %lld usecs)",
+		stats->max_burst,
+		usecs_to_secs(train[stats->max_burst_start].time_usecs),
+		(long long)spec->burst_gap_usecs);
+}
+
+/* Describe the first limit the train breaks, if any. */
+static bool spacing_failure(FILE *s, const struct spacing_spec *spec,
+			    const struct train_packet *train,
+			    int num_packets,
+			    const struct spacing_stats *stats)
+{
+	int i = 0;
+
+	for (i = 1; i < num_packets; ++i) {
+		const s64 gap = train[i].time_usecs - train[i - 1].time_usecs;
+		const char *limit = NULL;
+		s64 limit_usecs = 0;
+
+		if (spec->min_gap_usecs > 0 && gap < spec->min_gap_usecs) {
+			limit = "below min_gap";
+			limit_usecs = spec->min_gap_usecs;
+		} else if (spec->max_gap_usecs > 0 &&
+			   gap > spec->max_gap_usecs) {
+			limit = "above max_gap";
+			limit_usecs = spec->max_gap_usecs;
+		}
+		if (limit != NULL) {
+			fprintf(s, "gap of %lld usecs between packets %d and "
+				"%d (at %.6f and %.6f) is %s of %lld usecs\n",
+				(long long)gap, i, i + 1,
+				usecs_to_secs(train[i - 1].time_usecs),
+				usecs_to_secs(train[i].time_usecs),
+				limit, (long long)limit_usecs);
+			return true;
+		}
+	}
+	if ((spec->min_rate_bps > 0 || spec->max_rate_bps > 0) &&
+	    stats->num_windows == 0) {
+		fprintf(s, "train is too short to measure its rate\n");
+		return true;
+	}
+	if (spec->min_rate_bps > 0 &&
+	    stats->min_rate_bps < spec->min_rate_bps) {
+		fprintf(s, "rate of %.0f bits/sec is below min_rate of "
+			"%lld bits/sec\n", stats->min_rate_bps,
+			(long long)spec->min_rate_bps);
+		return true;
+	}
+	if (spec->max_rate_bps > 0 &&
+	    stats->max_rate_bps > spec->max_rate_bps) {
+		fprintf(s, "rate of %.0f bits/sec is above max_rate of "
+			"%lld bits/sec\n", stats->max_rate_bps,
+			(long long)spec->max_rate_bps);
+		return true;
+	}
+	if (spec->max_burst > 0 && stats->max_burst > spec->max_burst) {
+		fprintf(s, "burst of %d packets is above max_burst of %lld\n",
+			stats->max_burst, (long long)spec->max_burst);
+		return true;
+	}
+	return false;
+}
+
+int verify_packet_spacing(const struct spacing_spec *spec,
+			  const struct train_packet *train,
+			  int num_packets, char **error)
+{
+	struct spacing_stats stats;
+	int result = STATUS_OK;
+	size_t size = 0;
+	FILE *s = NULL;
+
+	if (num_packets < spec->packets) {
+		asprintf(error, "expected %lld outbound packets but saw %d",
+			 (long long)spec->packets, num_packets);
+		return STATUS_ERR;
+	}
+
+	measure_spacing(spec, train, num_packets, &stats);
+
+	s = open_memstream(error, &size);
+	if (spacing_failure(s, spec, train, num_packets, &stats)) {
+		print_spacing(s, spec, train, num_packets, &stats);
+		result = STATUS_ERR;
+	}
+	fclose(s);
+	if (result == STATUS_OK) {
+		free(*error);
+		*error = NULL;
+	}
+
+	free(stats.sorted_gaps);
+	return result;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for verifying the spacing of a train of outbound packets:
+ * the gaps between them, the rate they achieve, and their bursts.
+ */
+
+#ifndef __PACKET_SPACING_H__
+#define __PACKET_SPACING_H__
+
+#include "types.h"
+
+#include "script.h"
+
+/* A packet of a train of outbound packets, as sniffed. */
+struct train_packet {
+	s64 time_usecs;		/* when we sniffed it */
+	u32 ip_bytes;		/* length of its IP datagram */
+};
+
+/* Verify the given train of packets, oldest first, against the limits
+ * in the spec. The rate in a window counts the IP bytes of the packets
+ * that start in it. On success, returns STATUS_OK. On failure, returns
+ * STATUS_ERR and fills in *error with the limit that failed and the
+ * measured spacing of the whole train.
+ */
+extern int verify_packet_spacing(const struct spacing_spec *spec,
+				 const struct train_packet *train,
+				 int num_packets, char **error);
+
+#endif /* __PACKET_SPACING_H__ */
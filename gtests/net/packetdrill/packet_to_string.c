@@ -336,6 +336,12 @@ int packet_to_string(struct packet *packet,
 		} else {
 			fputs("[No SCTP, TCP, UDP, UDPLite or ICMP header]", s);
 		}
+		if (packet->gso_size != 0)
+			fprintf(s, " gso %u", packet->gso_size);
+		if (packet->flags & FLAG_CSUM_PARTIAL)
+			fputs(" needs_csum", s);
+		if (packet->queue != 0)
+			fprintf(s, " queue %u", packet->queue);
 	}
 
 	result = STATUS_OK;
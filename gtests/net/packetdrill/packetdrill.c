@@ -31,7 +31,11 @@
 #include <string.h>
 #include <unistd.h>
 #include "config.h"
+#include "lint.h"
+#include "offline.h"
 #include "parse.h"
+#include "pcap_to_script.h"
+#include "repeat.h"
 #include "run.h"
 #include "script.h"
 #include "system.h"
@@ -64,6 +68,7 @@ static void run_init_scripts(struct config *config)
 int main(int argc, char *argv[])
 {
 	struct config config;
+	int failures = 0;
 	set_default_config(&config);
 	/* Get command line options and list of test scripts. */
 	char **arg = parse_command_line_options(argc, argv, &config);
@@ -82,6 +87,15 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
+	/* If --pcap_to_script, then write a script instead of running any. */
+	if (config.pcap_to_script_path != NULL) {
+		char *error = NULL;
+
+		if (pcap_to_script(&config, stdout, &error))
+			die("--pcap_to_script: %s\n", error);
+		return 0;
+	}
+
 	/* Ensure that there is at least one script path, to avoid
 	 * confusion between the lack of output caused by "all tests
 	 * passing" and "no tests listed on command line".
@@ -92,6 +106,11 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	/* If --lint, then check the scripts in parallel without running them. */
+	if (config.lint)
+		exit(lint_scripts(argc, argv, &config, arg) ?
+		     EXIT_FAILURE : EXIT_SUCCESS);
+
 	/* Parse and run each script on the command line. */
 	for (; *arg != NULL; ++arg) {
 		struct script script;
@@ -102,12 +121,25 @@ int main(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 
 		/* If --dry_run, then don't actually execute the script. */
-		if (config.dry_run)
+		if (config.dry_run) {
+			script_free(&script);
 			continue;
+		}
+
+		/* If --offline_pcap, verify against the capture instead. */
+		if (config.offline_path != NULL) {
+			offline_verify_script(&config, &script);
+			script_free(&script);
+			continue;
+		}
 
 		run_init_scripts(&config);
-		run_script(&config, &script);
+		if (config.repeat > 1)
+			failures += run_script_repeatedly(&config, &script);
+		else
+			run_script(&config, &script);
+		script_free(&script);
 	}
 
-	return 0;
+	return failures ? EXIT_FAILURE : 0;
 }
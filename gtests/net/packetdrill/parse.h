@@ -28,9 +28,29 @@
 #include "types.h"
 
 #include <assert.h>
+#include "arena.h"
 #include "config.h"
 #include "script.h"
 
+/* The state of one run of the parser, passed to the reentrant bison
+ * parser and flex scanner so that scripts may be parsed repeatedly and
+ * in several threads at once.
+ */
+struct parse_state {
+	const struct config *config;	/* config info needed for parsing */
+	struct script *script;		/* the output script */
+	struct invocation *invocation;	/* for parse_and_finalize_config() */
+	struct arena *arena;		/* the script's arena */
+
+	/* The starting line number of the input script statement that
+	 * we're currently parsing. This may be different than the
+	 * scanner's line number if bison had to look ahead and lexically
+	 * scan a token on the following line to decide that the current
+	 * statement is done.
+	 */
+	int script_line;
+};
+
 /* Copy the script contents into our single linear buffer. */
 extern void copy_script(const char *script_buffer,
 			struct script *script);
@@ -48,6 +68,9 @@ extern void read_script(const char *script_path,
  * parse_and_finalize_config() after parsing all in-script
  * options.
  *
+ * All of the parsed representation is allocated from the script's
+ * arena, and is freed by script_free().
+ *
  * Returns STATUS_OK on success; on failure returns STATUS_ERR. The
  * implementation for this function is in the bison parser file
  * parser.y.
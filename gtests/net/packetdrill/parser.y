@@ -117,40 +117,17 @@
 extern int yydebug;
 #endif
 
-extern FILE *yyin;
-extern int yylineno;
-extern char *yytext;
-extern int yylex(void);
-extern int yyparse(void);
-extern int yywrap(void);
-
-/* This mutex guards all parser global variables declared in this file. */
-pthread_mutex_t parser_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-/* The input to the parser: the path name of the script file to parse. */
-static const char* current_script_path = NULL;
-
-/* The starting line number of the input script statement that we're
- * currently parsing. This may be different than yylineno if bison had
- * to look ahead and lexically scan a token on the following line to
- * decide that the current statement is done.
- */
-static int current_script_line = -1;
-
-/*
- * We uses this object to look up configuration info needed during
- * parsing (such as whether packets are IPv4 or IPv6).
- */
-static const struct config *in_config = NULL;
-
-/* The output of the parser: an output script containing
- * 1) a linked list of options
- * 2) a linked list of events
- */
-static struct script *out_script = NULL;
-
-/* The test invocation to pass back to parse_and_finalize_config(). */
-struct invocation *invocation;
+/* The reentrant scanner API generated by flex from lexer.l. */
+extern int yylex(YYSTYPE *yylval_param, YYLTYPE *yylloc_param,
+		 yyscan_t yyscanner);
+extern int yylex_init_extra(struct parse_state *parse_state,
+			    yyscan_t *scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern struct yy_buffer_state *yy_scan_bytes(const char *bytes, int len,
+					      yyscan_t scanner);
+extern char *yyget_text(yyscan_t scanner);
+extern int yyget_lineno(yyscan_t scanner);
+extern void yyset_lineno(int line_number, yyscan_t scanner);
 
 /* Copy the script contents into our single linear buffer. */
 void copy_script(const char *script_buffer, struct script *script)
@@ -225,43 +202,32 @@ int parse_script(const struct config *config,
 			 struct script *script,
 			 struct invocation *callback_invocation)
 {
-	/* This bison-generated parser is not multi-thread safe, so we
-	 * have a lock to prevent more than one thread using the
-	 * parser at the same time. This is useful in the wire server
-	 * context, where in general we may have more than one test
-	 * thread running at the same time.
-	 */
-	if (pthread_mutex_lock(&parser_mutex) != 0)
-		die_perror("pthread_mutex_lock");
+	struct parse_state parse_state = {
+		.config		= config,
+		.script		= script,
+		.invocation	= callback_invocation,
+		.script_line	= -1,
+	};
+	yyscan_t scanner = NULL;
 
 #if YYDEBUG
 	yydebug = 1;
 #endif
 
-	/* Now parse the script from our buffer. */
-	yyin = fmemopen(script->buffer, script->length, "r");
-	if (yyin == NULL)
-		die_perror("fmemopen: parse error opening script buffer");
-
-	current_script_path = config->script_path;
-	in_config = config;
-	out_script = script;
-	invocation = callback_invocation;
-
-	/* We have to reset the line number here since the wire server
-	 * can do more than one yyparse().
-	 */
-	yylineno = 1;
+	if (script->arena == NULL)
+		script->arena = arena_new();
+	parse_state.arena = script->arena;
 
-	int result = yyparse();		/* invoke bison-generated parser */
-	current_script_path = NULL;
+	/* Now parse the script from our buffer. */
+	if (yylex_init_extra(&parse_state, &scanner) != 0)
+		die_perror("yylex_init_extra");
+	yy_scan_bytes(script->buffer, script->length, scanner);
+	yyset_lineno(1, scanner);
 
-	if (fclose(yyin))
-		die_perror("fclose: error closing script buffer");
+	/* invoke bison-generated parser */
+	int result = yyparse(scanner, &parse_state);
 
-	/* Unlock parser. */
-	if (pthread_mutex_unlock(&parser_mutex) != 0)
-		die_perror("pthread_mutex_unlock");
+	yylex_destroy(scanner);
 
 	return result ? STATUS_ERR : STATUS_OK;
 }
@@ -269,35 +235,33 @@ int parse_script(const struct config *config,
 /* Bison emits code to call this method when there's a parse-time error.
  * We print the line number and the error message.
  */
-static void yyerror(const char *message)
+static void yyerror(YYLTYPE *location, yyscan_t scanner,
+		    struct parse_state *parse_state, const char *message)
 {
 	fprintf(stderr, "%s:%d: parse error at '%s': %s\n",
-		current_script_path, yylineno, yytext, message);
+		parse_state->config->script_path, yyget_lineno(scanner),
+		yyget_text(scanner), message);
 }
 
 /* After we finish parsing each line of a script, we analyze the
  * semantics of the line. If we encounter an error then we print the
  * error message to stderr and exit with an error.
  */
-static void semantic_error(const char* message)
+static void semantic_error(struct parse_state *parse_state,
+			   const char* message)
 {
-	assert(current_script_line >= 0);
+	assert(parse_state->script_line >= 0);
 	die("%s:%d: semantic error: %s\n",
-	    current_script_path, current_script_line, message);
-}
-
-/* This standard callback is invoked by flex when it encounters
- * the end of a file. We return 1 to tell flex to return EOF.
- */
-int yywrap(void)
-{
-	return 1;
+	    parse_state->config->script_path, parse_state->script_line,
+	    message);
 }
 
 /* Create and initalize a new expression. */
-static struct expression *new_expression(enum expression_t type)
+static struct expression *new_expression(struct parse_state *parse_state,
+					 enum expression_t type)
 {
-	struct expression *expression = calloc(1, sizeof(struct expression));
+	struct expression *expression =
+		arena_alloc(parse_state->arena, sizeof(struct expression));
 	expression->type = type;
 	return expression;
 }
@@ -305,9 +269,11 @@ static struct expression *new_expression(enum expression_t type)
 /* Create and initalize a new integer expression with the given
  * literal value and format string.
  */
-static struct expression *new_integer_expression(s64 num, const char *format)
+static struct expression *new_integer_expression(
+	struct parse_state *parse_state, s64 num, const char *format)
 {
-	struct expression *expression = new_expression(EXPR_INTEGER);
+	struct expression *expression =
+		new_expression(parse_state, EXPR_INTEGER);
 	expression->value.num = num;
 	expression->format = format;
 	return expression;
@@ -315,44 +281,274 @@ static struct expression *new_integer_expression(s64 num, const char *format)
 
 /* Create and initalize a new one-element expression_list. */
 static struct expression_list *new_expression_list(
-	struct expression *expression)
+	struct parse_state *parse_state, struct expression *expression)
 {
 	struct expression_list *list;
-	list = calloc(1, sizeof(struct expression_list));
+	list = arena_alloc(parse_state->arena, sizeof(struct expression_list));
 	list->expression = expression;
 	list->next = NULL;
 	return list;
 }
 
 /* Add the expression to the end of the list. */
-static void expression_list_append(struct expression_list *list,
+static void expression_list_append(struct parse_state *parse_state,
+				   struct expression_list *list,
 				   struct expression *expression)
 {
 	while (list->next != NULL) {
 		list = list->next;
 	}
-	list->next = new_expression_list(expression);
+	list->next = new_expression_list(parse_state, expression);
 }
 
 /* Create and initialize a new option. */
-static struct option_list *new_option(char *name, char *value)
+static struct option_list *new_option(struct parse_state *parse_state,
+				      char *name, char *value)
 {
-	struct option_list *opt = calloc(1, sizeof(struct option_list));
+	struct option_list *opt =
+		arena_alloc(parse_state->arena, sizeof(struct option_list));
 	opt->name = name;
 	opt->value = value;
 	return opt;
 }
 
 /* Create and initialize a new event. */
-static struct event *new_event(enum event_t type)
+static struct event *new_event(struct parse_state *parse_state,
+			       enum event_t type)
 {
-	struct event *e = calloc(1, sizeof(struct event));
+	struct event *e = arena_alloc(parse_state->arena, sizeof(struct event));
 	e->type = type;
 	e->time_usecs_end = NO_TIME_RANGE;
 	e->offset_usecs = NO_TIME_RANGE;
 	return e;
 }
 
+static void packet_cleanup(void *packet)
+{
+	packet_free(packet);
+}
+
+/* Hand ownership of a finished packet to the script's arena. Packets
+ * are built by the same heap-allocating code we use for live packets,
+ * so we free them with packet_free() when the arena is freed.
+ */
+static struct packet *arena_own_packet(struct parse_state *parse_state,
+				       struct packet *packet)
+{
+	arena_add_cleanup(parse_state->arena, packet_cleanup, packet);
+	return packet;
+}
+
+/* Attach the given offload metadata and tun queue to a packet. */
+static void packet_set_meta(struct parse_state *parse_state,
+			    struct packet *packet, u16 gso_size,
+			    bool needs_csum, bool has_queue, u16 queue)
+{
+	/* We pick the tun queue we inject on; the kernel picks the one
+	 * it sends on, so a queue on an outbound packet would be ignored.
+	 */
+	if (has_queue && (packet->direction != DIRECTION_INBOUND)) {
+		semantic_error(parse_state,
+			       "queue can only be used with inbound packets");
+	}
+	packet->gso_size = gso_size;
+	if (needs_csum)
+		packet->flags |= FLAG_CSUM_PARTIAL;
+	packet->queue = queue;
+}
+
+/* A "name=value" parameter of an autopeer or spacing statement, with a
+ * number or a list of integers as its value.
+ */
+struct event_parameter {
+	const char *name;
+	double number;			/* numeric value, if not a list */
+	struct expression_list *list;	/* list value, or NULL */
+	bool is_list;
+	struct event_parameter *next;
+};
+
+static struct event_parameter *new_event_parameter(
+	struct parse_state *parse_state, const char *name)
+{
+	struct event_parameter *parameter =
+		arena_alloc(parse_state->arena, sizeof(struct event_parameter));
+	parameter->name = name;
+	return parameter;
+}
+
+/* Return the value of a parameter of the named statement that must be
+ * a whole number no smaller than 'min'.
+ */
+static s64 event_parameter_integer(struct parse_state *parse_state,
+				   const char *statement,
+				   const struct event_parameter *parameter,
+				   s64 min)
+{
+	char *error = NULL;
+
+	if (parameter->is_list || parameter->number != (s64)parameter->number ||
+	    parameter->number < min) {
+		asprintf(&error, "%s %s must be an integer >= %lld",
+			 statement, parameter->name, (long long)min);
+		semantic_error(parse_state, error);
+	}
+	return (s64)parameter->number;
+}
+
+/* Return the value of a parameter given in seconds, in microseconds. */
+static s64 event_parameter_usecs(struct parse_state *parse_state,
+				 const char *statement,
+				 const struct event_parameter *parameter)
+{
+	char *error = NULL;
+
+	if (parameter->is_list || parameter->number < 0) {
+		asprintf(&error, "%s %s must be a non-negative time",
+			 statement, parameter->name);
+		semantic_error(parse_state, error);
+	}
+	return (s64)(parameter->number * 1.0e6);
+}
+
+/* Fill in the drop list of the phase from a list of increasing data
+ * segment numbers, counting from 1.
+ */
+static void set_peer_drops(struct parse_state *parse_state,
+			   struct peer_spec *peer,
+			   const struct event_parameter *parameter)
+{
+	struct expression_list *list = NULL;
+	int i = 0;
+
+	if (!parameter->is_list)
+		semantic_error(parse_state, "autopeer drop must be a list");
+	for (list = parameter->list; list != NULL; list = list->next)
+		++peer->num_drops;
+	peer->drops = arena_alloc(parse_state->arena,
+				  peer->num_drops * sizeof(peer->drops[0]));
+	for (list = parameter->list; list != NULL; list = list->next, ++i) {
+		struct expression *expression = list->expression;
+
+		if (expression->type != EXPR_INTEGER ||
+		    expression->value.num < 1 ||
+		    (i > 0 && expression->value.num <= peer->drops[i - 1])) {
+			semantic_error(parse_state,
+				       "autopeer drop must list increasing "
+				       "segment numbers starting from 1");
+		}
+		peer->drops[i] = expression->value.num;
+	}
+}
+
+/* Build an autopeer phase from its parameters. */
+static struct peer_spec *new_peer_spec(struct parse_state *parse_state,
+				       struct event_parameter *parameters)
+{
+	struct peer_spec *peer =
+		arena_alloc(parse_state->arena, sizeof(struct peer_spec));
+	struct event_parameter *parameter = NULL;
+	const char *statement = "autopeer";
+	char *error = NULL;
+
+	peer->ack_every = 2;
+	for (parameter = parameters; parameter != NULL;
+	     parameter = parameter->next) {
+		const char *name = parameter->name;
+
+		if (strcmp(name, "bytes") == 0) {
+			peer->bytes = event_parameter_integer(
+				parse_state, statement, parameter, 1);
+		} else if (strcmp(name, "duration") == 0) {
+			peer->duration_usecs = event_parameter_usecs(
+				parse_state, statement, parameter);
+		} else if (strcmp(name, "ack_every") == 0) {
+			peer->ack_every = event_parameter_integer(
+				parse_state, statement, parameter, 1);
+		} else if (strcmp(name, "rtt") == 0) {
+			peer->rtt_usecs = event_parameter_usecs(
+				parse_state, statement, parameter);
+		} else if (strcmp(name, "rate") == 0) {
+			peer->rate_bps = event_parameter_integer(
+				parse_state, statement, parameter, 0);
+		} else if (strcmp(name, "sack") == 0) {
+			peer->sack = event_parameter_integer(
+				parse_state, statement, parameter, 0);
+		} else if (strcmp(name, "drop") == 0) {
+			set_peer_drops(parse_state, peer, parameter);
+		} else {
+			asprintf(&error, "unknown autopeer parameter '%s'",
+				 name);
+			semantic_error(parse_state, error);
+		}
+	}
+	if (peer->bytes == 0 && peer->duration_usecs == 0)
+		semantic_error(parse_state, "autopeer needs bytes or duration");
+	return peer;
+}
+
+/* Build a spacing assertion from its parameters. */
+static struct spacing_spec *new_spacing_spec(
+	struct parse_state *parse_state, struct event_parameter *parameters)
+{
+	struct spacing_spec *spacing =
+		arena_alloc(parse_state->arena, sizeof(struct spacing_spec));
+	struct event_parameter *parameter = NULL;
+	const char *statement = "spacing";
+	char *error = NULL;
+
+	spacing->burst_gap_usecs = DEFAULT_BURST_GAP_USECS;
+	for (parameter = parameters; parameter != NULL;
+	     parameter = parameter->next) {
+		const char *name = parameter->name;
+
+		if (strcmp(name, "packets") == 0) {
+			spacing->packets = event_parameter_integer(
+				parse_state, statement, parameter, 2);
+		} else if (strcmp(name, "min_gap") == 0) {
+			spacing->min_gap_usecs = event_parameter_usecs(
+				parse_state, statement, parameter);
+		} else if (strcmp(name, "max_gap") == 0) {
+			spacing->max_gap_usecs = event_parameter_usecs(
+				parse_state, statement, parameter);
+		} else if (strcmp(name, "min_rate") == 0) {
+			spacing->min_rate_bps = event_parameter_integer(
+				parse_state, statement, parameter, 1);
+		} else if (strcmp(name, "max_rate") == 0) {
+			spacing->max_rate_bps = event_parameter_integer(
+				parse_state, statement, parameter, 1);
+		} else if (strcmp(name, "window") == 0) {
+			spacing->window_usecs = event_parameter_usecs(
+				parse_state, statement, parameter);
+		} else if (strcmp(name, "max_burst") == 0) {
+			spacing->max_burst = event_parameter_integer(
+				parse_state, statement, parameter, 1);
+		} else if (strcmp(name, "burst_gap") == 0) {
+			spacing->burst_gap_usecs = event_parameter_usecs(
+				parse_state, statement, parameter);
+		} else {
+			asprintf(&error, "unknown spacing parameter '%s'",
+				 name);
+			semantic_error(parse_state, error);
+		}
+	}
+	if (spacing->packets == 0)
+		semantic_error(parse_state, "spacing needs packets");
+	if (spacing->packets > MAX_SPACING_PACKETS) {
+		asprintf(&error, "spacing can check at most %d packets",
+			 MAX_SPACING_PACKETS);
+		semantic_error(parse_state, error);
+	}
+	if (spacing->max_gap_usecs > 0 &&
+	    spacing->min_gap_usecs > spacing->max_gap_usecs)
+		semantic_error(parse_state, "spacing min_gap exceeds max_gap");
+	if (spacing->max_rate_bps > 0 &&
+	    spacing->min_rate_bps > spacing->max_rate_bps)
+		semantic_error(parse_state,
+			       "spacing min_rate exceeds max_rate");
+	return spacing;
+}
+
 static int parse_hex_byte(const char *hex, u8 *byte)
 {
 	if (!isxdigit((int)hex[0]) || !isxdigit((int)hex[1])) {
@@ -432,7 +628,18 @@ static struct tcp_option *new_tcp_fast_open_option(const char *cookie_string,
 
 %}
 
+%define api.pure full
 %locations
+%param {yyscan_t scanner}
+%parse-param {struct parse_state *parse_state}
+%code requires {
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;		/* a reentrant flex scanner */
+#endif
+struct parse_state;
+struct event_parameter;
+}
 %expect 1  /* we expect a shift/reduce conflict for the | binary expression */
 /* The %union section specifies the set of possible types for values
  * for all nonterminal and terminal symbols in the grammar.
@@ -452,8 +659,14 @@ static struct tcp_option *new_tcp_fast_open_option(const char *cookie_string,
 	u32 sequence_number;
 	struct {
 		u32 start_sequence;
-		u16 payload_bytes;
+		u32 payload_bytes;
 	} tcp_sequence_info;
+	struct {
+		u16 gso_size;
+		bool needs_csum;
+		bool has_queue;
+		u16 queue;
+	} packet_meta;
 	struct {
 		int protocol;
 		u16 payload_bytes;
@@ -475,6 +688,9 @@ static struct tcp_option *new_tcp_fast_open_option(const char *cookie_string,
 	struct syscall_spec *syscall;
 	struct command_spec *command;
 	struct code_spec *code;
+	struct peer_spec *peer;
+	struct spacing_spec *spacing;
+	struct event_parameter *event_parameter;
 	struct tcp_option *tcp_option;
 	struct tcp_options *tcp_options;
 	struct expression *expression;
@@ -488,14 +704,17 @@ static struct tcp_option *new_tcp_fast_open_option(const char *cookie_string,
  */
 %token ELLIPSIS
 %token <reserved> SA_FAMILY SIN_PORT SIN_ADDR _HTONS_ INET_ADDR
-%token <reserved> MSG_NAME MSG_IOV MSG_FLAGS
+%token <reserved> MSG_NAME MSG_IOV MSG_FLAGS MSG_CONTROL
+%token <reserved> CMSG_LEVEL CMSG_TYPE CMSG_DATA
+%token <reserved> EE_ERRNO EE_ORIGIN EE_TYPE EE_CODE EE_INFO EE_DATA
 %token <reserved> FD EVENTS REVENTS ONOFF LINGER
 %token <reserved> ACK ECR EOL MSS NOP SACK SACKOK TIMESTAMP VAL WIN WSCALE PRO
 %token <reserved> FAST_OPEN
 %token <reserved> ECT0 ECT1 CE ECT01 NO_ECN
 %token <reserved> IPV4 IPV6 ICMP SCTP UDP UDPLITE GRE MTU
 %token <reserved> MPLS LABEL TC TTL
-%token <reserved> OPTION
+%token <reserved> GSO NEEDS_CSUM QUEUE
+%token <reserved> OPTION AUTOPEER SPACING LATENCY
 %token <reserved> SRTO_INITIAL SRTO_MAX SRTO_MIN
 %token <reserved> SINIT_NUM_OSTREAMS SINIT_MAX_INSTREAMS SINIT_MAX_ATTEMPTS
 %token <reserved> SINIT_MAX_INIT_TIMEO
@@ -518,7 +737,7 @@ static struct tcp_option *new_tcp_fast_open_option(const char *cookie_string,
 %type <ip_ecn> ip_ecn
 %type <option> option options opt_options
 %type <event> event events event_time action
-%type <time_usecs> time opt_end_time
+%type <time_usecs> time opt_end_time opt_latency
 %type <packet> packet_spec
 %type <packet> sctp_packet_spec tcp_packet_spec
 %type <packet> udp_packet_spec udplite_packet_spec
@@ -527,6 +746,9 @@ static struct tcp_option *new_tcp_fast_open_option(const char *cookie_string,
 %type <syscall> syscall_spec
 %type <command> command_spec
 %type <code> code_spec
+%type <peer> peer_spec
+%type <spacing> spacing_spec
+%type <event_parameter> event_parameter event_parameters
 %type <mpls_stack> mpls_stack
 %type <mpls_stack_entry> mpls_stack_entry
 %type <integer> opt_mpls_stack_bottom
@@ -536,6 +758,7 @@ static struct tcp_option *new_tcp_fast_open_option(const char *cookie_string,
 %type <string> opt_note note word_list
 %type <string> option_flag option_value script
 %type <window> opt_window
+%type <packet_meta> opt_packet_meta
 %type <sequence_number> opt_ack
 %type <tcp_sequence_info> seq
 %type <transport_info> opt_icmp_echoed
@@ -546,6 +769,7 @@ static struct tcp_option *new_tcp_fast_open_option(const char *cookie_string,
 %type <expression> expression binary_expression array
 %type <expression> decimal_integer hex_integer
 %type <expression> inaddr sockaddr msghdr iovec pollfd opt_revents linger
+%type <expression> opt_msg_control cmsghdr sock_extended_err epollev
 %type <expression> sctp_rtoinfo sctp_initmsg sctp_assocval sctp_sackinfo
 %type <errno_info> opt_errno
 %type <chunk_list> sctp_chunk_list_spec
@@ -595,17 +819,17 @@ script
 opt_options
 :		{
 	$$ = NULL;
-	parse_and_finalize_config(invocation);
+	parse_and_finalize_config(parse_state->invocation);
 }
 | options	{
 	$$ = $1;
-	parse_and_finalize_config(invocation);
+	parse_and_finalize_config(parse_state->invocation);
 }
 ;
 
 options
 : option		{
-	out_script->option_list = $1;
+	parse_state->script->option_list = $1;
 	$$ = $1;		/* return the tail so we can append to it */
 }
 | options option	{
@@ -616,7 +840,7 @@ options
 
 option
 : option_flag '=' option_value {
-	$$ = new_option($1, $3);
+	$$ = new_option(parse_state, $1, $3);
 }
 
 option_flag
@@ -624,13 +848,13 @@ option_flag
 ;
 
 option_value
-: INTEGER	{ $$ = strdup(yytext); }
+: INTEGER	{ $$ = arena_strdup(parse_state->arena, yyget_text(scanner)); }
 | WORD		{ $$ = $1; }
 | STRING	{ $$ = $1; }
 | IPV4_ADDR	{ $$ = $1; }
 | IPV6_ADDR	{ $$ = $1; }
-| IPV4		{ $$ = strdup("ipv4"); }
-| IPV6		{ $$ = strdup("ipv6"); }
+| IPV4		{ $$ = arena_strdup(parse_state->arena, "ipv4"); }
+| IPV6		{ $$ = arena_strdup(parse_state->arena, "ipv6"); }
 ;
 
 opt_init_command
@@ -639,13 +863,13 @@ opt_init_command
 ;
 
 init_command
-: command_spec  { out_script->init_command = $1; }
+: command_spec  { parse_state->script->init_command = $1; }
 ;
 
 events
 : event        {
-	out_script->event_list = $1;  /* save pointer to event list as output
-				       * of parser */
+	/* save pointer to event list as output of parser */
+	parse_state->script->event_list = $1;
 	$$ = $1;          /* return the tail so that we can append to it */
 }
 | events event {
@@ -664,52 +888,53 @@ event
 
 	if ($$->time_usecs_end != NO_TIME_RANGE) {
 		if ($$->time_usecs_end < $$->time_usecs)
-			semantic_error("time range is backwards");
+			semantic_error(parse_state, "time range is backwards");
 	}
 	if ($$->time_type == ANY_TIME &&  ($$->type != PACKET_EVENT ||
 	    packet_direction($$->event.packet) != DIRECTION_OUTBOUND)) {
-		yylineno = $$->line_number;
-		semantic_error("event time <star> can only be used with "
+		yyset_lineno($$->line_number, scanner);
+		semantic_error(parse_state,
+			       "event time <star> can only be used with "
 			       "outbound packets");
 	} else if (($$->time_type == ABSOLUTE_RANGE_TIME ||
 		    $$->time_type == RELATIVE_RANGE_TIME) &&
 	           ($$->type != PACKET_EVENT ||
 		    packet_direction($$->event.packet) != DIRECTION_OUTBOUND)) {
-		yylineno = $$->line_number;
-		semantic_error("event time range can only be used with "
+		yyset_lineno($$->line_number, scanner);
+		semantic_error(parse_state,
+			       "event time range can only be used with "
 			       "outbound packets");
 	}
-	free($1);
 }
 ;
 
 event_time
 : '+' time	{
-	$$ = new_event(INVALID_EVENT);
+	$$ = new_event(parse_state, INVALID_EVENT);
 	$$->line_number = @2.first_line;
 	$$->time_usecs = $2;
 	$$->time_type = RELATIVE_TIME;
 }
 | time         {
-	$$ = new_event(INVALID_EVENT);
+	$$ = new_event(parse_state, INVALID_EVENT);
 	$$->line_number = @1.first_line;
 	$$->time_usecs = $1;
 	$$->time_type = ABSOLUTE_TIME;
 }
 | '*'		{
-	$$ = new_event(INVALID_EVENT);
+	$$ = new_event(parse_state, INVALID_EVENT);
 	$$->line_number = @1.first_line;
 	$$->time_type = ANY_TIME;
 }
 | time '~' time	{
-	$$ = new_event(INVALID_EVENT);
+	$$ = new_event(parse_state, INVALID_EVENT);
 	$$->line_number = @1.first_line;
 	$$->time_type = ABSOLUTE_RANGE_TIME;
 	$$->time_usecs = $1;
 	$$->time_usecs_end = $3;
 }
 | '+' time '~' '+' time {
-	$$ = new_event(INVALID_EVENT);
+	$$ = new_event(parse_state, INVALID_EVENT);
 	$$->line_number = @1.first_line;
 	$$->time_type = RELATIVE_RANGE_TIME;
 	$$->time_usecs = $2;
@@ -720,23 +945,43 @@ event_time
 time
 : FLOAT        {
 	if ($1 < 0) {
-		semantic_error("negative time");
+		semantic_error(parse_state, "negative time");
 	}
 	$$ = (s64)($1 * 1.0e6); /* convert float secs to s64 microseconds */
 }
 | INTEGER	{
 	if ($1 < 0) {
-		semantic_error("negative time");
+		semantic_error(parse_state, "negative time");
 	}
 	$$ = (s64)($1 * 1000000); /* convert int secs to s64 microseconds */
 }
 ;
 
 action
-: packet_spec  { $$ = new_event(PACKET_EVENT);  $$->event.packet  = $1; }
-| syscall_spec { $$ = new_event(SYSCALL_EVENT); $$->event.syscall = $1; }
-| command_spec { $$ = new_event(COMMAND_EVENT); $$->event.command = $1; }
-| code_spec    { $$ = new_event(CODE_EVENT);    $$->event.code    = $1; }
+: packet_spec  {
+	$$ = new_event(parse_state, PACKET_EVENT);
+	$$->event.packet = arena_own_packet(parse_state, $1);
+}
+| syscall_spec {
+	$$ = new_event(parse_state, SYSCALL_EVENT);
+	$$->event.syscall = $1;
+}
+| command_spec {
+	$$ = new_event(parse_state, COMMAND_EVENT);
+	$$->event.command = $1;
+}
+| code_spec    {
+	$$ = new_event(parse_state, CODE_EVENT);
+	$$->event.code = $1;
+}
+| peer_spec    {
+	$$ = new_event(parse_state, PEER_EVENT);
+	$$->event.peer = $1;
+}
+| spacing_spec {
+	$$ = new_event(parse_state, SPACING_EVENT);
+	$$->event.spacing = $1;
+}
 ;
 
 packet_spec
@@ -753,11 +998,11 @@ sctp_packet_spec
 	struct packet *outer = $1, *inner = NULL;
 	enum direction_t direction = outer->direction;
 
-	inner = new_sctp_packet(in_config->wire_protocol, direction, $2, $5,
-				&error);
+	inner = new_sctp_packet(parse_state->config->wire_protocol,
+				direction, $2, $5, &error);
 	if (inner == NULL) {
 		assert(error != NULL);
-		semantic_error(error);
+		semantic_error(parse_state, error);
 		free(error);
 	}
 
@@ -796,7 +1041,7 @@ opt_chunk_len
 : LEN '=' ELLIPSIS { $$ = -1; }
 | LEN '=' INTEGER  {
 	if (!is_valid_u16($3)) {
-		semantic_error("length value out of range");
+		semantic_error(parse_state, "length value out of range");
         }
         $$ = $3;
 }
@@ -806,13 +1051,13 @@ opt_flags
 : FLAGS '=' ELLIPSIS    { $$ = -1; }
 | FLAGS '=' HEX_INTEGER {
 	if (!is_valid_u8($3)) {
-		semantic_error("flags value out of range");
+		semantic_error(parse_state, "flags value out of range");
         }
 	$$ = $3;
 }
 | FLAGS '=' INTEGER     {
 	if (!is_valid_u8($3)) {
-		semantic_error("flags value out of range");
+		semantic_error(parse_state, "flags value out of range");
         }
 	$$ = $3;
 }
@@ -822,13 +1067,13 @@ opt_data_flags
 : FLAGS '=' ELLIPSIS    { $$ = -1; }
 | FLAGS '=' HEX_INTEGER {
 	if (!is_valid_u8($3)) {
-		semantic_error("flags value out of range");
+		semantic_error(parse_state, "flags value out of range");
 	}
 	$$ = $3;
 }
 | FLAGS '=' INTEGER     {
 	if (!is_valid_u8($3)) {
-		semantic_error("flags value out of range");
+		semantic_error(parse_state, "flags value out of range");
         }
 	$$ = $3;
 }
@@ -841,34 +1086,39 @@ opt_data_flags
 		switch (*c) {
 		case 'I':
 			if (flags & SCTP_DATA_CHUNK_I_BIT) {
-				semantic_error("I-bit specified multiple times");
+				semantic_error(parse_state,
+					       "I-bit specified multiple times");
 			} else {
 				flags |= SCTP_DATA_CHUNK_I_BIT;
 			}
 			break;
 		case 'U':
 			if (flags & SCTP_DATA_CHUNK_U_BIT) {
-				semantic_error("U-bit specified multiple times");
+				semantic_error(parse_state,
+					       "U-bit specified multiple times");
 			} else {
 				flags |= SCTP_DATA_CHUNK_U_BIT;
 			}
 			break;
 		case 'B':
 			if (flags & SCTP_DATA_CHUNK_B_BIT) {
-				semantic_error("B-bit specified multiple times");
+				semantic_error(parse_state,
+					       "B-bit specified multiple times");
 			} else {
 				flags |= SCTP_DATA_CHUNK_B_BIT;
 			}
 			break;
 		case 'E':
 			if (flags & SCTP_DATA_CHUNK_E_BIT) {
-				semantic_error("E-bit specified multiple times");
+				semantic_error(parse_state,
+					       "E-bit specified multiple times");
 			} else {
 				flags |= SCTP_DATA_CHUNK_E_BIT;
 			}
 			break;
 		default:
-			semantic_error("Only expecting IUBE as flags");
+			semantic_error(parse_state,
+				       "Only expecting IUBE as flags");
 			break;
 		}
 	}
@@ -880,13 +1130,13 @@ opt_abort_flags
 : FLAGS '=' ELLIPSIS    { $$ = -1; }
 | FLAGS '=' HEX_INTEGER {
 	if (!is_valid_u8($3)) {
-		semantic_error("flags value out of range");
+		semantic_error(parse_state, "flags value out of range");
 	}
 	$$ = $3;
 }
 | FLAGS '=' INTEGER     {
 	if (!is_valid_u8($3)) {
-		semantic_error("flags value out of range");
+		semantic_error(parse_state, "flags value out of range");
         }
 	$$ = $3;
 }
@@ -899,13 +1149,15 @@ opt_abort_flags
 		switch (*c) {
 		case 'T':
 			if (flags & SCTP_ABORT_CHUNK_T_BIT) {
-				semantic_error("T-bit specified multiple times");
+				semantic_error(parse_state,
+					       "T-bit specified multiple times");
 			} else {
 				flags |= SCTP_ABORT_CHUNK_T_BIT;
 			}
 			break;
 		default:
-			semantic_error("Only expecting T as flags");
+			semantic_error(parse_state,
+				       "Only expecting T as flags");
 			break;
 		}
 	}
@@ -917,13 +1169,13 @@ opt_shutdown_complete_flags
 : FLAGS '=' ELLIPSIS    { $$ = -1; }
 | FLAGS '=' HEX_INTEGER {
 	if (!is_valid_u8($3)) {
-		semantic_error("flags value out of range");
+		semantic_error(parse_state, "flags value out of range");
 	}
 	$$ = $3;
 }
 | FLAGS '=' INTEGER     {
 	if (!is_valid_u8($3)) {
-		semantic_error("flags value out of range");
+		semantic_error(parse_state, "flags value out of range");
         }
 	$$ = $3;
 }
@@ -936,13 +1188,15 @@ opt_shutdown_complete_flags
 		switch (*c) {
 		case 'T':
 			if (flags & SCTP_SHUTDOWN_COMPLETE_CHUNK_T_BIT) {
-				semantic_error("T-bit specified multiple times");
+				semantic_error(parse_state,
+					       "T-bit specified multiple times");
 			} else {
 				flags |= SCTP_SHUTDOWN_COMPLETE_CHUNK_T_BIT;
 			}
 			break;
 		default:
-			semantic_error("Only expecting T as flags");
+			semantic_error(parse_state,
+				       "Only expecting T as flags");
 			break;
 		}
 	}
@@ -953,7 +1207,7 @@ opt_shutdown_complete_flags
 opt_tag
 : TAG '=' INTEGER {
 	if (!is_valid_u32($3)) {
-		semantic_error("tag value out of range");
+		semantic_error(parse_state, "tag value out of range");
 	}
 	$$ = $3;
 }
@@ -963,7 +1217,7 @@ opt_a_rwnd
 : A_RWND '=' ELLIPSIS   { $$ = -1; }
 | A_RWND '=' INTEGER    {
 	if (!is_valid_u32($3)) {
-		semantic_error("a_rwnd value out of range");
+		semantic_error(parse_state, "a_rwnd value out of range");
 	}
 	$$ = $3;
 }
@@ -973,7 +1227,7 @@ opt_os
 : OS '=' ELLIPSIS { $$ = -1; }
 | OS '=' INTEGER  {
 	if (!is_valid_u16($3)) {
-		semantic_error("os value out of range");
+		semantic_error(parse_state, "os value out of range");
 	}
 	$$ = $3;
 }
@@ -983,7 +1237,7 @@ opt_is
 : IS '=' ELLIPSIS { $$ = -1; }
 | IS '=' INTEGER  {
 	if (!is_valid_u16($3)) {
-		semantic_error("is value out of range");
+		semantic_error(parse_state, "is value out of range");
 	}
 	$$ = $3;
 }
@@ -993,7 +1247,7 @@ opt_tsn
 : TSN '=' ELLIPSIS { $$ = -1; }
 | TSN '=' INTEGER  {
 	if (!is_valid_u32($3)) {
-		semantic_error("tsn value out of range");
+		semantic_error(parse_state, "tsn value out of range");
 	}
 	$$ = $3;
 }
@@ -1003,7 +1257,7 @@ opt_sid
 : SID '=' ELLIPSIS { $$ = -1; }
 | SID '=' INTEGER  {
 	if (!is_valid_u16($3)) {
-		semantic_error("sid value out of range");
+		semantic_error(parse_state, "sid value out of range");
 	}
 	$$ = $3;
 }
@@ -1013,7 +1267,7 @@ opt_ssn
 : SSN '=' ELLIPSIS { $$ = -1; }
 | SSN '=' INTEGER  {
 	if (!is_valid_u16($3)) {
-		semantic_error("ssn value out of range");
+		semantic_error(parse_state, "ssn value out of range");
 	}
 	$$ = $3;
 }
@@ -1023,7 +1277,7 @@ opt_ppid
 : PPID '=' ELLIPSIS { $$ = -1; }
 | PPID '=' INTEGER  {
 	if (!is_valid_u32($3)) {
-		semantic_error("ppid value out of range");
+		semantic_error(parse_state, "ppid value out of range");
 	}
 	$$ = $3;
 }
@@ -1033,7 +1287,7 @@ opt_cum_tsn
 : CUM_TSN '=' ELLIPSIS { $$ = -1; }
 | CUM_TSN '=' INTEGER  {
 	if (!is_valid_u32($3)) {
-		semantic_error("cum_tsn value out of range");
+		semantic_error(parse_state, "cum_tsn value out of range");
 	}
 	$$ = $3;
 }
@@ -1056,10 +1310,10 @@ gap_list
 gap
 : INTEGER ':' INTEGER {
 	if (!is_valid_u16($1)) {
-		semantic_error("start value out of range");
+		semantic_error(parse_state, "start value out of range");
 	}
 	if (!is_valid_u16($3)) {
-		semantic_error("end value out of range");
+		semantic_error(parse_state, "end value out of range");
 	}
 	$$ = sctp_sack_block_list_item_gap_new($1, $3);
 }
@@ -1082,7 +1336,7 @@ dup_list
 dup
 : INTEGER {
 	if (!is_valid_u32($1)) {
-		semantic_error("tsn value out of range");
+		semantic_error(parse_state, "tsn value out of range");
 	}
 	$$ = sctp_sack_block_list_item_dup_new($1);
 }
@@ -1091,7 +1345,7 @@ dup
 sctp_data_chunk_spec
 : DATA '[' opt_data_flags ',' opt_chunk_len ',' opt_tsn ',' opt_sid ',' opt_ssn ',' opt_ppid ']' {
 	if (($5 != -1) && ($5 < sizeof(struct sctp_data_chunk))) {
-		semantic_error("length value out of range");
+		semantic_error(parse_state, "length value out of range");
 	}
 	$$ = sctp_data_chunk_new($3, $5, $7, $9, $11, $13);
 }
@@ -1099,10 +1353,10 @@ sctp_data_chunk_spec
 sctp_init_chunk_spec
 : INIT '[' opt_flags ',' opt_tag ',' opt_a_rwnd ',' opt_os ',' opt_is ',' opt_tsn opt_parameter_list_spec ']' {
 	if ($5 == -1) {
-		semantic_error("tag value must be specified");
+		semantic_error(parse_state, "tag value must be specified");
 	}
 	if ($13 == -1) {
-		semantic_error("tsn value must be specified");
+		semantic_error(parse_state, "tsn value must be specified");
 	}
 	$$ = sctp_init_chunk_new($3, $5, $7, $9, $11, $13, $14);
 }
@@ -1110,10 +1364,10 @@ sctp_init_chunk_spec
 sctp_init_ack_chunk_spec
 : INIT_ACK '[' opt_flags ',' opt_tag ',' opt_a_rwnd ',' opt_os ',' opt_is ',' opt_tsn opt_parameter_list_spec ']' {
 	if ($5 == -1) {
-		semantic_error("tag value must be specified");
+		semantic_error(parse_state, "tag value must be specified");
 	}
 	if ($13 == -1) {
-		semantic_error("tsn value must be specified");
+		semantic_error(parse_state, "tsn value must be specified");
 	}
 	$$ = sctp_init_ack_chunk_new($3, $5, $7, $9, $11, $13, $14);
 }
@@ -1219,7 +1473,7 @@ sctp_heartbeat_information_parameter_spec
 | HEARTBEAT_INFORMATION '[' LEN '=' INTEGER ',' VAL '=' ELLIPSIS ']' {
 	if (($5 < sizeof(struct sctp_heartbeat_information_parameter)) ||
 	    !is_valid_u16($5)) {
-		semantic_error("len value out of range");
+		semantic_error(parse_state, "len value out of range");
 	}
 	$$ = sctp_heartbeat_information_parameter_new($5, NULL);
 }
@@ -1229,7 +1483,7 @@ sctp_ipv4_address_parameter_spec
 	struct in_addr addr;
 
 	if (inet_pton(AF_INET, $5, &addr) != 1) {
-		semantic_error("Invalid address");
+		semantic_error(parse_state, "Invalid address");
 	}
 	$$ = sctp_ipv4_address_parameter_new(&addr);
 }
@@ -1242,7 +1496,7 @@ sctp_ipv6_address_parameter_spec
 	struct in6_addr addr;
 
 	if (inet_pton(AF_INET6, $5, &addr) != 1) {
-		semantic_error("Invalid address");
+		semantic_error(parse_state, "Invalid address");
 	}
 	$$ = sctp_ipv6_address_parameter_new(&addr);
 }
@@ -1260,7 +1514,7 @@ sctp_state_cookie_parameter_spec
 | STATE_COOKIE '[' LEN '=' INTEGER ',' VAL '=' ELLIPSIS ']' {
 	if (($5 < sizeof(struct sctp_state_cookie_parameter)) ||
 	    !is_valid_u32($5)) {
-		semantic_error("len value out of range");
+		semantic_error(parse_state, "len value out of range");
 	}
 	$$ = sctp_state_cookie_parameter_new($5, NULL);
 }
@@ -1276,7 +1530,7 @@ sctp_unrecognized_parameter_parameter_spec
 sctp_cookie_preservative_parameter_spec
 : COOKIE_PRESERVATIVE '[' INCR '=' INTEGER ']' {
 	if (!is_valid_u32($5)) {
-		semantic_error("increment value out of range");
+		semantic_error(parse_state, "increment value out of range");
 	}
 	$$ = sctp_cookie_preservative_parameter_new($5);
 }
@@ -1302,7 +1556,8 @@ address_types_list
 
 address_type
 : INTEGER       { if (!is_valid_u16($1)) {
-                  semantic_error("address type value out of range");
+                  semantic_error(parse_state,
+                                 "address type value out of range");
 	          }
 	          $$ = sctp_address_type_list_item_new($1); }
 | IPV4_TYPE     { $$ = sctp_address_type_list_item_new(SCTP_IPV4_ADDRESS_PARAMETER_TYPE); }
@@ -1334,57 +1589,64 @@ sctp_pad_parameter_spec
 | PAD '[' LEN '=' INTEGER ',' VAL '=' ELLIPSIS ']' {
 	if (($5 < sizeof(struct sctp_pad_parameter)) ||
 	    !is_valid_u32($5)) {
-		semantic_error("len value out of range");
+		semantic_error(parse_state, "len value out of range");
 	}
 	$$ = sctp_pad_parameter_new($5, NULL);
 }
 
 tcp_packet_spec
-: packet_prefix opt_ip_info flags seq opt_ack opt_window opt_tcp_options {
+: packet_prefix opt_ip_info flags seq opt_ack opt_window opt_tcp_options
+  opt_packet_meta {
 	char *error = NULL;
 	struct packet *outer = $1, *inner = NULL;
 	enum direction_t direction = outer->direction;
 
 	if (($7 == NULL) && (direction != DIRECTION_OUTBOUND)) {
-		yylineno = @7.first_line;
-		semantic_error("<...> for TCP options can only be used with "
+		yyset_lineno(@7.first_line, scanner);
+		semantic_error(parse_state,
+			       "<...> for TCP options can only be used with "
 			       "outbound packets");
 	}
 
-	inner = new_tcp_packet(in_config->wire_protocol,
+	inner = new_tcp_packet(parse_state->config->wire_protocol,
 			       direction, $2, $3,
 			       $4.start_sequence, $4.payload_bytes,
 			       $5, $6, $7, &error);
-	free($3);
 	free($7);
 	if (inner == NULL) {
 		assert(error != NULL);
-		semantic_error(error);
+		semantic_error(parse_state, error);
 		free(error);
 	}
 
 	$$ = packet_encapsulate_and_free(outer, inner);
+	packet_set_meta(parse_state, $$, $8.gso_size, $8.needs_csum,
+			$8.has_queue, $8.queue);
+	tcp_packet_compile_template($$);
 }
 ;
 
 udp_packet_spec
-: packet_prefix UDP '(' INTEGER ')' {
+: packet_prefix UDP '(' INTEGER ')' opt_packet_meta {
 	char *error = NULL;
 	struct packet *outer = $1, *inner = NULL;
 	enum direction_t direction = outer->direction;
 
 	if (!is_valid_u16($4)) {
-		semantic_error("UDP payload size out of range");
+		semantic_error(parse_state, "UDP payload size out of range");
 	}
 
-	inner = new_udp_packet(in_config->wire_protocol, direction, $4, &error);
+	inner = new_udp_packet(parse_state->config->wire_protocol,
+			       direction, $4, &error);
 	if (inner == NULL) {
 		assert(error != NULL);
-		semantic_error(error);
+		semantic_error(parse_state, error);
 		free(error);
 	}
 
 	$$ = packet_encapsulate_and_free(outer, inner);
+	packet_set_meta(parse_state, $$, $6.gso_size, $6.needs_csum,
+			$6.has_queue, $6.queue);
 }
 ;
 
@@ -1395,17 +1657,19 @@ udplite_packet_spec
 	enum direction_t direction = outer->direction;
 
 	if (!is_valid_u16($4)) {
-		semantic_error("UDPLite payload size out of range");
+		semantic_error(parse_state,
+			       "UDPLite payload size out of range");
 	}
 	if (!is_valid_u16($6)) {
-		semantic_error("UDPLite checksum coverage out of range");
+		semantic_error(parse_state,
+			       "UDPLite checksum coverage out of range");
 	}
 
-	inner = new_udplite_packet(in_config->wire_protocol, direction, $4, $6,
-				   &error);
+	inner = new_udplite_packet(parse_state->config->wire_protocol,
+				   direction, $4, $6, &error);
 	if (inner == NULL) {
 		assert(error != NULL);
-		semantic_error(error);
+		semantic_error(parse_state, error);
 		free(error);
 	}
 
@@ -1419,14 +1683,12 @@ icmp_packet_spec
 	struct packet *outer = $1, *inner = NULL;
 	enum direction_t direction = outer->direction;
 
-	inner = new_icmp_packet(in_config->wire_protocol, direction, $4, $5,
-				$2.protocol, $2.payload_bytes,
+	inner = new_icmp_packet(parse_state->config->wire_protocol,
+				direction, $4, $5, $2.protocol, $2.payload_bytes,
 				$2.start_sequence, $2.checksum_coverage,
 				$2.verification_tag, $6, &error);
-	free($4);
-	free($5);
 	if (inner == NULL) {
-		semantic_error(error);
+		semantic_error(parse_state, error);
 		free(error);
 	}
 
@@ -1446,9 +1708,7 @@ packet_prefix
 	char *ip_src = $3;
 	char *ip_dst = $5;
 	if (ipv4_header_append(packet, ip_src, ip_dst, &error))
-		semantic_error(error);
-	free(ip_src);
-	free(ip_dst);
+		semantic_error(parse_state, error);
 	$$ = packet;
 }
 | packet_prefix IPV6 IPV6_ADDR '>' IPV6_ADDR ':' {
@@ -1457,16 +1717,14 @@ packet_prefix
 	char *ip_src = $3;
 	char *ip_dst = $5;
 	if (ipv6_header_append(packet, ip_src, ip_dst, &error))
-		semantic_error(error);
-	free(ip_src);
-	free(ip_dst);
+		semantic_error(parse_state, error);
 	$$ = packet;
 }
 | packet_prefix GRE ':' {
 	char *error = NULL;
 	struct packet *packet = $1;
 	if (gre_header_append(packet, &error))
-		semantic_error(error);
+		semantic_error(parse_state, error);
 	$$ = packet;
 }
 | packet_prefix MPLS mpls_stack ':' {
@@ -1475,7 +1733,7 @@ packet_prefix
 	struct mpls_stack *mpls_stack = $3;
 
 	if (mpls_header_append(packet, mpls_stack, &error))
-		semantic_error(error);
+		semantic_error(parse_state, error);
 	free(mpls_stack);
 	$$ = packet;
 }
@@ -1487,7 +1745,7 @@ mpls_stack
 }
 | mpls_stack mpls_stack_entry	{
 	if (mpls_stack_append($1, $2))
-		semantic_error("too many MPLS labels");
+		semantic_error(parse_state, "too many MPLS labels");
 	$$ = $1;
 }
 ;
@@ -1504,7 +1762,7 @@ mpls_stack_entry
 
 	if (new_mpls_stack_entry(label, traffic_class, is_stack_bottom, ttl,
 				 &mpls, &error))
-		semantic_error(error);
+		semantic_error(parse_state, error);
 	$$ = mpls;
 }
 ;
@@ -1513,8 +1771,8 @@ opt_mpls_stack_bottom
 :			{ $$ = 0; }
 | '[' WORD ']' ','	{
 	if (strcmp($2, "S") != 0)
-		semantic_error("expected [S] for MPLS label stack bottom");
-	free($2);
+		semantic_error(parse_state,
+			       "expected [S] for MPLS label stack bottom");
 	$$ = 1;
 }
 ;
@@ -1563,8 +1821,14 @@ opt_icmp_mtu
 ;
 
 direction
-: '<'          { $$ = DIRECTION_INBOUND;  current_script_line = yylineno; }
-| '>'          { $$ = DIRECTION_OUTBOUND; current_script_line = yylineno; }
+: '<'          {
+	$$ = DIRECTION_INBOUND;
+	parse_state->script_line = yyget_lineno(scanner);
+}
+| '>'          {
+	$$ = DIRECTION_OUTBOUND;
+	parse_state->script_line = yyget_lineno(scanner);
+}
 ;
 
 opt_ip_info
@@ -1582,24 +1846,28 @@ ip_ecn
 
 flags
 : WORD         { $$ = $1; }
-| '.'          { $$ = strdup("."); }
-| WORD '.'     { asprintf(&($$), "%s.", $1); free($1); }
-| '-'          { $$ = strdup(""); }  /* no TCP flags set in segment */
+| '.'          { $$ = arena_strdup(parse_state->arena, "."); }
+| WORD '.'     { $$ = arena_asprintf(parse_state->arena, "%s.", $1); }
+/* no TCP flags set in segment */
+| '-'          { $$ = arena_strdup(parse_state->arena, ""); }
 ;
 
 seq
 : INTEGER ':' INTEGER '(' INTEGER ')' {
 	if (!is_valid_u32($1)) {
-		semantic_error("TCP start sequence number out of range");
+		semantic_error(parse_state,
+			       "TCP start sequence number out of range");
 	}
 	if (!is_valid_u32($3)) {
-		semantic_error("TCP end sequence number out of range");
+		semantic_error(parse_state,
+			       "TCP end sequence number out of range");
 	}
-	if (!is_valid_u16($5)) {
-		semantic_error("TCP payload size out of range");
+	if ($5 < 0 || $5 > MAX_TCP_DATAGRAM_BYTES) {
+		semantic_error(parse_state, "TCP payload size out of range");
 	}
 	if ($3 != ($1 +$5)) {
-		semantic_error("inconsistent TCP sequence numbers and "
+		semantic_error(parse_state,
+			       "inconsistent TCP sequence numbers and "
 			       "payload size");
 	}
 	$$.start_sequence = $1;
@@ -1611,7 +1879,8 @@ opt_ack
 :              { $$ = 0; }
 | ACK INTEGER  {
 	if (!is_valid_u32($2)) {
-		semantic_error("TCP ack sequence number out of range");
+		semantic_error(parse_state,
+			       "TCP ack sequence number out of range");
 	}
 	$$ = $2;
 }
@@ -1621,12 +1890,48 @@ opt_window
 :		{ $$ = -1; }
 | WIN INTEGER	{
 	if (!is_valid_u16($2)) {
-		semantic_error("TCP window value out of range");
+		semantic_error(parse_state, "TCP window value out of range");
 	}
 	$$ = $2;
 }
 ;
 
+opt_packet_meta
+:			{
+	$$.gso_size = 0;
+	$$.needs_csum = false;
+	$$.has_queue = false;
+	$$.queue = 0;
+}
+| opt_packet_meta GSO INTEGER {
+	if (!parse_state->config->tun_vnet_hdr) {
+		semantic_error(parse_state, "gso requires --tun_vnet_hdr");
+	}
+	if (!is_valid_u16($3) || ($3 == 0)) {
+		semantic_error(parse_state, "gso size out of range");
+	}
+	$$ = $1;
+	$$.gso_size = $3;
+}
+| opt_packet_meta NEEDS_CSUM {
+	if (!parse_state->config->tun_vnet_hdr) {
+		semantic_error(parse_state,
+			       "needs_csum requires --tun_vnet_hdr");
+	}
+	$$ = $1;
+	$$.needs_csum = true;
+}
+| opt_packet_meta QUEUE INTEGER {
+	if (($3 < 0) || ($3 >= parse_state->config->tun_queues)) {
+		semantic_error(parse_state,
+			       "queue out of range for --tun_queues");
+	}
+	$$ = $1;
+	$$.has_queue = true;
+	$$.queue = $3;
+}
+;
+
 opt_tcp_options
 :                             { $$ = tcp_options_new(); }
 | '<' tcp_option_list '>'     { $$ = $2; }
@@ -1637,25 +1942,27 @@ tcp_option_list
 : tcp_option                       {
 	$$ = tcp_options_new();
 	if (tcp_options_append($$, $1)) {
-		semantic_error("TCP option list too long");
+		semantic_error(parse_state, "TCP option list too long");
 	}
+	free($1);
 }
 | tcp_option_list ',' tcp_option   {
 	$$ = $1;
 	if (tcp_options_append($$, $3)) {
-		semantic_error("TCP option list too long");
+		semantic_error(parse_state, "TCP option list too long");
 	}
+	free($3);
 }
 ;
 
 opt_tcp_fast_open_cookie
-:			{ $$ = strdup(""); }
+:			{ $$ = arena_strdup(parse_state->arena, ""); }
 | tcp_fast_open_cookie	{ $$ = $1; }
 ;
 
 tcp_fast_open_cookie
-: WORD    { $$ = strdup(yytext); }
-| INTEGER { $$ = strdup(yytext); }
+: WORD    { $$ = arena_strdup(parse_state->arena, yyget_text(scanner)); }
+| INTEGER { $$ = arena_strdup(parse_state->arena, yyget_text(scanner)); }
 ;
 
 tcp_option
@@ -1664,14 +1971,15 @@ tcp_option
 | MSS INTEGER      {
 	$$ = tcp_option_new(TCPOPT_MAXSEG, TCPOLEN_MAXSEG);
 	if (!is_valid_u16($2)) {
-		semantic_error("mss value out of range");
+		semantic_error(parse_state, "mss value out of range");
 	}
 	$$->data.mss.bytes = htons($2);
 }
 | WSCALE INTEGER   {
 	$$ = tcp_option_new(TCPOPT_WINDOW, TCPOLEN_WINDOW);
 	if (!is_valid_u8($2)) {
-		semantic_error("window scale shift count out of range");
+		semantic_error(parse_state,
+			       "window scale shift count out of range");
 	}
 	$$->data.window_scale.shift_count = $2;
 }
@@ -1686,10 +1994,10 @@ tcp_option
 	u32 val, ecr;
 	$$ = tcp_option_new(TCPOPT_TIMESTAMP, TCPOLEN_TIMESTAMP);
 	if (!is_valid_u32($3)) {
-		semantic_error("ts val out of range");
+		semantic_error(parse_state, "ts val out of range");
 	}
 	if (!is_valid_u32($5)) {
-		semantic_error("ecr val out of range");
+		semantic_error(parse_state, "ecr val out of range");
 	}
 	val = $3;
 	ecr = $5;
@@ -1699,10 +2007,9 @@ tcp_option
 | FAST_OPEN opt_tcp_fast_open_cookie  {
 	char *error = NULL;
 	$$ = new_tcp_fast_open_option($2, &error);
-	free($2);
 	if ($$ == NULL) {
 		assert(error != NULL);
-		semantic_error(error);
+		semantic_error(parse_state, error);
 		free(error);
 	}
 }
@@ -1728,10 +2035,12 @@ sack_block
 : INTEGER ':' INTEGER {
 	$$ = tcp_option_new(TCPOPT_SACK, 2 + sizeof(struct sack_block));
 	if (!is_valid_u32($1)) {
-		semantic_error("TCP SACK left sequence number out of range");
+		semantic_error(parse_state,
+			       "TCP SACK left sequence number out of range");
 	}
 	if (!is_valid_u32($3)) {
-		semantic_error("TCP SACK right sequence number out of range");
+		semantic_error(parse_state,
+			       "TCP SACK right sequence number out of range");
 	}
 	$$->data.sack.block[0].left = htonl($1);
 	$$->data.sack.block[0].right = htonl($3);
@@ -1740,14 +2049,15 @@ sack_block
 
 syscall_spec
 : opt_end_time function_name function_arguments '='
-  expression opt_errno opt_note  {
-	$$ = calloc(1, sizeof(struct syscall_spec));
+  expression opt_errno opt_note opt_latency  {
+	$$ = arena_alloc(parse_state->arena, sizeof(struct syscall_spec));
 	$$->end_usecs	= $1;
 	$$->name	= $2;
 	$$->arguments	= $3;
 	$$->result	= $5;
 	$$->error	= $6;
 	$$->note	= $7;
+	$$->max_latency_usecs = $8;
 }
 ;
 
@@ -1756,8 +2066,16 @@ opt_end_time
 | ELLIPSIS time           { $$ = $2; }
 ;
 
+opt_latency
+:                         { $$ = NO_LATENCY_LIMIT; }
+| LATENCY '<' time        { $$ = $3; }
+;
+
 function_name
-: WORD                    { $$ = $1; current_script_line = yylineno; }
+: WORD                    {
+	$$ = $1;
+	parse_state->script_line = yyget_lineno(scanner);
+}
 ;
 
 function_arguments
@@ -1766,27 +2084,30 @@ function_arguments
 ;
 
 expression_list
-: expression                     { $$ = new_expression_list($1); }
-| expression_list ',' expression { $$ = $1; expression_list_append($1, $3); }
+: expression                     { $$ = new_expression_list(parse_state, $1); }
+| expression_list ',' expression {
+	$$ = $1;
+	expression_list_append(parse_state, $1, $3);
+}
 ;
 
 expression
 : ELLIPSIS          {
-	$$ = new_expression(EXPR_ELLIPSIS);
+	$$ = new_expression(parse_state, EXPR_ELLIPSIS);
 }
 | decimal_integer   { $$ = $1; }
 | hex_integer       { $$ = $1; }
 | WORD              {
-	$$ = new_expression(EXPR_WORD);
+	$$ = new_expression(parse_state, EXPR_WORD);
 	$$->value.string = $1;
 }
 | STRING            {
-	$$ = new_expression(EXPR_STRING);
+	$$ = new_expression(parse_state, EXPR_STRING);
 	$$->value.string = $1;
 	$$->format = "\"%s\"";
 }
 | STRING ELLIPSIS   {
-	$$ = new_expression(EXPR_STRING);
+	$$ = new_expression(parse_state, EXPR_STRING);
 	$$->value.string = $1;
 	$$->format = "\"%s\"...";
 }
@@ -1811,6 +2132,15 @@ expression
 | pollfd            {
 	$$ = $1;
 }
+| cmsghdr           {
+	$$ = $1;
+}
+| sock_extended_err {
+	$$ = $1;
+}
+| epollev           {
+	$$ = $1;
+}
 | linger            {
 	$$ = $1;
 }
@@ -1830,22 +2160,23 @@ expression
 
 decimal_integer
 : INTEGER           {
-	$$ = new_integer_expression($1, "%ld");
+	$$ = new_integer_expression(parse_state, $1, "%ld");
 }
 ;
 
 hex_integer
 : HEX_INTEGER       {
-	$$ = new_integer_expression($1, "%#lx");
+	$$ = new_integer_expression(parse_state, $1, "%#lx");
 }
 ;
 
 binary_expression
 : expression '|' expression {       /* bitwise OR */
-	$$ = new_expression(EXPR_BINARY);
+	$$ = new_expression(parse_state, EXPR_BINARY);
 	struct binary_expression *binary =
-			  malloc(sizeof(struct binary_expression));
-	binary->op = strdup("|");
+		arena_alloc(parse_state->arena,
+			    sizeof(struct binary_expression));
+	binary->op = arena_strdup(parse_state->arena, "|");
 	binary->lhs = $1;
 	binary->rhs = $3;
 	$$->value.binary = binary;
@@ -1854,11 +2185,11 @@ binary_expression
 
 array
 : '[' ']'                 {
-	$$ = new_expression(EXPR_LIST);
+	$$ = new_expression(parse_state, EXPR_LIST);
 	$$->value.list = NULL;
 }
 | '[' expression_list ']' {
-	$$ = new_expression(EXPR_LIST);
+	$$ = new_expression(parse_state, EXPR_LIST);
 	$$->value.list = $2;
 }
 ;
@@ -1866,7 +2197,7 @@ array
 inaddr
 : INET_ADDR '(' STRING ')' {
 	__be32 ip_address = inet_addr($3);
-	$$ = new_integer_expression(ip_address, "%#lx");
+	$$ = new_integer_expression(parse_state, ip_address, "%#lx");
 }
 ;
 
@@ -1875,28 +2206,30 @@ sockaddr
 	SIN_PORT '=' _HTONS_ '(' INTEGER ')' ','
 	SIN_ADDR '=' INET_ADDR '(' STRING ')' '}' {
 	if (strcmp($4, "AF_INET") == 0) {
-		struct sockaddr_in *ipv4 = malloc(sizeof(struct sockaddr_in));
-		memset(ipv4, 0, sizeof(*ipv4));
+		struct sockaddr_in *ipv4 =
+			arena_alloc(parse_state->arena,
+				    sizeof(struct sockaddr_in));
 		ipv4->sin_family = AF_INET;
 		ipv4->sin_port = htons($10);
 		if (inet_pton(AF_INET, $17, &ipv4->sin_addr) == 1) {
-			$$ = new_expression(EXPR_SOCKET_ADDRESS_IPV4);
+			$$ = new_expression(parse_state,
+					    EXPR_SOCKET_ADDRESS_IPV4);
 			$$->value.socket_address_ipv4 = ipv4;
 		} else {
-			free(ipv4);
-			semantic_error("invalid IPv4 address");
+			semantic_error(parse_state, "invalid IPv4 address");
 		}
 	} else if (strcmp($4, "AF_INET6") == 0) {
-		struct sockaddr_in6 *ipv6 = malloc(sizeof(struct sockaddr_in6));
-		memset(ipv6, 0, sizeof(*ipv6));
+		struct sockaddr_in6 *ipv6 =
+			arena_alloc(parse_state->arena,
+				    sizeof(struct sockaddr_in6));
 		ipv6->sin6_family = AF_INET6;
 		ipv6->sin6_port = htons($10);
 		if (inet_pton(AF_INET6, $17, &ipv6->sin6_addr) == 1) {
-			$$ = new_expression(EXPR_SOCKET_ADDRESS_IPV6);
+			$$ = new_expression(parse_state,
+					    EXPR_SOCKET_ADDRESS_IPV6);
 			$$->value.socket_address_ipv6 = ipv6;
 		} else {
-			free(ipv6);
-			semantic_error("invalid IPv6 address");
+			semantic_error(parse_state, "invalid IPv6 address");
 		}
 	}
 }
@@ -1905,33 +2238,72 @@ sockaddr
 msghdr
 : '{' MSG_NAME '(' ELLIPSIS ')' '=' ELLIPSIS ','
       MSG_IOV '(' decimal_integer ')' '=' array ','
-      MSG_FLAGS '=' expression '}' {
-	struct msghdr_expr *msg_expr = calloc(1, sizeof(struct msghdr_expr));
-	$$ = new_expression(EXPR_MSGHDR);
+      MSG_FLAGS '=' expression opt_msg_control '}' {
+	struct msghdr_expr *msg_expr =
+		arena_alloc(parse_state->arena, sizeof(struct msghdr_expr));
+	$$ = new_expression(parse_state, EXPR_MSGHDR);
 	$$->value.msghdr = msg_expr;
-	msg_expr->msg_name	= new_expression(EXPR_ELLIPSIS);
-	msg_expr->msg_namelen	= new_expression(EXPR_ELLIPSIS);
+	msg_expr->msg_name	= new_expression(parse_state, EXPR_ELLIPSIS);
+	msg_expr->msg_namelen	= new_expression(parse_state, EXPR_ELLIPSIS);
 	msg_expr->msg_iov	= $14;
 	msg_expr->msg_iovlen	= $11;
 	msg_expr->msg_flags	= $18;
-	/* TODO(ncardwell): msg_control, msg_controllen */
+	msg_expr->msg_control	= $19;
+}
+;
+
+opt_msg_control
+:                                { $$ = NULL; }
+| ',' MSG_CONTROL '=' array      { $$ = $4; }
+;
+
+cmsghdr
+: '{' CMSG_LEVEL '=' expression ',' CMSG_TYPE '=' expression ','
+      CMSG_DATA '=' expression '}' {
+	struct cmsghdr_expr *cmsg_expr =
+		arena_alloc(parse_state->arena, sizeof(struct cmsghdr_expr));
+	$$ = new_expression(parse_state, EXPR_CMSGHDR);
+	$$->value.cmsghdr = cmsg_expr;
+	cmsg_expr->cmsg_level	= $4;
+	cmsg_expr->cmsg_type	= $8;
+	cmsg_expr->cmsg_data	= $12;
+}
+;
+
+sock_extended_err
+: '{' EE_ERRNO '=' expression ',' EE_ORIGIN '=' expression ','
+      EE_TYPE '=' expression ',' EE_CODE '=' expression ','
+      EE_INFO '=' expression ',' EE_DATA '=' expression '}' {
+	struct sock_extended_err_expr *ee_expr =
+		arena_alloc(parse_state->arena,
+			    sizeof(struct sock_extended_err_expr));
+	$$ = new_expression(parse_state, EXPR_SOCK_EXTENDED_ERR);
+	$$->value.sock_extended_err = ee_expr;
+	ee_expr->ee_errno	= $4;
+	ee_expr->ee_origin	= $8;
+	ee_expr->ee_type	= $12;
+	ee_expr->ee_code	= $16;
+	ee_expr->ee_info	= $20;
+	ee_expr->ee_data	= $24;
 }
 ;
 
 iovec
 : '{' ELLIPSIS ',' decimal_integer '}' {
-	struct iovec_expr *iov_expr = calloc(1, sizeof(struct iovec_expr));
-	$$ = new_expression(EXPR_IOVEC);
+	struct iovec_expr *iov_expr =
+		arena_alloc(parse_state->arena, sizeof(struct iovec_expr));
+	$$ = new_expression(parse_state, EXPR_IOVEC);
 	$$->value.iovec = iov_expr;
-	iov_expr->iov_base = new_expression(EXPR_ELLIPSIS);
+	iov_expr->iov_base = new_expression(parse_state, EXPR_ELLIPSIS);
 	iov_expr->iov_len = $4;
 }
 ;
 
 pollfd
 : '{' FD '=' expression ',' EVENTS '=' expression opt_revents '}' {
-	struct pollfd_expr *pollfd_expr = calloc(1, sizeof(struct pollfd_expr));
-	$$ = new_expression(EXPR_POLLFD);
+	struct pollfd_expr *pollfd_expr =
+		arena_alloc(parse_state->arena, sizeof(struct pollfd_expr));
+	$$ = new_expression(parse_state, EXPR_POLLFD);
 	$$->value.pollfd = pollfd_expr;
 	pollfd_expr->fd = $4;
 	pollfd_expr->events = $8;
@@ -1939,14 +2311,27 @@ pollfd
 }
 ;
 
+epollev
+: '{' EVENTS '=' expression ',' FD '=' expression '}' {
+	struct epollev_expr *epollev_expr =
+		arena_alloc(parse_state->arena, sizeof(struct epollev_expr));
+	$$ = new_expression(parse_state, EXPR_EPOLLEV);
+	$$->value.epollev = epollev_expr;
+	epollev_expr->events = $4;
+	epollev_expr->fd = $8;
+}
+;
+
 opt_revents
-:                                { $$ = new_integer_expression(0, "%ld"); }
+:                                {
+	$$ = new_integer_expression(parse_state, 0, "%ld");
+}
 | ',' REVENTS '=' expression     { $$ = $4; }
 ;
 
 linger
 : '{' ONOFF '=' INTEGER ',' LINGER '=' INTEGER '}' {
-	$$ = new_expression(EXPR_LINGER);
+	$$ = new_expression(parse_state, EXPR_LINGER);
 	$$->value.linger.l_onoff  = $4;
 	$$->value.linger.l_linger = $8;
 }
@@ -1955,17 +2340,17 @@ linger
 sctp_rtoinfo
 : '{' SRTO_INITIAL '=' INTEGER ',' SRTO_MAX '=' INTEGER ',' SRTO_MIN '=' INTEGER '}' {
 #ifdef SCTP_RTOINFO
-	$$ = new_expression(EXPR_SCTP_RTOINFO);
+	$$ = new_expression(parse_state, EXPR_SCTP_RTOINFO);
 	if (!is_valid_u32($4)) {
-		semantic_error("srto_initial out of range");
+		semantic_error(parse_state, "srto_initial out of range");
 	}
 	$$->value.sctp_rtoinfo.srto_initial = $4;
 	if (!is_valid_u32($8)) {
-		semantic_error("srto_max out of range");
+		semantic_error(parse_state, "srto_max out of range");
 	}
 	$$->value.sctp_rtoinfo.srto_max = $8;
 	if (!is_valid_u32($12)) {
-		semantic_error("srto_min out of range");
+		semantic_error(parse_state, "srto_min out of range");
 	}
 	$$->value.sctp_rtoinfo.srto_min = $12;
 #else
@@ -1977,21 +2362,22 @@ sctp_rtoinfo
 sctp_initmsg
 : '{' SINIT_NUM_OSTREAMS '=' INTEGER ',' SINIT_MAX_INSTREAMS '=' INTEGER ',' SINIT_MAX_ATTEMPTS '=' INTEGER ',' SINIT_MAX_INIT_TIMEO '=' INTEGER '}' {
 #ifdef SCTP_INITMSG
-	$$ = new_expression(EXPR_SCTP_INITMSG);
+	$$ = new_expression(parse_state, EXPR_SCTP_INITMSG);
 	if (!is_valid_u16($4)) {
-		semantic_error("sinit_num_ostreams out of range");
+		semantic_error(parse_state, "sinit_num_ostreams out of range");
 	}
 	$$->value.sctp_initmsg.sinit_num_ostreams = $4;
 	if (!is_valid_u16($8)) {
-		semantic_error("sinit_max_instreams out of range");
+		semantic_error(parse_state, "sinit_max_instreams out of range");
 	}
 	$$->value.sctp_initmsg.sinit_max_instreams = $8;
 	if (!is_valid_u16($12)) {
-		semantic_error("sinit_max_attempts out of range");
+		semantic_error(parse_state, "sinit_max_attempts out of range");
 	}
 	$$->value.sctp_initmsg.sinit_max_attempts = $12;
 	if (!is_valid_u16($16)) {
-		semantic_error("sinit_max_init_timeo out of range");
+		semantic_error(parse_state,
+			       "sinit_max_init_timeo out of range");
 	}
 	$$->value.sctp_initmsg.sinit_max_init_timeo = $16;
 #else
@@ -2003,9 +2389,9 @@ sctp_initmsg
 sctp_assocval
 : '{' ASSOC_VALUE '=' INTEGER '}' {
 #if defined(SCTP_MAXSEG) || defined(SCTP_MAX_BURST)
-	$$ = new_expression(EXPR_SCTP_ASSOCVAL);
+	$$ = new_expression(parse_state, EXPR_SCTP_ASSOCVAL);
 	if (!is_valid_u32($4)) {
-		semantic_error("assoc_value out of range");
+		semantic_error(parse_state, "assoc_value out of range");
 	}
 	$$->value.sctp_assoc_value.assoc_value = $4;
 #else
@@ -2017,13 +2403,13 @@ sctp_assocval
 sctp_sackinfo
 : '{' SACK_DELAY '=' INTEGER ',' SACK_FREQ '=' INTEGER '}' {
 #ifdef SCTP_DELAYED_SACK
-	$$ = new_expression(EXPR_SCTP_SACKINFO);
+	$$ = new_expression(parse_state, EXPR_SCTP_SACKINFO);
 	if (!is_valid_u32($4)) {
-		semantic_error("sack_delay out of range");
+		semantic_error(parse_state, "sack_delay out of range");
 	}
 	$$->value.sctp_sack_info.sack_delay = $4;
 	if (!is_valid_u32($8)) {
-		semantic_error("sack_freq out of range");
+		semantic_error(parse_state, "sack_freq out of range");
 	}
 	$$->value.sctp_sack_info.sack_freq  = $8;
 #else
@@ -2035,7 +2421,7 @@ sctp_sackinfo
 opt_errno
 :                   { $$ = NULL; }
 | WORD note         {
-	$$ = malloc(sizeof(struct errno_spec));
+	$$ = arena_alloc(parse_state->arena, sizeof(struct errno_spec));
 	$$->errno_macro = $1;
 	$$->strerror    = $2;
 }
@@ -2052,22 +2438,69 @@ note
 
 word_list
 : WORD              { $$ = $1; }
-| word_list WORD    { asprintf(&($$), "%s %s", $1, $2); free($1); free($2); }
+| word_list WORD    {
+	$$ = arena_asprintf(parse_state->arena, "%s %s", $1, $2);
+}
 ;
 
 command_spec
 : BACK_QUOTED       {
-	$$ = malloc(sizeof(struct command_spec));
+	$$ = arena_alloc(parse_state->arena, sizeof(struct command_spec));
 	$$->command_line = $1;
-	current_script_line = yylineno;
+	parse_state->script_line = yyget_lineno(scanner);
 }
 ;
 
 code_spec
 : CODE              {
-	$$ = calloc(1, sizeof(struct code_spec));
+	$$ = arena_alloc(parse_state->arena, sizeof(struct code_spec));
 	$$->text = $1;
-	current_script_line = yylineno;
+	parse_state->script_line = yyget_lineno(scanner);
  }
 ;
 
+peer_spec
+: AUTOPEER '(' event_parameters ')' {
+	parse_state->script_line = yyget_lineno(scanner);
+	$$ = new_peer_spec(parse_state, $3);
+}
+;
+
+spacing_spec
+: SPACING '(' event_parameters ')' {
+	parse_state->script_line = yyget_lineno(scanner);
+	$$ = new_spacing_spec(parse_state, $3);
+}
+;
+
+event_parameters
+: event_parameter    { $$ = $1; }
+| event_parameters ',' event_parameter {
+	struct event_parameter *last = $1;
+	while (last->next != NULL)
+		last = last->next;
+	last->next = $3;
+	$$ = $1;
+}
+;
+
+event_parameter
+: WORD '=' INTEGER  {
+	$$ = new_event_parameter(parse_state, $1);
+	$$->number = $3;
+}
+| WORD '=' FLOAT    {
+	$$ = new_event_parameter(parse_state, $1);
+	$$->number = $3;
+}
+| WORD '=' array    {
+	$$ = new_event_parameter(parse_state, $1);
+	$$->list = $3->value.list;
+	$$->is_list = true;
+}
+| SACK '=' INTEGER  {
+	$$ = new_event_parameter(parse_state, "sack");
+	$$->number = $3;
+}
+;
+
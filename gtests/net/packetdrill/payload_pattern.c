@@ -0,0 +1,90 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of the --payload_pattern helpers.
+ *
+ * We precompute two periods of the pattern, so that any window of up
+ * to one period starting at any offset is a contiguous run of the
+ * table. Filling and checking are then done a period at a time with
+ * memcpy() and memcmp(), which libc implements with vector
+ * instructions, and we only fall back to a byte-at-a-time scan to
+ * locate the first mismatching byte once memcmp() finds a mismatch.
+ */
+
+#include "payload_pattern.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static u8 *pattern_table;	/* two periods of the pattern */
+static pthread_once_t pattern_once = PTHREAD_ONCE_INIT;
+
+static void pattern_table_init(void)
+{
+	int i;
+
+	pattern_table = malloc(2 * PAYLOAD_PATTERN_PERIOD);
+	for (i = 0; i < 2 * PAYLOAD_PATTERN_PERIOD; ++i)
+		pattern_table[i] = payload_pattern_byte(i);
+}
+
+void payload_pattern_init(void)
+{
+	pthread_once(&pattern_once, pattern_table_init);
+}
+
+void payload_pattern_fill(u8 *buf, size_t len, u64 offset)
+{
+	while (len > 0) {
+		size_t chunk = len;
+
+		if (chunk > PAYLOAD_PATTERN_PERIOD)
+			chunk = PAYLOAD_PATTERN_PERIOD;
+		memcpy(buf, pattern_table + (offset % PAYLOAD_PATTERN_PERIOD),
+		       chunk);
+		buf += chunk;
+		len -= chunk;
+		offset += chunk;
+	}
+}
+
+ssize_t payload_pattern_mismatch(const u8 *buf, size_t len, u64 offset)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		const u8 *expected =
+			pattern_table + ((offset + done) %
+					 PAYLOAD_PATTERN_PERIOD);
+		size_t chunk = len - done;
+		size_t i;
+
+		if (chunk > PAYLOAD_PATTERN_PERIOD)
+			chunk = PAYLOAD_PATTERN_PERIOD;
+		if (memcmp(buf + done, expected, chunk) != 0) {
+			for (i = 0; i < chunk; ++i) {
+				if (buf[done + i] != expected[i])
+					return done + i;
+			}
+		}
+		done += chunk;
+	}
+	return -1;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Helpers for the --payload_pattern mode, in which every payload byte
+ * of a TCP stream (or of a datagram) carries a deterministic value
+ * derived from its offset in the stream (or datagram), so that
+ * corrupted, reordered, or duplicated data can be detected.
+ */
+
+#ifndef __PAYLOAD_PATTERN_H__
+#define __PAYLOAD_PATTERN_H__
+
+#include "types.h"
+
+#include <sys/types.h>
+
+/* The pattern repeats with this period. We use a prime so the period
+ * never lines up with MSS, page, or buffer size multiples.
+ */
+#define PAYLOAD_PATTERN_PERIOD	65521
+
+/* Return the pattern byte at the given stream offset. */
+static inline u8 payload_pattern_byte(u64 offset)
+{
+	u32 x = offset % PAYLOAD_PATTERN_PERIOD;
+
+	x ^= x >> 7;
+	x *= 0x9e3779b1;
+	return x >> 24;
+}
+
+/* Precompute the pattern. Call before using the functions below. */
+extern void payload_pattern_init(void);
+
+/* Fill the given buffer with the pattern starting at the given offset. */
+extern void payload_pattern_fill(u8 *buf, size_t len, u64 offset);
+
+/* Compare the given buffer with the pattern starting at the given
+ * offset. Returns -1 if they match; otherwise returns the index in
+ * the buffer of the first mismatching byte.
+ */
+extern ssize_t payload_pattern_mismatch(const u8 *buf, size_t len,
+					u64 offset);
+
+#endif /* __PAYLOAD_PATTERN_H__ */
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Declarations for the pcap and pcapng capture file formats.
+ *
+ * We don't use libpcap's headers since we only build with libpcap on
+ * some platforms, and we only need the file formats.
+ */
+
+#ifndef __PCAP_H__
+#define __PCAP_H__
+
+#include "types.h"
+
+/* Classic pcap file header magic numbers. */
+#define PCAP_MAGIC_USECS	0xA1B2C3D4	/* microsecond timestamps */
+#define PCAP_MAGIC_NSECS	0xA1B23C4D	/* nanosecond timestamps */
+
+/* Classic pcap file header. */
+struct pcap_file_header {
+	u32 magic;
+	u16 version_major;
+	u16 version_minor;
+	s32 thiszone;
+	u32 sigfigs;
+	u32 snaplen;
+	u32 linktype;
+} __attribute__ ((__packed__));
+
+/* Classic pcap per-packet record header. */
+struct pcap_record_header {
+	u32 ts_sec;
+	u32 ts_frac;		/* microseconds or nanoseconds */
+	u32 caplen;		/* bytes of the packet in the file */
+	u32 len;		/* bytes of the packet on the wire */
+} __attribute__ ((__packed__));
+
+/* pcapng block types. */
+#define PCAPNG_SECTION_HEADER	0x0A0D0D0A
+#define PCAPNG_INTERFACE	0x00000001
+#define PCAPNG_ENHANCED_PACKET	0x00000006
+
+/* pcapng Section Header Block byte-order magic. */
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1A2B3C4D
+
+/* pcapng option codes. */
+#define PCAPNG_OPT_END		0
+#define PCAPNG_OPT_COMMENT	1
+#define PCAPNG_OPT_EPB_FLAGS	2	/* in Enhanced Packet Blocks */
+#define PCAPNG_OPT_IF_TSRESOL	9	/* in Interface Description Blocks */
+
+/* Direction bits of the epb_flags option. */
+#define PCAPNG_EPB_DIRECTION_MASK	0x3
+#define PCAPNG_EPB_INBOUND		0x1
+#define PCAPNG_EPB_OUTBOUND		0x2
+
+/* Link-layer header types we know how to read or write. */
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW		101	/* raw IPv4 or IPv6 */
+#define LINKTYPE_LINUX_SLL	113	/* Linux "cooked" capture */
+#define LINKTYPE_IPV4		228
+#define LINKTYPE_IPV6		229
+#define LINKTYPE_LINUX_SLL2	276	/* Linux "cooked" capture v2 */
+
+/* Round up to the 32-bit alignment of pcapng blocks and options. */
+static inline u32 pcapng_pad(u32 bytes)
+{
+	return (bytes + 3) & ~3;
+}
+
+#endif /* __PCAP_H__ */
@@ -0,0 +1,622 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of a reader for pcap and pcapng files.
+ *
+ * We handle classic pcap files in either byte order with microsecond
+ * or nanosecond timestamps, and pcapng files with any number of
+ * sections and interfaces. We read packets with raw IP, Ethernet
+ * (with at most one VLAN tag), or Linux "cooked" link-layer headers.
+ *
+ * A record truncated by the snap length of the capture still stands
+ * for the whole packet: we parse it at its original length, with the
+ * missing payload bytes zeroed, as long as its headers were captured.
+ */
+
+#include "pcap_reader.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ethernet.h"
+#include "logging.h"
+#include "packet_parser.h"
+#include "pcap.h"
+
+#define USECS_PER_SEC		1000000ULL
+#define NSECS_PER_SEC		1000000000ULL
+#define PCAP_MAX_BLOCK_BYTES	(16 * 1024 * 1024)	/* sanity limit */
+
+/* Linux "cooked" capture packet types. */
+#define SLL_PACKET_HOST		0	/* to us */
+#define SLL_PACKET_OUTGOING	4	/* from us */
+
+/* A pcapng interface: how to read its packets. */
+struct pcap_interface {
+	u16 linktype;
+	u64 units_per_sec;		/* timestamp resolution */
+};
+
+struct pcap_reader {
+	FILE *file;
+	char *path;
+	bool is_pcapng;
+	bool swapped;			/* file byte order differs from ours? */
+	struct pcap_interface pcap;	/* the interface of a classic pcap */
+	struct pcap_interface *interfaces;	/* of current pcapng section */
+	int num_interfaces;
+	u8 *buffer;			/* the current record or block */
+	u32 buffer_bytes;
+	u64 num_records;		/* packet records read so far */
+	u64 num_skipped;		/* IP packets we couldn't parse */
+};
+
+static u16 swap16(u16 value)
+{
+	return (value >> 8) | (value << 8);
+}
+
+static u32 swap32(u32 value)
+{
+	return ((value >> 24) | ((value >> 8) & 0xff00) |
+		((value << 8) & 0xff0000) | (value << 24));
+}
+
+static u16 file_u16(const struct pcap_reader *reader, const u8 *data)
+{
+	u16 value;
+
+	memcpy(&value, data, sizeof(value));
+	return reader->swapped ? swap16(value) : value;
+}
+
+static u32 file_u32(const struct pcap_reader *reader, const u8 *data)
+{
+	u32 value;
+
+	memcpy(&value, data, sizeof(value));
+	return reader->swapped ? swap32(value) : value;
+}
+
+/* Link-layer headers are in network byte order. */
+static u16 net_u16(const u8 *data)
+{
+	return (data[0] << 8) | data[1];
+}
+
+/* Read exactly the given number of bytes. Returns STATUS_OK on
+ * success. At a clean end of file, returns STATUS_ERR with *error
+ * NULL; on a short read or I/O error, fills in *error.
+ */
+static int read_bytes(struct pcap_reader *reader, void *data, u32 bytes,
+		      bool eof_ok, char **error)
+{
+	size_t got = fread(data, 1, bytes, reader->file);
+
+	*error = NULL;
+	if (got == bytes)
+		return STATUS_OK;
+	if (ferror(reader->file))
+		asprintf(error, "%s: read error: %s",
+			 reader->path, strerror(errno));
+	else if (got != 0 || !eof_ok)
+		asprintf(error, "%s: truncated file", reader->path);
+	return STATUS_ERR;
+}
+
+/* Make sure the buffer can hold the given number of bytes. */
+static int grow_buffer(struct pcap_reader *reader, u32 bytes, char **error)
+{
+	if (bytes > PCAP_MAX_BLOCK_BYTES) {
+		asprintf(error, "%s: record of %u bytes is too big",
+			 reader->path, bytes);
+		return STATUS_ERR;
+	}
+	if (bytes > reader->buffer_bytes) {
+		reader->buffer = realloc(reader->buffer, bytes);
+		if (reader->buffer == NULL)
+			die("unable to allocate %u bytes\n", bytes);
+		reader->buffer_bytes = bytes;
+	}
+	return STATUS_OK;
+}
+
+/* Convert a timestamp in units of the given resolution to microseconds. */
+static s64 timestamp_to_usecs(u64 timestamp, u64 units_per_sec)
+{
+	return (timestamp / units_per_sec * USECS_PER_SEC +
+		(timestamp % units_per_sec) * USECS_PER_SEC /
+		units_per_sec);
+}
+
+/* Find the IP datagram inside a link-layer frame. On success, returns
+ * STATUS_OK and fills in the offset of the IP header, its ethertype,
+ * and the direction if the link-layer header records it. Returns
+ * STATUS_ERR if this is not an IP packet we can read.
+ */
+static int find_ip_datagram(u16 linktype, const u8 *data, u32 bytes,
+			    u32 *offset, u16 *ether_type,
+			    enum direction_t *direction)
+{
+	u8 sll_type = 0;
+
+	*direction = DIRECTION_INVALID;
+	switch (linktype) {
+	case LINKTYPE_RAW:
+		if (bytes < 1)
+			return STATUS_ERR;
+		*offset = 0;
+		switch (data[0] >> 4) {
+		case 4:	*ether_type = ETHERTYPE_IP;	break;
+		case 6:	*ether_type = ETHERTYPE_IPV6;	break;
+		default: return STATUS_ERR;
+		}
+		break;
+	case LINKTYPE_IPV4:
+		*offset = 0;
+		*ether_type = ETHERTYPE_IP;
+		break;
+	case LINKTYPE_IPV6:
+		*offset = 0;
+		*ether_type = ETHERTYPE_IPV6;
+		break;
+	case LINKTYPE_ETHERNET:
+		if (bytes < sizeof(struct ether_header))
+			return STATUS_ERR;
+		*offset = sizeof(struct ether_header);
+		*ether_type = net_u16(data + 12);
+		if (*ether_type == 0x8100) {	/* 802.1Q VLAN tag */
+			if (bytes < *offset + 4)
+				return STATUS_ERR;
+			*ether_type = net_u16(data + 16);
+			*offset += 4;
+		}
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if (bytes < 16)
+			return STATUS_ERR;
+		*offset = 16;
+		*ether_type = net_u16(data + 14);
+		sll_type = net_u16(data);
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		if (bytes < 20)
+			return STATUS_ERR;
+		*offset = 20;
+		*ether_type = net_u16(data);
+		sll_type = data[10];
+		break;
+	default:
+		return STATUS_ERR;
+	}
+
+	if (linktype == LINKTYPE_LINUX_SLL || linktype == LINKTYPE_LINUX_SLL2) {
+		if (sll_type == SLL_PACKET_HOST)
+			*direction = DIRECTION_INBOUND;
+		else if (sll_type == SLL_PACKET_OUTGOING)
+			*direction = DIRECTION_OUTBOUND;
+	}
+
+	if (*ether_type != ETHERTYPE_IP && *ether_type != ETHERTYPE_IPV6)
+		return STATUS_ERR;
+	return STATUS_OK;
+}
+
+static bool is_supported_linktype(u16 linktype)
+{
+	switch (linktype) {
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+	case LINKTYPE_ETHERNET:
+	case LINKTYPE_LINUX_SLL:
+	case LINKTYPE_LINUX_SLL2:
+		return true;
+	}
+	return false;
+}
+
+/* Read the rest of a pcapng Section Header Block, whose type we've read. */
+static int read_section_header(struct pcap_reader *reader, char **error)
+{
+	u8 header[8];
+	u32 magic, bytes;
+
+	if (read_bytes(reader, header, sizeof(header), false, error))
+		return STATUS_ERR;
+	memcpy(&magic, header + 4, sizeof(magic));
+	if (magic == PCAPNG_BYTE_ORDER_MAGIC) {
+		reader->swapped = false;
+	} else if (magic == swap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+		reader->swapped = true;
+	} else {
+		asprintf(error, "%s: bad pcapng byte-order magic",
+			 reader->path);
+		return STATUS_ERR;
+	}
+	bytes = file_u32(reader, header);
+	if (bytes < 28 || bytes % 4 != 0) {
+		asprintf(error, "%s: bad pcapng section header length %u",
+			 reader->path, bytes);
+		return STATUS_ERR;
+	}
+
+	/* Interface IDs are per section. */
+	free(reader->interfaces);
+	reader->interfaces = NULL;
+	reader->num_interfaces = 0;
+
+	if (grow_buffer(reader, bytes, error))
+		return STATUS_ERR;
+	return read_bytes(reader, reader->buffer, bytes - 12, false, error);
+}
+
+/* Parse a pcapng Interface Description Block body. */
+static int parse_interface(struct pcap_reader *reader,
+			   const u8 *body, u32 bytes, char **error)
+{
+	struct pcap_interface *interface = NULL;
+	u32 offset = 8;
+
+	if (bytes < 8) {
+		asprintf(error, "%s: short pcapng interface block",
+			 reader->path);
+		return STATUS_ERR;
+	}
+	reader->interfaces = realloc(reader->interfaces,
+				     (reader->num_interfaces + 1) *
+				     sizeof(struct pcap_interface));
+	interface = &reader->interfaces[reader->num_interfaces++];
+	interface->linktype = file_u16(reader, body);
+	interface->units_per_sec = USECS_PER_SEC;
+
+	while (offset + 4 <= bytes) {
+		u16 code = file_u16(reader, body + offset);
+		u16 length = file_u16(reader, body + offset + 2);
+
+		offset += 4;
+		if (code == PCAPNG_OPT_END || offset + length > bytes)
+			break;
+		if (code == PCAPNG_OPT_IF_TSRESOL && length >= 1) {
+			u8 resolution = body[offset];
+			u8 exponent = resolution & 0x7f;
+			int i;
+
+			if (resolution & 0x80) {
+				interface->units_per_sec =
+					exponent < 64 ? 1ULL << exponent : 0;
+			} else {
+				interface->units_per_sec = 1;
+				for (i = 0; i < exponent && i < 20; ++i)
+					interface->units_per_sec *= 10;
+				if (exponent >= 20)
+					interface->units_per_sec = 0;
+			}
+			if (interface->units_per_sec == 0) {
+				asprintf(error, "%s: unsupported if_tsresol %u",
+					 reader->path, resolution);
+				return STATUS_ERR;
+			}
+		}
+		offset += pcapng_pad(length);
+	}
+	return STATUS_OK;
+}
+
+/* Parse the epb_flags option from the options of an Enhanced Packet
+ * Block, returning the direction it records, if any.
+ */
+static enum direction_t parse_packet_options(struct pcap_reader *reader,
+					     const u8 *options, u32 bytes)
+{
+	u32 offset = 0;
+
+	while (offset + 4 <= bytes) {
+		u16 code = file_u16(reader, options + offset);
+		u16 length = file_u16(reader, options + offset + 2);
+
+		offset += 4;
+		if (code == PCAPNG_OPT_END || offset + length > bytes)
+			break;
+		if (code == PCAPNG_OPT_EPB_FLAGS && length == 4) {
+			u32 flags = file_u32(reader, options + offset);
+
+			switch (flags & PCAPNG_EPB_DIRECTION_MASK) {
+			case PCAPNG_EPB_INBOUND:
+				return DIRECTION_INBOUND;
+			case PCAPNG_EPB_OUTBOUND:
+				return DIRECTION_OUTBOUND;
+			}
+		}
+		offset += pcapng_pad(length);
+	}
+	return DIRECTION_INVALID;
+}
+
+/* Read the next record of a classic pcap file into the buffer. */
+static int next_pcap_record(struct pcap_reader *reader,
+			    const struct pcap_interface **interface,
+			    const u8 **data, u32 *bytes, u32 *original_bytes,
+			    u64 *timestamp, enum direction_t *direction,
+			    char **error)
+{
+	struct pcap_record_header header;
+	u32 ts_sec, ts_frac;
+
+	if (read_bytes(reader, &header, sizeof(header), true, error))
+		return STATUS_ERR;
+	ts_sec = file_u32(reader, (u8 *)&header.ts_sec);
+	ts_frac = file_u32(reader, (u8 *)&header.ts_frac);
+	*bytes = file_u32(reader, (u8 *)&header.caplen);
+	*original_bytes = file_u32(reader, (u8 *)&header.len);
+	if (grow_buffer(reader, *bytes, error) ||
+	    read_bytes(reader, reader->buffer, *bytes, false, error))
+		return STATUS_ERR;
+
+	*interface = &reader->pcap;
+	*data = reader->buffer;
+	*timestamp = (u64)ts_sec * reader->pcap.units_per_sec + ts_frac;
+	*direction = DIRECTION_INVALID;
+	return STATUS_OK;
+}
+
+/* Read pcapng blocks until the next Enhanced Packet Block. */
+static int next_pcapng_packet(struct pcap_reader *reader,
+			      const struct pcap_interface **interface,
+			      const u8 **data, u32 *bytes,
+			      u32 *original_bytes, u64 *timestamp,
+			      enum direction_t *direction, char **error)
+{
+	while (1) {
+		u8 header[8];
+		u32 type, block_bytes, body_bytes;
+		const u8 *body = NULL;
+
+		if (read_bytes(reader, header, sizeof(header), true, error))
+			return STATUS_ERR;
+		memcpy(&type, header, sizeof(type));
+		if (type == PCAPNG_SECTION_HEADER) {
+			if (fseek(reader->file, -4, SEEK_CUR) != 0) {
+				asprintf(error, "%s: fseek: %s",
+					 reader->path, strerror(errno));
+				return STATUS_ERR;
+			}
+			if (read_section_header(reader, error))
+				return STATUS_ERR;
+			continue;
+		}
+
+		type = file_u32(reader, header);
+		block_bytes = file_u32(reader, header + 4);
+		if (block_bytes < 12 || block_bytes % 4 != 0) {
+			asprintf(error, "%s: bad pcapng block length %u",
+				 reader->path, block_bytes);
+			return STATUS_ERR;
+		}
+		body_bytes = block_bytes - 12;
+		if (grow_buffer(reader, block_bytes - 8, error) ||
+		    read_bytes(reader, reader->buffer, block_bytes - 8,
+			       false, error))
+			return STATUS_ERR;
+		body = reader->buffer;
+
+		if (type == PCAPNG_INTERFACE) {
+			if (parse_interface(reader, body, body_bytes, error))
+				return STATUS_ERR;
+		} else if (type == PCAPNG_ENHANCED_PACKET) {
+			u32 interface_id, captured;
+
+			if (body_bytes < 20)
+				goto bad_block;
+			interface_id = file_u32(reader, body);
+			captured = file_u32(reader, body + 12);
+			if (interface_id >= reader->num_interfaces ||
+			    20 + pcapng_pad(captured) > body_bytes)
+				goto bad_block;
+			*interface = &reader->interfaces[interface_id];
+			*timestamp = ((u64)file_u32(reader, body + 4) << 32 |
+				      file_u32(reader, body + 8));
+			*data = body + 20;
+			*bytes = captured;
+			*original_bytes = file_u32(reader, body + 16);
+			*direction = parse_packet_options(
+				reader, body + 20 + pcapng_pad(captured),
+				body_bytes - 20 - pcapng_pad(captured));
+			return STATUS_OK;
+		}
+		/* Skip other blocks, e.g. statistics or name resolution. */
+	}
+
+bad_block:
+	asprintf(error, "%s: bad pcapng packet block", reader->path);
+	return STATUS_ERR;
+}
+
+struct pcap_reader *pcap_reader_open(const char *path, char **error)
+{
+	struct pcap_reader *reader = calloc(1, sizeof(struct pcap_reader));
+	struct pcap_file_header header;
+	u32 magic;
+
+	reader->path = strdup(path);
+	reader->file = fopen(path, "r");
+	if (reader->file == NULL) {
+		asprintf(error, "%s: %s", path, strerror(errno));
+		goto error_out;
+	}
+	if (read_bytes(reader, &magic, sizeof(magic), false, error))
+		goto error_out;
+
+	if (magic == PCAPNG_SECTION_HEADER) {
+		reader->is_pcapng = true;
+		if (read_section_header(reader, error))
+			goto error_out;
+		return reader;
+	}
+
+	if (magic == swap32(PCAP_MAGIC_USECS) ||
+	    magic == swap32(PCAP_MAGIC_NSECS)) {
+		reader->swapped = true;
+		magic = swap32(magic);
+	}
+	if (magic != PCAP_MAGIC_USECS && magic != PCAP_MAGIC_NSECS) {
+		asprintf(error, "%s: not a pcap or pcapng file", path);
+		goto error_out;
+	}
+	header.magic = magic;
+	if (read_bytes(reader, &header.version_major,
+		       sizeof(header) - sizeof(header.magic), false, error))
+		goto error_out;
+	reader->pcap.linktype = file_u32(reader, (u8 *)&header.linktype);
+	reader->pcap.units_per_sec = (magic == PCAP_MAGIC_NSECS ?
+				      NSECS_PER_SEC : USECS_PER_SEC);
+	if (!is_supported_linktype(reader->pcap.linktype)) {
+		asprintf(error, "%s: unsupported link type %u",
+			 path, reader->pcap.linktype);
+		goto error_out;
+	}
+	return reader;
+
+error_out:
+	pcap_reader_free(reader);
+	return NULL;
+}
+
+void pcap_reader_free(struct pcap_reader *reader)
+{
+	if (reader->file != NULL)
+		fclose(reader->file);
+	free(reader->path);
+	free(reader->interfaces);
+	free(reader->buffer);
+	free(reader);
+}
+
+/* Were all the headers of the given packet, parsed from a record of
+ * which only the given number of bytes of IP datagram were captured,
+ * within those bytes? We only take truncated TCP and UDP packets, since
+ * we'd parse garbage from the missing parts of SCTP chunks or of the
+ * IP packets echoed by ICMP messages.
+ */
+static bool headers_captured(struct packet *packet, u32 captured)
+{
+	if (packet->sctp != NULL || packet->icmpv4 != NULL ||
+	    packet->icmpv6 != NULL)
+		return false;
+	if (packet->tcp == NULL && packet->udp == NULL &&
+	    packet->udplite == NULL)
+		return false;
+	return packet_payload(packet) - packet_start(packet) <= captured;
+}
+
+/* Warn about an IP packet record that we're skipping, and count it.
+ * We only print the first line of the reason, leaving out any dump of
+ * the packet.
+ */
+static void skip_record(struct pcap_reader *reader, const char *reason)
+{
+	++reader->num_skipped;
+	fprintf(stderr, "%s: skipping packet record %llu: %.*s\n",
+		reader->path, reader->num_records,
+		(int)strcspn(reason, "\n"), reason);
+}
+
+int pcap_reader_next(struct pcap_reader *reader,
+		     struct packet **packet,
+		     enum direction_t *direction,
+		     char **error)
+{
+	*packet = NULL;
+	*error = NULL;
+
+	while (1) {
+		const struct pcap_interface *interface = NULL;
+		const u8 *data = NULL;
+		u32 bytes = 0, original_bytes = 0, offset = 0;
+		u32 captured = 0, ip_bytes = 0;
+		u64 timestamp = 0;
+		u16 ether_type = 0;
+		enum direction_t link_direction = DIRECTION_INVALID;
+		char *parse_error = NULL;
+		int result;
+
+		if (reader->is_pcapng)
+			result = next_pcapng_packet(reader, &interface, &data,
+						    &bytes, &original_bytes,
+						    &timestamp, direction,
+						    error);
+		else
+			result = next_pcap_record(reader, &interface, &data,
+						  &bytes, &original_bytes,
+						  &timestamp, direction,
+						  error);
+		if (result != STATUS_OK)
+			return STATUS_ERR;
+		++reader->num_records;
+
+		/* Skip packets of other protocols quietly. */
+		if (find_ip_datagram(interface->linktype, data, bytes,
+				     &offset, &ether_type, &link_direction))
+			continue;
+		if (*direction == DIRECTION_INVALID)
+			*direction = link_direction;
+
+		captured = bytes - offset;
+		ip_bytes = captured;
+		if (original_bytes > bytes)
+			ip_bytes = original_bytes - offset;
+		if (ip_bytes > MAX_PACKET_BYTES) {
+			skip_record(reader, "packet too big");
+			continue;
+		}
+
+		*packet = packet_new(ip_bytes);
+		memcpy((*packet)->buffer, data + offset, captured);
+		memset((*packet)->buffer + captured, 0, ip_bytes - captured);
+		if (parse_packet(*packet, ip_bytes, ether_type,
+				 &parse_error) != PACKET_OK) {
+			skip_record(reader, parse_error ? parse_error :
+				    "unparseable packet");
+			free(parse_error);
+			packet_free(*packet);
+			*packet = NULL;
+			continue;
+		}
+		if (captured < ip_bytes) {
+			if (!headers_captured(*packet, captured)) {
+				skip_record(reader, "headers truncated by "
+					    "snap length");
+				packet_free(*packet);
+				*packet = NULL;
+				continue;
+			}
+			(*packet)->captured_bytes = captured;
+		}
+		(*packet)->time_usecs =
+			timestamp_to_usecs(timestamp,
+					   interface->units_per_sec);
+		return STATUS_OK;
+	}
+}
+
+u64 pcap_reader_skipped(const struct pcap_reader *reader)
+{
+	return reader->num_skipped;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for reading the IP packets in a pcap or pcapng file, such
+ * as one written by --capture or by tcpdump.
+ */
+
+#ifndef __PCAP_READER_H__
+#define __PCAP_READER_H__
+
+#include "types.h"
+
+#include "packet.h"
+
+struct pcap_reader;
+
+/* Open the given pcap or pcapng file. On success, returns a new reader.
+ * On failure, returns NULL and fills in *error.
+ */
+extern struct pcap_reader *pcap_reader_open(const char *path, char **error);
+
+/* Close the file and free the reader. */
+extern void pcap_reader_free(struct pcap_reader *reader);
+
+/* Read the next IPv4 or IPv6 packet in the file, skipping packets of
+ * other protocols, and warning about and counting packets we can't
+ * parse (e.g. with headers cut off by the snap length). A packet whose
+ * payload was cut off by the snap length keeps its original length,
+ * with captured_bytes set and the missing bytes zero. On success,
+ * returns STATUS_OK and fills in *packet with a newly-allocated,
+ * parsed packet whose time_usecs is the capture timestamp, and
+ * *direction with the direction the file recorded for it:
+ * DIRECTION_OUTBOUND for packets the capturing host sent,
+ * DIRECTION_INBOUND for packets it received, or DIRECTION_INVALID if
+ * the file doesn't say. At the end of the file, returns STATUS_ERR
+ * with *packet and *error NULL. On error, returns STATUS_ERR and fills
+ * in *error.
+ */
+extern int pcap_reader_next(struct pcap_reader *reader,
+			    struct packet **packet,
+			    enum direction_t *direction,
+			    char **error);
+
+/* Return the number of IP packets pcap_reader_next() has skipped. */
+extern u64 pcap_reader_skipped(const struct pcap_reader *reader);
+
+#endif /* __PCAP_READER_H__ */
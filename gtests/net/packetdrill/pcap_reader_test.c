@@ -0,0 +1,145 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for reading pcap files.
+ */
+
+#include "pcap_reader.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checksum.h"
+#include "pcap.h"
+
+#define TEST_PAYLOAD_BYTES	1000
+
+/* Write a classic pcap record of an IPv4/TCP packet with the given
+ * payload, of which only the first caplen bytes of the datagram are
+ * in the file.
+ */
+static void write_tcp_record(FILE *f, u32 ts_usecs, u32 caplen)
+{
+	const u32 len = 20 + 20 + TEST_PAYLOAD_BYTES;
+	struct pcap_record_header header = {
+		.ts_sec = 1,
+		.ts_frac = ts_usecs,
+		.caplen = caplen,
+		.len = len,
+	};
+	u8 data[20 + 20 + TEST_PAYLOAD_BYTES];
+	int i;
+
+	memset(data, 0, sizeof(data));
+	data[0] = 0x45;				/* IPv4, 20-byte header */
+	data[2] = len >> 8;			/* tot_len */
+	data[3] = len & 0xff;
+	data[8] = 64;				/* ttl */
+	data[9] = 6;				/* TCP */
+	memcpy(data + 12, "\xc0\xa8\x00\x01\xc0\x00\x02\x01", 8);
+	data[20] = 0x1f;			/* sport 8080 */
+	data[21] = 0x90;
+	data[22] = 0xbc;			/* dport 48328 */
+	data[23] = 0xc8;
+	data[32] = 0x50;			/* 20-byte header */
+	data[33] = 0x18;			/* PSH|ACK */
+	memcpy(data + 10, &(u16){ ipv4_checksum(data, 20) }, 2);
+	for (i = 0; i < TEST_PAYLOAD_BYTES; ++i)
+		data[40 + i] = i + 1;
+
+	assert(fwrite(&header, sizeof(header), 1, f) == 1);
+	assert(fwrite(data, caplen, 1, f) == 1);
+}
+
+static void test_read_truncated_records(void)
+{
+	char path[] = "/tmp/pcap_reader_test.XXXXXX";
+	struct pcap_file_header header = {
+		.magic = PCAP_MAGIC_USECS,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = 65535,
+		.linktype = LINKTYPE_RAW,
+	};
+	struct pcap_reader *reader = NULL;
+	struct packet *packet = NULL;
+	enum direction_t direction = DIRECTION_INVALID;
+	char *error = NULL;
+	int fd = mkstemp(path);
+	FILE *f = fdopen(fd, "w");
+
+	assert(f != NULL);
+	assert(fwrite(&header, sizeof(header), 1, f) == 1);
+	write_tcp_record(f, 1, 20 + 20 + TEST_PAYLOAD_BYTES);	/* whole */
+	write_tcp_record(f, 2, 20 + 20 + 10);	/* payload truncated */
+	write_tcp_record(f, 3, 20 + 10);	/* TCP header truncated */
+	write_tcp_record(f, 4, 20 + 20 + TEST_PAYLOAD_BYTES);	/* whole */
+	assert(fclose(f) == 0);
+
+	reader = pcap_reader_open(path, &error);
+	assert(reader != NULL);
+
+	/* A whole record. */
+	assert(pcap_reader_next(reader, &packet, &direction, &error) ==
+	       STATUS_OK);
+	assert(packet->ip_bytes == 20 + 20 + TEST_PAYLOAD_BYTES);
+	assert(packet->captured_bytes == 0);
+	assert(packet_payload_len(packet) == TEST_PAYLOAD_BYTES);
+	assert(packet_captured_payload_len(packet) == TEST_PAYLOAD_BYTES);
+	assert(packet->time_usecs == 1000001);
+	packet_free(packet);
+
+	/* A record cut off in its payload keeps its original length. */
+	assert(pcap_reader_next(reader, &packet, &direction, &error) ==
+	       STATUS_OK);
+	assert(packet->ip_bytes == 20 + 20 + TEST_PAYLOAD_BYTES);
+	assert(packet->captured_bytes == 20 + 20 + 10);
+	assert(packet->tcp != NULL);
+	assert(packet_payload_len(packet) == TEST_PAYLOAD_BYTES);
+	assert(packet_captured_payload_len(packet) == 10);
+	assert(packet_payload(packet)[9] == 10);
+	assert(packet_payload(packet)[10] == 0);
+	assert(packet->time_usecs == 1000002);
+	packet_free(packet);
+
+	/* A record cut off in its TCP header is skipped and counted. */
+	assert(pcap_reader_next(reader, &packet, &direction, &error) ==
+	       STATUS_OK);
+	assert(packet->captured_bytes == 0);
+	assert(packet->time_usecs == 1000004);
+	assert(pcap_reader_skipped(reader) == 1);
+	packet_free(packet);
+
+	/* Then the end of the file. */
+	assert(pcap_reader_next(reader, &packet, &direction, &error) ==
+	       STATUS_ERR);
+	assert(packet == NULL);
+	assert(error == NULL);
+
+	pcap_reader_free(reader);
+	unlink(path);
+}
+
+int main(void)
+{
+	test_read_truncated_records();
+	return 0;
+}
@@ -0,0 +1,315 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of --pcap_to_script.
+ *
+ * We pick the connection from the first packet that matches, and
+ * decide which side is local from the direction the capture recorded,
+ * if any, or else from the handshake: the side that sends a SYN-ACK is
+ * local, and otherwise we assume the capture was taken on the receiver
+ * of the first packet, as on a server.
+ *
+ * If the capture has the SYN, we start the script with the system
+ * calls to set up a listening or connecting socket, so the script can
+ * run as is, apart from the reads and writes behind the data, which
+ * the capture can't tell us about. If the capture starts in the
+ * middle of the connection, the sequence numbers are relative to the
+ * first ones we see.
+ */
+
+#include "pcap_to_script.h"
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ip.h"
+#include "ipv6.h"
+#include "logging.h"
+#include "packet_to_string.h"
+#include "pcap_reader.h"
+#include "run_packet.h"
+#include "socket.h"
+
+/* The state of a conversion. */
+struct converter {
+	const struct config *config;
+	FILE *out;
+	bool have_flow;			/* picked the connection yet? */
+	struct tuple outbound;		/* local to remote live addresses */
+	bool passive;			/* did the remote side send the SYN? */
+	bool accepted;			/* written the accept() yet? */
+	bool know_local_isn;
+	bool know_remote_isn;
+	u32 local_isn;
+	u32 remote_isn;
+	s64 last_usecs;			/* time of the last packet we wrote */
+	int lines;			/* timed lines we wrote */
+	int packets;			/* packets we wrote */
+};
+
+/* Write the time of a packet line, relative to the previous packet, or
+ * 0 if it is the first line of the script.
+ */
+static void write_time(struct converter *converter, s64 time_usecs)
+{
+	s64 delta_usecs = time_usecs - converter->last_usecs;
+
+	if (converter->packets == 0)
+		delta_usecs = 0;
+	/* Timestamps in a capture can step backwards (e.g. when the
+	 * system clock is set, or packets are captured on several
+	 * CPUs), but script times can't, so we write such a packet at
+	 * the time of the previous one, and measure the next packet
+	 * from there.
+	 */
+	if (delta_usecs < 0) {
+		delta_usecs = 0;
+		time_usecs = converter->last_usecs;
+	}
+	if (converter->lines++ == 0) {
+		fputs("0", converter->out);
+	} else if (delta_usecs == 0) {
+		fputs("+0", converter->out);
+	} else {
+		fprintf(converter->out, "+%lld.%06lld",
+			delta_usecs / 1000000, delta_usecs % 1000000);
+	}
+	converter->last_usecs = time_usecs;
+}
+
+/* Write the system calls that set up the socket for the connection. */
+static void write_socket_setup(struct converter *converter)
+{
+	FILE *out = converter->out;
+
+	fputs("0 socket(..., SOCK_STREAM, IPPROTO_TCP) = 3\n", out);
+	++converter->lines;
+	if (converter->passive) {
+		fputs("+0 setsockopt(3, SOL_SOCKET, SO_REUSEADDR, [1], 4)"
+		      " = 0\n", out);
+		fputs("+0 bind(3, ..., ...) = 0\n", out);
+		fputs("+0 listen(3, 1) = 0\n", out);
+	} else {
+		fputs("+0 fcntl(3, F_SETFL, O_RDWR|O_NONBLOCK) = 0\n", out);
+		fputs("+0 connect(3, ..., ...) = -1 EINPROGRESS"
+		      " (Operation now in progress)\n", out);
+	}
+	fputc('\n', out);
+}
+
+/* See if the packet is from the connection we want, and if so pick it
+ * and write the start of the script.
+ */
+static bool pick_flow(struct converter *converter,
+		      const struct packet *packet,
+		      enum direction_t direction)
+{
+	const struct config *config = converter->config;
+	const u16 port = config->pcap_to_script_port;
+	struct tuple tuple;
+	bool local_sent = false;	/* did the local side send it? */
+	bool is_first_syn = packet->tcp->syn && !packet->tcp->ack;
+
+	get_packet_tuple(packet, &tuple);
+	if (port != 0) {
+		if (ntohs(tuple.src.port) == port)
+			local_sent = true;
+		else if (ntohs(tuple.dst.port) == port)
+			local_sent = false;
+		else
+			return false;
+	} else if (direction != DIRECTION_INVALID) {
+		local_sent = (direction == DIRECTION_OUTBOUND);
+	} else {
+		local_sent = packet->tcp->syn && packet->tcp->ack;
+	}
+
+	memset(&converter->outbound, 0, sizeof(converter->outbound));
+	if (local_sent)
+		converter->outbound = tuple;
+	else
+		reverse_tuple(&tuple, &converter->outbound);
+	converter->have_flow = true;
+	converter->passive = !local_sent;
+
+	fprintf(converter->out,
+		"// Converted from %s by packetdrill --pcap_to_script.\n",
+		config->pcap_to_script_path);
+	if (packet->ipv6 != NULL)
+		fputs("--ip_version=ipv6\n", converter->out);
+	fputc('\n', converter->out);
+	if (is_first_syn) {
+		write_socket_setup(converter);
+	} else {
+		converter->accepted = true;	/* no listener to accept */
+		fputs("// The capture starts after the handshake, so this "
+		      "script needs a socket\n"
+		      "// set up for the connection before the packets.\n\n",
+		      converter->out);
+	}
+	return true;
+}
+
+/* Return the direction of the packet in the connection we picked, or
+ * DIRECTION_INVALID if it's not part of it.
+ */
+static enum direction_t flow_direction(const struct converter *converter,
+				       const struct packet *packet)
+{
+	struct tuple tuple, inbound;
+
+	get_packet_tuple(packet, &tuple);
+	memset(&inbound, 0, sizeof(inbound));	/* is_equal_tuple is memcmp */
+	reverse_tuple(&converter->outbound, &inbound);
+	if (is_equal_tuple(&tuple, &converter->outbound))
+		return DIRECTION_OUTBOUND;
+	if (is_equal_tuple(&tuple, &inbound))
+		return DIRECTION_INBOUND;
+	return DIRECTION_INVALID;
+}
+
+static const char *ecn_to_string(const struct packet *packet)
+{
+	u8 ecn = (packet->ipv4 != NULL ? ipv4_ecn_bits(packet->ipv4) :
+		  ipv6_ecn_bits(packet->ipv6));
+
+	switch (ecn) {
+	case IP_ECN_ECT0:	return "[ect0] ";
+	case IP_ECN_ECT1:	return "[ect1] ";
+	case IP_ECN_CE:		return "[ce] ";
+	}
+	return "";
+}
+
+/* Write a script line for the given live packet of the connection. */
+static int write_packet(struct converter *converter, struct packet *packet,
+			enum direction_t direction, char **error)
+{
+	const bool outbound = (direction == DIRECTION_OUTBOUND);
+	bool *know_own_isn = (outbound ? &converter->know_local_isn :
+			      &converter->know_remote_isn);
+	bool *know_peer_isn = (outbound ? &converter->know_remote_isn :
+			       &converter->know_local_isn);
+	u32 *own_isn = (outbound ? &converter->local_isn :
+			&converter->remote_isn);
+	u32 *peer_isn = (outbound ? &converter->remote_isn :
+			 &converter->local_isn);
+	struct packet *script_packet = NULL;
+	char *text = NULL;
+	int len;
+
+	/* Learn the ISNs from the SYNs, or pick ones that make the first
+	 * sequence numbers we see 1 if the capture doesn't have them.
+	 */
+	if (packet->tcp->syn || !*know_own_isn) {
+		*own_isn = ntohl(packet->tcp->seq) - (packet->tcp->syn ? 0 : 1);
+		*know_own_isn = true;
+	}
+	if (packet->tcp->ack && !*know_peer_isn) {
+		*peer_isn = ntohl(packet->tcp->ack_seq) - 1;
+		*know_peer_isn = true;
+	}
+
+	/* Map the live packet into script space. */
+	script_packet = packet_copy(packet);
+	script_packet->tcp->seq = htonl(ntohl(packet->tcp->seq) - *own_isn);
+	if (packet->tcp->ack)
+		script_packet->tcp->ack_seq =
+			htonl(ntohl(packet->tcp->ack_seq) - *peer_isn);
+	if (offset_sack_blocks(script_packet, -*peer_isn, error))
+		goto error_out;
+
+	/* Scripts usually leave the window of outbound packets to the
+	 * kernel.
+	 */
+	if (outbound)
+		script_packet->flags |= FLAG_WIN_NOCHECK;
+
+	if (packet_to_string(script_packet, DUMP_SHORT, &text, error))
+		goto error_out;
+	len = strlen(text);
+	while (len > 0 && text[len - 1] == ' ')
+		text[--len] = '\0';
+
+	write_time(converter, packet->time_usecs);
+	fprintf(converter->out, " %c %s%s\n", outbound ? '>' : '<',
+		ecn_to_string(packet), text);
+	++converter->packets;
+
+	/* The handshake is done once the local side's SYN is ACKed. */
+	if (converter->passive && !converter->accepted &&
+	    !outbound && packet->tcp->ack && !packet->tcp->syn &&
+	    converter->know_local_isn &&
+	    ntohl(script_packet->tcp->ack_seq) == 1) {
+		fputs("+0 accept(3, ..., ...) = 4\n", converter->out);
+		converter->accepted = true;
+	}
+
+	free(text);
+	packet_free(script_packet);
+	return STATUS_OK;
+
+error_out:
+	free(text);
+	packet_free(script_packet);
+	return STATUS_ERR;
+}
+
+int pcap_to_script(const struct config *config, FILE *out, char **error)
+{
+	struct converter converter;
+	struct pcap_reader *reader = NULL;
+	struct packet *packet = NULL;
+	enum direction_t direction = DIRECTION_INVALID;
+	int result = STATUS_OK;
+
+	memset(&converter, 0, sizeof(converter));
+	converter.config = config;
+	converter.out = out;
+
+	reader = pcap_reader_open(config->pcap_to_script_path, error);
+	if (reader == NULL)
+		return STATUS_ERR;
+
+	while (pcap_reader_next(reader, &packet, &direction, error) ==
+	       STATUS_OK) {
+		if (packet->tcp != NULL &&
+		    (converter.have_flow ||
+		     pick_flow(&converter, packet, direction))) {
+			direction = flow_direction(&converter, packet);
+			if (direction != DIRECTION_INVALID)
+				result = write_packet(&converter, packet,
+						      direction, error);
+		}
+		packet_free(packet);
+		if (result != STATUS_OK)
+			break;
+	}
+	pcap_reader_free(reader);
+	if (result != STATUS_OK || *error != NULL)
+		return STATUS_ERR;
+
+	if (!converter.have_flow) {
+		asprintf(error, "%s: no matching TCP connection",
+			 config->pcap_to_script_path);
+		return STATUS_ERR;
+	}
+	DEBUGP("--pcap_to_script: wrote %d packets\n", converter.packets);
+	return STATUS_OK;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for --pcap_to_script, which converts a TCP connection in a
+ * capture file into a packetdrill script.
+ */
+
+#ifndef __PCAP_TO_SCRIPT_H__
+#define __PCAP_TO_SCRIPT_H__
+
+#include "types.h"
+
+#include <stdio.h>
+#include "config.h"
+
+/* Write to the given stream a script for one TCP connection in the
+ * capture file at config->pcap_to_script_path: the one whose local
+ * port is config->pcap_to_script_port, if set, or else the first one
+ * in the file. Packets the local side sent become outbound packets to
+ * expect, and packets the remote side sent become inbound packets to
+ * inject, each timed relative to the previous line. Sequence numbers
+ * follow the script conventions: relative to the ISNs, which are 0 in
+ * the script. We read and write one packet at a time, so memory use
+ * doesn't grow with the capture. Returns STATUS_OK on success; on
+ * failure returns STATUS_ERR and fills in *error.
+ */
+extern int pcap_to_script(const struct config *config, FILE *out,
+			  char **error);
+
+#endif /* __PCAP_TO_SCRIPT_H__ */
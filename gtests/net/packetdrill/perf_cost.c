@@ -0,0 +1,304 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of --perf_cost.
+ *
+ * Each thread that makes system calls or injects packets opens its own
+ * group of counters on itself, led by task-clock, and reads the whole
+ * group with one read(2) before and after each unit of work. We count
+ * cycles and instructions in kernel mode only, so they measure the
+ * kernel's work and not ours. There is no per-task counter of softirq
+ * time, so we count softirq entries with the irq:softirq_entry
+ * tracepoint instead; softirqs that run in the context of the thread
+ * (e.g. the receive processing of a packet we write to the tun device)
+ * are charged to it by task-clock, cycles and instructions too.
+ */
+
+#include "perf_cost.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "tracefs.h"
+
+#ifdef linux
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+/* The cost charged to one script line. */
+struct perf_line_cost {
+	const char *what;		/* what the line does, or NULL */
+	u64 count;			/* times the line's work ran */
+	u64 totals[NUM_PERF_COUNTERS];	/* sum of counter deltas */
+};
+
+struct perf_costs {
+	struct perf_line_cost *lines;	/* indexed by line number */
+	int num_lines;			/* allocated length of lines */
+};
+
+/* Which counters we could open, as found by perf_costs_new(). */
+static bool perf_available[NUM_PERF_COUNTERS];
+static u64 perf_softirq_id;		/* tracepoint id of softirq_entry */
+
+/* The calling thread's counters. */
+static __thread int perf_fds[NUM_PERF_COUNTERS] = { -1, -1, -1, -1 };
+static __thread bool perf_opened;
+
+static const char *perf_counter_names[NUM_PERF_COUNTERS] = {
+	[PERF_TASK_CLOCK]	= "task-clock",
+	[PERF_CYCLES]		= "cycles",
+	[PERF_INSTRUCTIONS]	= "instructions",
+	[PERF_SOFTIRQS]		= "softirqs",
+};
+
+/* Read the tracepoint id of irq:softirq_entry from tracefs. */
+static bool read_softirq_entry_id(u64 *id)
+{
+	FILE *f = tracefs_fopen("events/irq/softirq_entry/id");
+	unsigned long long value = 0;
+	int matched = 0;
+
+	if (f == NULL)
+		return false;
+	matched = fscanf(f, "%llu", &value);
+	fclose(f);
+	if (matched != 1)
+		return false;
+	*id = value;
+	return true;
+}
+
+/* Open the given counter on the calling thread, in the group of the
+ * given leader (or as the leader, if group_fd is -1).
+ */
+static int perf_open(enum perf_counter_t counter, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.read_format = PERF_FORMAT_GROUP;
+	switch (counter) {
+	case PERF_TASK_CLOCK:
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = PERF_COUNT_SW_TASK_CLOCK;
+		break;
+	case PERF_CYCLES:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		attr.exclude_user = 1;
+		attr.exclude_hv = 1;
+		break;
+	case PERF_INSTRUCTIONS:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		attr.exclude_user = 1;
+		attr.exclude_hv = 1;
+		break;
+	case PERF_SOFTIRQS:
+		attr.type = PERF_TYPE_TRACEPOINT;
+		attr.config = perf_softirq_id;
+		break;
+	case NUM_PERF_COUNTERS:
+		assert(!"bogus counter");
+		break;
+	}
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/* Open the calling thread's counters: all the available ones, or all
+ * we can if 'probe' is set, noting which those are.
+ */
+static void perf_open_thread(bool probe)
+{
+	int i;
+
+	for (i = 0; i < NUM_PERF_COUNTERS; ++i) {
+		if (!probe && !perf_available[i])
+			continue;
+		if (probe && i == PERF_SOFTIRQS &&
+		    !read_softirq_entry_id(&perf_softirq_id)) {
+			fprintf(stderr, "--perf_cost: no %s counter: "
+				"irq:softirq_entry not found in tracefs\n",
+				perf_counter_names[i]);
+			continue;
+		}
+		perf_fds[i] = perf_open(i, perf_fds[PERF_TASK_CLOCK]);
+		if (perf_fds[i] < 0 && (!probe || i == PERF_TASK_CLOCK))
+			die_perror("--perf_cost: perf_event_open");
+		if (probe) {
+			perf_available[i] = (perf_fds[i] >= 0);
+			if (!perf_available[i]) {
+				fprintf(stderr, "--perf_cost: no %s counter: "
+					"%s\n", perf_counter_names[i],
+					strerror(errno));
+			}
+		}
+	}
+	perf_opened = true;
+}
+
+struct perf_costs *perf_costs_new(void)
+{
+	perf_sample_close();
+	perf_open_thread(true);
+	return calloc(1, sizeof(struct perf_costs));
+}
+
+void perf_costs_free(struct perf_costs *costs)
+{
+	perf_sample_close();
+	free(costs->lines);
+	free(costs);
+}
+
+void perf_sample_read(struct perf_sample *sample)
+{
+	u64 values[1 + NUM_PERF_COUNTERS];	/* count, then values */
+	ssize_t bytes = 0;
+	int i, next = 1;
+
+	if (!perf_opened)
+		perf_open_thread(false);
+
+	bytes = read(perf_fds[PERF_TASK_CLOCK], values, sizeof(values));
+	if (bytes < (ssize_t)sizeof(u64) ||
+	    bytes < (ssize_t)((1 + values[0]) * sizeof(u64)))
+		die_perror("--perf_cost: read");
+
+	/* The group lists its counters in the order we opened them. */
+	memset(sample, 0, sizeof(*sample));
+	for (i = 0; i < NUM_PERF_COUNTERS; ++i) {
+		if (perf_fds[i] >= 0)
+			sample->values[i] = values[next++];
+	}
+}
+
+void perf_sample_close(void)
+{
+	int i;
+
+	for (i = NUM_PERF_COUNTERS - 1; i >= 0; --i) {
+		if (perf_fds[i] >= 0)
+			close(perf_fds[i]);
+		perf_fds[i] = -1;
+	}
+	perf_opened = false;
+}
+
+void perf_costs_add(struct perf_costs *costs, int line_number,
+		    const char *what,
+		    const struct perf_sample *start,
+		    const struct perf_sample *end)
+{
+	struct perf_line_cost *line = NULL;
+	int i;
+
+	assert(line_number >= 0);
+	if (line_number >= costs->num_lines) {
+		int num_lines = line_number + 64;
+
+		costs->lines = realloc(costs->lines,
+				       num_lines * sizeof(*costs->lines));
+		if (costs->lines == NULL)
+			die("--perf_cost: out of memory\n");
+		memset(costs->lines + costs->num_lines, 0,
+		       (num_lines - costs->num_lines) * sizeof(*costs->lines));
+		costs->num_lines = num_lines;
+	}
+	line = &costs->lines[line_number];
+	if (line->what == NULL)
+		line->what = what;
+	++line->count;
+	for (i = 0; i < NUM_PERF_COUNTERS; ++i)
+		line->totals[i] += end->values[i] - start->values[i];
+}
+
+void perf_costs_report(const struct perf_costs *costs,
+		       const char *script_path)
+{
+	int line_number, i;
+
+	fprintf(stderr, "%s: kernel cost per script line:\n", script_path);
+	fprintf(stderr, "%6s %-16s %6s %14s %14s %14s %10s\n",
+		"line", "event", "count", "task-clock(us)", "cycles",
+		"instructions", "softirqs");
+	for (line_number = 0; line_number < costs->num_lines; ++line_number) {
+		const struct perf_line_cost *line = &costs->lines[line_number];
+
+		if (line->count == 0)
+			continue;
+		fprintf(stderr, "%6d %-16s %6llu", line_number, line->what,
+			(unsigned long long)line->count);
+		for (i = 0; i < NUM_PERF_COUNTERS; ++i) {
+			const int width = (i == PERF_SOFTIRQS) ? 10 : 14;
+
+			if (!perf_available[i])
+				fprintf(stderr, " %*s", width, "-");
+			else if (i == PERF_TASK_CLOCK)
+				fprintf(stderr, " %*.3f", width,
+					line->totals[i] / 1000.0);
+			else
+				fprintf(stderr, " %*llu", width,
+					(unsigned long long)line->totals[i]);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+#else  /* !linux */
+
+struct perf_costs *perf_costs_new(void)
+{
+	die("--perf_cost is only supported on Linux\n");
+	return NULL;
+}
+
+void perf_costs_free(struct perf_costs *costs)
+{
+}
+
+void perf_sample_read(struct perf_sample *sample)
+{
+	memset(sample, 0, sizeof(*sample));
+}
+
+void perf_sample_close(void)
+{
+}
+
+void perf_costs_add(struct perf_costs *costs, int line_number,
+		    const char *what,
+		    const struct perf_sample *start,
+		    const struct perf_sample *end)
+{
+}
+
+void perf_costs_report(const struct perf_costs *costs,
+		       const char *script_path)
+{
+}
+
+#endif  /* linux */
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for --perf_cost, which uses perf_event_open(2) counters to
+ * measure the kernel's CPU cost of each system call and each injected
+ * packet, and reports it per script line.
+ */
+
+#ifndef __PERF_COST_H__
+#define __PERF_COST_H__
+
+#include "types.h"
+
+/* The counters we read, in the order we report them. */
+enum perf_counter_t {
+	PERF_TASK_CLOCK,	/* nsecs on CPU, in user or kernel mode */
+	PERF_CYCLES,		/* CPU cycles in kernel mode */
+	PERF_INSTRUCTIONS,	/* instructions in kernel mode */
+	PERF_SOFTIRQS,		/* softirqs entered */
+	NUM_PERF_COUNTERS,
+};
+
+/* A reading of the counters of one thread. */
+struct perf_sample {
+	u64 values[NUM_PERF_COUNTERS];
+};
+
+struct perf_costs;
+
+/* Allocate an empty table of costs, and find which counters this
+ * machine lets us open. Dies if it lets us open none.
+ */
+extern struct perf_costs *perf_costs_new(void);
+
+/* Free the table, and close the calling thread's counters. */
+extern void perf_costs_free(struct perf_costs *costs);
+
+/* Read the calling thread's counters, opening them on first use. */
+extern void perf_sample_read(struct perf_sample *sample);
+
+/* Close the calling thread's counters, if it opened any; for threads
+ * about to exit.
+ */
+extern void perf_sample_close(void);
+
+/* Charge the cost between the two samples, which the calling thread
+ * read, to the given script line. The 'what' string names the work,
+ * e.g. the system call, and must outlive the table.
+ */
+extern void perf_costs_add(struct perf_costs *costs, int line_number,
+			   const char *what,
+			   const struct perf_sample *start,
+			   const struct perf_sample *end);
+
+/* Print the costs of each script line, in line order, to stderr. */
+extern void perf_costs_report(const struct perf_costs *costs,
+			      const char *script_path);
+
+#endif /* __PERF_COST_H__ */
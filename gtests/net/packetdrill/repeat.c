@@ -0,0 +1,381 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation of --repeat.
+ *
+ * We parse the script once, and then fork a child process for each
+ * iteration. Running a script mutates its parse tree (e.g. relative
+ * event times are made absolute), and any failure exits via die(),
+ * possibly from a syscall thread, so a fresh copy-on-write process per
+ * iteration is the simplest way to reset all state. The child streams
+ * text records to the parent over a pipe:
+ *
+ *   T <line> <delta_usecs> <description>   an event timing
+ *   F <line>                               the iteration failed
+ *
+ * and its stderr goes to a temporary file, from which the parent takes
+ * the error message of a failed iteration.
+ */
+
+#include "repeat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "capture.h"
+#include "logging.h"
+#include "run.h"
+#include "stats.h"
+
+/* State of a child process running an iteration. The main thread and
+ * the system call thread both check timing, and either may exit, so
+ * the line numbers are only accessed with atomics.
+ */
+static int repeat_fd = -1;	/* pipe to the parent, or -1 */
+static int repeat_line;		/* line of the current event */
+static int repeat_failed_line;	/* line of the first failed time check */
+static bool repeat_done;	/* did the iteration run to completion? */
+
+/* Timing deltas for one kind of time check of an event line. */
+struct repeat_timing {
+	char *description;		/* e.g. "outbound packet" */
+	s64 *deltas;			/* |delta| of each sample */
+	int num_deltas;
+	int max_deltas;
+	struct repeat_timing *next;
+};
+
+/* Flakiness statistics for one event line, across iterations. */
+struct repeat_line {
+	int line_number;		/* 0 if before any event */
+	int failures;			/* iterations that failed here */
+	char *last_error;		/* error of the last such failure */
+	struct repeat_timing *timings;	/* list of kinds of time checks */
+};
+
+/* Flakiness statistics for all event lines of a script. */
+struct repeat_stats {
+	struct repeat_line *lines;
+	int num_lines;
+	int max_lines;
+};
+
+void repeat_note_event(int line_number)
+{
+	__atomic_store_n(&repeat_line, line_number, __ATOMIC_RELAXED);
+}
+
+void repeat_record_timing(int line_number, const char *description,
+			  s64 delta_usecs, bool failed)
+{
+	int no_line = 0;
+
+	if (repeat_fd < 0)
+		return;
+	if (failed)
+		__atomic_compare_exchange_n(&repeat_failed_line, &no_line,
+					    line_number, false,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	dprintf(repeat_fd, "T %d %lld %s\n",
+		line_number, delta_usecs, description);
+}
+
+/* When an iteration exits early, tell the parent which line to blame:
+ * the first failed timing check, or else the event being run.
+ */
+static void repeat_child_exit(void)
+{
+	int line_number = __atomic_load_n(&repeat_failed_line,
+					  __ATOMIC_RELAXED);
+
+	if (repeat_done)
+		return;
+	if (line_number == 0)
+		line_number = __atomic_load_n(&repeat_line, __ATOMIC_RELAXED);
+	dprintf(repeat_fd, "F %d\n", line_number);
+}
+
+/* Find or add the statistics for the given line. */
+static struct repeat_line *repeat_stats_line(struct repeat_stats *stats,
+					     int line_number)
+{
+	struct repeat_line *line = NULL;
+	int i;
+
+	for (i = 0; i < stats->num_lines; ++i) {
+		if (stats->lines[i].line_number == line_number)
+			return &stats->lines[i];
+	}
+	if (stats->num_lines == stats->max_lines) {
+		stats->max_lines = stats->max_lines ? 2 * stats->max_lines : 16;
+		stats->lines = realloc(stats->lines,
+				       stats->max_lines * sizeof(*stats->lines));
+	}
+	line = &stats->lines[stats->num_lines++];
+	memset(line, 0, sizeof(*line));
+	line->line_number = line_number;
+	return line;
+}
+
+/* Add a timing sample for the given line and kind of time check. */
+static void repeat_stats_add_timing(struct repeat_stats *stats,
+				    int line_number, const char *description,
+				    s64 delta_usecs)
+{
+	struct repeat_line *line = repeat_stats_line(stats, line_number);
+	struct repeat_timing *timing = NULL;
+
+	for (timing = line->timings; timing != NULL; timing = timing->next) {
+		if (strcmp(timing->description, description) == 0)
+			break;
+	}
+	if (timing == NULL) {
+		timing = calloc(1, sizeof(*timing));
+		timing->description = strdup(description);
+		timing->next = line->timings;
+		line->timings = timing;
+	}
+	if (timing->num_deltas == timing->max_deltas) {
+		timing->max_deltas =
+			timing->max_deltas ? 2 * timing->max_deltas : 16;
+		timing->deltas = realloc(timing->deltas,
+					 timing->max_deltas * sizeof(s64));
+	}
+	timing->deltas[timing->num_deltas++] = llabs(delta_usecs);
+}
+
+/* Parse one record streamed by an iteration. Returns the line the
+ * iteration failed at for an "F" record, or -1.
+ */
+static int repeat_parse_record(struct repeat_stats *stats, char *record)
+{
+	int line_number = 0, offset = 0;
+	long long delta_usecs = 0;
+
+	record[strcspn(record, "\n")] = '\0';
+	if (sscanf(record, "T %d %lld %n", &line_number, &delta_usecs,
+		   &offset) == 2 && offset > 0) {
+		repeat_stats_add_timing(stats, line_number, record + offset,
+					delta_usecs);
+	} else if (sscanf(record, "F %d", &line_number) == 1) {
+		return line_number;
+	} else {
+		DEBUGP("bad --repeat record: '%s'\n", record);
+	}
+	return -1;
+}
+
+/* Return the last non-empty line of the given file, malloc-ed. */
+static char *last_line(FILE *f)
+{
+	char buf[1024];
+	char *last = NULL;
+
+	rewind(f);
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		buf[strcspn(buf, "\n")] = '\0';
+		if (buf[0] == '\0')
+			continue;
+		free(last);
+		last = strdup(buf);
+	}
+	return last;
+}
+
+/* Copy the given file to stderr. */
+static void copy_to_stderr(FILE *f)
+{
+	char buf[1024];
+	size_t bytes;
+
+	rewind(f);
+	while ((bytes = fread(buf, 1, sizeof(buf), f)) > 0)
+		fwrite(buf, 1, bytes, stderr);
+}
+
+/* Run one iteration in a child process, and add its records to the
+ * statistics. Returns true if the iteration passed.
+ */
+static bool run_iteration(struct config *config, struct script *script,
+			  struct repeat_stats *stats)
+{
+	char record[1024];
+	int fds[2];
+	int status = 0;
+	int failed_line = 0;
+	bool passed = false;
+	FILE *err = NULL, *in = NULL;
+	pid_t pid;
+
+	err = tmpfile();
+	if (err == NULL)
+		die_perror("tmpfile");
+	if (pipe(fds) != 0)
+		die_perror("pipe");
+	/* Keep commands run by the script from holding the pipe open. */
+	if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) != 0 ||
+	    fcntl(fds[1], F_SETFD, FD_CLOEXEC) != 0)
+		die_perror("fcntl(FD_CLOEXEC)");
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0)
+		die_perror("fork");
+	if (pid == 0) {
+		close(fds[0]);
+		repeat_fd = fds[1];
+		if (dup2(fileno(err), STDERR_FILENO) < 0)
+			die_perror("dup2");
+		atexit(repeat_child_exit);
+		run_script(config, script);
+		repeat_done = true;
+		exit(EXIT_SUCCESS);
+	}
+
+	/* The child captured this run, so the next one gets a new file. */
+	if (config->capture_path != NULL)
+		capture_count_run();
+
+	close(fds[1]);
+	in = fdopen(fds[0], "r");
+	if (in == NULL)
+		die_perror("fdopen");
+	while (fgets(record, sizeof(record), in) != NULL) {
+		int line = repeat_parse_record(stats, record);
+
+		if (line >= 0)
+			failed_line = line;
+	}
+	fclose(in);
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			die_perror("waitpid");
+	}
+
+	passed = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+	if (!passed) {
+		struct repeat_line *line =
+			repeat_stats_line(stats, failed_line);
+
+		++line->failures;
+		free(line->last_error);
+		line->last_error = last_line(err);
+		if (WIFSIGNALED(status) && line->last_error == NULL)
+			asprintf(&line->last_error, "killed by signal %d",
+				 WTERMSIG(status));
+	}
+	if (config->verbose)
+		copy_to_stderr(err);
+	fclose(err);
+	return passed;
+}
+
+static int compare_lines(const void *a, const void *b)
+{
+	const struct repeat_line *x = a, *y = b;
+
+	return x->line_number - y->line_number;
+}
+
+/* Print the flakiness report for the script. */
+static void repeat_report(const struct config *config,
+			  struct repeat_stats *stats, int failures)
+{
+	const char *path = config->script_path;
+	const int n = config->repeat;
+	const double tolerance = config->tolerance_usecs;
+	struct repeat_timing *timing;
+	int i;
+
+	printf("%s: %d/%d iterations failed (%.1f%%)\n",
+	       path, failures, n, 100.0 * failures / n);
+
+	qsort(stats->lines, stats->num_lines, sizeof(*stats->lines),
+	      compare_lines);
+	for (i = 0; i < stats->num_lines; ++i) {
+		struct repeat_line *line = &stats->lines[i];
+
+		printf("%s:%d: %d/%d failed (%.1f%%)\n",
+		       path, line->line_number, line->failures, n,
+		       100.0 * line->failures / n);
+		for (timing = line->timings; timing != NULL;
+		     timing = timing->next) {
+			s64 *d = timing->deltas;
+			int m = timing->num_deltas;
+			s64 p50, p90, p99, max;
+
+			sort_s64(d, m);
+			p50 = percentile_s64(d, m, 50);
+			p90 = percentile_s64(d, m, 90);
+			p99 = percentile_s64(d, m, 99);
+			max = d[m - 1];
+			printf("\t%s: |delta| usecs over %d samples: "
+			       "p50 %lld p90 %lld p99 %lld max %lld "
+			       "(%.0f%%/%.0f%%/%.0f%%/%.0f%% of tolerance)\n",
+			       timing->description, m, p50, p90, p99, max,
+			       100.0 * p50 / tolerance, 100.0 * p90 / tolerance,
+			       100.0 * p99 / tolerance, 100.0 * max / tolerance);
+		}
+		if (line->last_error != NULL)
+			printf("\tlast error: %s\n", line->last_error);
+	}
+}
+
+static void repeat_stats_free(struct repeat_stats *stats)
+{
+	int i;
+
+	for (i = 0; i < stats->num_lines; ++i) {
+		struct repeat_line *line = &stats->lines[i];
+
+		while (line->timings != NULL) {
+			struct repeat_timing *timing = line->timings;
+
+			line->timings = timing->next;
+			free(timing->description);
+			free(timing->deltas);
+			free(timing);
+		}
+		free(line->last_error);
+	}
+	free(stats->lines);
+}
+
+int run_script_repeatedly(struct config *config, struct script *script)
+{
+	struct repeat_stats stats;
+	int failures = 0;
+	int i;
+
+	memset(&stats, 0, sizeof(stats));
+	for (i = 0; i < config->repeat; ++i) {
+		DEBUGP("%s: iteration %d\n", config->script_path, i);
+		if (!run_iteration(config, script, &stats))
+			++failures;
+	}
+	repeat_report(config, &stats, failures);
+	repeat_stats_free(&stats);
+	return failures;
+}
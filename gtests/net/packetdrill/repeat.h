@@ -0,0 +1,55 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for --repeat, which runs a script many times to measure
+ * how flaky it is and how its event timings are distributed.
+ */
+
+#ifndef __REPEAT_H__
+#define __REPEAT_H__
+
+#include "types.h"
+
+#include "config.h"
+#include "script.h"
+
+/* Run the given parsed script config->repeat times, each time in a
+ * fresh child process so that a failing iteration (which exits via
+ * die()) neither ends the run nor leaks state into the next iteration,
+ * and print a flakiness report: the failure rate of each event line,
+ * and percentiles of the timing deltas of each event line relative to
+ * --tolerance_usecs. Returns the number of failed iterations.
+ */
+extern int run_script_repeatedly(struct config *config,
+				 struct script *script);
+
+/* Note that the iteration is now running the event at the given line,
+ * so that we can blame it if the iteration fails.
+ */
+extern void repeat_note_event(int line_number);
+
+/* Record that the event at the given line happened delta_usecs away
+ * from the time (or time range) at which the script expected it, and
+ * whether that was outside the tolerance. No-op unless running
+ * under --repeat.
+ */
+extern void repeat_record_timing(int line_number, const char *description,
+				 s64 delta_usecs, bool failed);
+
+#endif /* __REPEAT_H__ */
@@ -29,17 +29,24 @@
 #include <netinet/in.h>
 #include <sched.h>
 #include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/times.h>
+#include <time.h>
 #include <unistd.h>
+#include "capture.h"
+#include "cpu_affinity.h"
 #include "ip.h"
+#include "kernel_timeline.h"
 #include "logging.h"
 #include "netdev.h"
 #include "wire_client_netdev.h"
 #include "parse.h"
+#include "payload_pattern.h"
+#include "repeat.h"
 #include "run_command.h"
 #include "run_packet.h"
 #include "run_system_call.h"
@@ -75,12 +82,17 @@ struct state *state_new(struct config *config,
 
 	run_lock(state);
 
+	if (config->payload_pattern)
+		payload_pattern_init();
+
 	state->config = config;
 	state->script = script;
 	state->netdev = netdev;
 	state->packets = packets_new();
 	state->syscalls = syscalls_new(state);
 	state->code = code_new(config);
+	if (config->perf_cost)
+		state->perf_costs = perf_costs_new();
 	state->sockets = NULL;
 	return state;
 }
@@ -135,6 +147,8 @@ void state_free(struct state *state)
 	netdev_free(state->netdev);
 	packets_free(state->packets);
 	code_free(state->code);
+	if (state->perf_costs != NULL)
+		perf_costs_free(state->perf_costs);
 
 	run_unlock(state);
 	if (pthread_mutex_destroy(&state->mutex) != 0)
@@ -152,6 +166,25 @@ s64 now_usecs(void)
 	return timeval_to_usecs(&tv);
 }
 
+/* Read the given clock in nanoseconds. */
+static s64 clock_nsecs(clockid_t clock)
+{
+	struct timespec ts;
+	if (clock_gettime(clock, &ts) < 0)
+		die_perror("clock_gettime");
+	return (s64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+s64 now_nsecs(void)
+{
+	return clock_nsecs(CLOCK_REALTIME);
+}
+
+s64 now_monotonic_nsecs(void)
+{
+	return clock_nsecs(CLOCK_MONOTONIC);
+}
+
 /*
  * Verify that something happened at the expected time.
  * WARNING: verify_time() should not be looking at state->event
@@ -162,7 +195,8 @@ s64 now_usecs(void)
  */
 int verify_time(struct state *state, enum event_time_t time_type,
 		s64 script_usecs, s64 script_usecs_end,
-		s64 live_usecs, const char *description, char **error)
+		s64 live_usecs, int line_number, const char *description,
+		char **error)
 {
 	s64 expected_usecs = script_usecs - state->script_start_time_usecs;
 	s64 expected_usecs_end = script_usecs_end -
@@ -176,6 +210,20 @@ int verify_time(struct state *state, enum event_time_t time_type,
 	if (time_type == ANY_TIME)
 		return STATUS_OK;
 
+	if (state->config->repeat > 1) {
+		s64 delta_usecs = actual_usecs - expected_usecs;
+
+		/* Anywhere within a time range counts as no delta. */
+		if ((time_type == ABSOLUTE_RANGE_TIME ||
+		     time_type == RELATIVE_RANGE_TIME) && delta_usecs > 0) {
+			delta_usecs = actual_usecs - expected_usecs_end;
+			if (delta_usecs < 0)
+				delta_usecs = 0;
+		}
+		repeat_record_timing(line_number, description, delta_usecs,
+				     llabs(delta_usecs) > tolerance_usecs);
+	}
+
 	if (time_type == ABSOLUTE_RANGE_TIME ||
 	    time_type == RELATIVE_RANGE_TIME) {
 		DEBUGP("expected_usecs_end %.3f\n",
@@ -250,6 +298,10 @@ static const char *event_description(struct event *event)
 		return "command";
 	case CODE_EVENT:
 		return "data collection for code";
+	case PEER_EVENT:
+		return "autopeer phase";
+	case SPACING_EVENT:
+		return "packet spacing";
 	case INVALID_EVENT:
 	case NUM_EVENT_TYPES:
 		assert(!"bogus type");
@@ -267,7 +319,7 @@ void check_event_time(struct state *state, s64 live_usecs)
 			state->event->time_type,
 			state->event->time_usecs,
 			state->event->time_usecs_end, live_usecs,
-			description, &error)) {
+			state->event->line_number, description, &error)) {
 		die("%s:%d: %s\n",
 		    state->config->script_path,
 		    state->event->line_number,
@@ -280,14 +332,17 @@ void check_event_time(struct state *state, s64 live_usecs)
  */
 void adjust_relative_event_times(struct state *state, struct event *event)
 {
-	s64 offset_usecs;
+	offset_relative_event_times(event,
+				    now_usecs() - state->live_start_time_usecs);
+}
 
+void offset_relative_event_times(struct event *event, s64 offset_usecs)
+{
 	if (event->time_type != ANY_TIME &&
 	    event->time_type != RELATIVE_TIME &&
 	    event->time_type != RELATIVE_RANGE_TIME)
 		return;
 
-	offset_usecs = now_usecs() - state->live_start_time_usecs;
 	event->offset_usecs = offset_usecs;
 
 	event->time_usecs += offset_usecs;
@@ -338,6 +393,33 @@ void wait_for_event(struct state *state)
 	check_event_time(state, now_usecs());
 }
 
+int check_event_order(const struct config *config,
+		      struct event *last_event, struct event *event,
+		      char **error)
+{
+	if (last_event == NULL && event->time_usecs != 0) {
+		asprintf(error,
+			 "%s:%d: first event should be at time 0\n",
+			 config->script_path, event->line_number);
+		return STATUS_ERR;
+	}
+
+	if (last_event &&
+	    is_event_time_absolute(last_event) &&
+	    is_event_time_absolute(event) &&
+	    event->time_usecs < last_event->time_usecs) {
+		asprintf(error,
+			 "%s:%d: time goes backward in script "
+			 "from %lld usec to %lld usec\n",
+			 config->script_path,
+			 event->line_number,
+			 last_event->time_usecs,
+			 event->time_usecs);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
 int get_next_event(struct state *state, char **error)
 {
 	DEBUGP("gettimeofday: %.6f\n", now_usecs()/1000000.0);
@@ -346,13 +428,6 @@ int get_next_event(struct state *state, char **error)
 		/* First event. */
 		state->event = state->script->event_list;
 		state->script_start_time_usecs = state->event->time_usecs;
-		if (state->event->time_usecs != 0) {
-			asprintf(error,
-				 "%s:%d: first event should be at time 0\n",
-				 state->config->script_path,
-				 state->event->line_number);
-			return STATUS_ERR;
-		}
 	} else {
 		/* Move to the next event. */
 		state->script_last_time_usecs = state->event->time_usecs;
@@ -366,20 +441,8 @@ int get_next_event(struct state *state, char **error)
 	assert((state->event->type > INVALID_EVENT) &&
 	       (state->event->type < NUM_EVENT_TYPES));
 
-	if (state->last_event &&
-	    is_event_time_absolute(state->last_event) &&
-	    is_event_time_absolute(state->event) &&
-	    state->event->time_usecs < state->script_last_time_usecs) {
-		asprintf(error,
-			 "%s:%d: time goes backward in script "
-			 "from %lld usec to %lld usec\n",
-			 state->config->script_path,
-			 state->event->line_number,
-			 state->script_last_time_usecs,
-			 state->event->time_usecs);
-		return STATUS_ERR;
-	}
-	return STATUS_OK;
+	return check_event_order(state->config, state->last_event,
+				 state->event, error);
 }
 
 /* Run the given packet event; print warnings/errors, and exit on error. */
@@ -398,6 +461,39 @@ static void run_local_packet_event(struct state *state, struct event *event,
 	}
 }
 
+static void run_local_peer_event(struct state *state, struct event *event,
+				 const struct peer_spec *peer)
+{
+	char *error = NULL;
+
+	if (state->config->is_wire_client)
+		die("%s:%d: autopeer is not supported in wire mode\n",
+		    state->config->script_path, event->line_number);
+	if (run_peer_event(state, event, peer, &error))
+		die("%s", error);
+}
+
+/* Check the spacing of recent outbound packets; print warnings/errors,
+ * and exit on error.
+ */
+static void run_local_spacing_event(struct state *state, struct event *event,
+				    const struct spacing_spec *spacing)
+{
+	char *error = NULL;
+	int result = STATUS_OK;
+
+	if (state->config->is_wire_client)
+		die("%s:%d: spacing is not supported in wire mode\n",
+		    state->config->script_path, event->line_number);
+	result = run_spacing_event(state, event, spacing, &error);
+	if (result == STATUS_WARN) {
+		fprintf(stderr, "%s", error);
+		free(error);
+	} else if (result == STATUS_ERR) {
+		die("%s", error);
+	}
+}
+
 /* For more consistent timing, if there's more than one CPU on this
  * machine then use a real-time priority. We skip this if there's only
  * 1 CPU because we do not want to risk making the machine
@@ -434,6 +530,28 @@ void set_scheduling_priority(void)
 #endif  /* !defined(__OpenBSD__) */
 }
 
+/* Report how often the scheduler migrated or preempted the main thread
+ * during the script, and the syscall threads during their lifetime.
+ */
+static void report_sched_stats(struct state *state,
+			       const struct sched_stats *main_start)
+{
+	const char *path = state->config->script_path;
+	char *who = NULL;
+	int i;
+
+	sched_stats_report(path, "main thread", 0, main_start);
+	for (i = 0; i < state->syscalls->num_threads; ++i) {
+		struct syscall_thread *thread = &state->syscalls->threads[i];
+
+		if (thread->thread_id <= 0)
+			continue;	/* never ran */
+		asprintf(&who, "syscall thread %d", i);
+		sched_stats_report(path, who, thread->thread_id, NULL);
+		free(who);
+	}
+}
+
 /* To ensure timing that's as consistent as possible, pull all our
  * pages to RAM and pin them there.
  */
@@ -443,6 +561,10 @@ void lock_memory(void)
 		die_perror("lockall(MCL_CURRENT | MCL_FUTURE)");
 }
 
+#ifdef linux
+/* How far into a jiffy we start a test, in microseconds. */
+static const int JIFFY_OFFSET_USECS = 250;
+
 /* Wait for and return the wall time at which we should start the
  * test, in microseconds. To make test results more reproducible, we
  * wait for a start time that is well into the middle of a Linux jiffy
@@ -462,9 +584,8 @@ void lock_memory(void)
  * effects. We could do fancier measuring and filtering here, but so
  * far this level of complexity seems sufficient.
  */
-static s64 schedule_start_time_usecs(void)
+static s64 spin_start_time_usecs(void)
 {
-#ifdef linux
 	s64 start_usecs = 0;
 	clock_t last_jiffies = times(NULL);
 	int jiffy_ticks = 0;
@@ -477,9 +598,108 @@ static s64 schedule_start_time_usecs(void)
 		}
 		last_jiffies = jiffies;
 	}
-	const int JIFFY_OFFSET_USECS = 250;
 	start_usecs += JIFFY_OFFSET_USECS;
 	return start_usecs;
+}
+
+/* The phase of the jiffies clock for --start_alignment=cached, which
+ * we measure once per process: the wall time at which we saw one jiffy
+ * edge, the CLOCK_REALTIME_COARSE time of that edge, and the length
+ * of a jiffy.
+ */
+static s64 jiffy_edge_usecs;
+static s64 jiffy_coarse_usecs;
+static s64 jiffy_usecs;		/* 0 until measured */
+
+/* Measure the jiffy phase. CLOCK_REALTIME_COARSE only advances when
+ * the tick updates the kernel's clock, and its resolution is the length
+ * of a jiffy, so we spin until we see it advance a few times; this
+ * takes a few jiffies instead of the ten that times(2) needs, and then
+ * only once per process.
+ */
+static void measure_jiffy_phase(void)
+{
+	struct timespec res, coarse;
+	s64 last_usecs;
+	int jiffy_ticks = 0;
+	const int TARGET_JIFFY_TICKS = 3;
+
+	if (clock_getres(CLOCK_REALTIME_COARSE, &res) != 0)
+		die_perror("clock_getres(CLOCK_REALTIME_COARSE)");
+	jiffy_usecs = timespec_to_usecs(&res);
+	if (jiffy_usecs <= JIFFY_OFFSET_USECS)
+		die("bad CLOCK_REALTIME_COARSE resolution: %lld usecs\n",
+		    jiffy_usecs);
+
+	if (clock_gettime(CLOCK_REALTIME_COARSE, &coarse) != 0)
+		die_perror("clock_gettime(CLOCK_REALTIME_COARSE)");
+	last_usecs = timespec_to_usecs(&coarse);
+	while (jiffy_ticks < TARGET_JIFFY_TICKS) {
+		if (clock_gettime(CLOCK_REALTIME_COARSE, &coarse) != 0)
+			die_perror("clock_gettime(CLOCK_REALTIME_COARSE)");
+		if (timespec_to_usecs(&coarse) != last_usecs) {
+			jiffy_edge_usecs = now_usecs();
+			last_usecs = timespec_to_usecs(&coarse);
+			++jiffy_ticks;
+		}
+	}
+	jiffy_coarse_usecs = last_usecs;
+	DEBUGP("jiffy is %lld usecs, with an edge at %lld\n",
+	       jiffy_usecs, jiffy_edge_usecs);
+}
+
+/* Return the wall time at which we should start the test, computed
+ * from the cached jiffy phase without spinning: JIFFY_OFFSET_USECS
+ * into the next jiffy. As a self-check we verify that the kernel's
+ * coarse clock still advances in whole jiffies from the edge we
+ * measured, and re-measure the phase if it has drifted by too much,
+ * e.g. because the wall clock was stepped or NTP changed the length of
+ * a tick.
+ */
+static s64 cached_start_time_usecs(const struct config *config)
+{
+	struct timespec coarse;
+	s64 now, error;
+
+	if (jiffy_usecs == 0)
+		measure_jiffy_phase();
+
+	if (clock_gettime(CLOCK_REALTIME_COARSE, &coarse) != 0)
+		die_perror("clock_gettime(CLOCK_REALTIME_COARSE)");
+	error = (timespec_to_usecs(&coarse) - jiffy_coarse_usecs) %
+		jiffy_usecs;
+	if (error > jiffy_usecs / 2)
+		error -= jiffy_usecs;
+	else if (error < -jiffy_usecs / 2)
+		error += jiffy_usecs;
+
+	if (config->verbose) {
+		fprintf(stderr, "%s: jiffy phase error %lld usecs\n",
+			config->script_path, error);
+	}
+	if (llabs(error) > JIFFY_OFFSET_USECS / 2) {
+		fprintf(stderr, "%s: jiffy phase error %lld usecs; "
+			"re-measuring jiffy phase\n",
+			config->script_path, error);
+		measure_jiffy_phase();
+	}
+
+	now = now_usecs();
+	return (jiffy_edge_usecs +
+		((now - jiffy_edge_usecs) / jiffy_usecs + 1) * jiffy_usecs +
+		JIFFY_OFFSET_USECS);
+}
+#endif
+
+/* Return the wall time at which we should start the test, in
+ * microseconds, aligned to the middle of a jiffy as configured.
+ */
+static s64 schedule_start_time_usecs(const struct config *config)
+{
+#ifdef linux
+	if (config->start_alignment == START_ALIGN_CACHED)
+		return cached_start_time_usecs(config);
+	return spin_start_time_usecs();
 #else
 	return now_usecs();
 #endif
@@ -491,12 +711,28 @@ void run_script(struct config *config, struct script *script)
 	struct state *state = NULL;
 	struct netdev *netdev = NULL;
 	struct event *event = NULL;
+	struct sched_stats main_sched_stats;
 
 	DEBUGP("run_script: running script\n");
 
 	set_scheduling_priority();
 	lock_memory();
 
+	/* Start the capture writer before pinning the main thread, so it
+	 * doesn't inherit the main thread's CPU.
+	 */
+	if (config->capture_path != NULL)
+		capture_start(config->capture_path);
+
+	/* Pin the main thread, which the other threads we create next
+	 * would otherwise inherit the affinity of.
+	 */
+	if (config->auto_cpus)
+		cpu_affinity_auto_assign(config);
+	cpu_affinity_pin_self(config->main_cpu, "main thread");
+	if (config->sched_stats)
+		sched_stats_get(0, &main_sched_stats);
+
 	/* This interpreter loop runs for local mode or wire client mode. */
 	assert(!config->is_wire_server);
 
@@ -523,9 +759,12 @@ void run_script(struct config *config, struct script *script)
 		}
 	}
 
+	if (config->kernel_timeline)
+		kernel_timeline_start(state);
+
 	signal(SIGPIPE, SIG_IGN);	/* ignore EPIPE */
 
-	state->live_start_time_usecs = schedule_start_time_usecs();
+	state->live_start_time_usecs = schedule_start_time_usecs(config);
 	DEBUGP("live_start_time_usecs is %lld\n",
 	       state->live_start_time_usecs);
 
@@ -538,6 +777,8 @@ void run_script(struct config *config, struct script *script)
 		event = state->event;
 		if (event == NULL)
 			break;
+		repeat_note_event(event->line_number);
+		capture_note_event(event->line_number);
 
 		if (state->wire_client != NULL)
 			wire_client_next_event(state->wire_client, event);
@@ -547,6 +788,7 @@ void run_script(struct config *config, struct script *script)
 		 * have completed, if any.
 		 */
 		adjust_relative_event_times(state, event);
+		kernel_timeline_note_event(event);
 
 		switch (event->type) {
 		case PACKET_EVENT:
@@ -568,6 +810,13 @@ void run_script(struct config *config, struct script *script)
 			run_code_event(state, event,
 				       event->event.code->text);
 			break;
+		case PEER_EVENT:
+			run_local_peer_event(state, event, event->event.peer);
+			break;
+		case SPACING_EVENT:
+			run_local_spacing_event(state, event,
+						event->event.spacing);
+			break;
 		case INVALID_EVENT:
 		case NUM_EVENT_TYPES:
 			assert(!"bogus type");
@@ -586,7 +835,19 @@ void run_script(struct config *config, struct script *script)
 		free(error);
 	}
 
+	/* The script passed, so we don't need its kernel timeline. */
+	kernel_timeline_stop();
+
+	if (config->sched_stats)
+		report_sched_stats(state, &main_sched_stats);
+	if (config->syscall_histograms)
+		syscall_latencies_report(state->syscalls->latencies,
+					 config->script_path);
+	if (state->perf_costs != NULL)
+		perf_costs_report(state->perf_costs, config->script_path);
+
 	state_free(state);
+	capture_stop();
 
 	DEBUGP("run_script: done running\n");
 }
@@ -617,5 +878,11 @@ int parse_script_and_set_config(int argc, char *argv[],
 	else
 		read_script(script_path, script);
 
-	return parse_script(config, script, &invocation);
+	if (parse_script(config, script, &invocation))
+		return STATUS_ERR;
+
+	/* --lint reports the argument errors of every event itself. */
+	if (!config->lint && prepare_system_calls(config, script))
+		return STATUS_ERR;
+	return STATUS_OK;
 }
@@ -23,13 +23,15 @@
  *
  * Threading And Locking Model
  *
- * There are two threads in our process:
+ * There are two kinds of threads in our process:
  *
  *  1) main thread: this is the thread that invokes main() and
  *     does most of the work of test execution.
  *
- *  2) blocking system call thread: this is the thread that
- *     executes blocking system calls.
+ *  2) blocking system call threads: a small pool of threads
+ *     (--syscall_threads) that execute blocking system calls. Each
+ *     runs one blocking system call at a time, and blocking calls on
+ *     the same fd are serialized onto a single thread at a time.
  *
  * To keep things as simple as possible, there is a single global
  * mutex, state->mutex, which protects all global data (data that is
@@ -39,10 +41,10 @@
  * duration of a test run. It unlocks the mutex only for:
  *
  *   o sleeping while waiting for the start time of the next event
- *   o waiting for the system call thread to block on a system call
- *   o waiting for the system call thread to exit
+ *   o waiting for a system call thread to block on a system call
+ *   o waiting for the system call threads to exit
  *
- * The system call thread runs briefly, only to execute blocking
+ * Each system call thread runs briefly, only to execute blocking
  * system calls, and holds the global mutex for the entire duration it
  * is running, from interpreting system call arguments to processing
  * system call outputs. It unlocks the mutex only for:
@@ -63,6 +65,7 @@
 #include "code.h"
 #include "config.h"
 #include "netdev.h"
+#include "perf_cost.h"
 #include "run_packet.h"
 #include "run_system_call.h"
 #include "script.h"
@@ -99,6 +102,7 @@ struct state {
 	struct event *last_event;		/* previous event */
 	struct code_state *code;	/* for running post-processing code */
 	struct wire_client *wire_client;	/* for on-the-wire tests */
+	struct perf_costs *perf_costs;	/* for --perf_cost, or NULL */
 	s64 script_start_time_usecs;	/* time of first event in script */
 	s64 script_last_time_usecs;	/* time of previous event in script */
 	s64 live_start_time_usecs;	/* time of first event in live test */
@@ -129,6 +133,14 @@ static inline void run_unlock(struct state *state)
 /* Get the wall clock time of day in microseconds. */
 extern s64 now_usecs(void);
 
+/* Get the wall clock time of day in nanoseconds. */
+extern s64 now_nsecs(void);
+
+/* Get the time in nanoseconds from a clock that the time of day being
+ * set can't move, for measuring intervals.
+ */
+extern s64 now_monotonic_nsecs(void);
+
 /* Convert script time to live wall clock time. */
 static inline s64 script_time_to_live_time_usecs(struct state *state,
 						 s64 script_time_usecs)
@@ -153,14 +165,16 @@ static inline s64 live_time_to_script_time_usecs(struct state *state,
  * wanted it to happen in the script. verify_time compares the
  * given script and live times and returns STATUS_OK on success or on
  * failure returns STATUS_ERR and fills in *error using the given
- * description.  The check_event_time variant is a shortcut
+ * description. The line_number is that of the event being checked, for
+ * --repeat statistics.  The check_event_time variant is a shortcut
  * for the common case: it looks at the current event and on failure
  * it prints the error message to stderr and exits with an error
  * status.  For time ranges the end time is specified in script_usecs_end.
  */
 extern int verify_time(struct state *state, enum event_time_t time_type,
 		       s64 script_usecs, s64 script_usecs_end,
-		       s64 live_usecs, const char *description, char **error);
+		       s64 live_usecs, int line_number,
+		       const char *description, char **error);
 extern void check_event_time(struct state *state, s64 live_usecs);
 
 /* Set the start (and end time, if applicable) for the event if it
@@ -169,6 +183,12 @@ extern void check_event_time(struct state *state, s64 live_usecs);
 extern void adjust_relative_event_times(struct state *state,
 					struct event *event);
 
+/* As above, but for relative times that start at the given offset from
+ * the start of the script, rather than now.
+ */
+extern void offset_relative_event_times(struct event *event,
+					s64 offset_usecs);
+
 /*
  * Sleep and/or spin until the time at which we want the current event
  * to happen.
@@ -178,6 +198,15 @@ extern void wait_for_event(struct state *state);
 /* Advance the interpreter state to the next event. */
 extern int get_next_event(struct state *state, char **error);
 
+/* Check that the given event may follow last_event (NULL for the
+ * first event) in the script: the first event must be at time 0, and
+ * time must not go backward between absolute event times. On failure
+ * returns STATUS_ERR and fills in *error.
+ */
+extern int check_event_order(const struct config *config,
+			     struct event *last_event, struct event *event,
+			     char **error);
+
 /* Set a higher priority for ourselves, to reduce test timing noise. */
 extern void set_scheduling_priority(void);
 
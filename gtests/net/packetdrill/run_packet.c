@@ -37,6 +37,8 @@
 #include "packet.h"
 #include "packet_checksum.h"
 #include "packet_to_string.h"
+#include "payload_pattern.h"
+#include "perf_cost.h"
 #include "run.h"
 #include "script.h"
 #include "sctp_iterator.h"
@@ -490,8 +492,7 @@ static int find_tcp_timestamp(struct packet *packet, char **error)
  * by the given 'ack_offset'. Returns STATUS_OK on success; on
  * failure returns STATUS_ERR and sets error message.
  */
-static int offset_sack_blocks(struct packet *packet,
-			      u32 ack_offset, char **error)
+int offset_sack_blocks(struct packet *packet, u32 ack_offset, char **error)
 {
 	struct tcp_options_iterator iter;
 	struct tcp_option *option = NULL;
@@ -960,8 +961,10 @@ static int verify_ipv4(
 	const struct packet *script_packet,
 	int layer, char **error)
 {
-	const struct ipv4 *actual_ipv4 = actual_packet->headers[layer].h.ipv4;
-	const struct ipv4 *script_ipv4 = script_packet->headers[layer].h.ipv4;
+	const struct header *actual_header = &actual_packet->headers[layer];
+	const struct header *script_header = &script_packet->headers[layer];
+	const struct ipv4 *actual_ipv4 = actual_header->h.ipv4;
+	const struct ipv4 *script_ipv4 = script_header->h.ipv4;
 
 	if (check_field("ipv4_version",
 			script_ipv4->version,
@@ -979,16 +982,16 @@ static int verify_ipv4(
 		break;
 	case IPPROTO_TCP:
 		if (check_field("ipv4_total_length",
-				(ntohs(script_ipv4->tot_len) +
+				(script_header->total_bytes +
 				 tcp_options_allowance(actual_packet,
 						       script_packet)),
-				ntohs(actual_ipv4->tot_len), error))
+				actual_header->total_bytes, error))
 			return STATUS_ERR;
 		break;
 	default:
 		if (check_field("ipv4_total_length",
-				ntohs(script_ipv4->tot_len),
-				ntohs(actual_ipv4->tot_len), error))
+				script_header->total_bytes,
+				actual_header->total_bytes, error))
 			return STATUS_ERR;
 		break;
 	}
@@ -1008,32 +1011,39 @@ static int verify_ipv6(
 	const struct packet *script_packet,
 	int layer, char **error)
 {
-	const struct ipv6 *actual_ipv6 = actual_packet->headers[layer].h.ipv6;
-	const struct ipv6 *script_ipv6 = script_packet->headers[layer].h.ipv6;
+	const struct header *actual_header = &actual_packet->headers[layer];
+	const struct header *script_header = &script_packet->headers[layer];
+	const struct ipv6 *actual_ipv6 = actual_header->h.ipv6;
+	const struct ipv6 *script_ipv6 = script_header->h.ipv6;
+	/* Payload lengths exclude any BIG TCP jumbo Hop-by-Hop header. */
+	const u32 actual_payload_bytes =
+		actual_header->total_bytes - actual_header->header_bytes;
+	const u32 script_payload_bytes =
+		script_header->total_bytes - script_header->header_bytes;
 
 	if (check_field("ipv6_version",
 			script_ipv6->version,
 			actual_ipv6->version, error) ||
 	    check_field("ipv6_next_header",
-			script_ipv6->next_header,
-			actual_ipv6->next_header, error))
+			ipv6_upper_layer_protocol(script_ipv6),
+			ipv6_upper_layer_protocol(actual_ipv6), error))
 		return STATUS_ERR;
-	switch (script_ipv6->next_header) {
+	switch (ipv6_upper_layer_protocol(script_ipv6)) {
 	case IPPROTO_SCTP:
 		/* FIXME */
 		break;
 	case IPPROTO_TCP:
 		if (check_field("ipv6_payload_len",
-				(ntohs(script_ipv6->payload_len) +
+				(script_payload_bytes +
 				 tcp_options_allowance(actual_packet,
 						       script_packet)),
-				ntohs(actual_ipv6->payload_len), error))
+				actual_payload_bytes, error))
 			return STATUS_ERR;
 		break;
 	default:
 		if (check_field("ipv6_payload_len",
-				ntohs(script_ipv6->payload_len),
-				ntohs(actual_ipv6->payload_len), error))
+				script_payload_bytes,
+				actual_payload_bytes, error))
 			return STATUS_ERR;
 		break;
 	}
@@ -1740,22 +1750,23 @@ typedef int (*verifier_func)(
 	const struct packet *script_packet,
 	int layer, char **error);
 
+static const verifier_func verifiers[HEADER_NUM_TYPES] = {
+	[HEADER_IPV4]		= verify_ipv4,
+	[HEADER_IPV6]		= verify_ipv6,
+	[HEADER_GRE]		= verify_gre,
+	[HEADER_MPLS]		= verify_mpls,
+	[HEADER_SCTP]		= verify_sctp,
+	[HEADER_TCP]		= verify_tcp,
+	[HEADER_UDP]		= verify_udp,
+	[HEADER_UDPLITE]	= verify_udplite,
+};
+
 /* Verify that required actual header fields are as the script expected. */
 static int verify_header(
 	const struct packet *actual_packet,
 	const struct packet *script_packet,
 	int layer, char **error)
 {
-	verifier_func verifiers[HEADER_NUM_TYPES] = {
-		[HEADER_IPV4]		= verify_ipv4,
-		[HEADER_IPV6]		= verify_ipv6,
-		[HEADER_GRE]		= verify_gre,
-		[HEADER_MPLS]		= verify_mpls,
-		[HEADER_SCTP]		= verify_sctp,
-		[HEADER_TCP]		= verify_tcp,
-		[HEADER_UDP]		= verify_udp,
-		[HEADER_UDPLITE]	= verify_udplite,
-	};
 	verifier_func verifier = NULL;
 	const struct header *actual_header = &actual_packet->headers[layer];
 	const struct header *script_header = &script_packet->headers[layer];
@@ -1777,6 +1788,38 @@ static int verify_header(
 	return verifier(actual_packet, script_packet, layer, error);
 }
 
+/* Return true iff the actual TCP header at the given layer matches the
+ * template compiled from the script packet when the script was parsed.
+ * This is a quick check of the fields that verify_tcp() checks; if it
+ * fails we run verify_tcp() to say what is wrong.
+ */
+static bool tcp_header_matches_template(
+	const struct packet *actual_packet,
+	const struct packet *script_packet,
+	int layer)
+{
+	const struct header *actual_header = &actual_packet->headers[layer];
+	const struct header *script_header = &script_packet->headers[layer];
+	const struct tcp *actual_tcp = actual_header->h.tcp;
+	const struct tcp *script_tcp = script_header->h.tcp;
+
+	if (script_packet->tcp_template == NULL ||
+	    script_header->type != HEADER_TCP ||
+	    actual_header->type != HEADER_TCP ||
+	    script_tcp != script_packet->tcp)
+		return false;
+
+	/* The template leaves out the data offset if options are <...>. */
+	if ((script_packet->flags & FLAG_OPTIONS_NOCHECK) &&
+	    (actual_tcp->doff !=
+	     (script_tcp->doff +
+	      tcp_options_allowance(actual_packet,
+				    script_packet)/sizeof(u32))))
+		return false;
+
+	return tcp_template_matches(script_packet->tcp_template, actual_tcp);
+}
+
 /* Verify that required actual header fields are as the script expected. */
 static int verify_outbound_live_headers(
 	const struct packet *actual_packet,
@@ -1806,6 +1849,10 @@ static int verify_outbound_live_headers(
 		if (script_packet->headers[i].type == HEADER_NONE)
 			break;
 
+		if (tcp_header_matches_template(actual_packet, script_packet,
+						i))
+			continue;
+
 		if (verify_header(actual_packet, script_packet, i, error))
 			return STATUS_ERR;
 	}
@@ -1871,9 +1918,51 @@ static int verify_outbound_live_tcp_options(
 	return STATUS_ERR;	/* The TCP options did not match */
 }
 
+/* Verify the segmentation offload metadata the script expects, if any:
+ * the GSO size of a super-packet and whether its checksum is partial.
+ */
+static int verify_outbound_live_offload(
+	struct packet *actual_packet,
+	struct packet *script_packet, char **error)
+{
+	if ((script_packet->gso_size != 0) &&
+	    (actual_packet->gso_size != script_packet->gso_size)) {
+		asprintf(error, "live packet gso_size: %u vs expected: %u",
+			 actual_packet->gso_size, script_packet->gso_size);
+		return STATUS_ERR;
+	}
+	if ((script_packet->flags & FLAG_CSUM_PARTIAL) &&
+	    !(actual_packet->flags & FLAG_CSUM_PARTIAL)) {
+		asprintf(error, "live packet checksum is not partial "
+			 "(no VIRTIO_NET_HDR_F_NEEDS_CSUM)");
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* For --payload_pattern, return the stream offset of the first payload
+ * byte of the given packet, given the ISN of its direction of the
+ * connection. Each UDP datagram starts at offset 0. The sequence
+ * number only gives the offset modulo 2^32, so we take the 64-bit
+ * offset nearest the given one, which the application has reached
+ * when writing or reading the same direction of the stream; data in
+ * flight is always well within 2^31 bytes of it.
+ */
+static u64 pattern_packet_offset(struct packet *packet, u32 isn,
+				 u64 near_offset)
+{
+	u32 offset = 0;
+
+	if (packet->tcp == NULL)
+		return 0;
+	offset = ntohl(packet->tcp->seq) + (packet->tcp->syn ? 1 : 0) -
+		 (isn + 1);
+	return near_offset + (s32)(offset - (u32)near_offset);
+}
 
 /* Verify TCP/UDP payload matches expected value. */
 static int verify_outbound_live_payload(
+	struct state *state, struct socket *socket,
 	struct packet *actual_packet,
 	struct packet *script_packet, char **error)
 {
@@ -1881,12 +1970,36 @@ static int verify_outbound_live_payload(
 		return STATUS_OK;
 	/* Diff the TCP/UDP data payloads. We've already implicitly
 	 * checked their length by checking the IP and TCP/UDP headers.
+	 * Of a packet from a truncated capture, we only diff the bytes
+	 * that were captured.
 	 */
 	assert(packet_payload_len(actual_packet) ==
 	       packet_payload_len(script_packet));
+	int len = packet_captured_payload_len(actual_packet);
+
+	if (state->config->payload_pattern) {
+		/* The app wrote the pattern, so the payload must carry
+		 * the pattern at the stream offset of this segment.
+		 */
+		u64 offset = pattern_packet_offset(
+			actual_packet, socket->script.local_isn,
+			socket->pattern_write_offset);
+		u8 *payload = packet_payload(actual_packet);
+		ssize_t bad = payload_pattern_mismatch(payload, len, offset);
+		if (bad >= 0) {
+			asprintf(error,
+				 "incorrect outbound data payload at stream "
+				 "offset %llu: expected byte 0x%02x but got "
+				 "0x%02x",
+				 (unsigned long long)(offset + bad),
+				 payload_pattern_byte(offset + bad),
+				 payload[bad]);
+			return STATUS_ERR;
+		}
+		return STATUS_OK;
+	}
 	if (memcmp(packet_payload(script_packet),
-		   packet_payload(actual_packet),
-		   packet_payload_len(script_packet)) != 0) {
+		   packet_payload(actual_packet), len) != 0) {
 		asprintf(error, "incorrect outbound data payload");
 		return STATUS_ERR;
 	}
@@ -1944,8 +2057,15 @@ static int verify_outbound_live_packet(
 		}
 	}
 
+	/* Verify GSO size and checksum offload matched expected ones. */
+	if (verify_outbound_live_offload(actual_packet, script_packet, error)) {
+		non_fatal = true;
+		goto out;
+	}
+
 	/* Verify TCP/UDP payload matches expected value. */
-	if (verify_outbound_live_payload(actual_packet, script_packet, error)) {
+	if (verify_outbound_live_payload(state, socket, actual_packet,
+					 script_packet, error)) {
 		non_fatal = true;
 		goto out;
 	}
@@ -1954,6 +2074,7 @@ static int verify_outbound_live_packet(
 	DEBUGP("packet time_usecs: %lld\n", live_packet->time_usecs);
 	if (verify_time(state, time_type, script_usecs,
 				script_usecs_end, live_packet->time_usecs,
+				state->event->line_number,
 				"outbound packet", error)) {
 		non_fatal = true;
 		goto out;
@@ -1977,6 +2098,19 @@ out:
 	return result;
 }
 
+/* Remember the time and size of an outbound packet, for spacing. */
+static void record_outbound_packet(struct packets *packets,
+				   const struct packet *packet)
+{
+	struct train_packet *record =
+		&packets->outbound[packets->num_outbound % MAX_SPACING_PACKETS];
+
+	record->time_usecs = packet->time_usecs ? packet->time_usecs :
+			     now_usecs();
+	record->ip_bytes = packet->ip_bytes;
+	++packets->num_outbound;
+}
+
 /* Sniff the next outbound live packet and return it. */
 static int sniff_outbound_live_packet(
 	struct state *state, struct socket *expected_socket,
@@ -2127,6 +2261,7 @@ static int do_outbound_script_packet(
 	/* Sniff outbound live packet and verify it's for the right socket. */
 	if (sniff_outbound_live_packet(state, socket, &live_packet, error))
 		goto out;
+	record_outbound_packet(state->packets, live_packet);
 
 	if (packet->tcp) {
 		if ((socket->state == SOCKET_PASSIVE_PACKET_RECEIVED) &&
@@ -2243,8 +2378,11 @@ static int do_outbound_script_packet(
 				    state, live_packet->time_usecs));
 
 	/* Save the TCP header so we can reset the connection at the end. */
-	if (live_packet->tcp)
+	if (live_packet->tcp) {
 		socket->last_outbound_tcp_header = *(live_packet->tcp);
+		socket->last_outbound_tcp_payload_len =
+			packet_payload_len(live_packet);
+	}
 
 	/* Verify the bits the kernel sent were what the script expected. */
 	result = verify_outbound_live_packet(
@@ -2256,10 +2394,16 @@ out:
 	return result;
 }
 
-/* Checksum the packet and inject it into the kernel under test. */
-static int send_live_ip_packet(struct netdev *netdev,
+/* Checksum the packet and inject it into the kernel under test. For
+ * --perf_cost, charge the kernel's cost of taking the packet to the
+ * current script line, if any.
+ */
+static int send_live_ip_packet(struct state *state,
 			       struct packet *packet)
 {
+	struct perf_sample perf_start, perf_end;
+	int result = STATUS_ERR;
+
 	assert(packet->ip_bytes > 0);
 	/* We do IPv4 and IPv6 */
 	assert(packet->ipv4 || packet->ipv6);
@@ -2270,7 +2414,17 @@ static int send_live_ip_packet(struct netdev *netdev,
 	/* Fill in layer 3 and layer 4 checksums */
 	checksum_packet(packet);
 
-	return netdev_send(netdev, packet);
+	if (state->perf_costs == NULL || state->event == NULL)
+		return netdev_send(state->netdev, packet);
+
+	perf_sample_read(&perf_start);
+	result = netdev_send(state->netdev, packet);
+	perf_sample_read(&perf_end);
+	perf_costs_add(state->perf_costs, state->event->line_number,
+		       state->event->type == PEER_EVENT ?
+		       "autopeer" : "inbound packet",
+		       &perf_start, &perf_end);
+	return result;
 }
 
 /* Perform the action implied by an inbound packet in a script */
@@ -2385,6 +2539,14 @@ static int do_inbound_script_packet(
 
 	/* Start with a bit-for-bit copy of the packet from the script. */
 	struct packet *live_packet = packet_copy(packet);
+	/* With --payload_pattern, the app expects the pattern. */
+	if (state->config->payload_pattern && (live_packet->sctp == NULL)) {
+		u64 offset = pattern_packet_offset(
+			live_packet, socket->script.remote_isn,
+			socket->pattern_read_offset);
+		payload_pattern_fill(packet_payload(live_packet),
+				     packet_payload_len(live_packet), offset);
+	}
 	/* Map packet fields from script values to live values. */
 	if (map_inbound_packet(socket, live_packet, error))
 		goto out;
@@ -2398,10 +2560,18 @@ static int do_inbound_script_packet(
 		socket->last_injected_tcp_header = *(live_packet->tcp);
 		socket->last_injected_tcp_payload_len =
 			packet_payload_len(live_packet);
+		socket->has_last_injected_tcp_ts =
+			(live_packet->tcp_ts_val != NULL);
+		if (live_packet->tcp_ts_val != NULL) {
+			socket->last_injected_tcp_ts_val =
+				packet_tcp_ts_val(live_packet);
+			socket->last_injected_tcp_ts_ecr =
+				packet_tcp_ts_ecr(live_packet);
+		}
 	}
 
 	/* Inject live packet into kernel. */
-	result = send_live_ip_packet(state->netdev, live_packet);
+	result = send_live_ip_packet(state, live_packet);
 
 out:
 	packet_free(live_packet);
@@ -2456,6 +2626,589 @@ out:
 	return result;
 }
 
+int verify_recorded_packet(
+	struct state *state, struct event *event, struct socket *socket,
+	struct packet *script_packet, struct packet *recorded_packet,
+	char **error)
+{
+	DEBUGP("%d: recorded packet\n", event->line_number);
+
+	char *err = NULL;
+	int result = STATUS_ERR;
+
+	assert(packet_direction(script_packet) == DIRECTION_OUTBOUND);
+	if (script_packet->tcp != NULL && recorded_packet->tcp == NULL) {
+		asprintf(&err, "recorded packet is not TCP");
+		goto out;
+	}
+
+	/* There are no system calls to tell us the ISNs, so learn the
+	 * live and script ISNs from the SYN or SYNACK themselves.
+	 */
+	if (script_packet->tcp && script_packet->tcp->syn) {
+		socket->script.local_isn = ntohl(script_packet->tcp->seq);
+		socket->live.local_isn = ntohl(recorded_packet->tcp->seq);
+		DEBUGP("recorded SYN live.local_isn: %u\n",
+		       socket->live.local_isn);
+	}
+
+	record_outbound_packet(state->packets, recorded_packet);
+	verbose_packet_dump(state, "outbound recorded", recorded_packet,
+			    live_time_to_script_time_usecs(
+				    state, recorded_packet->time_usecs));
+
+	if (recorded_packet->tcp) {
+		socket->last_outbound_tcp_header = *(recorded_packet->tcp);
+		socket->last_outbound_tcp_payload_len =
+			packet_payload_len(recorded_packet);
+	}
+
+	result = verify_outbound_live_packet(
+			state, socket, script_packet, recorded_packet, &err);
+	if (result == STATUS_OK)
+		return STATUS_OK;
+
+out:
+	asprintf(error, "%s:%d: %s handling packet: %s\n",
+		 state->config->script_path, event->line_number,
+		 result == STATUS_ERR ? "error" : "warning", err);
+	free(err);
+	return result;
+}
+
+/* An autopeer phase plays a bulk data receiver for the socket under
+ * test, so that a script can run a transfer over thousands of round
+ * trips. We sniff the data segments the kernel sends, pass them over
+ * an emulated path with the given bottleneck rate (and an unlimited
+ * queue) and half the given RTT of delay, drop the ones the script
+ * asks us to, and inject the ACKs a simple receiver would send, after
+ * another half RTT of delay. The receiver ACKs every ack_every
+ * in-order segments or after PEER_DELACK_USECS, and ACKs out-of-order
+ * data and data that fills a hole at once, with SACK blocks if asked.
+ *
+ * All of this happens in live sequence space, starting from the last
+ * packets we injected and sniffed, and at the end we leave the socket's
+ * last injected and outbound TCP headers describing the last ACK and
+ * data segment, so the script can carry on from there.
+ */
+
+#define PEER_DELACK_USECS	40000	/* receiver's delayed ACK timeout */
+#define PEER_IDLE_USECS		1000000	/* sender idle time that's an error */
+#define PEER_MAX_RANGES		32	/* out-of-order blocks we hold */
+
+/* A data segment on its way to the receiver. */
+struct peer_segment {
+	s64 arrival_usecs;		/* when it reaches the receiver */
+	u32 seq;			/* live sequence number */
+	u32 len;			/* bytes of payload */
+	bool has_ts;			/* did it carry a TCP timestamp? */
+	u32 ts_val;			/* its TS val, if so */
+	struct peer_segment *next;
+};
+
+/* An ACK on its way back to the sender. */
+struct peer_ack {
+	s64 send_usecs;			/* when to inject it */
+	struct packet *packet;		/* the live packet to inject */
+	struct peer_ack *next;
+};
+
+/* A block of out-of-order data held by the receiver. */
+struct peer_range {
+	u32 start;			/* first sequence number */
+	u32 end;			/* sequence number just past the end */
+};
+
+struct peer {
+	struct state *state;
+	struct socket *socket;
+	const struct peer_spec *spec;
+	s64 start_usecs;		/* wall time the phase started */
+	s64 link_free_usecs;		/* when the bottleneck is next idle */
+	s64 last_data_usecs;		/* when we last sniffed data */
+	u64 data_segments;		/* data segments sniffed so far */
+	int next_drop;			/* index of next entry in spec->drops */
+	struct peer_segment *segments;	/* in flight to receiver, in order */
+	struct peer_segment *last_segment;
+	struct peer_ack *acks;		/* in flight to sender, in order */
+	struct peer_ack *last_ack;
+
+	/* The receiver. */
+	u32 rcv_nxt;			/* next in-order sequence number */
+	struct peer_range ranges[PEER_MAX_RANGES]; /* sorted by sequence */
+	int num_ranges;
+	int recent_range;		/* range of latest arrival, or -1 */
+	int segments_unacked;		/* in-order segments not yet ACKed */
+	s64 delack_usecs;		/* delayed ACK deadline, or 0 */
+	u32 ts_recent;			/* TS val to echo */
+
+	/* The ACKs we send. */
+	u32 snd_nxt;			/* our sequence number */
+	u16 window;			/* our window, as on the wire */
+	bool has_ts;			/* do we send TCP timestamps? */
+	u32 ts_val_base;		/* our TS val at the start */
+	u32 acked;			/* ACK field of last ACK injected */
+	u64 acked_bytes;		/* bytes ACKed during the phase */
+};
+
+/* Is sequence number a before sequence number b? */
+static inline bool peer_seq_before(u32 a, u32 b)
+{
+	return (s32)(a - b) < 0;
+}
+
+static int peer_init(struct peer *peer, struct state *state,
+		     const struct peer_spec *spec, char **error)
+{
+	struct socket *socket = state->socket_under_test;
+	const struct tcp *injected = NULL, *outbound = NULL;
+	u32 seen_end = 0;
+
+	memset(peer, 0, sizeof(*peer));
+	peer->state = state;
+	peer->spec = spec;
+	peer->recent_range = -1;
+	peer->start_usecs = now_usecs();
+	peer->link_free_usecs = peer->start_usecs;
+	peer->last_data_usecs = peer->start_usecs;
+
+	if (socket == NULL || socket->protocol != IPPROTO_TCP) {
+		asprintf(error, "autopeer needs a TCP socket under test");
+		return STATUS_ERR;
+	}
+	injected = &socket->last_injected_tcp_header;
+	outbound = &socket->last_outbound_tcp_header;
+	if (!injected->ack) {
+		asprintf(error, "autopeer needs an established connection");
+		return STATUS_ERR;
+	}
+	peer->socket = socket;
+
+	peer->snd_nxt = (ntohl(injected->seq) +
+			 (injected->syn ? 1 : 0) + (injected->fin ? 1 : 0) +
+			 socket->last_injected_tcp_payload_len);
+	peer->window = ntohs(injected->window);
+	peer->rcv_nxt = ntohl(injected->ack_seq);
+	peer->acked = peer->rcv_nxt;
+	peer->has_ts = socket->has_last_injected_tcp_ts;
+	peer->ts_val_base = socket->last_injected_tcp_ts_val;
+	peer->ts_recent = socket->last_injected_tcp_ts_ecr;
+
+	/* The script saw every data segment the kernel sent so far, so
+	 * the receiver has whatever it didn't ACK yet, and should ACK it.
+	 */
+	seen_end = ntohl(outbound->seq) + socket->last_outbound_tcp_payload_len;
+	if (socket->last_outbound_tcp_payload_len > 0 &&
+	    peer_seq_before(peer->rcv_nxt, seen_end)) {
+		peer->rcv_nxt = seen_end;
+		peer->segments_unacked = 1;
+		peer->delack_usecs = peer->start_usecs;
+	}
+	return STATUS_OK;
+}
+
+static void peer_free(struct peer *peer)
+{
+	while (peer->segments != NULL) {
+		struct peer_segment *segment = peer->segments;
+
+		peer->segments = segment->next;
+		free(segment);
+	}
+	while (peer->acks != NULL) {
+		struct peer_ack *ack = peer->acks;
+
+		peer->acks = ack->next;
+		packet_free(ack->packet);
+		free(ack);
+	}
+}
+
+/* Add the given block of out-of-order data to the receiver, merging it
+ * with the blocks it overlaps or abuts. Returns the index of the block
+ * now holding it, or -1 if the receiver has no room and drops it.
+ */
+static int peer_add_range(struct peer *peer, u32 start, u32 end)
+{
+	struct peer_range *ranges = peer->ranges;
+	int i = 0, j = 0;
+
+	while (i < peer->num_ranges && peer_seq_before(ranges[i].end, start))
+		++i;
+	if (i < peer->num_ranges && !peer_seq_before(end, ranges[i].start)) {
+		if (peer_seq_before(start, ranges[i].start))
+			ranges[i].start = start;
+		if (peer_seq_before(ranges[i].end, end))
+			ranges[i].end = end;
+		for (j = i + 1; j < peer->num_ranges &&
+			     !peer_seq_before(ranges[i].end, ranges[j].start);
+		     ++j) {
+			if (peer_seq_before(ranges[i].end, ranges[j].end))
+				ranges[i].end = ranges[j].end;
+		}
+		memmove(&ranges[i + 1], &ranges[j],
+			(peer->num_ranges - j) * sizeof(ranges[0]));
+		peer->num_ranges -= j - (i + 1);
+		return i;
+	}
+	if (peer->num_ranges == PEER_MAX_RANGES)
+		return -1;
+	memmove(&ranges[i + 1], &ranges[i],
+		(peer->num_ranges - i) * sizeof(ranges[0]));
+	ranges[i].start = start;
+	ranges[i].end = end;
+	++peer->num_ranges;
+	return i;
+}
+
+/* Move rcv_nxt past any out-of-order blocks it has reached. */
+static void peer_absorb_ranges(struct peer *peer)
+{
+	int i = 0;
+
+	while (i < peer->num_ranges &&
+	       !peer_seq_before(peer->rcv_nxt, peer->ranges[i].start)) {
+		if (peer_seq_before(peer->rcv_nxt, peer->ranges[i].end))
+			peer->rcv_nxt = peer->ranges[i].end;
+		++i;
+	}
+	memmove(&peer->ranges[0], &peer->ranges[i],
+		(peer->num_ranges - i) * sizeof(peer->ranges[0]));
+	peer->num_ranges -= i;
+}
+
+static void set_peer_sack_block(struct tcp_option *sack, int i,
+				const struct peer_range *range)
+{
+	sack->data.sack.block[i].left = htonl(range->start);
+	sack->data.sack.block[i].right = htonl(range->end);
+}
+
+/* Build the ACK the receiver sends at the given time, and queue it to
+ * reach the sender half an RTT later.
+ */
+static int peer_queue_ack(struct peer *peer, s64 time_usecs, char **error)
+{
+	struct socket *socket = peer->socket;
+	struct tcp_options options;
+	struct tcp_option option;
+	struct tuple live_inbound;
+	struct packet *packet = NULL;
+	struct peer_ack *ack = NULL;
+	int i = 0, num_blocks = 0;
+
+	memset(&options, 0, sizeof(options));
+	memset(&option, 0, sizeof(option));
+	option.kind = TCPOPT_NOP;
+	option.length = 1;
+	if (peer->has_ts) {
+		u32 ts_val = (peer->ts_val_base +
+			      (time_usecs - peer->start_usecs) / 1000);
+
+		tcp_options_append(&options, &option);
+		tcp_options_append(&options, &option);
+		option.kind = TCPOPT_TIMESTAMP;
+		option.length = TCPOLEN_TIMESTAMP;
+		option.data.time_stamp.val = htonl(ts_val);
+		option.data.time_stamp.ecr = htonl(peer->ts_recent);
+		tcp_options_append(&options, &option);
+	}
+	if (peer->spec->sack && peer->num_ranges > 0) {
+		/* RFC 2018: the first block holds the latest arrival. */
+		const int max_blocks = peer->has_ts ? 3 : 4;
+		struct tcp_option sack;
+
+		memset(&sack, 0, sizeof(sack));
+		sack.kind = TCPOPT_SACK;
+		if (peer->recent_range >= 0)
+			set_peer_sack_block(&sack, num_blocks++,
+					    &peer->ranges[peer->recent_range]);
+		for (i = 0; i < peer->num_ranges && num_blocks < max_blocks;
+		     ++i) {
+			if (i != peer->recent_range)
+				set_peer_sack_block(&sack, num_blocks++,
+						    &peer->ranges[i]);
+		}
+		sack.length = 2 + num_blocks * sizeof(struct sack_block);
+		option.kind = TCPOPT_NOP;
+		option.length = 1;
+		tcp_options_append(&options, &option);
+		tcp_options_append(&options, &option);
+		tcp_options_append(&options, &sack);
+	}
+
+	packet = new_tcp_packet(socket->address_family,
+				DIRECTION_INBOUND, ECN_NONE, ".",
+				peer->snd_nxt, 0, peer->rcv_nxt, peer->window,
+				&options, error);
+	if (packet == NULL)
+		return STATUS_ERR;
+	socket_get_inbound(&socket->live, &live_inbound);
+	set_packet_tuple(packet, &live_inbound);
+
+	ack = calloc(1, sizeof(struct peer_ack));
+	ack->send_usecs = time_usecs + peer->spec->rtt_usecs / 2;
+	ack->packet = packet;
+	if (peer->last_ack != NULL)
+		peer->last_ack->next = ack;
+	else
+		peer->acks = ack;
+	peer->last_ack = ack;
+
+	peer->segments_unacked = 0;
+	peer->delack_usecs = 0;
+	return STATUS_OK;
+}
+
+/* Have the receiver take the given segment, which reached it at the
+ * given time.
+ */
+static int peer_receive_segment(struct peer *peer,
+				const struct peer_segment *segment,
+				char **error)
+{
+	const u32 end = segment->seq + segment->len;
+	bool ack_now = false;
+
+	if (!peer_seq_before(peer->rcv_nxt, end)) {
+		/* A spurious retransmit; tell the sender at once. */
+		peer->recent_range = -1;
+		ack_now = true;
+	} else if (!peer_seq_before(peer->rcv_nxt, segment->seq)) {
+		const bool filled_hole = (peer->num_ranges > 0);
+
+		if (segment->has_ts)
+			peer->ts_recent = segment->ts_val;
+		peer->rcv_nxt = end;
+		peer_absorb_ranges(peer);
+		peer->recent_range = -1;
+		++peer->segments_unacked;
+		ack_now = (filled_hole ||
+			   peer->segments_unacked >= peer->spec->ack_every);
+	} else {
+		peer->recent_range = peer_add_range(peer, segment->seq, end);
+		ack_now = true;
+	}
+
+	if (ack_now)
+		return peer_queue_ack(peer, segment->arrival_usecs, error);
+	if (peer->delack_usecs == 0)
+		peer->delack_usecs = segment->arrival_usecs + PEER_DELACK_USECS;
+	return STATUS_OK;
+}
+
+/* Take a packet sniffed during the phase. We ignore packets that aren't
+ * from the socket under test, and those carrying no data.
+ */
+static int peer_sniff(struct peer *peer, struct packet *packet,
+		      char **error)
+{
+	const struct peer_spec *spec = peer->spec;
+	enum direction_t direction = DIRECTION_INVALID;
+	struct peer_segment *segment = NULL;
+	s64 sent_usecs = 0;
+	u32 len = 0;
+
+	if (find_socket_for_live_packet(peer->state, packet,
+					&direction) != peer->socket ||
+	    direction != DIRECTION_OUTBOUND || packet->tcp == NULL)
+		return STATUS_OK;
+	if (packet->tcp->syn || packet->tcp->rst) {
+		asprintf(error, "socket under test sent a %s",
+			 packet->tcp->syn ? "SYN" : "RST");
+		return STATUS_ERR;
+	}
+
+	record_outbound_packet(peer->state->packets, packet);
+	len = packet_payload_len(packet);
+	peer->socket->last_outbound_tcp_header = *(packet->tcp);
+	peer->socket->last_outbound_tcp_payload_len = len;
+	if (len == 0)
+		return STATUS_OK;
+
+	sent_usecs = packet->time_usecs ? packet->time_usecs : now_usecs();
+	peer->last_data_usecs = sent_usecs;
+	++peer->data_segments;
+	if (peer->next_drop < spec->num_drops &&
+	    spec->drops[peer->next_drop] == peer->data_segments) {
+		DEBUGP("autopeer: dropping data segment %llu\n",
+		       (unsigned long long)peer->data_segments);
+		++peer->next_drop;
+		return STATUS_OK;
+	}
+	if (find_tcp_timestamp(packet, error))
+		return STATUS_ERR;
+
+	segment = calloc(1, sizeof(struct peer_segment));
+	segment->seq = ntohl(packet->tcp->seq);
+	segment->len = len;
+	if (packet->tcp_ts_val != NULL) {
+		segment->has_ts = true;
+		segment->ts_val = packet_tcp_ts_val(packet);
+	}
+	if (spec->rate_bps > 0) {
+		if (peer->link_free_usecs < sent_usecs)
+			peer->link_free_usecs = sent_usecs;
+		peer->link_free_usecs +=
+			(s64)packet->ip_bytes * 8000000LL / spec->rate_bps;
+		sent_usecs = peer->link_free_usecs;
+	}
+	segment->arrival_usecs = sent_usecs + spec->rtt_usecs / 2;
+
+	if (peer->last_segment != NULL)
+		peer->last_segment->next = segment;
+	else
+		peer->segments = segment;
+	peer->last_segment = segment;
+	return STATUS_OK;
+}
+
+/* Inject the ACK at the head of the queue. */
+static int peer_send_ack(struct peer *peer, char **error)
+{
+	struct socket *socket = peer->socket;
+	struct peer_ack *ack = peer->acks;
+	struct packet *packet = ack->packet;
+	u32 ack_seq = ntohl(packet->tcp->ack_seq);
+	int result = STATUS_ERR;
+
+	peer->acks = ack->next;
+	if (peer->acks == NULL)
+		peer->last_ack = NULL;
+
+	if (peer_seq_before(peer->acked, ack_seq)) {
+		peer->acked_bytes += ack_seq - peer->acked;
+		peer->acked = ack_seq;
+	}
+	socket->last_injected_tcp_header = *(packet->tcp);
+	socket->last_injected_tcp_payload_len = 0;
+	if (find_tcp_timestamp(packet, error))
+		goto out;
+	if (packet->tcp_ts_val != NULL) {
+		socket->last_injected_tcp_ts_val = packet_tcp_ts_val(packet);
+		socket->last_injected_tcp_ts_ecr = packet_tcp_ts_ecr(packet);
+	}
+
+	result = send_live_ip_packet(peer->state, packet);
+	if (result != STATUS_OK)
+		asprintf(error, "unable to inject ACK");
+out:
+	packet_free(packet);
+	free(ack);
+	return result;
+}
+
+/* Return the wall time of the next thing the phase has to do. */
+static s64 peer_next_deadline(const struct peer *peer)
+{
+	const struct peer_spec *spec = peer->spec;
+	s64 deadline = NO_DEADLINE;
+
+	if (peer->segments != NULL)
+		deadline = peer->segments->arrival_usecs;
+	if (peer->delack_usecs != 0 &&
+	    (deadline == NO_DEADLINE || peer->delack_usecs < deadline))
+		deadline = peer->delack_usecs;
+	if (peer->acks != NULL &&
+	    (deadline == NO_DEADLINE || peer->acks->send_usecs < deadline))
+		deadline = peer->acks->send_usecs;
+	if (spec->duration_usecs > 0) {
+		s64 end_usecs = peer->start_usecs + spec->duration_usecs;
+
+		if (deadline == NO_DEADLINE || end_usecs < deadline)
+			deadline = end_usecs;
+	} else if (deadline == NO_DEADLINE) {
+		deadline = (peer->last_data_usecs + spec->rtt_usecs +
+			    PEER_IDLE_USECS);
+	}
+	return deadline;
+}
+
+/* Run the phase until it is done. */
+static int peer_run(struct peer *peer, char **error)
+{
+	const struct peer_spec *spec = peer->spec;
+
+	while (1) {
+		struct packet *packet = NULL;
+		s64 now = now_usecs();
+
+		while (peer->segments != NULL &&
+		       peer->segments->arrival_usecs <= now) {
+			struct peer_segment *segment = peer->segments;
+
+			peer->segments = segment->next;
+			if (peer->segments == NULL)
+				peer->last_segment = NULL;
+			if (peer_receive_segment(peer, segment, error)) {
+				free(segment);
+				return STATUS_ERR;
+			}
+			free(segment);
+		}
+		if (peer->delack_usecs != 0 && peer->delack_usecs <= now &&
+		    peer_queue_ack(peer, peer->delack_usecs, error))
+			return STATUS_ERR;
+		while (peer->acks != NULL && peer->acks->send_usecs <= now) {
+			if (peer_send_ack(peer, error))
+				return STATUS_ERR;
+		}
+
+		if (spec->bytes > 0 && peer->acked_bytes >= spec->bytes)
+			return STATUS_OK;
+		if (spec->duration_usecs > 0 &&
+		    now - peer->start_usecs >= spec->duration_usecs)
+			return STATUS_OK;
+		if (spec->duration_usecs == 0 && peer->segments == NULL &&
+		    peer->acks == NULL && peer->delack_usecs == 0 &&
+		    now - peer->last_data_usecs >=
+		    spec->rtt_usecs + PEER_IDLE_USECS) {
+			asprintf(error, "sender went idle after %llu of "
+				 "%lld bytes",
+				 (unsigned long long)peer->acked_bytes,
+				 spec->bytes);
+			return STATUS_ERR;
+		}
+
+		if (netdev_receive_by(peer->state->netdev,
+				      peer_next_deadline(peer), &packet,
+				      error))
+			return STATUS_ERR;
+		if (packet != NULL) {
+			int result = peer_sniff(peer, packet, error);
+
+			packet_free(packet);
+			if (result != STATUS_OK)
+				return result;
+		}
+	}
+}
+
+int run_peer_event(struct state *state, struct event *event,
+		   const struct peer_spec *spec, char **error)
+{
+	DEBUGP("%d: autopeer\n", event->line_number);
+
+	struct peer peer;
+	char *err = NULL;
+	int result = STATUS_ERR;
+
+	wait_for_event(state);
+	if (peer_init(&peer, state, spec, &err) == STATUS_OK)
+		result = peer_run(&peer, &err);
+	DEBUGP("autopeer: %llu data segments, %llu bytes ACKed\n",
+	       (unsigned long long)peer.data_segments,
+	       (unsigned long long)peer.acked_bytes);
+	peer_free(&peer);
+	if (result == STATUS_OK)
+		return STATUS_OK;
+
+	asprintf(error, "%s:%d: error in autopeer phase: %s\n",
+		 state->config->script_path, event->line_number, err);
+	free(err);
+	return result;
+}
+
 /* Inject a TCP RST packet to clear the connection state out of the
  * kernel, so the connection does not continue to retransmit packets
  * that may be sniffed during later test executions and cause false
@@ -2511,7 +3264,7 @@ int reset_connection(struct state *state, struct socket *socket)
 	set_packet_tuple(packet, &live_inbound);
 
 	/* Inject live packet into kernel. */
-	result = send_live_ip_packet(state->netdev, packet);
+	result = send_live_ip_packet(state, packet);
 
 	packet_free(packet);
 
@@ -2557,13 +3310,50 @@ int abort_association(struct state *state, struct socket *socket)
 	}
 
 	/* Inject live packet into kernel. */
-	result = send_live_ip_packet(state->netdev, packet);
+	result = send_live_ip_packet(state, packet);
 
 	packet_free(packet);
 
 	return result;
 }
 
+int run_spacing_event(struct state *state, struct event *event,
+		      const struct spacing_spec *spec, char **error)
+{
+	struct packets *packets = state->packets;
+	struct train_packet train[MAX_SPACING_PACKETS];
+	int num_packets = spec->packets;
+	int result = STATUS_ERR;
+	char *err = NULL;
+	int i = 0;
+
+	DEBUGP("%d: spacing of %lld packets\n", event->line_number,
+	       (long long)spec->packets);
+
+	if (num_packets > packets->num_outbound)
+		num_packets = packets->num_outbound;
+	for (i = 0; i < num_packets; ++i) {
+		const u64 n = packets->num_outbound - num_packets + i;
+
+		train[i] = packets->outbound[n % MAX_SPACING_PACKETS];
+		train[i].time_usecs = live_time_to_script_time_usecs(
+			state, train[i].time_usecs);
+	}
+
+	result = verify_packet_spacing(spec, train, num_packets, &err);
+	if (result == STATUS_OK)
+		return STATUS_OK;
+	if (state->config->non_fatal_packet)
+		result = STATUS_WARN;
+	asprintf(error, "%s:%d: %s handling spacing of last %lld outbound "
+		 "packets: %s\n",
+		 state->config->script_path, event->line_number,
+		 result == STATUS_ERR ? "error" : "warning",
+		 (long long)spec->packets, err);
+	free(err);
+	return result;
+}
+
 struct packets *packets_new(void)
 {
 	struct packets *packets = calloc(1, sizeof(struct packets));
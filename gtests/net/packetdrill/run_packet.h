@@ -27,6 +27,7 @@
 
 #include "types.h"
 
+#include "packet_spacing.h"
 #include "script.h"
 
 struct event;
@@ -37,6 +38,10 @@ struct state;
 /* Internal state for the packet-handling module. */
 struct packets {
 	int next_ephemeral_port;	/* cached port to use, or -1 */
+
+	/* Ring of the last outbound packets we sniffed, for spacing. */
+	struct train_packet outbound[MAX_SPACING_PACKETS];
+	u64 num_outbound;		/* outbound packets sniffed in all */
 };
 
 /* Allocate and return internal state for the packets module. */
@@ -54,6 +59,48 @@ extern int run_packet_event(struct state *state,
 			    struct packet *packet,
 			    char **error);
 
+/* Run an autopeer phase, playing a bulk data receiver for the socket
+ * under test until the phase is done. On success, return STATUS_OK; on
+ * error return STATUS_ERR and fill in a malloc-allocated error message
+ * in *error.
+ */
+extern int run_peer_event(struct state *state,
+			  struct event *event,
+			  const struct peer_spec *spec,
+			  char **error);
+
+/* Verify the spacing of the last outbound packets the script sniffed,
+ * in the script or in an autopeer phase, against the given limits.
+ * Returns STATUS_OK on success; on failure returns STATUS_ERR, or
+ * STATUS_WARN if packet errors are non-fatal, and fills in a
+ * malloc-allocated error message in *error.
+ */
+extern int run_spacing_event(struct state *state,
+			     struct event *event,
+			     const struct spacing_spec *spec,
+			     char **error);
+
+/* Offset the sequence numbers of the SACK blocks in the packet's TCP
+ * options by the given amount, to translate them between live and
+ * script space. Returns STATUS_OK on success; on failure returns
+ * STATUS_ERR and fills in *error.
+ */
+extern int offset_sack_blocks(struct packet *packet, u32 ack_offset,
+			      char **error);
+
+/* For offline verification: check that the given packet from a capture
+ * file, with live addresses and sequence numbers, matches the given
+ * outbound script packet of the given event, as if we had sniffed it
+ * live. Returns STATUS_OK, STATUS_WARN, or STATUS_ERR like
+ * run_packet_event().
+ */
+extern int verify_recorded_packet(struct state *state,
+				  struct event *event,
+				  struct socket *socket,
+				  struct packet *script_packet,
+				  struct packet *recorded_packet,
+				  char **error);
+
 /* Inject a TCP RST packet to clear the connection state out of the kernel. */
 extern int reset_connection(struct state *state,
 			    struct socket *socket);
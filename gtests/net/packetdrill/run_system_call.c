@@ -35,13 +35,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef linux
+#include <linux/errqueue.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
+#include "cpu_affinity.h"
 #include "logging.h"
+#include "payload_pattern.h"
+#include "perf_cost.h"
 #include "run.h"
 #include "script.h"
 
@@ -248,100 +257,487 @@ static int ellipsis_arg(struct expression_list *args, int index, char **error)
 	return STATUS_OK;
 }
 
-/* Free all the space used by the given iovec. */
-static void iovec_free(struct iovec *iov, size_t iov_len)
+/* Return STATUS_OK iff the argument with the given index is NULL. */
+static int null_arg(struct expression_list *args, int index, char **error)
+{
+	s32 value;
+
+	if (s32_arg(args, index, &value, error))
+		return STATUS_ERR;
+	if (value != 0) {
+		asprintf(error, "Expected NULL for argument %d but got %d",
+			 index, value);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Return the integer value of the given argument expression if it is
+ * a literal integer, or 0 otherwise.
+ */
+static size_t literal_arg_bytes(struct expression_list *args, int index)
+{
+	while ((args != NULL) && (index-- > 0))
+		args = args->next;
+	if ((args == NULL) || (args->expression == NULL) ||
+	    (args->expression->type != EXPR_INTEGER) ||
+	    (args->expression->value.num < 0))
+		return 0;
+	return args->expression->value.num;
+}
+
+/* Return the total number of bytes in the iovec array expression. */
+static size_t iovec_expression_bytes(struct expression *expression)
+{
+	struct expression_list *list;
+	size_t bytes = 0;
+
+	if ((expression == NULL) || (expression->type != EXPR_LIST))
+		return 0;
+	for (list = expression->value.list; list != NULL; list = list->next) {
+		struct iovec_expr *iov_expr;
+
+		if (list->expression->type != EXPR_IOVEC)
+			continue;
+		iov_expr = list->expression->value.iovec;
+		if ((iov_expr->iov_len->type == EXPR_INTEGER) &&
+		    (iov_expr->iov_len->value.num > 0))
+			bytes += iov_expr->iov_len->value.num;
+	}
+	return bytes;
+}
+
+/* Return the total number of bytes in the msg_iov of the msghdr
+ * expression.
+ */
+static size_t msghdr_expression_bytes(struct expression *expression)
+{
+	if ((expression == NULL) || (expression->type != EXPR_MSGHDR))
+		return 0;
+	return iovec_expression_bytes(expression->value.msghdr->msg_iov);
+}
+
+/* Return the total number of bytes in the msg_iov of each msghdr of
+ * the mmsghdr array expression, since recvmmsg() reads all of the
+ * messages into one sink buffer.
+ */
+static size_t mmsghdr_expression_bytes(struct expression *expression)
+{
+	struct expression_list *list;
+	size_t bytes = 0;
+
+	if ((expression == NULL) || (expression->type != EXPR_LIST))
+		return 0;
+	for (list = expression->value.list; list != NULL; list = list->next)
+		bytes += msghdr_expression_bytes(list->expression);
+	return bytes;
+}
+
+/* Return the payload bytes the given system call in the script will
+ * need from the payload arena, or 0 if it doesn't use the arena.
+ */
+static size_t syscall_payload_bytes(struct syscall_spec *syscall)
+{
+	const char *name = syscall->name;
+	struct expression_list *args = syscall->arguments;
+
+	if (!strcmp(name, "read") || !strcmp(name, "write") ||
+	    !strcmp(name, "recv") || !strcmp(name, "send") ||
+	    !strcmp(name, "recvfrom") || !strcmp(name, "sendto"))
+		return literal_arg_bytes(args, 2);
+	if (!strcmp(name, "readv") || !strcmp(name, "writev"))
+		return iovec_expression_bytes((args && args->next) ?
+					      args->next->expression : NULL);
+	if (!strcmp(name, "recvmsg") || !strcmp(name, "sendmsg"))
+		return msghdr_expression_bytes((args && args->next) ?
+					       args->next->expression : NULL);
+	if (!strcmp(name, "recvmmsg") || !strcmp(name, "sendmmsg"))
+		return mmsghdr_expression_bytes((args && args->next) ?
+						args->next->expression : NULL);
+	return 0;
+}
+
+/* Map and pre-fault the payload arena, sized for the largest payload
+ * of any system call in the script.
+ */
+static void payload_arena_new(struct state *state, struct syscalls *syscalls)
+{
+	struct event *event = NULL;
+	size_t max_bytes = 0;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void *arena = MAP_FAILED;
+
+	for (event = state->script->event_list; event != NULL;
+	     event = event->next) {
+		if (event->type == SYSCALL_EVENT) {
+			size_t bytes = syscall_payload_bytes(
+				event->event.syscall);
+			if (bytes > max_bytes)
+				max_bytes = bytes;
+		}
+	}
+	if (max_bytes == 0)
+		return;
+
+	syscalls->payload_arena_bytes = max_bytes;
+	syscalls->payload_source_bytes = max_bytes;
+	if (state->config->payload_pattern)
+		syscalls->payload_source_bytes += PAYLOAD_PATTERN_PERIOD;
+	syscalls->payload_map_bytes = (syscalls->payload_source_bytes +
+				       (syscalls->num_threads + 1) * max_bytes);
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+#ifdef MAP_HUGETLB
+	if (state->config->payload_hugepages) {
+		const size_t HUGEPAGE_BYTES = 2 * 1024 * 1024;
+		size_t map_bytes = ((syscalls->payload_map_bytes +
+				     HUGEPAGE_BYTES - 1) &
+				    ~(HUGEPAGE_BYTES - 1));
+		arena = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE,
+			     flags | MAP_HUGETLB, -1, 0);
+		if (arena != MAP_FAILED)
+			syscalls->payload_map_bytes = map_bytes;
+		else
+			DEBUGP("hugepage payload arena unavailable; "
+			       "falling back to regular pages\n");
+	}
+#endif
+	if (arena == MAP_FAILED)
+		arena = mmap(NULL, syscalls->payload_map_bytes,
+			     PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (arena == MAP_FAILED)
+		die_perror("mmap");
+
+	/* Touch every page, in case MAP_POPULATE is unavailable. */
+	memset(arena, 0, syscalls->payload_map_bytes);
+	if (state->config->payload_pattern)
+		payload_pattern_fill(arena, syscalls->payload_source_bytes, 0);
+	syscalls->payload_arena = arena;
+	DEBUGP("payload arena: %zu bytes per payload\n", max_bytes);
+}
+
+static void payload_arena_free(struct syscalls *syscalls)
+{
+	if (syscalls->payload_arena == NULL)
+		return;
+	if (munmap(syscalls->payload_arena, syscalls->payload_map_bytes) < 0)
+		die_perror("munmap");
+	syscalls->payload_arena = NULL;
+}
+
+/* Return the payload arena sink for the calling thread: sink 0 for the
+ * main thread, and sink i + 1 for pool thread i.
+ */
+static char *payload_sink(struct syscalls *syscalls)
 {
+	pthread_t self = pthread_self();
 	int i;
 
-	if (iov == NULL)
+	for (i = 0; i < syscalls->num_threads; ++i) {
+		if (pthread_equal(self, syscalls->threads[i].thread))
+			break;
+	}
+	if (i == syscalls->num_threads)
+		i = 0;
+	else
+		i += 1;
+	return (syscalls->payload_arena + syscalls->payload_source_bytes +
+		i * syscalls->payload_arena_bytes);
+}
+
+/* Return a buffer of count bytes for the payload of a system call. A
+ * source of outgoing data is zero-filled, or with --payload_pattern
+ * holds the pattern starting at the given stream offset; a sink for
+ * incoming data is scratch space private to the calling thread. The
+ * buffer comes from the payload arena if the arena is large enough,
+ * or else from the heap. Release it with payload_buffer_free().
+ */
+static char *payload_buffer_new(struct state *state, size_t count,
+				bool is_sink, u64 offset)
+{
+	struct syscalls *syscalls = state->syscalls;
+	bool pattern = state->config->payload_pattern;
+	char *buf = NULL;
+
+	if ((syscalls->payload_arena != NULL) &&
+	    (count <= syscalls->payload_arena_bytes)) {
+		if (is_sink)
+			return payload_sink(syscalls);
+		if (pattern)
+			offset %= PAYLOAD_PATTERN_PERIOD;
+		else
+			offset = 0;
+		return syscalls->payload_arena + offset;
+	}
+	buf = calloc(count, 1);
+	if (pattern && !is_sink)
+		payload_pattern_fill((u8 *)buf, count, offset);
+	return buf;
+}
+
+static void payload_buffer_free(struct state *state, char *buf)
+{
+	struct syscalls *syscalls = state->syscalls;
+
+	if ((syscalls->payload_arena != NULL) &&
+	    (buf >= syscalls->payload_arena) &&
+	    (buf < syscalls->payload_arena + syscalls->payload_map_bytes))
 		return;
+	free(buf);
+}
+
+/* The iovec, msghdr, or mmsghdr array argument of a system call
+ * event, built in the script's arena by prepare_system_calls() before
+ * the script runs. Running the event only points the iovecs at
+ * payload buffers, and works on a copy of the msghdrs, which the
+ * kernel writes to.
+ */
+struct syscall_buffers {
+	struct iovec *iov;		/* iovecs of readv() or writev() */
+	size_t iov_len;			/* elements of iov */
+	struct msghdr *msgs;		/* msghdrs of *msg() or *mmsg() */
+	size_t *iov_lens;		/* elements of the msg_iov of each */
+	size_t vlen;			/* elements of msgs */
+#ifdef linux
+	struct mmsghdr *msgvec;		/* live copy of msgs for *mmsg() */
+#endif
+};
+
+/* Point the iov_base of each of the given iovecs into a single
+ * payload buffer; for a source with --payload_pattern, that buffer
+ * holds the pattern starting at the given stream offset. Release the
+ * buffer with iovec_release().
+ */
+static void iovec_fill(struct state *state, struct iovec *iov,
+		       size_t iov_len, bool is_sink, u64 offset)
+{
+	size_t total_len = 0;
+	char *buf = NULL;
+	int i;
 
+	if (iov_len == 0)
+		return;
 	for (i = 0; i < iov_len; ++i)
-		free(iov[i].iov_base);
-	free(iov);
+		total_len += iov[i].iov_len;
+	buf = payload_buffer_new(state, total_len, is_sink, offset);
+	for (i = 0; i < iov_len; ++i) {
+		iov[i].iov_base = buf;
+		buf += iov[i].iov_len;
+	}
+}
+
+/* Release the payload buffer that iovec_fill() gave the iovecs. */
+static void iovec_release(struct state *state, struct iovec *iov,
+			  size_t iov_len)
+{
+	if (iov_len > 0)
+		payload_buffer_free(state, iov[0].iov_base);
 }
 
-/* Allocate and fill in an iovec described by the given expression.
- * Return STATUS_OK if the expression is a valid iovec. Otherwise
- * fill in the error with a human-readable error message and return
- * STATUS_ERR.
+/* Build an iovec array described by the given expression in the given
+ * arena, with the iov_len fields filled in and the iov_base buffers
+ * left to iovec_fill(). Return STATUS_OK if the expression is a valid
+ * iovec. Otherwise fill in the error with a human-readable error
+ * message and return STATUS_ERR.
  */
-static int iovec_new(struct expression *expression,
-		     struct iovec **iov_ptr, size_t *iov_len_ptr,
-		     char **error)
+static int iovec_build(struct arena *arena, struct expression *expression,
+		       struct iovec **iov_ptr, size_t *iov_len_ptr,
+		       char **error)
 {
-	int status = STATUS_ERR;
 	int i;
 	struct expression_list *list;	/* input expression from script */
 	size_t iov_len = 0;
 	struct iovec *iov = NULL;	/* live output */
 
 	if (check_type(expression, EXPR_LIST, error))
-		goto error_out;
+		return STATUS_ERR;
 
 	list = expression->value.list;
 
 	iov_len = expression_list_length(list);
-	iov = calloc(iov_len, sizeof(struct iovec));
+	iov = arena_alloc(arena, iov_len * sizeof(struct iovec));
 
 	for (i = 0; i < iov_len; ++i, list = list->next) {
-		size_t len;
 		struct iovec_expr *iov_expr;
 
 		if (check_type(list->expression, EXPR_IOVEC, error))
-			goto error_out;
+			return STATUS_ERR;
 
 		iov_expr = list->expression->value.iovec;
 
 		assert(iov_expr->iov_base->type == EXPR_ELLIPSIS);
 		assert(iov_expr->iov_len->type == EXPR_INTEGER);
 
-		len = iov_expr->iov_len->value.num;
-
-		iov[i].iov_len = len;
-		iov[i].iov_base = calloc(len, 1);
+		iov[i].iov_len = iov_expr->iov_len->value.num;
 	}
 
-	status = STATUS_OK;
-
-error_out:
 	*iov_ptr = iov;
 	*iov_len_ptr = iov_len;
-	return status;
+	return STATUS_OK;
 }
 
-/* Free all the space used by the given msghdr. */
-static void msghdr_free(struct msghdr *msg, size_t iov_len)
+#ifdef linux
+/* The control buffer space we provide for each cmsg a script expects:
+ * room for an IP_RECVERR/IPV6_RECVERR sock_extended_err followed by
+ * the offender address.
+ */
+#define CMSG_RECVERR_SPACE \
+	CMSG_SPACE(sizeof(struct sock_extended_err) + \
+		   sizeof(struct sockaddr_in6))
+#endif
+
+/* Allocate a control buffer in the given arena for the msg_control
+ * list of cmsghdr expressions in the given expression. Returns
+ * STATUS_OK on success; on failure returns STATUS_ERR and sets error
+ * message.
+ */
+static int cmsgs_build(struct arena *arena, struct expression *expression,
+		       struct msghdr *msg, char **error)
 {
-	if (msg == NULL)
-		return;
+	if (check_type(expression, EXPR_LIST, error))
+		return STATUS_ERR;
+#ifdef linux
+	msg->msg_controllen = (expression_list_length(expression->value.list) *
+			       CMSG_RECVERR_SPACE);
+	msg->msg_control = arena_alloc(arena, msg->msg_controllen);
+	return STATUS_OK;
+#else
+	asprintf(error, "msg_control is not supported on this platform");
+	return STATUS_ERR;
+#endif
+}
+
+#ifdef linux
+/* Check the given field of a cmsg against the script's expectation,
+ * which may be an ellipsis to accept any value.
+ */
+static int cmsg_field_check(const char *name, struct expression *expression,
+			    u32 actual, char **error)
+{
+	s32 expected;
 
-	free(msg->msg_name);
-	iovec_free(msg->msg_iov, iov_len);
-	free(msg->msg_control);
+	if (expression->type == EXPR_ELLIPSIS)
+		return STATUS_OK;
+	if (get_s32(expression, &expected, error))
+		return STATUS_ERR;
+	if ((u32)expected != actual) {
+		asprintf(error, "Expected %s %u but got %u",
+			 name, (u32)expected, actual);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
 }
 
-/* Allocate and fill in a msghdr described by the given expression. */
-static int msghdr_new(struct expression *expression,
-		      struct msghdr **msg_ptr, size_t *iov_len_ptr,
-		      char **error)
+/* Check a sock_extended_err read from the error queue, e.g. the
+ * [ee_info, ee_data] range of a MSG_ZEROCOPY completion.
+ */
+static int sock_extended_err_check(struct sock_extended_err_expr *ee_expr,
+				   const struct sock_extended_err *ee,
+				   char **error)
+{
+	if (cmsg_field_check("ee_errno", ee_expr->ee_errno,
+			     ee->ee_errno, error) ||
+	    cmsg_field_check("ee_origin", ee_expr->ee_origin,
+			     ee->ee_origin, error) ||
+	    cmsg_field_check("ee_type", ee_expr->ee_type,
+			     ee->ee_type, error) ||
+	    cmsg_field_check("ee_code", ee_expr->ee_code,
+			     ee->ee_code, error) ||
+	    cmsg_field_check("ee_info", ee_expr->ee_info,
+			     ee->ee_info, error) ||
+	    cmsg_field_check("ee_data", ee_expr->ee_data,
+			     ee->ee_data, error))
+		return STATUS_ERR;
+	return STATUS_OK;
+}
+#endif
+
+/* Check the cmsgs returned by recvmsg() against the msg_control list
+ * in the script. Return STATUS_OK if they match. Otherwise fill in
+ * the error with a human-readable error message and return STATUS_ERR.
+ */
+static int cmsgs_check(struct expression *expression, struct msghdr *msg,
+		       char **error)
+{
+#ifdef linux
+	struct expression_list *list;	/* input expression from script */
+	struct cmsghdr *cmsg;
+	int i = 0;
+
+	assert(expression->type == EXPR_LIST);
+	list = expression->value.list;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msg, cmsg), list = list->next, ++i) {
+		struct cmsghdr_expr *cmsg_expr;
+		struct expression *data;
+
+		if (list == NULL) {
+			asprintf(error, "Expected %d cmsgs but got more", i);
+			return STATUS_ERR;
+		}
+		if (check_type(list->expression, EXPR_CMSGHDR, error))
+			return STATUS_ERR;
+		cmsg_expr = list->expression->value.cmsghdr;
+
+		if (cmsg_field_check("cmsg_level", cmsg_expr->cmsg_level,
+				     cmsg->cmsg_level, error) ||
+		    cmsg_field_check("cmsg_type", cmsg_expr->cmsg_type,
+				     cmsg->cmsg_type, error))
+			return STATUS_ERR;
+
+		data = cmsg_expr->cmsg_data;
+		if (data->type == EXPR_ELLIPSIS)
+			continue;
+		if (check_type(data, EXPR_SOCK_EXTENDED_ERR, error))
+			return STATUS_ERR;
+		if (cmsg->cmsg_len <
+		    CMSG_LEN(sizeof(struct sock_extended_err))) {
+			asprintf(error, "cmsg %d too short for "
+				 "sock_extended_err: %d bytes",
+				 i, (int)cmsg->cmsg_len);
+			return STATUS_ERR;
+		}
+		if (sock_extended_err_check(
+			    data->value.sock_extended_err,
+			    (struct sock_extended_err *)CMSG_DATA(cmsg),
+			    error))
+			return STATUS_ERR;
+	}
+	if (list != NULL) {
+		asprintf(error, "Expected %d cmsgs but got %d",
+			 expression_list_length(expression->value.list), i);
+		return STATUS_ERR;
+	}
+	return STATUS_OK;
+#else
+	assert(!"cmsgs_check not supported on this platform");
+	return STATUS_ERR;
+#endif
+}
+
+/* Build a msghdr described by the given expression in the given
+ * arena, with its msg_iov buffers left to iovec_fill(). Return
+ * STATUS_OK if the expression is a valid msghdr. Otherwise fill in the
+ * error with a human-readable error message and return STATUS_ERR.
+ */
+static int msghdr_build(struct arena *arena, struct expression *expression,
+			struct msghdr *msg, size_t *iov_len_ptr,
+			char **error)
 {
-	int status = STATUS_ERR;
 	s32 s32_val = 0;
 	struct msghdr_expr *msg_expr;	/* input expression from script */
 	socklen_t name_len = sizeof(struct sockaddr_storage);
-	struct msghdr *msg = NULL;	/* live output */
 
 	if (check_type(expression, EXPR_MSGHDR, error))
-		goto error_out;
+		return STATUS_ERR;
 
 	msg_expr = expression->value.msghdr;
 
-	msg = calloc(1, sizeof(struct msghdr));
-
 	if (msg_expr->msg_name != NULL) {
 		assert(msg_expr->msg_name->type == EXPR_ELLIPSIS);
-		msg->msg_name = calloc(1, name_len);
+		msg->msg_name = arena_alloc(arena, name_len);
 	}
 
 	if (msg_expr->msg_namelen != NULL) {
@@ -349,15 +745,16 @@ static int msghdr_new(struct expression *expression,
 		msg->msg_namelen = name_len;
 	}
 
+	*iov_len_ptr = 0;
 	if (msg_expr->msg_iov != NULL) {
-		if (iovec_new(msg_expr->msg_iov, &msg->msg_iov, iov_len_ptr,
-			      error))
-			goto error_out;
+		if (iovec_build(arena, msg_expr->msg_iov,
+				&msg->msg_iov, iov_len_ptr, error))
+			return STATUS_ERR;
 	}
 
 	if (msg_expr->msg_iovlen != NULL) {
 		if (get_s32(msg_expr->msg_iovlen, &s32_val, error))
-			goto error_out;
+			return STATUS_ERR;
 		msg->msg_iovlen = s32_val;
 	}
 
@@ -365,22 +762,81 @@ static int msghdr_new(struct expression *expression,
 		asprintf(error,
 			 "msg_iovlen %d does not match %d-element iovec array",
 			 (int)msg->msg_iovlen, (int)*iov_len_ptr);
-		goto error_out;
+		return STATUS_ERR;
 	}
 
 	if (msg_expr->msg_flags != NULL) {
 		if (get_s32(msg_expr->msg_flags, &s32_val, error))
-			goto error_out;
+			return STATUS_ERR;
 		msg->msg_flags = s32_val;
 	}
 
-	/* TODO(ncardwell): msg_control, msg_controllen */
+	if (msg_expr->msg_control != NULL) {
+		if (cmsgs_build(arena, msg_expr->msg_control, msg, error))
+			return STATUS_ERR;
+	}
 
-	status = STATUS_OK;
+	return STATUS_OK;
+}
 
-error_out:
-	*msg_ptr = msg;
-	return status;
+/* Point the msg_iov buffers of the msghdrs of the given system call at
+ * payload buffers, as iovec_fill() does. Sinks get consecutive slices
+ * of one buffer, so no message overwrites another. Sources each get
+ * their own buffer, holding the pattern from the given stream offset;
+ * if is_stream, the offset runs on from one message to the next, as
+ * the kernel sends them, and otherwise each message is a datagram
+ * starting at offset 0. Release the buffers with msghdrs_release().
+ */
+static void msghdrs_fill(struct state *state, struct syscall_buffers *buffers,
+			 bool is_sink, bool is_stream, u64 offset)
+{
+	size_t total_len = 0, num_iovs = 0;
+	char *buf = NULL;
+	int i, j;
+
+	for (i = 0; i < buffers->vlen; ++i) {
+		struct iovec *iov = buffers->msgs[i].msg_iov;
+		size_t msg_len = 0;
+
+		num_iovs += buffers->iov_lens[i];
+		for (j = 0; j < buffers->iov_lens[i]; ++j)
+			msg_len += iov[j].iov_len;
+		if (!is_sink) {
+			iovec_fill(state, iov, buffers->iov_lens[i], false,
+				   offset);
+			if (is_stream)
+				offset += msg_len;
+		}
+		total_len += msg_len;
+	}
+	if (!is_sink || (num_iovs == 0))
+		return;
+
+	buf = payload_buffer_new(state, total_len, true, 0);
+	for (i = 0; i < buffers->vlen; ++i) {
+		struct iovec *iov = buffers->msgs[i].msg_iov;
+
+		for (j = 0; j < buffers->iov_lens[i]; ++j) {
+			iov[j].iov_base = buf;
+			buf += iov[j].iov_len;
+		}
+	}
+}
+
+/* Release the payload buffers that msghdrs_fill() used. */
+static void msghdrs_release(struct state *state,
+			    struct syscall_buffers *buffers, bool is_sink)
+{
+	int i;
+
+	for (i = 0; i < buffers->vlen; ++i) {
+		if (buffers->iov_lens[i] == 0)
+			continue;
+		iovec_release(state, buffers->msgs[i].msg_iov,
+			      buffers->iov_lens[i]);
+		if (is_sink)
+			break;		/* the first slice starts the buffer */
+	}
 }
 
 /* Allocate and fill in a pollfds array described by the given
@@ -487,26 +943,62 @@ static int pollfds_check(struct expression *fds_expression,
 	return STATUS_OK;
 }
 
+/* Return the syscall thread in the pool that is executing the given
+ * blocking system call. Callers must hold the global lock.
+ */
+static struct syscall_thread *find_thread_for_syscall(
+	struct state *state, struct syscall_spec *syscall)
+{
+	int i;
+
+	for (i = 0; i < state->syscalls->num_threads; ++i) {
+		struct syscall_thread *thread = &state->syscalls->threads[i];
+		if ((thread->event != NULL) &&
+		    (thread->event->event.syscall == syscall))
+			return thread;
+	}
+	assert(!"no syscall thread for blocking system call");
+	return NULL;
+}
+
+/* When the system call this thread is running began, in nanoseconds
+ * of CLOCK_MONOTONIC; and for --perf_cost, its script line and the
+ * thread's counters as it began.
+ */
+static __thread s64 syscall_begin_nsecs;
+static __thread int syscall_line_number;
+static __thread struct perf_sample syscall_perf_start;
+
 /* For blocking system calls, give up the global lock and wake the
  * main thread so it can continue test execution. Callers should call
  * this function immediately before calling a system call in order to
  * release the global lock immediately before a system call that the
- * script expects to block.
+ * script expects to block. Either way, we note when the call begins.
  */
 static void begin_syscall(struct state *state, struct syscall_spec *syscall)
 {
 	if (is_blocking_syscall(syscall)) {
-		assert(state->syscalls->state == SYSCALL_ENQUEUED);
-		state->syscalls->state = SYSCALL_RUNNING;
+		struct syscall_thread *thread =
+			find_thread_for_syscall(state, syscall);
+		syscall_line_number = thread->event->line_number;
+		assert(thread->state == SYSCALL_ENQUEUED);
+		thread->state = SYSCALL_RUNNING;
 		run_unlock(state);
-		DEBUGP("syscall thread: begin_syscall signals dequeued\n");
+		DEBUGP("syscall thread %d: begin_syscall signals dequeued\n",
+		       thread->index);
 		if (pthread_cond_signal(&state->syscalls->dequeued) != 0)
 			die_perror("pthread_cond_signal");
+	} else {
+		syscall_line_number = state->event->line_number;
 	}
+	if (state->perf_costs != NULL)
+		perf_sample_read(&syscall_perf_start);
+	syscall_begin_nsecs = now_monotonic_nsecs();
 }
 
 /* Verify that the system call returned the expected result code and
- * errno value. Returns STATUS_OK on success; on failure returns
+ * errno value, and took no longer than any latency limit the script
+ * gives. Returns STATUS_OK on success; on failure returns
  * STATUS_ERR and sets error message. Callers should call this function
  * immediately after returning from a system call in order to immediately
  * re-grab the global lock if this is a blocking call.
@@ -519,17 +1011,30 @@ static int end_syscall(struct state *state, struct syscall_spec *syscall,
 		       enum result_check_t mode, int actual, char **error)
 {
 	int actual_errno = errno;	/* in case we clobber this later */
+	s64 latency_nsecs = now_monotonic_nsecs() - syscall_begin_nsecs;
+	struct perf_sample perf_end;
 	s32 expected = 0;
 
+	/* The perf_costs pointer doesn't change while the script runs. */
+	if (state->perf_costs != NULL)
+		perf_sample_read(&perf_end);
+
 	/* For blocking calls, advance state and reacquire the global lock. */
 	if (is_blocking_syscall(syscall)) {
 		s64 live_end_usecs = now_usecs();
 		DEBUGP("syscall thread: end_syscall grabs lock\n");
 		run_lock(state);
-		state->syscalls->live_end_usecs = live_end_usecs;
-		assert(state->syscalls->state == SYSCALL_RUNNING);
-		state->syscalls->state = SYSCALL_DONE;
+		struct syscall_thread *thread =
+			find_thread_for_syscall(state, syscall);
+		thread->live_end_usecs = live_end_usecs;
+		assert(thread->state == SYSCALL_RUNNING);
+		thread->state = SYSCALL_DONE;
 	}
+	syscall_latencies_add(state->syscalls->latencies, syscall->name,
+			      latency_nsecs);
+	if (state->perf_costs != NULL)
+		perf_costs_add(state->perf_costs, syscall_line_number,
+			       syscall->name, &syscall_perf_start, &perf_end);
 
 	/* Compare actual vs expected return value */
 	if (get_s32(syscall->result, &expected, error))
@@ -582,6 +1087,16 @@ static int end_syscall(struct state *state, struct syscall_spec *syscall,
 		}
 	}
 
+	/* Compare actual vs allowed latency */
+	if (syscall->max_latency_usecs != NO_LATENCY_LIMIT &&
+	    latency_nsecs > syscall->max_latency_usecs * 1000) {
+		asprintf(error,
+			 "Expected latency under %.6f sec but took %.6f sec",
+			 usecs_to_secs(syscall->max_latency_usecs),
+			 latency_nsecs / 1.0e9);
+		return STATUS_ERR;
+	}
+
 	return STATUS_OK;
 }
 
@@ -632,6 +1147,110 @@ static int to_live_fd(struct state *state, int script_fd, int *live_fd,
 	}
 }
 
+#ifdef linux
+/* For --payload_pattern, does the pattern run on from one write to the
+ * given socket to the next, as for a stream?
+ */
+static bool pattern_is_stream(struct state *state, int script_fd)
+{
+	struct socket *socket = find_socket_by_script_fd(state, script_fd);
+
+	return (socket != NULL) && (socket->protocol == IPPROTO_TCP);
+}
+#endif /* linux */
+
+/* For --payload_pattern, return the stream offset at which the next
+ * payload written to the given socket starts. Datagrams each start
+ * at offset 0.
+ */
+static u64 pattern_write_offset(struct state *state, int script_fd)
+{
+	struct socket *socket = NULL;
+
+	if (!state->config->payload_pattern)
+		return 0;
+	socket = find_socket_by_script_fd(state, script_fd);
+	if ((socket == NULL) || (socket->protocol != IPPROTO_TCP))
+		return 0;
+	return socket->pattern_write_offset;
+}
+
+/* For --payload_pattern, note that the app wrote the given number of
+ * bytes of the pattern to the given socket.
+ */
+static void pattern_write_advance(struct state *state, int script_fd,
+				  int result)
+{
+	struct socket *socket = NULL;
+
+	if (!state->config->payload_pattern || (result <= 0))
+		return;
+	socket = find_socket_by_script_fd(state, script_fd);
+	if ((socket != NULL) && (socket->protocol == IPPROTO_TCP))
+		socket->pattern_write_offset += result;
+}
+
+/* For --payload_pattern, verify that the given number of bytes the app
+ * read from the given socket into the given iovec match the pattern
+ * at the socket's current read offset, and advance that offset unless
+ * the read used MSG_PEEK. Returns STATUS_OK on success; on failure
+ * returns STATUS_ERR and sets error message.
+ */
+static int pattern_read_check(struct state *state, int script_fd,
+			      const struct iovec *iov, size_t iov_len,
+			      int result, int flags, char **error)
+{
+	struct socket *socket = NULL;
+	u64 offset = 0;
+	size_t left = 0;
+	int i;
+
+	if (!state->config->payload_pattern || (result <= 0))
+		return STATUS_OK;
+#ifdef MSG_ERRQUEUE
+	if (flags & MSG_ERRQUEUE)
+		return STATUS_OK;	/* not stream data */
+#endif
+	socket = find_socket_by_script_fd(state, script_fd);
+	if (socket == NULL)
+		return STATUS_OK;
+	if (socket->protocol == IPPROTO_TCP)
+		offset = socket->pattern_read_offset;
+
+	left = result;
+	for (i = 0; (i < iov_len) && (left > 0); ++i) {
+		size_t len = iov[i].iov_len < left ? iov[i].iov_len : left;
+		const u8 *buf = iov[i].iov_base;
+		ssize_t bad = payload_pattern_mismatch(buf, len, offset);
+
+		if (bad >= 0) {
+			asprintf(error,
+				 "payload mismatch at stream offset %llu: "
+				 "expected byte 0x%02x but got 0x%02x",
+				 (unsigned long long)(offset + bad),
+				 payload_pattern_byte(offset + bad),
+				 buf[bad]);
+			return STATUS_ERR;
+		}
+		offset += len;
+		left -= len;
+	}
+	if ((socket->protocol == IPPROTO_TCP) && !(flags & MSG_PEEK))
+		socket->pattern_read_offset = offset;
+	return STATUS_OK;
+}
+
+/* Like pattern_read_check(), for a single buffer. */
+static int pattern_read_check_buf(struct state *state, int script_fd,
+				  char *buf, int result, int flags,
+				  char **error)
+{
+	struct iovec iov = { .iov_base = buf, .iov_len = result };
+
+	return pattern_read_check(state, script_fd, &iov, 1, result, flags,
+				  error);
+}
+
 /****************************************************************************
  * Here we have the "backend" post-processing and pre-processing that
  * we perform after and/or before each of the system calls that
@@ -1055,7 +1674,7 @@ static int syscall_read(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (s32_arg(args, 2, &count, error))
 		return STATUS_ERR;
-	buf = malloc(count);
+	buf = payload_buffer_new(state, count, true, 0);
 	assert(buf != NULL);
 
 	begin_syscall(state, syscall);
@@ -1063,52 +1682,52 @@ static int syscall_read(struct state *state, struct syscall_spec *syscall,
 	result = read(live_fd, buf, count);
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	if (status == STATUS_OK)
+		status = pattern_read_check_buf(state, script_fd, buf, result,
+						0, error);
 
-	free(buf);
+	payload_buffer_free(state, buf);
 	return status;
 }
 
 static int syscall_readv(struct state *state, struct syscall_spec *syscall,
 			 struct expression_list *args, char **error)
 {
-	int live_fd, script_fd, iov_count, result;
-	struct expression *iov_expression = NULL;
-	struct iovec *iov = NULL;
-	size_t iov_len = 0;
-	int status = STATUS_ERR;
+	int live_fd, script_fd, iov_count, result, status;
+	struct syscall_buffers *buffers = syscall->buffers;
 
 	if (check_arg_count(args, 3, error))
-		goto error_out;
+		return STATUS_ERR;
 
 	if (s32_arg(args, 0, &script_fd, error))
-		goto error_out;
+		return STATUS_ERR;
 	if (to_live_fd(state, script_fd, &live_fd, error))
-		goto error_out;
-
-	iov_expression = get_arg(args, 1, error);
-	if (iov_expression == NULL)
-		goto error_out;
-	if (iovec_new(iov_expression, &iov, &iov_len, error))
-		goto error_out;
+		return STATUS_ERR;
 
 	if (s32_arg(args, 2, &iov_count, error))
-		goto error_out;
+		return STATUS_ERR;
 
-	if (iov_count != iov_len) {
+	assert(buffers != NULL);
+	if (iov_count != buffers->iov_len) {
 		asprintf(error,
 			 "iov_count %d does not match %d-element iovec array",
-			 iov_count, (int)iov_len);
-		goto error_out;
+			 iov_count, (int)buffers->iov_len);
+		return STATUS_ERR;
 	}
 
+	iovec_fill(state, buffers->iov, buffers->iov_len, true, 0);
+
 	begin_syscall(state, syscall);
 
-	result = readv(live_fd, iov, iov_count);
+	result = readv(live_fd, buffers->iov, iov_count);
 
 	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	if (status == STATUS_OK)
+		status = pattern_read_check(state, script_fd, buffers->iov,
+					    buffers->iov_len, result, 0,
+					    error);
 
-error_out:
-	iovec_free(iov, iov_len);
+	iovec_release(state, buffers->iov, buffers->iov_len);
 	return status;
 }
 
@@ -1129,7 +1748,7 @@ static int syscall_recv(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (s32_arg(args, 3, &flags, error))
 		return STATUS_ERR;
-	buf = malloc(count);
+	buf = payload_buffer_new(state, count, true, 0);
 	assert(buf != NULL);
 
 	begin_syscall(state, syscall);
@@ -1137,8 +1756,11 @@ static int syscall_recv(struct state *state, struct syscall_spec *syscall,
 	result = recv(live_fd, buf, count, flags);
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	if (status == STATUS_OK)
+		status = pattern_read_check_buf(state, script_fd, buf, result,
+						flags, error);
 
-	free(buf);
+	payload_buffer_free(state, buf);
 	return status;
 }
 
@@ -1165,7 +1787,7 @@ static int syscall_recvfrom(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (ellipsis_arg(args, 5, error))
 		return STATUS_ERR;
-	buf = malloc(count);
+	buf = payload_buffer_new(state, count, true, 0);
 	assert(buf != NULL);
 
 	begin_syscall(state, syscall);
@@ -1174,8 +1796,11 @@ static int syscall_recvfrom(struct state *state, struct syscall_spec *syscall,
 			  (struct sockaddr *)&live_addr, &live_addrlen);
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	if (status == STATUS_OK)
+		status = pattern_read_check_buf(state, script_fd, buf, result,
+						flags, error);
 
-	free(buf);
+	payload_buffer_free(state, buf);
 	return status;
 }
 
@@ -1183,47 +1808,55 @@ static int syscall_recvmsg(struct state *state, struct syscall_spec *syscall,
 			   struct expression_list *args, char **error)
 {
 	int live_fd, script_fd, flags, result;
+	struct syscall_buffers *buffers = syscall->buffers;
 	struct expression *msg_expression = NULL;
-	struct msghdr *msg = NULL;
-	size_t iov_len = 0;
-	int expected_msg_flags = 0;
+	struct msghdr msg;
 	int status = STATUS_ERR;
 
 	if (check_arg_count(args, 3, error))
-		goto error_out;
+		return STATUS_ERR;
 	if (s32_arg(args, 0, &script_fd, error))
-		goto error_out;
+		return STATUS_ERR;
 	if (to_live_fd(state, script_fd, &live_fd, error))
-		goto error_out;
+		return STATUS_ERR;
 
 	msg_expression = get_arg(args, 1, error);
 	if (msg_expression == NULL)
-		goto error_out;
-	if (msghdr_new(msg_expression, &msg, &iov_len, error))
-		goto error_out;
+		return STATUS_ERR;
 
 	if (s32_arg(args, 2, &flags, error))
-		goto error_out;
+		return STATUS_ERR;
 
-	expected_msg_flags = msg->msg_flags;
+	assert(buffers != NULL);
+	msghdrs_fill(state, buffers, true, false, 0);
+	msg = buffers->msgs[0];
 
 	begin_syscall(state, syscall);
 
-	result = recvmsg(live_fd, msg, flags);
+	result = recvmsg(live_fd, &msg, flags);
 
 	if (end_syscall(state, syscall, CHECK_EXACT, result, error))
 		goto error_out;
 
-	if (msg->msg_flags != expected_msg_flags) {
+	if (msg.msg_flags != buffers->msgs[0].msg_flags) {
 		asprintf(error, "Expected msg_flags 0x%08X but got 0x%08X",
-			 expected_msg_flags, msg->msg_flags);
+			 buffers->msgs[0].msg_flags, msg.msg_flags);
 		goto error_out;
 	}
 
+	if ((msg_expression->value.msghdr->msg_control != NULL) &&
+	    cmsgs_check(msg_expression->value.msghdr->msg_control, &msg,
+			error))
+		goto error_out;
+
+	if (pattern_read_check(state, script_fd, msg.msg_iov,
+			       buffers->iov_lens[0], result, flags, error))
+		goto error_out;
+
 	status = STATUS_OK;
 
 error_out:
-	msghdr_free(msg, iov_len);
+	msghdrs_release(state, buffers, true);
 	return status;
 }
 
@@ -1242,7 +1875,8 @@ static int syscall_write(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (s32_arg(args, 2, &count, error))
 		return STATUS_ERR;
-	buf = calloc(count, 1);
+	buf = payload_buffer_new(state, count, false,
+				 pattern_write_offset(state, script_fd));
 	assert(buf != NULL);
 
 	begin_syscall(state, syscall);
@@ -1250,52 +1884,48 @@ static int syscall_write(struct state *state, struct syscall_spec *syscall,
 	result = write(live_fd, buf, count);
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	pattern_write_advance(state, script_fd, result);
 
-	free(buf);
+	payload_buffer_free(state, buf);
 	return status;
 }
 
 static int syscall_writev(struct state *state, struct syscall_spec *syscall,
 			  struct expression_list *args, char **error)
 {
-	int live_fd, script_fd, iov_count, result;
-	struct expression *iov_expression = NULL;
-	struct iovec *iov = NULL;
-	size_t iov_len = 0;
-	int status = STATUS_ERR;
+	int live_fd, script_fd, iov_count, result, status;
+	struct syscall_buffers *buffers = syscall->buffers;
 
 	if (check_arg_count(args, 3, error))
-		goto error_out;
+		return STATUS_ERR;
 
 	if (s32_arg(args, 0, &script_fd, error))
-		goto error_out;
+		return STATUS_ERR;
 	if (to_live_fd(state, script_fd, &live_fd, error))
-		goto error_out;
-
-	iov_expression = get_arg(args, 1, error);
-	if (iov_expression == NULL)
-		goto error_out;
-	if (iovec_new(iov_expression, &iov, &iov_len, error))
-		goto error_out;
+		return STATUS_ERR;
 
 	if (s32_arg(args, 2, &iov_count, error))
-		goto error_out;
+		return STATUS_ERR;
 
-	if (iov_count != iov_len) {
+	assert(buffers != NULL);
+	if (iov_count != buffers->iov_len) {
 		asprintf(error,
 			 "iov_count %d does not match %d-element iovec array",
-			 iov_count, (int)iov_len);
-		goto error_out;
+			 iov_count, (int)buffers->iov_len);
+		return STATUS_ERR;
 	}
 
+	iovec_fill(state, buffers->iov, buffers->iov_len, false,
+		   pattern_write_offset(state, script_fd));
+
 	begin_syscall(state, syscall);
 
-	result = writev(live_fd, iov, iov_count);
+	result = writev(live_fd, buffers->iov, iov_count);
 
 	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	pattern_write_advance(state, script_fd, result);
 
-error_out:
-	iovec_free(iov, iov_len);
+	iovec_release(state, buffers->iov, buffers->iov_len);
 	return status;
 }
 
@@ -1316,7 +1946,8 @@ static int syscall_send(struct state *state, struct syscall_spec *syscall,
 		return STATUS_ERR;
 	if (s32_arg(args, 3, &flags, error))
 		return STATUS_ERR;
-	buf = calloc(count, 1);
+	buf = payload_buffer_new(state, count, false,
+				 pattern_write_offset(state, script_fd));
 	assert(buf != NULL);
 
 	begin_syscall(state, syscall);
@@ -1324,8 +1955,9 @@ static int syscall_send(struct state *state, struct syscall_spec *syscall,
 	result = send(live_fd, buf, count, flags);
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	pattern_write_advance(state, script_fd, result);
 
-	free(buf);
+	payload_buffer_free(state, buf);
 	return status;
 }
 
@@ -1358,7 +1990,8 @@ static int syscall_sendto(struct state *state, struct syscall_spec *syscall,
 		    (struct sockaddr *)&live_addr, &live_addrlen, error))
 		return STATUS_ERR;
 
-	buf = calloc(count, 1);
+	buf = payload_buffer_new(state, count, false,
+				 pattern_write_offset(state, script_fd));
 	assert(buf != NULL);
 
 	begin_syscall(state, syscall);
@@ -1367,56 +2000,403 @@ static int syscall_sendto(struct state *state, struct syscall_spec *syscall,
 			(struct sockaddr *)&live_addr, live_addrlen);
 
 	int status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	pattern_write_advance(state, script_fd, result);
 
-	free(buf);
+	payload_buffer_free(state, buf);
 	return status;
 }
 
 static int syscall_sendmsg(struct state *state, struct syscall_spec *syscall,
 			   struct expression_list *args, char **error)
 {
-	int live_fd, script_fd, flags, result;
-	struct expression *msg_expression = NULL;
-	struct msghdr *msg = NULL;
-	size_t iov_len = 0;
-	int status = STATUS_ERR;
+	int live_fd, script_fd, flags, result, status;
+	struct syscall_buffers *buffers = syscall->buffers;
+	struct msghdr msg;
 
 	if (check_arg_count(args, 3, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+
+	if (s32_arg(args, 2, &flags, error))
+		return STATUS_ERR;
+
+	assert(buffers != NULL);
+	msg = buffers->msgs[0];
+	if ((msg.msg_name != NULL) &&
+	    run_syscall_connect(state, script_fd, false,
+				msg.msg_name, &msg.msg_namelen, error))
+		return STATUS_ERR;
+	if (msg.msg_flags != 0) {
+		asprintf(error, "sendmsg ignores msg_flags field in msghdr");
+		return STATUS_ERR;
+	}
+	if (msg.msg_control != NULL) {
+		asprintf(error, "sendmsg does not support msg_control");
+		return STATUS_ERR;
+	}
+
+	msghdrs_fill(state, buffers, false, false,
+		     pattern_write_offset(state, script_fd));
+
+	begin_syscall(state, syscall);
+
+	result = sendmsg(live_fd, &msg, flags);
+
+	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	pattern_write_advance(state, script_fd, result);
+
+	msghdrs_release(state, buffers, false);
+	return status;
+}
+
+#ifdef linux
+/* Create an unlinked temporary file of the given size, filled with
+ * zeros, to serve as the input file of a sendfile() call.
+ */
+static int zero_file_new(off_t size)
+{
+	char path[] = "/tmp/packetdrill-sendfile-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+		die_perror("mkstemp");
+	if (unlink(path) < 0)
+		die_perror("unlink");
+	if (ftruncate(fd, size) < 0)
+		die_perror("ftruncate");
+	return fd;
+}
+
+/* sendfile(out_fd, ..., offset, count): the input file is a file of
+ * zeros that we provide; offset is either [<offset>] or NULL.
+ */
+static int syscall_sendfile(struct state *state, struct syscall_spec *syscall,
+			    struct expression_list *args, char **error)
+{
+	int live_fd, script_fd, count, in_fd = -1, result;
+	struct expression *offset_expression = NULL;
+	s32 script_offset = 0;
+	off_t live_offset = 0;
+	off_t *offset = NULL;
+	int status = STATUS_ERR;
+
+	if (check_arg_count(args, 4, error))
 		goto error_out;
 	if (s32_arg(args, 0, &script_fd, error))
 		goto error_out;
 	if (to_live_fd(state, script_fd, &live_fd, error))
 		goto error_out;
+	if (ellipsis_arg(args, 1, error))
+		goto error_out;
 
-	msg_expression = get_arg(args, 1, error);
-	if (msg_expression == NULL)
+	offset_expression = get_arg(args, 2, error);
+	if (offset_expression == NULL)
 		goto error_out;
-	if (msghdr_new(msg_expression, &msg, &iov_len, error))
+	if (offset_expression->type == EXPR_LIST) {
+		if (s32_bracketed_arg(args, 2, &script_offset, error))
+			goto error_out;
+		live_offset = script_offset;
+		offset = &live_offset;
+	} else if (null_arg(args, 2, error)) {
 		goto error_out;
+	}
 
-	if (s32_arg(args, 2, &flags, error))
+	if (s32_arg(args, 3, &count, error))
 		goto error_out;
 
-	if ((msg->msg_name != NULL) &&
-	    run_syscall_connect(state, script_fd, false,
-				msg->msg_name, &msg->msg_namelen, error))
+	in_fd = zero_file_new((off_t)script_offset + count);
+	if (state->config->payload_pattern && (count > 0)) {
+		char *buf = payload_buffer_new(
+			state, count, false,
+			pattern_write_offset(state, script_fd));
+		if (pwrite(in_fd, buf, count, script_offset) != count)
+			die_perror("pwrite");
+		payload_buffer_free(state, buf);
+	}
+
+	begin_syscall(state, syscall);
+
+	result = sendfile(live_fd, in_fd, offset, count);
+
+	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	pattern_write_advance(state, script_fd, result);
+
+error_out:
+	if ((in_fd >= 0) && (close(in_fd) < 0))
+		die_perror("close");
+	return status;
+}
+
+/* splice(fd_in, NULL, fd_out, NULL, len, flags): exactly one of fd_in
+ * and fd_out is a socket from the script, and the other is an
+ * ellipsis, for which we provide a pipe. When splicing from our pipe
+ * into the socket, we first fill the pipe with len bytes of zeros.
+ */
+static int syscall_splice(struct state *state, struct syscall_spec *syscall,
+			  struct expression_list *args, char **error)
+{
+	int live_fd, script_fd, len, flags, result;
+	int pipe_fds[2] = { -1, -1 };
+	struct expression *in_expression = NULL;
+	bool to_pipe = false;	/* splicing from the socket into our pipe? */
+	char *buf = NULL;
+	int status = STATUS_ERR;
+
+	if (check_arg_count(args, 6, error))
 		goto error_out;
-	if (msg->msg_flags != 0) {
-		asprintf(error, "sendmsg ignores msg_flags field in msghdr");
+
+	in_expression = get_arg(args, 0, error);
+	if (in_expression == NULL)
 		goto error_out;
+	to_pipe = (in_expression->type != EXPR_ELLIPSIS);
+
+	if (s32_arg(args, to_pipe ? 0 : 2, &script_fd, error))
+		goto error_out;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		goto error_out;
+	if (ellipsis_arg(args, to_pipe ? 2 : 0, error))
+		goto error_out;
+	if (null_arg(args, 1, error))
+		goto error_out;
+	if (null_arg(args, 3, error))
+		goto error_out;
+	if (s32_arg(args, 4, &len, error))
+		goto error_out;
+	if (s32_arg(args, 5, &flags, error))
+		goto error_out;
+
+	if (pipe(pipe_fds) < 0)
+		die_perror("pipe");
+	if ((len > 0) && (fcntl(pipe_fds[1], F_SETPIPE_SZ, len) < 0)) {
+		asprintf(error, "unable to size pipe for %d bytes: %s",
+			 len, strerror(errno));
+		goto error_out;
+	}
+	if (!to_pipe) {
+		buf = payload_buffer_new(state, len, false,
+					 pattern_write_offset(state, script_fd));
+		if (write(pipe_fds[1], buf, len) != len)
+			die_perror("write");
 	}
 
 	begin_syscall(state, syscall);
 
-	result = sendmsg(live_fd, msg, flags);
+	if (to_pipe)
+		result = splice(live_fd, NULL, pipe_fds[1], NULL, len, flags);
+	else
+		result = splice(pipe_fds[0], NULL, live_fd, NULL, len, flags);
 
 	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	if (!to_pipe) {
+		pattern_write_advance(state, script_fd, result);
+	} else if ((status == STATUS_OK) && state->config->payload_pattern &&
+		   (result > 0)) {
+		/* Drain what the kernel spliced into our pipe and check it. */
+		buf = payload_buffer_new(state, result, true, 0);
+		if (read(pipe_fds[0], buf, result) != result)
+			die_perror("read");
+		status = pattern_read_check_buf(state, script_fd, buf, result,
+						0, error);
+	}
 
 error_out:
-	msghdr_free(msg, iov_len);
+	if ((pipe_fds[0] >= 0) && (close(pipe_fds[0]) < 0))
+		die_perror("close");
+	if ((pipe_fds[1] >= 0) && (close(pipe_fds[1]) < 0))
+		die_perror("close");
+	if (buf != NULL)
+		payload_buffer_free(state, buf);
 	return status;
 }
 
+/* Build the msghdrs described by the given list of msghdr expressions
+ * in the given arena, along with the mmsghdr array to pass them in.
+ * Return STATUS_OK if the expression is valid. Otherwise fill in the
+ * error with a human-readable error message and return STATUS_ERR.
+ */
+static int mmsghdrs_build(struct arena *arena, struct expression *expression,
+			  struct syscall_buffers *buffers, char **error)
+{
+	int i;
+	struct expression_list *list;	/* input expression from script */
+
+	if (check_type(expression, EXPR_LIST, error))
+		return STATUS_ERR;
+
+	list = expression->value.list;
+
+	buffers->vlen = expression_list_length(list);
+	buffers->msgs = arena_alloc(arena,
+				    buffers->vlen * sizeof(struct msghdr));
+	buffers->iov_lens = arena_alloc(arena,
+					buffers->vlen * sizeof(size_t));
+	buffers->msgvec = arena_alloc(arena,
+				      buffers->vlen * sizeof(struct mmsghdr));
+
+	for (i = 0; i < buffers->vlen; ++i, list = list->next) {
+		if (msghdr_build(arena, list->expression, &buffers->msgs[i],
+				 &buffers->iov_lens[i], error))
+			return STATUS_ERR;
+	}
+	return STATUS_OK;
+}
+
+/* Fill in the live mmsghdr array of the given system call with fresh
+ * copies of its msghdrs, and return it.
+ */
+static struct mmsghdr *mmsghdrs_reset(struct syscall_buffers *buffers)
+{
+	int i;
+
+	for (i = 0; i < buffers->vlen; ++i) {
+		buffers->msgvec[i].msg_hdr = buffers->msgs[i];
+		buffers->msgvec[i].msg_len = 0;
+	}
+	return buffers->msgvec;
+}
+
+static int syscall_sendmmsg(struct state *state, struct syscall_spec *syscall,
+			    struct expression_list *args, char **error)
+{
+	int live_fd, script_fd, vlen, flags, result, status, i;
+	struct syscall_buffers *buffers = syscall->buffers;
+	struct mmsghdr *msgvec = NULL;
+
+	if (check_arg_count(args, 4, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+
+	if (s32_arg(args, 2, &vlen, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 3, &flags, error))
+		return STATUS_ERR;
+
+	assert(buffers != NULL);
+	if (vlen != buffers->vlen) {
+		asprintf(error,
+			 "vlen %d does not match %d-element msghdr array",
+			 vlen, (int)buffers->vlen);
+		return STATUS_ERR;
+	}
+
+	msgvec = mmsghdrs_reset(buffers);
+	for (i = 0; i < vlen; ++i) {
+		struct msghdr *msg = &msgvec[i].msg_hdr;
+
+		if ((msg->msg_name != NULL) &&
+		    run_syscall_connect(state, script_fd, false,
+					msg->msg_name, &msg->msg_namelen,
+					error))
+			return STATUS_ERR;
+		if (msg->msg_flags != 0) {
+			asprintf(error,
+				 "sendmmsg ignores msg_flags field in msghdr");
+			return STATUS_ERR;
+		}
+		if (msg->msg_control != NULL) {
+			asprintf(error, "sendmmsg does not support msg_control");
+			return STATUS_ERR;
+		}
+	}
+
+	msghdrs_fill(state, buffers, false,
+		     pattern_is_stream(state, script_fd),
+		     pattern_write_offset(state, script_fd));
+
+	begin_syscall(state, syscall);
+
+	result = sendmmsg(live_fd, msgvec, vlen, flags);
+
+	status = end_syscall(state, syscall, CHECK_EXACT, result, error);
+	for (i = 0; i < result; ++i)
+		pattern_write_advance(state, script_fd, msgvec[i].msg_len);
+
+	msghdrs_release(state, buffers, false);
+	return status;
+}
+
+/* recvmmsg(fd, msgvec, vlen, flags, NULL): check the msg_flags and
+ * any msg_control of each of the messages received.
+ */
+static int syscall_recvmmsg(struct state *state, struct syscall_spec *syscall,
+			    struct expression_list *args, char **error)
+{
+	int live_fd, script_fd, vlen, flags, result, i;
+	struct syscall_buffers *buffers = syscall->buffers;
+	struct expression *msgvec_expression = NULL;
+	struct expression_list *list = NULL;
+	struct mmsghdr *msgvec = NULL;
+	int status = STATUS_ERR;
+
+	if (check_arg_count(args, 5, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+
+	msgvec_expression = get_arg(args, 1, error);
+	if (msgvec_expression == NULL)
+		return STATUS_ERR;
+
+	if (s32_arg(args, 2, &vlen, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 3, &flags, error))
+		return STATUS_ERR;
+	if (null_arg(args, 4, error))
+		return STATUS_ERR;
+
+	assert(buffers != NULL);
+	if (vlen != buffers->vlen) {
+		asprintf(error,
+			 "vlen %d does not match %d-element msghdr array",
+			 vlen, (int)buffers->vlen);
+		return STATUS_ERR;
+	}
+
+	msgvec = mmsghdrs_reset(buffers);
+	msghdrs_fill(state, buffers, true, false, 0);
+
+	begin_syscall(state, syscall);
+
+	result = recvmmsg(live_fd, msgvec, vlen, flags, NULL);
+
+	if (end_syscall(state, syscall, CHECK_EXACT, result, error))
+		goto error_out;
+
+	list = msgvec_expression->value.list;
+	for (i = 0; i < result; ++i, list = list->next) {
+		struct msghdr *msg = &msgvec[i].msg_hdr;
+		struct msghdr_expr *msg_expr = list->expression->value.msghdr;
+
+		if (msg->msg_flags != buffers->msgs[i].msg_flags) {
+			asprintf(error, "Expected msg_flags 0x%08X but got "
+				 "0x%08X for msghdr %d",
+				 buffers->msgs[i].msg_flags, msg->msg_flags, i);
+			goto error_out;
+		}
+		if ((msg_expr->msg_control != NULL) &&
+		    cmsgs_check(msg_expr->msg_control, msg, error))
+			goto error_out;
+		if (pattern_read_check(state, script_fd, msg->msg_iov,
+				       buffers->iov_lens[i], msgvec[i].msg_len,
+				       flags, error))
+			goto error_out;
+	}
+
+	status = STATUS_OK;
+
+error_out:
+	msghdrs_release(state, buffers, true);
+	return status;
+}
+#endif /* linux */
+
 static int syscall_fcntl(struct state *state, struct syscall_spec *syscall,
 			 struct expression_list *args, char **error)
 {
@@ -1714,6 +2694,237 @@ error_out:
 	return status;
 }
 
+#ifdef linux
+/* Track the fd of a new epoll instance, so that scripts can refer to
+ * it by its script fd. Unlike sockets, it is never the socket under
+ * test for packets in the script.
+ */
+static int run_syscall_epoll_create(struct state *state, int script_fd,
+				    int live_fd, char **error)
+{
+	if (script_fd < 0) {
+		asprintf(error, "invalid epoll fd %d in script", script_fd);
+		return STATUS_ERR;
+	}
+	if (find_socket_by_script_fd(state, script_fd)) {
+		asprintf(error, "duplicate epoll fd %d in script", script_fd);
+		return STATUS_ERR;
+	}
+	if (find_socket_by_live_fd(state, live_fd)) {
+		asprintf(error, "duplicate live epoll fd %d", live_fd);
+		return STATUS_ERR;
+	}
+
+	struct socket *socket = socket_new(state);
+	socket->state		= SOCKET_NEW;
+	socket->address_family	= AF_UNSPEC;
+	socket->protocol	= 0;
+	socket->script.fd	= script_fd;
+	socket->live.fd		= live_fd;
+
+	DEBUGP("epoll_create1() creating new epoll fd: "
+	       "script_fd: %d live_fd: %d\n", script_fd, live_fd);
+	return STATUS_OK;
+}
+
+/* Fill in an epoll_event described by the given expression. The
+ * event's data is the script fd, so epoll_wait() hands it back to us
+ * in script terms. Returns STATUS_OK on success; on failure returns
+ * STATUS_ERR and sets error message.
+ */
+static int epollev_new(struct expression *expression,
+		       struct epoll_event *event, char **error)
+{
+	s32 events, script_fd;
+
+	if (check_type(expression, EXPR_EPOLLEV, error))
+		return STATUS_ERR;
+	if (get_s32(expression->value.epollev->events, &events, error))
+		return STATUS_ERR;
+	if (get_s32(expression->value.epollev->fd, &script_fd, error))
+		return STATUS_ERR;
+
+	memset(event, 0, sizeof(*event));
+	event->events = events;
+	event->data.fd = script_fd;
+	return STATUS_OK;
+}
+
+/* Check the events returned by epoll_wait() against the list of
+ * epoll_event expressions in the script, in order. Return STATUS_OK
+ * if they match. Otherwise fill in the error with a human-readable
+ * error message and return STATUS_ERR.
+ */
+static int epollevs_check(struct expression *events_expression,
+			  const struct epoll_event *events, int num_events,
+			  char **error)
+{
+	struct expression_list *list;	/* input expression from script */
+	int i;
+
+	assert(events_expression->type == EXPR_LIST);
+	list = events_expression->value.list;
+
+	for (i = 0; i < num_events; ++i, list = list->next) {
+		struct epoll_event expected;
+
+		if (list == NULL) {
+			asprintf(error, "Expected %d epoll events but got %d",
+				 i, num_events);
+			return STATUS_ERR;
+		}
+		if (epollev_new(list->expression, &expected, error))
+			return STATUS_ERR;
+		if (events[i].data.fd != expected.data.fd) {
+			asprintf(error,
+				 "Expected fd %d but got fd %d "
+				 "for epoll event %d",
+				 expected.data.fd, events[i].data.fd, i);
+			return STATUS_ERR;
+		}
+		if (events[i].events != expected.events) {
+			char *expected_events_string =
+				flags_to_string(epoll_flags, expected.events);
+			char *actual_events_string =
+				flags_to_string(epoll_flags, events[i].events);
+			asprintf(error,
+				 "Expected events of %s but got %s "
+				 "for epoll event %d",
+				 expected_events_string,
+				 actual_events_string, i);
+			free(expected_events_string);
+			free(actual_events_string);
+			return STATUS_ERR;
+		}
+	}
+	return STATUS_OK;
+}
+
+static int syscall_epoll_create1(struct state *state,
+				 struct syscall_spec *syscall,
+				 struct expression_list *args, char **error)
+{
+	int flags, live_fd, script_fd, result;
+	if (check_arg_count(args, 1, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &flags, error))
+		return STATUS_ERR;
+
+	begin_syscall(state, syscall);
+
+	result = epoll_create1(flags);
+
+	if (end_syscall(state, syscall, CHECK_NON_NEGATIVE, result, error))
+		return STATUS_ERR;
+
+	if (result >= 0) {
+		live_fd = result;
+		if (get_s32(syscall->result, &script_fd, error))
+			return STATUS_ERR;
+		if (run_syscall_epoll_create(state, script_fd, live_fd, error))
+			return STATUS_ERR;
+	}
+
+	return STATUS_OK;
+}
+
+/* epoll_ctl(epfd, op, fd, event), where event is NULL for
+ * EPOLL_CTL_DEL or an {events=..., fd=...} epoll_event otherwise.
+ */
+static int syscall_epoll_ctl(struct state *state, struct syscall_spec *syscall,
+			     struct expression_list *args, char **error)
+{
+	int live_epfd, script_epfd, op, live_fd, script_fd, result;
+	struct expression *event_expression = NULL;
+	struct epoll_event event;
+	struct epoll_event *live_event = NULL;
+
+	if (check_arg_count(args, 4, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 0, &script_epfd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_epfd, &live_epfd, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 1, &op, error))
+		return STATUS_ERR;
+	if (s32_arg(args, 2, &script_fd, error))
+		return STATUS_ERR;
+	if (to_live_fd(state, script_fd, &live_fd, error))
+		return STATUS_ERR;
+
+	event_expression = get_arg(args, 3, error);
+	if (event_expression == NULL)
+		return STATUS_ERR;
+	if (event_expression->type == EXPR_EPOLLEV) {
+		if (epollev_new(event_expression, &event, error))
+			return STATUS_ERR;
+		live_event = &event;
+	} else if (null_arg(args, 3, error)) {
+		return STATUS_ERR;
+	}
+
+	begin_syscall(state, syscall);
+
+	result = epoll_ctl(live_epfd, op, live_fd, live_event);
+
+	return end_syscall(state, syscall, CHECK_EXACT, result, error);
+}
+
+/* epoll_wait(epfd, events, maxevents, timeout), where events is the
+ * list of epoll_event structs we expect to be returned, in order.
+ */
+static int syscall_epoll_wait(struct state *state,
+			      struct syscall_spec *syscall,
+			      struct expression_list *args, char **error)
+{
+	int live_epfd, script_epfd, maxevents, timeout, result;
+	struct expression *events_expression = NULL;
+	struct epoll_event *events = NULL;
+	int status = STATUS_ERR;
+
+	if (check_arg_count(args, 4, error))
+		goto error_out;
+	if (s32_arg(args, 0, &script_epfd, error))
+		goto error_out;
+	if (to_live_fd(state, script_epfd, &live_epfd, error))
+		goto error_out;
+
+	events_expression = get_arg(args, 1, error);
+	if (events_expression == NULL)
+		goto error_out;
+	if (check_type(events_expression, EXPR_LIST, error))
+		goto error_out;
+
+	if (s32_arg(args, 2, &maxevents, error))
+		goto error_out;
+	if (s32_arg(args, 3, &timeout, error))
+		goto error_out;
+	if (maxevents <= 0) {
+		asprintf(error, "epoll_wait maxevents must be positive: %d",
+			 maxevents);
+		goto error_out;
+	}
+
+	events = calloc(maxevents, sizeof(struct epoll_event));
+
+	begin_syscall(state, syscall);
+
+	result = epoll_wait(live_epfd, events, maxevents, timeout);
+
+	if (end_syscall(state, syscall, CHECK_EXACT, result, error))
+		goto error_out;
+
+	if (epollevs_check(events_expression, events, result, error))
+		goto error_out;
+
+	status = STATUS_OK;
+
+error_out:
+	free(events);
+	return status;
+}
+#endif /* linux */
+
 /* A dispatch table with all the system calls that we support... */
 struct system_call_entry {
 	const char *name;
@@ -1738,6 +2949,12 @@ struct system_call_entry system_call_table[] = {
 	{"send",       syscall_send},
 	{"sendto",     syscall_sendto},
 	{"sendmsg",    syscall_sendmsg},
+#ifdef linux
+	{"sendfile",   syscall_sendfile},
+	{"splice",     syscall_splice},
+	{"sendmmsg",   syscall_sendmmsg},
+	{"recvmmsg",   syscall_recvmmsg},
+#endif
 	{"fcntl",      syscall_fcntl},
 	{"ioctl",      syscall_ioctl},
 	{"close",      syscall_close},
@@ -1745,8 +2962,85 @@ struct system_call_entry system_call_table[] = {
 	{"getsockopt", syscall_getsockopt},
 	{"setsockopt", syscall_setsockopt},
 	{"poll",       syscall_poll},
+#ifdef linux
+	{"epoll_create1", syscall_epoll_create1},
+	{"epoll_ctl",  syscall_epoll_ctl},
+	{"epoll_wait", syscall_epoll_wait},
+#endif
 };
 
+static void free_expression_list_cleanup(void *list)
+{
+	free_expression_list(list);
+}
+
+/* Build the iovec, msghdr, or mmsghdr array argument of the given
+ * system call, if it takes one, into syscall->buffers. A call that is
+ * missing the argument is left to fail its argument count check.
+ */
+static int syscall_buffers_new(struct arena *arena,
+			       struct syscall_spec *syscall, char **error)
+{
+	const char *name = syscall->name;
+	struct expression_list *args = syscall->evaluated_arguments;
+	struct syscall_buffers *buffers = NULL;
+	struct expression *expression = NULL;
+	int status = STATUS_OK;
+
+	if (args == NULL || args->next == NULL)
+		return STATUS_OK;
+	expression = args->next->expression;
+
+	if (!strcmp(name, "readv") || !strcmp(name, "writev")) {
+		buffers = arena_alloc(arena, sizeof(*buffers));
+		status = iovec_build(arena, expression, &buffers->iov,
+				     &buffers->iov_len, error);
+	} else if (!strcmp(name, "recvmsg") || !strcmp(name, "sendmsg")) {
+		buffers = arena_alloc(arena, sizeof(*buffers));
+		buffers->vlen = 1;
+		buffers->msgs = arena_alloc(arena, sizeof(struct msghdr));
+		buffers->iov_lens = arena_alloc(arena, sizeof(size_t));
+		status = msghdr_build(arena, expression, &buffers->msgs[0],
+				      &buffers->iov_lens[0], error);
+#ifdef linux
+	} else if (!strcmp(name, "recvmmsg") || !strcmp(name, "sendmmsg")) {
+		buffers = arena_alloc(arena, sizeof(*buffers));
+		status = mmsghdrs_build(arena, expression, buffers, error);
+#endif
+	}
+	syscall->buffers = buffers;
+	return status;
+}
+
+int prepare_system_calls(const struct config *config, struct script *script)
+{
+	struct event *event = NULL;
+
+	for (event = script->event_list; event != NULL; event = event->next) {
+		struct syscall_spec *syscall = NULL;
+		char *error = NULL;
+
+		if (event->type != SYSCALL_EVENT)
+			continue;
+		syscall = event->event.syscall;
+		if (evaluate_expression_list(syscall->arguments,
+					     &syscall->evaluated_arguments,
+					     &error) ||
+		    syscall_buffers_new(script->arena, syscall, &error)) {
+			fprintf(stderr, "%s:%d: runtime error in %s call: %s\n",
+				config->script_path, event->line_number,
+				syscall->name, error);
+			free(error);
+			return STATUS_ERR;
+		}
+		if (syscall->evaluated_arguments != NULL)
+			arena_add_cleanup(script->arena,
+					  free_expression_list_cleanup,
+					  syscall->evaluated_arguments);
+	}
+	return STATUS_OK;
+}
+
 /* Evaluate the system call arguments and invoke the system call. */
 static void invoke_system_call(
 	struct state *state, struct event *event, struct syscall_spec *syscall)
@@ -1772,15 +3066,18 @@ static void invoke_system_call(
 	}
 
 	/* Evaluate script symbolic expressions to get live numeric args for
-	 * system calls.
+	 * system calls, unless prepare_system_calls() already did.
 	 */
-	if (evaluate_expression_list(syscall->arguments, &args, &error))
+	args = syscall->evaluated_arguments;
+	if (args == NULL &&
+	    evaluate_expression_list(syscall->arguments, &args, &error))
 		goto error_out;
 
 	/* Run the system call. */
 	result = system_call_table[i].function(state, syscall, args, &error);
 
-	free_expression_list(args);
+	if (args != syscall->evaluated_arguments)
+		free_expression_list(args);
 
 	if (result == STATUS_ERR)
 		goto error_out;
@@ -1793,15 +3090,73 @@ error_out:
 	free(error);
 }
 
-/* Wait for the system call thread to go idle. To avoid mystifying
- * hangs when scripts specify overlapping time ranges for blocking
- * system calls, we limit the duration of our waiting to 1 second.
+/* Return the script fd on which the given system call operates, or
+ * -1 if the call does not name a single fd as its first argument
+ * (e.g. poll()).
  */
-static int await_idle_thread(struct state *state)
+static int syscall_script_fd(struct syscall_spec *syscall)
+{
+	struct expression_list *args = syscall->arguments;
+
+	if ((args == NULL) || (args->expression == NULL) ||
+	    (args->expression->type != EXPR_INTEGER))
+		return -1;
+	return args->expression->value.num;
+}
+
+/* Return a pool thread that is busy with a blocking system call on
+ * the given script fd, or NULL if there is none.
+ */
+static struct syscall_thread *find_busy_thread_for_fd(struct state *state,
+						      int script_fd)
+{
+	int i;
+
+	if (script_fd < 0)
+		return NULL;
+	for (i = 0; i < state->syscalls->num_threads; ++i) {
+		struct syscall_thread *thread = &state->syscalls->threads[i];
+		if ((thread->state != SYSCALL_IDLE) &&
+		    (thread->script_fd == script_fd))
+			return thread;
+	}
+	return NULL;
+}
+
+/* Return an idle pool thread, or NULL if all threads are busy. */
+static struct syscall_thread *find_idle_thread(struct state *state)
+{
+	int i;
+
+	for (i = 0; i < state->syscalls->num_threads; ++i) {
+		struct syscall_thread *thread = &state->syscalls->threads[i];
+		if (thread->state == SYSCALL_IDLE)
+			return thread;
+	}
+	return NULL;
+}
+
+/* Wait for a pool thread that can run a blocking system call on the
+ * given script fd: blocking calls on the same fd are serialized, so
+ * we wait for any thread busy with that fd to finish, and then for
+ * some thread to be idle. To avoid mystifying hangs when scripts
+ * specify overlapping time ranges for blocking system calls, we
+ * limit the duration of our waiting to 1 second. Returns the thread
+ * on success; on failure returns NULL and sets error message.
+ */
+static struct syscall_thread *await_idle_thread(struct state *state,
+						int script_fd, char **error)
 {
 	struct timespec end_time = { .tv_sec = 0, .tv_nsec = 0 };
 	const int MAX_WAIT_SECS = 1;
-	while (state->syscalls->state != SYSCALL_IDLE) {
+	struct syscall_thread *thread = NULL;
+
+	while (1) {
+		if (find_busy_thread_for_fd(state, script_fd) == NULL) {
+			thread = find_idle_thread(state);
+			if (thread != NULL)
+				return thread;
+		}
 		/* On the first time through the loop, calculate end time. */
 		if (end_time.tv_sec == 0) {
 			if (clock_gettime(CLOCK_REALTIME, &end_time) != 0)
@@ -1813,11 +3168,51 @@ static int await_idle_thread(struct state *state)
 		int status = pthread_cond_timedwait(&state->syscalls->idle,
 						    &state->mutex, &end_time);
 		if (status == ETIMEDOUT)
-			return STATUS_ERR;
+			break;
 		else if (status != 0)
 			die_perror("pthread_cond_timedwait");
 	}
-	return STATUS_OK;
+
+	if (find_busy_thread_for_fd(state, script_fd) != NULL) {
+		asprintf(error, "blocking system call while another blocking "
+			 "system call is already in progress on fd %d",
+			 script_fd);
+	} else {
+		asprintf(error, "blocking system call while all %d syscall "
+			 "threads are running blocking system calls",
+			 state->syscalls->num_threads);
+	}
+	return NULL;
+}
+
+/* Wait for all pool threads to go idle, for at most 1 second. On
+ * timeout, returns a thread that is still busy; otherwise NULL.
+ */
+static struct syscall_thread *await_all_idle_threads(struct state *state)
+{
+	struct timespec end_time = { .tv_sec = 0, .tv_nsec = 0 };
+	const int MAX_WAIT_SECS = 1;
+	int i;
+
+	if (clock_gettime(CLOCK_REALTIME, &end_time) != 0)
+		die_perror("clock_gettime");
+	end_time.tv_sec += MAX_WAIT_SECS;
+
+	for (i = 0; i < state->syscalls->num_threads; ++i) {
+		struct syscall_thread *thread = &state->syscalls->threads[i];
+		while (thread->state != SYSCALL_IDLE) {
+			DEBUGP("main thread: awaiting idle syscall thread\n");
+			int status =
+				pthread_cond_timedwait(&state->syscalls->idle,
+						       &state->mutex,
+						       &end_time);
+			if (status == ETIMEDOUT)
+				return thread;
+			else if (status != 0)
+				die_perror("pthread_cond_timedwait");
+		}
+	}
+	return NULL;
 }
 
 static int yield(void)
@@ -1832,30 +3227,33 @@ static int yield(void)
 #endif  /* defined(__NetBSD__) */
 }
 
-/* Enqueue the system call for the syscall thread and wake up the thread. */
+/* Enqueue the system call for a syscall thread and wake up the thread. */
 static void enqueue_system_call(
 	struct state *state, struct event *event, struct syscall_spec *syscall)
 {
 	char *error = NULL;
 	bool done = false;
+	int script_fd = syscall_script_fd(syscall);
+	struct syscall_thread *thread = NULL;
 
 	/* Wait if there are back-to-back blocking system calls. */
-	if (await_idle_thread(state)) {
-		asprintf(&error, "blocking system call while another blocking "
-			 "system call is already in progress");
+	thread = await_idle_thread(state, script_fd, &error);
+	if (thread == NULL)
 		goto error_out;
-	}
 
 	/* Enqueue the system call info and wake up the syscall thread. */
-	DEBUGP("main thread: signal enqueued\n");
-	state->syscalls->state = SYSCALL_ENQUEUED;
-	if (pthread_cond_signal(&state->syscalls->enqueued) != 0)
+	DEBUGP("main thread: signal enqueued to syscall thread %d\n",
+	       thread->index);
+	thread->event = event;
+	thread->script_fd = script_fd;
+	thread->state = SYSCALL_ENQUEUED;
+	if (pthread_cond_signal(&thread->enqueued) != 0)
 		die_perror("pthread_cond_signal");
 
 	/* Wait for the syscall thread to dequeue and start the system call. */
-	while (state->syscalls->state == SYSCALL_ENQUEUED) {
+	while (thread->state == SYSCALL_ENQUEUED) {
 		DEBUGP("main thread: waiting for dequeued signal; "
-		       "state: %d\n", state->syscalls->state);
+		       "state: %d\n", thread->state);
 		if (pthread_cond_wait(&state->syscalls->dequeued,
 				      &state->mutex) != 0) {
 			die_perror("pthread_cond_wait");
@@ -1868,7 +3266,7 @@ static void enqueue_system_call(
 		 * the system call in a timely fashion.
 		 */
 		DEBUGP("main thread: unlocking and yielding\n");
-		pid_t thread_id = state->syscalls->thread_id;
+		pid_t thread_id = thread->thread_id;
 		run_unlock(state);
 		if (yield() != 0)
 			die_perror("yield");
@@ -1880,7 +3278,7 @@ static void enqueue_system_call(
 		/* Grab the lock again and see if the thread is idle. */
 		DEBUGP("main thread: locking and reading state\n");
 		run_lock(state);
-		if (state->syscalls->state == SYSCALL_IDLE)
+		if (thread->event != event)
 			done = true;
 	}
 	DEBUGP("main thread: continuing after syscall\n");
@@ -1904,32 +3302,35 @@ void run_system_call_event(
 		invoke_system_call(state, event, syscall);
 }
 
-/* The code executed by our system call thread, which executes
+/* The code executed by each of our system call threads, which execute
  * blocking system calls.
  */
 static void *system_call_thread(void *arg)
 {
-	struct state *state = (struct state *)arg;
+	struct syscall_thread *thread = (struct syscall_thread *)arg;
+	struct state *state = thread->run_state;
 	char *error = NULL;
 	struct event *event = NULL;
 	struct syscall_spec *syscall = NULL;
 	bool done = false;
 
-	DEBUGP("syscall thread: starting and locking\n");
+	DEBUGP("syscall thread %d: starting and locking\n", thread->index);
 	run_lock(state);
 
-	state->syscalls->thread_id = gettid();
-	if (state->syscalls->thread_id < 0)
+	thread->thread_id = gettid();
+	if (thread->thread_id < 0)
 		die_perror("gettid");
+	cpu_affinity_pin_self(state->config->syscall_cpus[thread->index],
+			      "syscall thread");
 
 	while (!done) {
-		DEBUGP("syscall thread: in state %d\n",
-		       state->syscalls->state);
+		DEBUGP("syscall thread %d: in state %d\n",
+		       thread->index, thread->state);
 
-		switch (state->syscalls->state) {
+		switch (thread->state) {
 		case SYSCALL_IDLE:
-			DEBUGP("syscall thread: waiting\n");
-			if (pthread_cond_wait(&state->syscalls->enqueued,
+			DEBUGP("syscall thread %d: waiting\n", thread->index);
+			if (pthread_cond_wait(&thread->enqueued,
 					      &state->mutex)) {
 				die_perror("pthread_cond_wait");
 			}
@@ -1941,16 +3342,16 @@ static void *system_call_thread(void *arg)
 			break;
 
 		case SYSCALL_ENQUEUED:
-			DEBUGP("syscall thread: invoking syscall\n");
+			DEBUGP("syscall thread %d: invoking syscall\n",
+			       thread->index);
 			/* Remember the syscall event, since below we
 			 * release the global lock and the main thread
 			 * will move on to other, later events.
 			 */
-			event = state->event;
+			event = thread->event;
 			syscall = event->event.syscall;
 			assert(event->type == SYSCALL_EVENT);
-			state->syscalls->event = event;
-			state->syscalls->live_end_usecs = -1;
+			thread->live_end_usecs = -1;
 
 			/* Make the system call. Note that our callees
 			 * here will release the global lock before
@@ -1961,11 +3362,12 @@ static void *system_call_thread(void *arg)
 			invoke_system_call(state, event, syscall);
 
 			/* Check end time for the blocking system call. */
-			assert(state->syscalls->live_end_usecs >= 0);
+			assert(thread->live_end_usecs >= 0);
 			if (verify_time(state,
 						event->time_type,
 						syscall->end_usecs, 0,
-						state->syscalls->live_end_usecs,
+						thread->live_end_usecs,
+						event->line_number,
 						"system call return", &error)) {
 				die("%s:%d: %s\n",
 				    state->config->script_path,
@@ -1977,11 +3379,12 @@ static void *system_call_thread(void *arg)
 			 * thread if it's waiting for this call to
 			 * finish.
 			 */
-			assert(state->syscalls->state == SYSCALL_DONE);
-			state->syscalls->state = SYSCALL_IDLE;
-			state->syscalls->event = NULL;
-			state->syscalls->live_end_usecs = -1;
-			DEBUGP("syscall thread: now idle\n");
+			assert(thread->state == SYSCALL_DONE);
+			thread->state = SYSCALL_IDLE;
+			thread->event = NULL;
+			thread->script_fd = -1;
+			thread->live_end_usecs = -1;
+			DEBUGP("syscall thread %d: now idle\n", thread->index);
 			if (pthread_cond_signal(&state->syscalls->idle) != 0)
 				die_perror("pthread_cond_signal");
 			break;
@@ -1992,8 +3395,9 @@ static void *system_call_thread(void *arg)
 		/* omitting default so compiler will catch missing cases */
 		}
 	}
-	DEBUGP("syscall thread: unlocking and exiting\n");
+	DEBUGP("syscall thread %d: unlocking and exiting\n", thread->index);
 	run_unlock(state);
+	perf_sample_close();
 
 	return NULL;
 }
@@ -2001,54 +3405,88 @@ static void *system_call_thread(void *arg)
 struct syscalls *syscalls_new(struct state *state)
 {
 	struct syscalls *syscalls = calloc(1, sizeof(struct syscalls));
+	int i;
 
-	syscalls->state = SYSCALL_IDLE;
+	syscalls->num_threads = state->config->syscall_threads;
+	assert(syscalls->num_threads > 0);
+	syscalls->threads = calloc(syscalls->num_threads,
+				   sizeof(struct syscall_thread));
 
-	if (pthread_create(&syscalls->thread, NULL, system_call_thread,
-			   state) != 0) {
-		die_perror("pthread_create");
-	}
+	payload_arena_new(state, syscalls);
+	syscalls->latencies = syscall_latencies_new();
 
 	if ((pthread_cond_init(&syscalls->idle, NULL) != 0) ||
-	    (pthread_cond_init(&syscalls->enqueued, NULL) != 0) ||
 	    (pthread_cond_init(&syscalls->dequeued, NULL) != 0)) {
 		die_perror("pthread_cond_init");
 	}
 
+	for (i = 0; i < syscalls->num_threads; ++i) {
+		struct syscall_thread *thread = &syscalls->threads[i];
+
+		thread->run_state = state;
+		thread->index = i;
+		thread->state = SYSCALL_IDLE;
+		thread->script_fd = -1;
+		thread->live_end_usecs = -1;
+
+		if (pthread_cond_init(&thread->enqueued, NULL) != 0)
+			die_perror("pthread_cond_init");
+
+		if (pthread_create(&thread->thread, NULL, system_call_thread,
+				   thread) != 0) {
+			die_perror("pthread_create");
+		}
+	}
+
 	return syscalls;
 }
 
 void syscalls_free(struct state *state, struct syscalls *syscalls)
 {
-	/* Wait a bit for the thread to go idle. */
-	if (await_idle_thread(state)) {
+	struct syscall_thread *busy_thread = NULL;
+	int i;
+
+	/* Wait a bit for the threads to go idle. */
+	busy_thread = await_all_idle_threads(state);
+	if (busy_thread != NULL) {
 		die("%s:%d: runtime error: exiting while "
 		    "a blocking system call is in progress\n",
 		    state->config->script_path,
-		    syscalls->event->line_number);
+		    busy_thread->event->line_number);
 	}
 
-	/* Send a request to terminate the thread. */
-	DEBUGP("main thread: signaling syscall thread to exit\n");
-	syscalls->state = SYSCALL_EXITING;
-	if (pthread_cond_signal(&syscalls->enqueued) != 0)
-		die_perror("pthread_cond_signal");
+	/* Send a request to terminate each thread. */
+	DEBUGP("main thread: signaling syscall threads to exit\n");
+	for (i = 0; i < syscalls->num_threads; ++i) {
+		syscalls->threads[i].state = SYSCALL_EXITING;
+		if (pthread_cond_signal(&syscalls->threads[i].enqueued) != 0)
+			die_perror("pthread_cond_signal");
+	}
 
-	/* Release the lock briefly and wait for syscall thread to finish. */
+	/* Release the lock briefly and wait for syscall threads to finish. */
 	run_unlock(state);
 	DEBUGP("main thread: unlocking, waiting for syscall thread exit\n");
-	void *thread_result = NULL;
-	if (pthread_join(syscalls->thread, &thread_result) != 0)
-		die_perror("pthread_cancel");
-	DEBUGP("main thread: joined syscall thread; relocking\n");
+	for (i = 0; i < syscalls->num_threads; ++i) {
+		void *thread_result = NULL;
+		if (pthread_join(syscalls->threads[i].thread,
+				 &thread_result) != 0)
+			die_perror("pthread_join");
+	}
+	DEBUGP("main thread: joined syscall threads; relocking\n");
 	run_lock(state);
 
+	for (i = 0; i < syscalls->num_threads; ++i) {
+		if (pthread_cond_destroy(&syscalls->threads[i].enqueued) != 0)
+			die_perror("pthread_cond_destroy");
+	}
 	if ((pthread_cond_destroy(&syscalls->idle) != 0) ||
-	    (pthread_cond_destroy(&syscalls->enqueued) != 0) ||
 	    (pthread_cond_destroy(&syscalls->dequeued) != 0)) {
 		die_perror("pthread_cond_destroy");
 	}
 
+	payload_arena_free(syscalls);
+	syscall_latencies_free(syscalls->latencies);
+	free(syscalls->threads);
 	memset(syscalls, 0, sizeof(*syscalls));  /* to help catch bugs */
 	free(syscalls);
 }
@@ -29,10 +29,12 @@
 
 #include <pthread.h>
 #include "script.h"
+#include "syscall_latency.h"
 
+struct config;
 struct state;
 
-/* States in which the system call thread can be. */
+/* States in which a system call thread can be. */
 enum syscall_state_t {
 	SYSCALL_IDLE,		/* system call thread is idle */
 	SYSCALL_ENQUEUED,	/* blocking system call is ready to execute */
@@ -41,34 +43,62 @@ enum syscall_state_t {
 	SYSCALL_EXITING,	/* process is exiting */
 };
 
-/* Internal state for the system call module, including the "syscall
- * thread", which handles blocking system calls.
- */
-struct syscalls {
+/* A "syscall thread", which handles one blocking system call at a time. */
+struct syscall_thread {
+	struct state *run_state;	/* runtime state for the test */
+	int index;			/* index in the thread pool */
 	enum syscall_state_t state;	/* current state of syscall thread */
 	struct event *event;		/* current system call it's running */
+	int script_fd;			/* script fd of that call, or -1 */
 	s64 live_end_usecs;		/* time of last system call return */
 
-	/* Handles for the syscall thread, for blocking system calls. */
 	pthread_t thread;		/* pthread thread handle */
 	pid_t thread_id;		/* kernel thread ID  */
 
-	/* The main thread waits on this condition variable. The
+	/* The system call thread waits on this condition
+	 * variable. The main thread signals this when it has enqueued
+	 * a blocking system call for this thread to execute, and thus
+	 * the system call thread should wake up and execute that
+	 * system call. The main thread also signals this when it's
+	 * time to exit.
+	 */
+	pthread_cond_t enqueued;
+};
+
+/* Internal state for the system call module, including the pool of
+ * "syscall threads", which handle blocking system calls. Blocking
+ * system calls on different file descriptors may be in flight
+ * simultaneously, each on its own syscall thread.
+ */
+struct syscalls {
+	struct syscall_thread *threads;	/* array of pool threads */
+	int num_threads;		/* number of threads in the pool */
+
+	/* A pre-faulted arena for the payloads of read/write-style
+	 * system calls, sized at script load time from the largest
+	 * payload in the script, so that bulk transfers don't pay for
+	 * page faults and zeroing right before the system call. The
+	 * arena starts with a read-only source for outgoing data
+	 * (zeros, or with --payload_pattern one extra period of the
+	 * pattern, so any stream offset is a contiguous window), and
+	 * is followed by one scratch sink for incoming data for the
+	 * main thread and for each pool thread.
+	 */
+	char *payload_arena;		/* mmap-ed arena, or NULL */
+	size_t payload_arena_bytes;	/* max payload bytes of any call */
+	size_t payload_source_bytes;	/* bytes in the source region */
+	size_t payload_map_bytes;	/* total bytes mapped for the arena */
+
+	struct syscall_latencies *latencies;	/* time each call took */
+
+	/* The main thread waits on this condition variable. A
 	 * system call thread signals this when it has finished
 	 * executing a blocking system call and is now idle and ready
 	 * to execute another blocking system call.
 	 */
 	pthread_cond_t idle;
 
-	/* The system call thread waits on this condition
-	 * variable. The main thread signals this when it has enqueued
-	 * a blocking system call to execute, and thus the system call
-	 * thread should wake up and execute that system call. The
-	 * main thread also signals this when it's time to exit.
-	 */
-	pthread_cond_t enqueued;
-
-	/* The main thread waits on this condition variable. The
+	/* The main thread waits on this condition variable. A
 	 * system call thread signals this after it has dequeued the
 	 * system call and just before it invokes the system call, at
 	 * which point the main thread should wake up to continue test
@@ -84,12 +114,25 @@ extern struct syscalls *syscalls_new(struct state *state);
 extern void syscalls_free(struct state *state,
 			  struct syscalls *syscalls);
 
+/* Evaluate the arguments of each system call event of the given
+ * parsed script ahead of time, and build the iovec, msghdr, and
+ * mmsghdr arrays they describe, so that running an event only has to
+ * point them at payload buffers and look up the live fd. Everything
+ * built is owned by the script's arena. If any event has arguments
+ * that would fail to evaluate or build when it runs, prints that
+ * error, as running the event would, and returns STATUS_ERR.
+ */
+extern int prepare_system_calls(const struct config *config,
+				struct script *script);
+
 /* Execute the given system call event. The system call may be
  * expected to block for a while, or it may be expected to return
- * immediately. To keep things simple, currently we only support
- * at most one blocking system call at a time; if a script attempts to
- * start a second blocking call before the first blocking call has
- * returned then this second call raises a runtime error.
+ * immediately. Blocking system calls on different file descriptors
+ * run concurrently on the threads of the syscall thread pool; if a
+ * script attempts to start a blocking call on a file descriptor
+ * before a previous blocking call on that same file descriptor has
+ * returned, or when all pool threads are busy, then this second call
+ * raises a runtime error.
  */
 void run_system_call_event(struct state *state,
 			   struct event *event,
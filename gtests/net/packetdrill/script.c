@@ -26,7 +26,11 @@
 
 #include <assert.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdlib.h>
+#ifdef linux
+#include <sys/epoll.h>
+#endif
 
 #include "symbols.h"
 
@@ -46,6 +50,13 @@ void init_script(struct script *script)
 	script->event_list = NULL;
 }
 
+void script_free(struct script *script)
+{
+	arena_free(script->arena);
+	free(script->buffer);
+	init_script(script);
+}
+
 /* This table maps expression types to human-readable strings */
 struct expression_type_entry {
 	enum expression_t type;
@@ -65,6 +76,9 @@ struct expression_type_entry expression_type_table[] = {
 	{ EXPR_IOVEC,                "iovec" },
 	{ EXPR_MSGHDR,               "msghdr" },
 	{ EXPR_POLLFD,               "pollfd" },
+	{ EXPR_CMSGHDR,              "cmsghdr" },
+	{ EXPR_SOCK_EXTENDED_ERR,    "sock_extended_err" },
+	{ EXPR_EPOLLEV,              "epoll_event" },
 #ifdef SCTP_RTOINFO
 	{ EXPR_SCTP_RTOINFO,         "sctp_rtoinfo"},
 #endif
@@ -115,34 +129,98 @@ struct int_symbol cross_platform_symbols[] = {
 
 	{ SOL_SOCKET,                       "SOL_SOCKET"                      },
 
+	/* NULL pointer arguments, e.g. the offsets of splice(). */
+	{ 0,                                "NULL"                            },
+
 	/* Sentinel marking the end of the table. */
 	{ 0, NULL },
 };
 
-/* Do a symbol->int lookup, and return true iff we found the symbol. */
-static bool lookup_int_symbol(const char *input_symbol, s64 *output_integer,
-			      struct int_symbol *symbols)
+/* All symbols, sorted by name for binary search. We build this once,
+ * on first use; scripts resolve symbols often enough that a linear scan
+ * of the tables shows up in parse and run time.
+ */
+struct sorted_symbol {
+	const struct int_symbol *symbol;
+	int order;		/* position in the tables, to break ties */
+};
+static struct sorted_symbol *sorted_symbols;
+static int num_sorted_symbols;
+static pthread_once_t sorted_symbols_once = PTHREAD_ONCE_INIT;
+
+static int count_int_symbols(const struct int_symbol *symbols)
 {
 	int i;
-	for (i = 0; symbols[i].name != NULL ; ++i) {
-		if (strcmp(input_symbol, symbols[i].name) == 0) {
-			*output_integer = symbols[i].value;
-			return true;
-		}
+
+	for (i = 0; symbols[i].name != NULL; ++i)
+		;
+	return i;
+}
+
+static void add_sorted_symbols(const struct int_symbol *symbols)
+{
+	int i;
+
+	for (i = 0; symbols[i].name != NULL; ++i) {
+		struct sorted_symbol *entry =
+			&sorted_symbols[num_sorted_symbols];
+
+		entry->symbol = &symbols[i];
+		entry->order = num_sorted_symbols++;
+	}
+}
+
+static int compare_sorted_symbols(const void *a, const void *b)
+{
+	const struct sorted_symbol *x = a, *y = b;
+	int result = strcmp(x->symbol->name, y->symbol->name);
+
+	return result ? result : x->order - y->order;
+}
+
+static void sort_symbols(void)
+{
+	int n = (count_int_symbols(cross_platform_symbols) +
+		 count_int_symbols(platform_symbols()));
+	int i, j;
+
+	sorted_symbols = calloc(n, sizeof(struct sorted_symbol));
+	add_sorted_symbols(cross_platform_symbols);
+	add_sorted_symbols(platform_symbols());
+	qsort(sorted_symbols, n, sizeof(struct sorted_symbol),
+	      compare_sorted_symbols);
+
+	/* As with the old linear scans, the first definition of a name
+	 * wins, and cross-platform symbols come first; drop the rest.
+	 */
+	for (i = 0, j = 0; i < n; ++i) {
+		if (j > 0 && strcmp(sorted_symbols[i].symbol->name,
+				    sorted_symbols[j - 1].symbol->name) == 0)
+			continue;
+		sorted_symbols[j++] = sorted_symbols[i];
 	}
-	return false;
+	num_sorted_symbols = j;
+}
+
+static int compare_symbol_name(const void *name, const void *entry)
+{
+	const struct sorted_symbol *symbol = entry;
+
+	return strcmp(name, symbol->symbol->name);
 }
 
 int symbol_to_int(const char *input_symbol, s64 *output_integer,
 		  char **error)
 {
-	if (lookup_int_symbol(input_symbol, output_integer,
-			      cross_platform_symbols))
-		return STATUS_OK;
+	const struct sorted_symbol *symbol = NULL;
 
-	if (lookup_int_symbol(input_symbol, output_integer,
-			      platform_symbols()))
+	pthread_once(&sorted_symbols_once, sort_symbols);
+	symbol = bsearch(input_symbol, sorted_symbols, num_sorted_symbols,
+			 sizeof(struct sorted_symbol), compare_symbol_name);
+	if (symbol != NULL) {
+		*output_integer = symbol->symbol->value;
 		return STATUS_OK;
+	}
 
 	asprintf(error, "unknown symbol: '%s'", input_symbol);
 	return STATUS_ERR;
@@ -189,6 +267,32 @@ struct flag_name poll_flags[] = {
 	{ 0, "" },
 };
 
+#ifdef linux
+/* Names for the events bit mask flags for epoll_ctl()/epoll_wait() */
+struct flag_name epoll_flags[] = {
+
+	{ EPOLLIN,	"EPOLLIN" },
+	{ EPOLLPRI,	"EPOLLPRI" },
+	{ EPOLLOUT,	"EPOLLOUT" },
+	{ EPOLLRDNORM,	"EPOLLRDNORM" },
+	{ EPOLLRDBAND,	"EPOLLRDBAND" },
+	{ EPOLLWRNORM,	"EPOLLWRNORM" },
+	{ EPOLLWRBAND,	"EPOLLWRBAND" },
+	{ EPOLLMSG,	"EPOLLMSG" },
+	{ EPOLLERR,	"EPOLLERR" },
+	{ EPOLLHUP,	"EPOLLHUP" },
+	{ EPOLLRDHUP,	"EPOLLRDHUP" },
+#ifdef EPOLLEXCLUSIVE
+	{ EPOLLEXCLUSIVE, "EPOLLEXCLUSIVE" },
+#endif
+	{ EPOLLWAKEUP,	"EPOLLWAKEUP" },
+	{ EPOLLONESHOT,	"EPOLLONESHOT" },
+	{ EPOLLET,	"EPOLLET" },
+
+	{ 0, "" },
+};
+#endif
+
 /* Return the human-readable ASCII string corresponding to a given
  * flag value, or "???" if none matches.
  */
@@ -334,6 +438,7 @@ void free_expression(struct expression *expression)
 		free_expression(expression->value.msghdr->msg_iov);
 		free_expression(expression->value.msghdr->msg_iovlen);
 		free_expression(expression->value.msghdr->msg_flags);
+		free_expression(expression->value.msghdr->msg_control);
 		break;
 	case EXPR_POLLFD:
 		assert(expression->value.pollfd);
@@ -341,6 +446,26 @@ void free_expression(struct expression *expression)
 		free_expression(expression->value.pollfd->events);
 		free_expression(expression->value.pollfd->revents);
 		break;
+	case EXPR_CMSGHDR:
+		assert(expression->value.cmsghdr);
+		free_expression(expression->value.cmsghdr->cmsg_level);
+		free_expression(expression->value.cmsghdr->cmsg_type);
+		free_expression(expression->value.cmsghdr->cmsg_data);
+		break;
+	case EXPR_EPOLLEV:
+		assert(expression->value.epollev);
+		free_expression(expression->value.epollev->events);
+		free_expression(expression->value.epollev->fd);
+		break;
+	case EXPR_SOCK_EXTENDED_ERR:
+		assert(expression->value.sock_extended_err);
+		free_expression(expression->value.sock_extended_err->ee_errno);
+		free_expression(expression->value.sock_extended_err->ee_origin);
+		free_expression(expression->value.sock_extended_err->ee_type);
+		free_expression(expression->value.sock_extended_err->ee_code);
+		free_expression(expression->value.sock_extended_err->ee_info);
+		free_expression(expression->value.sock_extended_err->ee_data);
+		break;
 	case EXPR_NONE:
 	case NUM_EXPR_TYPES:
 		break;
@@ -452,6 +577,9 @@ static int evaluate_msghdr_expression(struct expression *in,
 		return STATUS_ERR;
 	if (evaluate(in_msg->msg_flags,		&out_msg->msg_flags,	error))
 		return STATUS_ERR;
+	if ((in_msg->msg_control != NULL) &&
+	    evaluate(in_msg->msg_control,	&out_msg->msg_control,	error))
+		return STATUS_ERR;
 
 	return STATUS_OK;
 }
@@ -481,6 +609,87 @@ static int evaluate_pollfd_expression(struct expression *in,
 	return STATUS_OK;
 }
 
+static int evaluate_cmsghdr_expression(struct expression *in,
+				       struct expression *out, char **error)
+{
+	struct cmsghdr_expr *in_cmsg;
+	struct cmsghdr_expr *out_cmsg;
+
+	assert(in->type == EXPR_CMSGHDR);
+	assert(in->value.cmsghdr);
+	assert(out->type == EXPR_CMSGHDR);
+
+	out->value.cmsghdr = calloc(1, sizeof(struct cmsghdr_expr));
+
+	in_cmsg = in->value.cmsghdr;
+	out_cmsg = out->value.cmsghdr;
+
+	if (evaluate(in_cmsg->cmsg_level,	&out_cmsg->cmsg_level,	error))
+		return STATUS_ERR;
+	if (evaluate(in_cmsg->cmsg_type,	&out_cmsg->cmsg_type,	error))
+		return STATUS_ERR;
+	if (evaluate(in_cmsg->cmsg_data,	&out_cmsg->cmsg_data,	error))
+		return STATUS_ERR;
+
+	return STATUS_OK;
+}
+
+static int evaluate_sock_extended_err_expression(struct expression *in,
+						 struct expression *out,
+						 char **error)
+{
+	struct sock_extended_err_expr *in_ee;
+	struct sock_extended_err_expr *out_ee;
+
+	assert(in->type == EXPR_SOCK_EXTENDED_ERR);
+	assert(in->value.sock_extended_err);
+	assert(out->type == EXPR_SOCK_EXTENDED_ERR);
+
+	out->value.sock_extended_err =
+		calloc(1, sizeof(struct sock_extended_err_expr));
+
+	in_ee = in->value.sock_extended_err;
+	out_ee = out->value.sock_extended_err;
+
+	if (evaluate(in_ee->ee_errno,		&out_ee->ee_errno,	error))
+		return STATUS_ERR;
+	if (evaluate(in_ee->ee_origin,		&out_ee->ee_origin,	error))
+		return STATUS_ERR;
+	if (evaluate(in_ee->ee_type,		&out_ee->ee_type,	error))
+		return STATUS_ERR;
+	if (evaluate(in_ee->ee_code,		&out_ee->ee_code,	error))
+		return STATUS_ERR;
+	if (evaluate(in_ee->ee_info,		&out_ee->ee_info,	error))
+		return STATUS_ERR;
+	if (evaluate(in_ee->ee_data,		&out_ee->ee_data,	error))
+		return STATUS_ERR;
+
+	return STATUS_OK;
+}
+
+static int evaluate_epollev_expression(struct expression *in,
+				       struct expression *out, char **error)
+{
+	struct epollev_expr *in_epollev;
+	struct epollev_expr *out_epollev;
+
+	assert(in->type == EXPR_EPOLLEV);
+	assert(in->value.epollev);
+	assert(out->type == EXPR_EPOLLEV);
+
+	out->value.epollev = calloc(1, sizeof(struct epollev_expr));
+
+	in_epollev = in->value.epollev;
+	out_epollev = out->value.epollev;
+
+	if (evaluate(in_epollev->events,	&out_epollev->events,	error))
+		return STATUS_ERR;
+	if (evaluate(in_epollev->fd,		&out_epollev->fd,	error))
+		return STATUS_ERR;
+
+	return STATUS_OK;
+}
+
 static int evaluate(struct expression *in,
 		    struct expression **out_ptr, char **error)
 {
@@ -568,6 +777,15 @@ static int evaluate(struct expression *in,
 	case EXPR_POLLFD:
 		result = evaluate_pollfd_expression(in, out, error);
 		break;
+	case EXPR_CMSGHDR:
+		result = evaluate_cmsghdr_expression(in, out, error);
+		break;
+	case EXPR_SOCK_EXTENDED_ERR:
+		result = evaluate_sock_extended_err_expression(in, out, error);
+		break;
+	case EXPR_EPOLLEV:
+		result = evaluate_epollev_expression(in, out, error);
+		break;
 	case EXPR_NONE:
 	case NUM_EXPR_TYPES:
 		break;
@@ -28,6 +28,7 @@
 #include "types.h"
 
 #include <sys/time.h>
+#include "arena.h"
 #include "packet.h"
 
 /* The types of expressions in a script */
@@ -45,6 +46,9 @@ enum expression_t {
 	EXPR_IOVEC,		  /* expression tree for an iovec struct */
 	EXPR_MSGHDR,		  /* expression tree for a msghdr struct */
 	EXPR_POLLFD,		  /* expression tree for a pollfd struct */
+	EXPR_CMSGHDR,		  /* expression tree for a cmsghdr struct */
+	EXPR_SOCK_EXTENDED_ERR,	  /* expression tree for sock_extended_err */
+	EXPR_EPOLLEV,		  /* expression tree for an epoll_event struct */
 #ifdef SCTP_RTOINFO
 	EXPR_SCTP_RTOINFO,	  /* struct sctp_rtoinfo for SCTP_RTOINFO */
 #endif
@@ -77,6 +81,9 @@ struct expression {
 		struct iovec_expr *iovec;
 		struct msghdr_expr *msghdr;
 		struct pollfd_expr *pollfd;
+		struct cmsghdr_expr *cmsghdr;
+		struct sock_extended_err_expr *sock_extended_err;
+		struct epollev_expr *epollev;
 #ifdef SCTP_RTOINFO
 		struct sctp_rtoinfo sctp_rtoinfo;
 #endif
@@ -121,6 +128,27 @@ struct msghdr_expr {
 	struct expression *msg_iov;
 	struct expression *msg_iovlen;
 	struct expression *msg_flags;
+	struct expression *msg_control;	/* list of cmsghdr, or NULL */
+};
+
+/* Parse tree for a cmsghdr struct in the msg_control of a msghdr. */
+struct cmsghdr_expr {
+	struct expression *cmsg_level;
+	struct expression *cmsg_type;
+	struct expression *cmsg_data;
+};
+
+/* Parse tree for a sock_extended_err struct, the cmsg_data of an
+ * IP_RECVERR/IPV6_RECVERR cmsg read from a socket's error queue; for
+ * MSG_ZEROCOPY completions ee_info..ee_data is the completed range.
+ */
+struct sock_extended_err_expr {
+	struct expression *ee_errno;
+	struct expression *ee_origin;
+	struct expression *ee_type;
+	struct expression *ee_code;
+	struct expression *ee_info;
+	struct expression *ee_data;
 };
 
 /* Parse tree for a pollfd struct in a poll syscall. */
@@ -130,6 +158,14 @@ struct pollfd_expr {
 	struct expression *revents;	/* returned events */
 };
 
+/* Parse tree for an epoll_event struct in an epoll_ctl/epoll_wait
+ * syscall. The event's data is the script fd it refers to.
+ */
+struct epollev_expr {
+	struct expression *events;	/* EPOLL* event mask */
+	struct expression *fd;		/* script fd stored in data.fd */
+};
+
 /* The errno-related info from strace to summarize a system call error */
 struct errno_spec {
 	const char *errno_macro;	/* errno symbol (C macro name) */
@@ -145,12 +181,16 @@ struct errno_spec {
 struct syscall_spec {
 	const char *name;			/* name of system call */
 	struct expression_list *arguments;	/* arguments to system call */
+	struct expression_list *evaluated_arguments; /* or NULL */
+	struct syscall_buffers *buffers;	/* built iovecs etc, or NULL */
 	struct expression *result;		/* expected result from call */
 	struct errno_spec *error;		/* errno symbol or NULL */
 	char *note;				/* extra note from strace */
 	s64 end_usecs;				/* finish time, if it blocks */
+	s64 max_latency_usecs;			/* most time the call may take */
 };
 #define SYSCALL_NON_BLOCKING  -1		/* end_usecs if non-blocking */
+#define NO_LATENCY_LIMIT      -1		/* max_latency_usecs if none */
 
 static inline bool is_blocking_syscall(struct syscall_spec *syscall)
 {
@@ -169,6 +209,40 @@ struct code_spec {
 	const char *text;	/* snippet of post-processing code */
 };
 
+/* An auto-peer phase, in which packetdrill plays a bulk data receiver
+ * that ACKs whatever the socket under test sends, so that scripts can
+ * run a transfer over many round trips without a line per ACK.
+ */
+struct peer_spec {
+	s64 bytes;		/* stop once this much data is ACKed, or 0 */
+	s64 duration_usecs;	/* stop after this much time, or 0 */
+	s64 ack_every;		/* ACK every this many in-order segments */
+	s64 rtt_usecs;		/* emulated round-trip time */
+	s64 rate_bps;		/* emulated bottleneck rate, or 0 for none */
+	bool sack;		/* send SACK blocks for out-of-order data? */
+	s64 *drops;		/* data segments to drop, counting from 1 */
+	int num_drops;		/* length of drops array */
+};
+
+#define MAX_SPACING_PACKETS	1024	/* most packets one spacing checks */
+#define DEFAULT_BURST_GAP_USECS	50	/* default burst_gap for spacing */
+
+/* An assertion about the spacing of the last few outbound packets, as
+ * sniffed, for checking pacing and burst behavior more closely than
+ * the tolerance on each packet's time allows. Each limit is 0 if the
+ * script gives none.
+ */
+struct spacing_spec {
+	s64 packets;		/* how many of the last outbound packets */
+	s64 min_gap_usecs;	/* least time between consecutive packets */
+	s64 max_gap_usecs;	/* most time between consecutive packets */
+	s64 min_rate_bps;	/* least rate achieved in any window */
+	s64 max_rate_bps;	/* most rate achieved in any window */
+	s64 window_usecs;	/* window for rates, or 0 for whole train */
+	s64 max_burst;		/* most packets in one burst */
+	s64 burst_gap_usecs;	/* gaps shorter than this join a burst */
+};
+
 /* Types of events in a script */
 enum event_t {
 	INVALID_EVENT = 0,
@@ -176,6 +250,8 @@ enum event_t {
 	SYSCALL_EVENT,
 	COMMAND_EVENT,
 	CODE_EVENT,
+	PEER_EVENT,
+	SPACING_EVENT,
 	NUM_EVENT_TYPES,
 };
 
@@ -203,6 +279,8 @@ struct event {
 		struct syscall_spec	*syscall;
 		struct command_spec	*command;
 		struct code_spec	*code;
+		struct peer_spec	*peer;
+		struct spacing_spec	*spacing;
 	} event;		/* pointer to the event */
 	struct event *next;	/* next in linked list of events */
 };
@@ -221,9 +299,9 @@ struct option_list {
 	struct option_list *next;
 };
 
-/* A parsed script. The script owns all of the data to which
- * it points. TODO: add a script_free() to free everything when we are
- * done executing the script, instead of leaking all that memory.
+/* A parsed script. The script owns all of the data to which it
+ * points: the parser allocates everything from the script's arena, so
+ * script_free() releases it all in one call.
  */
 struct script {
 	struct option_list *option_list;    /* linked list of options */
@@ -231,6 +309,7 @@ struct script {
 	struct event	*event_list;	    /* linked list of all events */
 	char		*buffer;	    /* raw input text of the script */
 	int		length;		    /* number of bytes in the script */
+	struct arena	*arena;		    /* memory for the parsed script */
 };
 
 /* A table entry mapping a bit mask to its human-readable name.
@@ -245,6 +324,11 @@ struct flag_name {
 /* Initialize a script object */
 extern void init_script(struct script *script);
 
+/* Free everything owned by a script, including its parsed
+ * representation, and reinitialize it.
+ */
+extern void script_free(struct script *script);
+
 /* Look up the value of the given symbol, and fill it in. On success,
  * return STATUS_OK; if the symbol cannot be found, return
  * STATUS_ERR and fill in an error message in *error.
@@ -257,6 +341,9 @@ extern int symbol_to_int(const char *input_symbol, s64 *output_integer,
  * string. Caller must free() the memory.
  */
 extern struct flag_name poll_flags[];
+#ifdef linux
+extern struct flag_name epoll_flags[];
+#endif
 char *flags_to_string(struct flag_name *flags_array, u64 flags);
 
 /* Do a deep deallocation of a heap-allocated expression list,
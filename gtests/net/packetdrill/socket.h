@@ -113,9 +113,23 @@ struct socket {
 	 * order to induce the kernel to free the socket.
 	 */
 	struct tcp last_outbound_tcp_header;
+	u32 last_outbound_tcp_payload_len;
 	struct tcp last_injected_tcp_header;
 	u32 last_injected_tcp_payload_len;
 
+	/* The TCP timestamp option of the last packet we injected, if
+	 * it had one, so an autopeer phase can carry on the sequence.
+	 */
+	bool has_last_injected_tcp_ts;
+	u32 last_injected_tcp_ts_val;
+	u32 last_injected_tcp_ts_ecr;
+
+	/* For --payload_pattern: the stream offsets of the next bytes
+	 * the application will write to and read from this socket.
+	 */
+	u64 pattern_write_offset;
+	u64 pattern_read_offset;
+
 	struct sctp_cookie_echo_chunk *prepared_cookie_echo;
 	u16 prepared_cookie_echo_length;
 	struct sctp_heartbeat_ack_chunk *prepared_heartbeat_ack;
@@ -291,13 +305,17 @@ static inline void set_packet_tuple(struct packet *packet,
  *
  * The code below for remote and local cases are different because the
  * packetdrill tool gets to pick the live ISN for remote packets but the
- * local kernel under test always gets to pick its live ISN.
+ * local kernel under test always gets to pick its live ISN. (Except
+ * with --offline_pcap, where the remote live ISN is the recorded one,
+ * so the live and script remote ISNs can differ too.)
  */
 
 static inline u32 remote_seq_script_to_live_offset(struct socket *socket,
 						   bool is_syn)
 {
-	return is_syn ? 0 : socket->live.remote_isn;
+	return is_syn ?
+		(socket->live.remote_isn - socket->script.remote_isn) :
+		socket->live.remote_isn;
 }
 
 static inline u32 remote_seq_live_to_script_offset(struct socket *socket,
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for summarizing samples of times.
+ */
+
+#include "stats.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+static int compare_s64(const void *a, const void *b)
+{
+	const s64 x = *(const s64 *)a, y = *(const s64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+void sort_s64(s64 *samples, int num_samples)
+{
+	qsort(samples, num_samples, sizeof(s64), compare_s64);
+}
+
+void print_nsecs_summary(FILE *f, const s64 *sorted, int num_samples)
+{
+	assert(num_samples > 0);
+	fprintf(f, "min %.3f p50 %.3f p99 %.3f max %.3f",
+		sorted[0] / 1000.0,
+		percentile_s64(sorted, num_samples, 50) / 1000.0,
+		percentile_s64(sorted, num_samples, 99) / 1000.0,
+		sorted[num_samples - 1] / 1000.0);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for summarizing samples of times, for the reports of the
+ * time-related flags.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+/* Sort the given samples in increasing order. */
+extern void sort_s64(s64 *samples, int num_samples);
+
+/* Return the given percentile of the sorted samples. */
+static inline s64 percentile_s64(const s64 *sorted, int num_samples,
+				 int percent)
+{
+	return sorted[(num_samples - 1) * percent / 100];
+}
+
+/* Print the min, p50, p99 and max of the sorted, non-empty samples of
+ * nanoseconds, in microseconds, as "min 1.000 p50 ... max 9.000".
+ */
+extern void print_nsecs_summary(FILE *f, const s64 *sorted,
+				int num_samples);
+
+#endif /* __STATS_H__ */
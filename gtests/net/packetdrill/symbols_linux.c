@@ -34,12 +34,14 @@
 #include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/unistd.h>
 
+#include <linux/errqueue.h>
 #include <linux/sockios.h>
 
 #include "tcp.h"
@@ -86,6 +88,38 @@ struct int_symbol platform_symbols_table[] = {
 	{ SO_SNDTIMEO,                      "SO_SNDTIMEO"                     },
 	{ SO_TIMESTAMP,                     "SO_TIMESTAMP"                    },
 	{ SO_TYPE,                          "SO_TYPE"                         },
+#ifdef SO_ZEROCOPY
+	{ SO_ZEROCOPY,                      "SO_ZEROCOPY"                     },
+#endif
+#ifdef SO_INCOMING_CPU
+	{ SO_INCOMING_CPU,                  "SO_INCOMING_CPU"                 },
+#endif
+#ifdef SO_INCOMING_NAPI_ID
+	{ SO_INCOMING_NAPI_ID,              "SO_INCOMING_NAPI_ID"             },
+#endif
+#ifdef SO_BUSY_POLL
+	{ SO_BUSY_POLL,                     "SO_BUSY_POLL"                    },
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+	{ SO_PREFER_BUSY_POLL,              "SO_PREFER_BUSY_POLL"             },
+#endif
+#ifdef SO_BUSY_POLL_BUDGET
+	{ SO_BUSY_POLL_BUDGET,              "SO_BUSY_POLL_BUDGET"             },
+#endif
+#ifdef SO_MAX_PACING_RATE
+	{ SO_MAX_PACING_RATE,               "SO_MAX_PACING_RATE"              },
+#endif
+
+	{ SO_EE_ORIGIN_NONE,                "SO_EE_ORIGIN_NONE"               },
+	{ SO_EE_ORIGIN_LOCAL,               "SO_EE_ORIGIN_LOCAL"              },
+	{ SO_EE_ORIGIN_ICMP,                "SO_EE_ORIGIN_ICMP"               },
+	{ SO_EE_ORIGIN_ICMP6,               "SO_EE_ORIGIN_ICMP6"              },
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+	{ SO_EE_ORIGIN_ZEROCOPY,            "SO_EE_ORIGIN_ZEROCOPY"           },
+#endif
+#ifdef SO_EE_CODE_ZEROCOPY_COPIED
+	{ SO_EE_CODE_ZEROCOPY_COPIED,       "SO_EE_CODE_ZEROCOPY_COPIED"      },
+#endif
 
 	{ IP_TOS,                           "IP_TOS"                          },
 	{ IP_MTU_DISCOVER,                  "IP_MTU_DISCOVER"                 },
@@ -93,6 +127,8 @@ struct int_symbol platform_symbols_table[] = {
 	{ IP_PMTUDISC_DONT,                 "IP_PMTUDISC_DONT"                },
 	{ IP_PMTUDISC_DO,                   "IP_PMTUDISC_DO"                  },
 	{ IP_PMTUDISC_PROBE,                "IP_PMTUDISC_PROBE"               },
+	{ IP_RECVERR,                       "IP_RECVERR"                      },
+	{ IPV6_RECVERR,                     "IPV6_RECVERR"                    },
 #ifdef IP_MTU
 	{ IP_MTU,                           "IP_MTU"                          },
 #endif
@@ -212,6 +248,13 @@ struct int_symbol platform_symbols_table[] = {
 	{ MSG_MORE,                         "MSG_MORE"                        },
 	{ MSG_CMSG_CLOEXEC,                 "MSG_CMSG_CLOEXEC"                },
 	{ MSG_FASTOPEN,                     "MSG_FASTOPEN"                    },
+#ifdef MSG_ZEROCOPY
+	{ MSG_ZEROCOPY,                     "MSG_ZEROCOPY"                    },
+#endif
+
+	{ SPLICE_F_MOVE,                    "SPLICE_F_MOVE"                   },
+	{ SPLICE_F_NONBLOCK,                "SPLICE_F_NONBLOCK"               },
+	{ SPLICE_F_MORE,                    "SPLICE_F_MORE"                   },
 
 #ifdef SIOCINQ
 	{ SIOCINQ,                          "SIOCINQ"                         },
@@ -250,6 +293,28 @@ struct int_symbol platform_symbols_table[] = {
 	{ POLLHUP,                          "POLLHUP"                         },
 	{ POLLNVAL,                         "POLLNVAL"                        },
 
+	{ EPOLL_CLOEXEC,                    "EPOLL_CLOEXEC"                   },
+	{ EPOLL_CTL_ADD,                    "EPOLL_CTL_ADD"                   },
+	{ EPOLL_CTL_MOD,                    "EPOLL_CTL_MOD"                   },
+	{ EPOLL_CTL_DEL,                    "EPOLL_CTL_DEL"                   },
+	{ EPOLLIN,                          "EPOLLIN"                         },
+	{ EPOLLPRI,                         "EPOLLPRI"                        },
+	{ EPOLLOUT,                         "EPOLLOUT"                        },
+	{ EPOLLRDNORM,                      "EPOLLRDNORM"                     },
+	{ EPOLLRDBAND,                      "EPOLLRDBAND"                     },
+	{ EPOLLWRNORM,                      "EPOLLWRNORM"                     },
+	{ EPOLLWRBAND,                      "EPOLLWRBAND"                     },
+	{ EPOLLMSG,                         "EPOLLMSG"                        },
+	{ EPOLLERR,                         "EPOLLERR"                        },
+	{ EPOLLHUP,                         "EPOLLHUP"                        },
+	{ EPOLLRDHUP,                       "EPOLLRDHUP"                      },
+#ifdef EPOLLEXCLUSIVE
+	{ EPOLLEXCLUSIVE,                   "EPOLLEXCLUSIVE"                  },
+#endif
+	{ EPOLLWAKEUP,                      "EPOLLWAKEUP"                     },
+	{ EPOLLONESHOT,                     "EPOLLONESHOT"                    },
+	{ EPOLLET,                          "EPOLLET"                         },
+
 	{ EPERM,                            "EPERM"                           },
 	{ ENOENT,                           "ENOENT"                          },
 	{ ESRCH,                            "ESRCH"                           },
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for collecting and reporting system call latencies.
+ *
+ * We keep every latency of every call, since scripts make at most a
+ * few thousand calls, so the summary can give exact percentiles; the
+ * histogram buckets are powers of two nanoseconds.
+ */
+
+#include "syscall_latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logging.h"
+#include "stats.h"
+
+#define HISTOGRAM_BAR_WIDTH	40	/* characters for the largest bucket */
+
+/* The latencies of all calls of one system call. */
+struct syscall_latency {
+	char *name;			/* name of the system call */
+	s64 *nsecs;			/* latency of each call */
+	int num_calls;
+	int max_calls;			/* allocated length of nsecs */
+};
+
+struct syscall_latencies {
+	struct syscall_latency *syscalls;	/* in order of first call */
+	int num_syscalls;
+	int max_syscalls;		/* allocated length of syscalls */
+};
+
+struct syscall_latencies *syscall_latencies_new(void)
+{
+	return calloc(1, sizeof(struct syscall_latencies));
+}
+
+void syscall_latencies_free(struct syscall_latencies *latencies)
+{
+	int i;
+
+	for (i = 0; i < latencies->num_syscalls; ++i) {
+		free(latencies->syscalls[i].name);
+		free(latencies->syscalls[i].nsecs);
+	}
+	free(latencies->syscalls);
+	free(latencies);
+}
+
+/* Return the entry for the named system call, adding it if need be. */
+static struct syscall_latency *find_syscall(
+	struct syscall_latencies *latencies, const char *name)
+{
+	struct syscall_latency *syscall = NULL;
+	int i;
+
+	for (i = 0; i < latencies->num_syscalls; ++i) {
+		if (strcmp(latencies->syscalls[i].name, name) == 0)
+			return &latencies->syscalls[i];
+	}
+	if (latencies->num_syscalls == latencies->max_syscalls) {
+		latencies->max_syscalls = (latencies->max_syscalls > 0 ?
+					   latencies->max_syscalls * 2 : 16);
+		latencies->syscalls = realloc(latencies->syscalls,
+					      latencies->max_syscalls *
+					      sizeof(struct syscall_latency));
+		if (latencies->syscalls == NULL)
+			die("out of memory for system call latencies\n");
+	}
+	syscall = &latencies->syscalls[latencies->num_syscalls++];
+	memset(syscall, 0, sizeof(*syscall));
+	syscall->name = strdup(name);
+	return syscall;
+}
+
+void syscall_latencies_add(struct syscall_latencies *latencies,
+			   const char *name, s64 latency_nsecs)
+{
+	struct syscall_latency *syscall = find_syscall(latencies, name);
+
+	if (syscall->num_calls == syscall->max_calls) {
+		syscall->max_calls = (syscall->max_calls > 0 ?
+				      syscall->max_calls * 2 : 64);
+		syscall->nsecs = realloc(syscall->nsecs,
+					 syscall->max_calls * sizeof(s64));
+		if (syscall->nsecs == NULL)
+			die("out of memory for system call latencies\n");
+	}
+	syscall->nsecs[syscall->num_calls++] = latency_nsecs;
+}
+
+/* Return the log2 histogram bucket for the given latency. */
+static int latency_bucket(s64 nsecs)
+{
+	int bucket = 0;
+
+	while (nsecs > 1) {
+		nsecs >>= 1;
+		++bucket;
+	}
+	return bucket;
+}
+
+static void report_syscall(const struct syscall_latency *syscall,
+			   const char *script_path)
+{
+	int counts[64] = { 0 };
+	int first = 63, last = 0, max_count = 0;
+	const s64 *nsecs = syscall->nsecs;
+	const int n = syscall->num_calls;
+	s64 *sorted = NULL;
+	int i, bucket;
+
+	/* Sort a copy, so we can report exact percentiles. */
+	sorted = malloc(n * sizeof(s64));
+	memcpy(sorted, nsecs, n * sizeof(s64));
+	sort_s64(sorted, n);
+
+	fprintf(stderr, "%s: %s: %d calls, usecs: ",
+		script_path, syscall->name, n);
+	print_nsecs_summary(stderr, sorted, n);
+	fprintf(stderr, "\n");
+
+	for (i = 0; i < n; ++i) {
+		bucket = latency_bucket(sorted[i]);
+		++counts[bucket];
+		if (bucket < first)
+			first = bucket;
+		if (bucket > last)
+			last = bucket;
+		if (counts[bucket] > max_count)
+			max_count = counts[bucket];
+	}
+	for (bucket = first; bucket <= last; ++bucket) {
+		const int bar = (counts[bucket] * HISTOGRAM_BAR_WIDTH +
+				 max_count - 1) / max_count;
+
+		fprintf(stderr, "  [%10lld, %10lld) nsecs: %6d %.*s\n",
+			1LL << bucket, 1LL << (bucket + 1), counts[bucket],
+			bar, "########################################");
+	}
+	free(sorted);
+}
+
+void syscall_latencies_report(const struct syscall_latencies *latencies,
+			      const char *script_path)
+{
+	int i;
+
+	for (i = 0; i < latencies->num_syscalls; ++i)
+		report_syscall(&latencies->syscalls[i], script_path);
+}
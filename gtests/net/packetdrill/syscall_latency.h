@@ -0,0 +1,47 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for collecting the latency of each system call a script
+ * makes, by system call name, and reporting it as histograms.
+ */
+
+#ifndef __SYSCALL_LATENCY_H__
+#define __SYSCALL_LATENCY_H__
+
+#include "types.h"
+
+struct syscall_latencies;
+
+/* Allocate an empty collection of system call latencies. */
+extern struct syscall_latencies *syscall_latencies_new(void);
+
+/* Free the collection. */
+extern void syscall_latencies_free(struct syscall_latencies *latencies);
+
+/* Add a call of the named system call that took the given time. */
+extern void syscall_latencies_add(struct syscall_latencies *latencies,
+				  const char *name, s64 latency_nsecs);
+
+/* Print a summary and a log2 histogram of the latencies of each
+ * system call to stderr.
+ */
+extern void syscall_latencies_report(const struct syscall_latencies *latencies,
+				     const char *script_path);
+
+#endif /* __SYSCALL_LATENCY_H__ */
@@ -55,7 +55,7 @@ struct packet *new_tcp_packet(int address_family,
 			       enum ip_ecn_t ecn,
 			       const char *flags,
 			       u32 start_sequence,
-			       u16 tcp_payload_bytes,
+			       u32 tcp_payload_bytes,
 			       u32 ack_sequence,
 			       s32 window,
 			       const struct tcp_options *tcp_options,
@@ -160,3 +160,40 @@ struct packet *new_tcp_packet(int address_family,
 	packet->ip_bytes = ip_bytes;
 	return packet;
 }
+
+void tcp_packet_compile_template(struct packet *packet)
+{
+	struct tcp_template *template = NULL;
+	struct tcp mask;
+
+	if (packet->tcp == NULL || packet->direction != DIRECTION_OUTBOUND)
+		return;
+
+	/* The fields that verify_tcp() in run_packet.c checks. */
+	memset(&mask, 0, sizeof(mask));
+	mask.seq	= 0xffffffff;
+	mask.ack_seq	= 0xffffffff;
+	mask.res1	= 0x3;
+	mask.fin	= 1;
+	mask.syn	= 1;
+	mask.rst	= 1;
+	mask.psh	= 1;
+	mask.ack	= 1;
+	mask.urg	= 1;
+	mask.ece	= 1;
+	mask.cwr	= 1;
+	mask.urg_ptr	= 0xffff;
+	/* With <...> options the data offset depends on the options
+	 * actually seen, so the caller must check it separately.
+	 */
+	if (!(packet->flags & FLAG_OPTIONS_NOCHECK))
+		mask.doff = 0xf;
+	if (!(packet->flags & FLAG_WIN_NOCHECK))
+		mask.window = 0xffff;
+
+	template = calloc(1, sizeof(*template));
+	memcpy(template->value, packet->tcp, sizeof(template->value));
+	memcpy(template->mask, &mask, sizeof(template->mask));
+	free(packet->tcp_template);
+	packet->tcp_template = template;
+}
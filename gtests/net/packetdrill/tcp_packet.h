@@ -27,7 +27,9 @@
 
 #include "types.h"
 
+#include <string.h>
 #include "packet.h"
+#include "tcp.h"
 #include "tcp_options.h"
 
 /* Create and initialize a new struct packet containing a TCP segment.
@@ -40,9 +42,39 @@ extern struct packet *new_tcp_packet(int address_family,
 				     enum ip_ecn_t ecn,
 				     const char *flags,
 				     u32 start_sequence,
-				     u16 tcp_payload_bytes,
+				     u32 tcp_payload_bytes,
 				     u32 ack_sequence,
 				     s32 window,
 				     const struct tcp_options *tcp_options,
 				     char **error);
+
+/* The TCP header fields that an outbound script packet expects, as a
+ * byte image: a live TCP header mapped into script space has the
+ * expected values iff it equals 'value' in every bit set in 'mask'.
+ */
+struct tcp_template {
+	u32 value[sizeof(struct tcp) / sizeof(u32)];
+	u32 mask[sizeof(struct tcp) / sizeof(u32)];
+};
+
+/* Compile packet->tcp_template from the TCP header of the given
+ * outbound script packet, covering the fields that the field-by-field
+ * checks of outbound packets look at. Does nothing for other packets.
+ */
+extern void tcp_packet_compile_template(struct packet *packet);
+
+/* Return true iff the given TCP header matches the template. */
+static inline bool tcp_template_matches(const struct tcp_template *template,
+					const struct tcp *tcp)
+{
+	u32 words[sizeof(struct tcp) / sizeof(u32)];
+	u32 diff = 0;
+	int i;
+
+	memcpy(words, tcp, sizeof(words));
+	for (i = 0; i < ARRAY_SIZE(words); ++i)
+		diff |= (words[i] ^ template->value[i]) & template->mask[i];
+	return diff == 0;
+}
+
 #endif /* __TCP_PACKET_H__ */
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Test for matching outbound TCP headers against compiled templates.
+ */
+
+#include "tcp_packet.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Build an outbound script packet and compile its template. */
+static struct packet *new_script_packet(s32 window,
+					const struct tcp_options *options)
+{
+	struct packet *packet = NULL;
+	char *error = NULL;
+
+	packet = new_tcp_packet(AF_INET, DIRECTION_OUTBOUND, ECN_NONE, "P.",
+				1000, 100, 2000, window, options, &error);
+	assert(packet != NULL);
+	assert(error == NULL);
+	tcp_packet_compile_template(packet);
+	assert(packet->tcp_template != NULL);
+	return packet;
+}
+
+static void test_exact_match(void)
+{
+	struct packet *packet = new_script_packet(1024, NULL);
+	struct tcp tcp;
+
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	assert(tcp_template_matches(packet->tcp_template, &tcp));
+
+	packet_free(packet);
+}
+
+static void test_unchecked_fields_match(void)
+{
+	struct packet *packet = new_script_packet(-1, NULL);
+	struct tcp tcp;
+
+	/* Ports and checksum are never part of the template. */
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.src_port = htons(8080);
+	tcp.dst_port = htons(9090);
+	tcp.check = htons(0xbeef);
+	assert(tcp_template_matches(packet->tcp_template, &tcp));
+
+	/* A window of <...> means any window is fine. */
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.window = htons(65535);
+	assert(tcp_template_matches(packet->tcp_template, &tcp));
+
+	/* Options of <...> means any header length is fine. */
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.doff = 8;
+	assert(tcp_template_matches(packet->tcp_template, &tcp));
+
+	packet_free(packet);
+}
+
+static void test_checked_fields_mismatch(void)
+{
+	struct packet *packet = new_script_packet(1024, NULL);
+	struct tcp tcp;
+
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.seq = htonl(1001);
+	assert(!tcp_template_matches(packet->tcp_template, &tcp));
+
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.ack_seq = htonl(1999);
+	assert(!tcp_template_matches(packet->tcp_template, &tcp));
+
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.psh = 0;
+	assert(!tcp_template_matches(packet->tcp_template, &tcp));
+
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.fin = 1;
+	assert(!tcp_template_matches(packet->tcp_template, &tcp));
+
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.ece = 1;
+	assert(!tcp_template_matches(packet->tcp_template, &tcp));
+
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.urg_ptr = htons(1);
+	assert(!tcp_template_matches(packet->tcp_template, &tcp));
+
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	tcp.window = htons(1023);
+	assert(!tcp_template_matches(packet->tcp_template, &tcp));
+
+	packet_free(packet);
+}
+
+static void test_options_length_mismatch(void)
+{
+	struct tcp_options *options = tcp_options_new();
+	struct tcp_option *option = tcp_option_new(TCPOPT_MAXSEG,
+						   TCPOLEN_MAXSEG);
+	struct packet *packet = NULL;
+	struct tcp tcp;
+
+	option->data.mss.bytes = htons(1460);
+	assert(tcp_options_append(options, option) == STATUS_OK);
+	free(option);
+	packet = new_script_packet(1024, options);
+	assert(packet->tcp->doff == 6);
+
+	memcpy(&tcp, packet->tcp, sizeof(tcp));
+	assert(tcp_template_matches(packet->tcp_template, &tcp));
+
+	/* Missing options: header is shorter than the script says. */
+	tcp.doff = 5;
+	assert(!tcp_template_matches(packet->tcp_template, &tcp));
+
+	/* Extra options: header is longer than the script says. */
+	tcp.doff = 7;
+	assert(!tcp_template_matches(packet->tcp_template, &tcp));
+
+	packet_free(packet);
+	free(options);
+}
+
+int main(void)
+{
+	test_exact_match();
+	test_unchecked_fields_match();
+	test_checked_fields_mismatch();
+	test_options_length_mismatch();
+	return 0;
+}
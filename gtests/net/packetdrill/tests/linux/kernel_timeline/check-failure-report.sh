@@ -0,0 +1,27 @@
+#!/bin/bash
+# Check that when a --kernel_timeline script fails, packetdrill prints
+# the kernel timeline, with the socket's state changes, after the error.
+# Each pattern matches only lines of the timeline dump, so a script that
+# fails for some other reason (e.g. a syntax error) does not pass.
+cd `dirname $0`
+script=expected_failure/kernel-timeline-report.pkt
+out=`../../../packetdrill $script 2>&1`
+status=$?
+
+fail() {
+  echo "$script: $1; output was:"
+  echo "$out"
+  exit 1
+}
+
+expect() {
+  echo "$out" | grep -q -E "$1" || fail "no line matching '$1'"
+}
+
+[ $status -ne 0 ] || fail "expected the script to fail"
+expect "^$script:21: error handling packet: "
+expect "^$script: kernel timeline before the failure, in script time:$"
+expect "^ +[0-9]+\.[0-9]{6} line 20: close$"
+expect "^ +[0-9]+\.[0-9]{6}   sock:inet_sock_set_state oldstate=TCP_ESTABLISHED newstate=TCP_CLOSE_WAIT "
+expect "^ +[0-9]+\.[0-9]{6}   sock:inet_sock_set_state oldstate=TCP_CLOSE_WAIT newstate=TCP_LAST_ACK "
+echo "$script: failed with the kernel timeline, as expected"
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Check that --lint reports a script with a bad in-script option and
+# keeps going: lint it along with good scripts on several threads, and
+# check that only it is reported and that the run finishes.
+cd `dirname $0`
+script=expected_failure/lint-bad-option.pkt
+out=`timeout 60 ../../../packetdrill --lint --lint_threads=4 \
+     $script ../payload_pattern ../syscall_arguments ../blocking 2>&1`
+status=$?
+
+fail() {
+  echo "$script: $1; output was:"
+  echo "$out"
+  exit 1
+}
+
+[ $status -ne 124 ] || fail "--lint did not finish"
+[ $status -eq 1 ] || fail "expected --lint to exit with status 1"
+echo "$out" | grep -q -E "^$script: bad --tolerance_usecs: 0$" ||
+  fail "expected the bad option to be reported"
+echo "$out" | grep -q -E "^lint: 1 of [0-9]+ scripts have problems$" ||
+  fail "expected only the bad script to have problems"
+echo "$script: reported by --lint, as expected"
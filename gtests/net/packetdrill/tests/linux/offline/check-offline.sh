@@ -0,0 +1,24 @@
+#!/bin/bash
+# Check --offline_pcap end to end: offline-data.pkt must verify against
+# offline-data.pcap, a capture of a live run of it, and a variant that
+# expects an ACK 50ms after the capture recorded it must fail there.
+cd `dirname $0`
+pcap=offline-data.pcap
+
+fail() {
+  echo "$script: $1; output was:"
+  echo "$out"
+  exit 1
+}
+
+script=offline-data.pkt
+out=`../../../packetdrill --offline_pcap=$pcap $script 2>&1`
+[ $? -eq 0 ] || fail "expected the script to verify against $pcap"
+echo "$script: verified against $pcap, as expected"
+
+script=expected_failure/offline-data-late-ack.pkt
+out=`../../../packetdrill --offline_pcap=$pcap $script 2>&1`
+[ $? -ne 0 ] || fail "expected the script to fail"
+echo "$out" | grep -q -E "^$script:20: error handling packet: timing error: expected outbound packet at 0\.350000 sec but happened at 0\.300069 sec$" ||
+  fail "expected a timing error for the ACK at line 20"
+echo "$script: failed at the late ACK, as expected"
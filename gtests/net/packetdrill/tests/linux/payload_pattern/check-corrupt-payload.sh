@@ -0,0 +1,20 @@
+#!/bin/bash
+# Check that --payload_pattern catches a corrupted byte: verify a script
+# against a capture of its run in which one payload byte was flipped,
+# and check that the payload check fails at that byte.
+cd `dirname $0`
+script=expected_failure/payload-pattern-corrupt.pkt
+pcap=expected_failure/payload-pattern-corrupt.pcapng
+out=`../../../packetdrill --offline_pcap=$pcap $script 2>&1`
+status=$?
+
+fail() {
+  echo "$script: $1; output was:"
+  echo "$out"
+  exit 1
+}
+
+[ $status -ne 0 ] || fail "expected the script to fail"
+echo "$out" | grep -q -E "^$script:21: error handling packet: incorrect outbound data payload at stream offset 500: " ||
+  fail "expected a payload mismatch at stream offset 500"
+echo "$script: failed at the corrupted byte, as expected"
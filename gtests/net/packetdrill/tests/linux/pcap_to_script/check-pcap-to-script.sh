@@ -0,0 +1,21 @@
+#!/bin/bash
+# Check --pcap_to_script: converting connect-data.pcapng, a capture of
+# a live run of connect-data.pkt, must give connect-data.pkt.expected.
+# The expected script is not named *.pkt, so run_tests.sh doesn't run
+# it live: it expects the capture's raw TCP timestamps.
+cd `dirname $0`
+pcap=connect-data.pcapng
+expected=connect-data.pkt.expected
+out=`../../../packetdrill --pcap_to_script=$pcap 2>&1`
+status=$?
+
+fail() {
+  echo "$pcap: $1; output was:"
+  echo "$out"
+  exit 1
+}
+
+[ $status -eq 0 ] || fail "expected the conversion to succeed"
+diff -u $expected - <<< "$out" ||
+  fail "expected the converted script to match $expected"
+echo "$pcap: converted to $expected, as expected"
@@ -1,6 +1,49 @@
 #!/bin/bash
-for f in `find . -name "*.pkt" | sort`; do
+# --kernel_timeline needs the kernel's TCP tracepoints in tracefs.
+has_tcp_tracepoints() {
+  for d in /sys/kernel/tracing /sys/kernel/debug/tracing; do
+    [ -e $d/events/tcp/tcp_probe ] && return 0
+  done
+  return 1
+}
+
+# The multi_queue tests pin tun queue threads to CPUs 0 and 1.
+has_two_cpus() {
+  [ `nproc` -ge 2 ]
+}
+
+# Scripts under expected_failure/ are meant to fail; the check-*.sh
+# scripts next to them run them and check how they fail.
+for f in `find . -name "*.pkt" -not -path "*/expected_failure/*" | sort`; do
+  case $f in
+  ./kernel_timeline/*)
+    if ! has_tcp_tracepoints; then
+      echo "Skipping $f: no TCP tracepoints in tracefs"
+      continue
+    fi
+    ;;
+  ./multi_queue/*)
+    if ! has_two_cpus; then
+      echo "Skipping $f: needs two CPUs"
+      continue
+    fi
+    ;;
+  esac
   echo "Running $f ..."
   ip tcp_metrics flush all > /dev/null 2>&1
   ../../packetdrill $f
 done
+
+for f in `find . -name "check-*.sh" | sort`; do
+  case $f in
+  ./kernel_timeline/*)
+    if ! has_tcp_tracepoints; then
+      echo "Skipping $f: no TCP tracepoints in tracefs"
+      continue
+    fi
+    ;;
+  esac
+  echo "Running $f ..."
+  ip tcp_metrics flush all > /dev/null 2>&1
+  $f
+done
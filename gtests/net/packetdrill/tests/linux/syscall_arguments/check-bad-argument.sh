@@ -0,0 +1,21 @@
+#!/bin/bash
+# Check that a system call argument that can't be built is reported
+# before the script runs: the script has an earlier event that would
+# fail when run, and we must see only the error for the bad argument.
+cd `dirname $0`
+script=expected_failure/bad-msghdr.pkt
+out=`../../../packetdrill $script 2>&1`
+status=$?
+
+fail() {
+  echo "$script: $1; output was:"
+  echo "$out"
+  exit 1
+}
+
+[ $status -ne 0 ] || fail "expected the script to fail"
+echo "$out" | grep -q -E "^$script:15: runtime error in sendmsg call: msg_iovlen 2 does not match 1-element iovec array$" ||
+  fail "expected the msg_iovlen mismatch to be reported"
+echo "$out" | grep -q "listen" &&
+  fail "expected the script not to run"
+echo "$script: failed before running, as expected"
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Implementation for reading the files of tracefs.
+ */
+
+#include "tracefs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Where tracefs is mounted on newer and older kernels, respectively. */
+static const char *tracefs_roots[] = {
+	"/sys/kernel/tracing",
+	"/sys/kernel/debug/tracing",
+};
+
+FILE *tracefs_fopen(const char *path)
+{
+	char full_path[256];
+	FILE *f = NULL;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tracefs_roots) && f == NULL; ++i) {
+		snprintf(full_path, sizeof(full_path), "%s/%s",
+			 tracefs_roots[i], path);
+		f = fopen(full_path, "r");
+	}
+	return f;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2013 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+/*
+ * Interface for reading the files of tracefs, where the kernel
+ * describes its tracepoints.
+ */
+
+#ifndef __TRACEFS_H__
+#define __TRACEFS_H__
+
+#include "types.h"
+
+#include <stdio.h>
+
+/* Open for reading the file at the given path relative to the root of
+ * tracefs (e.g. "events/irq/softirq_entry/id"), trying each of the
+ * places tracefs is usually mounted. Returns NULL if none has it.
+ */
+extern FILE *tracefs_fopen(const char *path);
+
+#endif /* __TRACEFS_H__ */
@@ -84,6 +84,7 @@
 #define IFF_ONE_QUEUE   0x2000
 #define IFF_VNET_HDR    0x4000
 #define IFF_TUN_EXCL    0x8000
+#define IFF_MULTI_QUEUE 0x0100
 
 /* Features for GSO (TUNSETOFFLOAD). */
 #define TUN_F_CSUM      0x01    /* You can hand me unchecksummed packets. */
@@ -91,6 +92,8 @@
 #define TUN_F_TSO6      0x04    /* I can handle TSO for IPv6 packets */
 #define TUN_F_TSO_ECN   0x08    /* I can handle TSO with ECN bits. */
 #define TUN_F_UFO       0x10    /* I can handle UFO packets */
+#define TUN_F_USO4      0x20    /* I can handle USO for IPv4 packets */
+#define TUN_F_USO6      0x40    /* I can handle USO for IPv6 packets */
 
 /* Protocol info prepended to the packets (when IFF_NO_PI is not set) */
 #define TUN_PKT_STRIP   0x0001
@@ -99,6 +102,26 @@ struct tun_pi {
 	__be16 proto;
 };
 
+/* Offload metadata prepended to the packets (when IFF_VNET_HDR is set),
+ * as defined for virtio-net devices in linux/virtio_net.h.
+ */
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM	1	/* Use csum_start, csum_offset */
+#define VIRTIO_NET_HDR_F_DATA_VALID	2	/* Csum is valid */
+#define VIRTIO_NET_HDR_GSO_NONE		0	/* Not a GSO frame */
+#define VIRTIO_NET_HDR_GSO_TCPV4	1	/* GSO frame, IPv4 TCP (TSO) */
+#define VIRTIO_NET_HDR_GSO_UDP		3	/* GSO frame, IPv4 UDP (UFO) */
+#define VIRTIO_NET_HDR_GSO_TCPV6	4	/* GSO frame, IPv6 TCP */
+#define VIRTIO_NET_HDR_GSO_UDP_L4	5	/* GSO frame, IPv4& IPv6 UDP (USO) */
+#define VIRTIO_NET_HDR_GSO_ECN		0x80	/* TCP has ECN set */
+struct virtio_net_hdr {
+	__u8 flags;
+	__u8 gso_type;
+	__u16 hdr_len;		/* Ethernet + IP + tcp/udp hdrs */
+	__u16 gso_size;		/* Bytes to append to hdr_len per frame */
+	__u16 csum_start;	/* Position to start checksumming from */
+	__u16 csum_offset;	/* Offset after that to place checksum */
+};
+
 /*
  * Filter spec (used for SETXXFILTER ioctls)
  * This stuff is applicable only to the TAP (Ethernet) devices.
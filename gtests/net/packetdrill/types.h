@@ -179,6 +179,19 @@ static inline s64 timeval_to_usecs(const struct timeval *tv)
 	return ((s64)tv->tv_sec) * 1000000LL + (s64)tv->tv_usec;
 }
 
+/* Convert a timespec to microseconds. */
+static inline s64 timespec_to_usecs(const struct timespec *ts)
+{
+	return ((s64)ts->tv_sec) * 1000000LL + (s64)ts->tv_nsec / 1000;
+}
+
+/* Convert microseconds to a timespec. */
+static inline void usecs_to_timespec(s64 usecs, struct timespec *ts)
+{
+	ts->tv_sec = usecs / 1000000LL;
+	ts->tv_nsec = (usecs % 1000000LL) * 1000;
+}
+
 /* Return a malloc-allocated hex dump of the given buffer of the given length */
 extern void hex_dump(const u8 *buffer, int bytes, char **hex);
 
@@ -73,6 +73,7 @@ static struct wire_server *wire_server_new(struct wire_conn *accepted_conn,
 static void wire_server_free(struct wire_server *wire_server)
 {
 	wire_conn_free(wire_server->wire_conn);
+	script_free(&wire_server->script);
 	free(wire_server->script_path);
 	free(wire_server->script_buffer);
 	free(wire_server->wire_server_device);
@@ -415,6 +416,18 @@ static int wire_server_run_script(struct wire_server *wire_server,
 		case CODE_EVENT:
 			DEBUGP("CODE_EVENT happens on client side...\n");
 			break;
+		case PEER_EVENT:
+			asprintf(error, "%s:%d: autopeer is not supported "
+				 "in wire mode\n",
+				 state->config->script_path,
+				 event->line_number);
+			return STATUS_ERR;
+		case SPACING_EVENT:
+			asprintf(error, "%s:%d: spacing is not supported "
+				 "in wire mode\n",
+				 state->config->script_path,
+				 event->line_number);
+			return STATUS_ERR;
 		case INVALID_EVENT:
 		case NUM_EVENT_TYPES:
 			assert(!"bogus type");